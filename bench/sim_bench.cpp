@@ -0,0 +1,313 @@
+// Runs the game simulation headless on a synthetic chart and entities, and
+// reports how long a frame takes. Exits with 1 if it's slower than
+// --max-ns, so it can gate a release.
+//
+// usage: sim_bench [--frames n] [--entities n] [--bars n] [--max-ns n]
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <vector>
+
+#include "bs_types.hpp"
+#include "chart.hpp"
+#include "dstack.hpp"
+#include "entity_manager.hpp"
+#include "game_state_manager.hpp"
+#include "latency.hpp"
+#include "tempo_map.hpp"
+
+#ifdef __linux__
+  #include <linux/perf_event.h>
+  #include <sys/ioctl.h>
+  #include <sys/syscall.h>
+  #include <unistd.h>
+#endif
+
+/******  ALLOCATIONS  ******/
+
+// Every heap allocation in the process. The simulation is supposed to live
+// in the DStack, so anything showing up here per frame is a regression.
+static std::atomic<uint64_t> nAllocations{0};
+
+void *operator new(size_t size) {
+  nAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+/******  COUNTERS  ******/
+
+// Hardware counters for the measured frames, if the kernel lets us have them
+class PerfCounters {
+ public:
+  static constexpr size_t N_COUNTERS = 4;
+  static constexpr const char *NAMES[N_COUNTERS] = {
+      "cycles", "instructions", "cache references", "cache misses"};
+
+  PerfCounters() : _fds{-1, -1, -1, -1} {
+#ifdef __linux__
+    const uint64_t configs[N_COUNTERS] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_REFERENCES, PERF_COUNT_HW_CACHE_MISSES};
+
+    for (size_t i{}; i < N_COUNTERS; i++) {
+      perf_event_attr attr{};
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = configs[i];
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // NOTE: Just this thread. The chart loader's work happens off the
+      // frame, and hot reload is off here.
+      attr.inherit = 0;
+      _fds[i] = static_cast<int>(
+          syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#ifdef __linux__
+    for (int fd : _fds) {
+      if (fd >= 0) close(fd);
+    }
+#endif
+  }
+
+  void start() {
+#ifdef __linux__
+    for (int fd : _fds) {
+      if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    for (int fd : _fds) {
+      if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif
+  }
+
+  // False if the counter isn't available here, e.g. in a container
+  bool read(size_t counter, uint64_t &value) const {
+#ifdef __linux__
+    return _fds[counter] >= 0 &&
+           ::read(_fds[counter], &value, sizeof(value)) == sizeof(value);
+#else
+    return false;
+#endif
+  }
+
+ private:
+  int _fds[N_COUNTERS];
+};
+
+/******  SIMULATION  ******/
+
+static constexpr float DELTA_TIME = 1.f / 120.f;
+static constexpr double BPM = 120.;
+static constexpr double LEAD_IN = 2.;
+
+// One event every quarter of every bar, all on the same button, so the
+// synthetic player knows exactly when to press without reading the chart
+static bool writeChart(const std::filesystem::path &filename, size_t nBars) {
+  std::ofstream o(filename);
+  o << "{\"events\": [";
+  for (size_t i{}; i < nBars; i++) {
+    o << (i ? "," : "") << "[";
+    for (uint32_t beat{}; beat < BAR_BEATS; beat += 4) {
+      o << (beat ? "," : "") << "{\"beat\": " << beat
+        << ", \"gamepadButton\": " << GAMEPAD_A << "}";
+    }
+    o << "]";
+  }
+  o << "]}";
+  return o.good();
+}
+
+static void spawnEnemy(EntityManager &entityManager, bs::Entity *target,
+                       size_t i) {
+  auto enemy = entityManager.createEntity();
+  enemy->_pos = glm::vec3{-10.f + (i % 20), 0.f, -20.f};
+
+  entityManager.addComponent(
+      enemy->_handle,
+      bs::GraphicsComponent{._transform = glm::mat4{}, ._model = nullptr});
+  entityManager.addComponent(
+      enemy->_handle,
+      TargetingComponent{enemy, target, 2.f + (i % 3), static_cast<float>(i % 7),
+                         glm::vec3{0.f, 3.f, 0.f}});
+}
+
+int main(int argc, char **argv) {
+  size_t nFrames = 100000;
+  size_t nEntities = MAX_ENTITIES;
+  size_t nBars = 64;
+  double maxNs = 0.;
+
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 == argc) {
+      std::cerr << "Missing a value for " << argv[i] << std::endl;
+      return 1;
+    }
+
+    if (strcmp(argv[i], "--frames") == 0) {
+      nFrames = strtoull(argv[i + 1], nullptr, 10);
+    } else if (strcmp(argv[i], "--entities") == 0) {
+      nEntities = strtoull(argv[i + 1], nullptr, 10);
+    } else if (strcmp(argv[i], "--bars") == 0) {
+      nBars = strtoull(argv[i + 1], nullptr, 10);
+    } else if (strcmp(argv[i], "--max-ns") == 0) {
+      maxNs = strtod(argv[i + 1], nullptr);
+    } else {
+      std::cerr << "Unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+  nEntities = std::clamp<size_t>(nEntities, 1, MAX_ENTITIES);
+  if (nFrames == 0) {
+    std::cerr << "--frames has to be at least 1" << std::endl;
+    return 1;
+  }
+
+  std::filesystem::path dataDir =
+      std::filesystem::temp_directory_path() / "bolster_bench";
+  std::filesystem::create_directories(dataDir);
+  if (!writeChart(dataDir / "level1.json", nBars)) {
+    std::cerr << "Couldn't write the chart to " << dataDir << std::endl;
+    return 1;
+  }
+
+  // The game states talk a lot, keep it out of the timings
+  std::ofstream nullStream;
+  std::streambuf *coutBuffer = std::cout.rdbuf(nullStream.rdbuf());
+
+  DStack allocator{1000000 * 100};  // 100mb
+  LatencyOffsets latencyOffsets{};
+  std::string dataDirString = dataDir.string() + "/";
+  GameStateManager gameStateManager{allocator, latencyOffsets,
+                                    dataDirString.c_str(), false};
+  EntityManager entityManager{allocator};
+
+  auto target = entityManager.createEntity();
+  for (size_t i = 1; i < nEntities; i++) {
+    spawnEnemy(entityManager, target, i);
+  }
+
+  TempoMap tempoMap{};
+  tempoMap.setConstant(BPM, LEAD_IN);
+  double trackTime{};
+
+  MusicPos lastMusicPos{999, 999, 999, 999};
+  std::vector<uint32_t> frameNs(nFrames);
+  PerfCounters counters{};
+
+  uint64_t allocationsBefore = nAllocations.load();
+  counters.start();
+
+  for (size_t f{}; f < nFrames; f++) {
+    auto frameStart = std::chrono::steady_clock::now();
+
+    trackTime += DELTA_TIME;
+    MusicPos musicPos = tempoMap.musicPosAt(trackTime);
+
+    // Starts the game and restarts it when it's over, and otherwise hits
+    // every event right on the beat
+    GamepadState gamepadState{};
+    bool newBeat = musicPos != lastMusicPos;
+    if (gameStateManager.getStateIndex() != RHYTHMIC_STATE) {
+      gamepadState[GAMEPAD_A] = true;
+    } else if (newBeat && musicPos.bar >= 0 && musicPos.bar % 2 == 0 &&
+               musicPos.beatRel % 4 == 0) {
+      gamepadState[GAMEPAD_A] = true;
+    }
+
+    FrameEvents frameEvents{
+        .events = allocator.alloc<FrameEvent, StackDirection::Top>(
+            sizeof(FrameEvent) * MAX_FRAME_EVENTS)};
+
+    gameStateManager.update(DELTA_TIME, musicPos, gamepadState, frameEvents);
+    if (newBeat) {
+      gameStateManager.rUpdate(musicPos, gamepadState, frameEvents);
+      lastMusicPos = musicPos;
+    }
+    entityManager.update(DELTA_TIME, musicPos, frameEvents);
+
+    for (size_t i{}; i < frameEvents.nEvents; i++) {
+      const FrameEvent &event = frameEvents.events[i];
+      if (event.type == EventType::GAME_START) {
+        trackTime = 0.;
+      } else if (event.type == EventType::DESTROY) {
+        // Keep the entity count steady
+        entityManager.deleteEntity(event.entityHandle);
+        spawnEnemy(entityManager, target, f);
+      }
+    }
+
+    allocator.clearTop();
+
+    frameNs[f] = static_cast<uint32_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - frameStart)
+            .count());
+  }
+
+  counters.stop();
+  uint64_t nFrameAllocations = nAllocations.load() - allocationsBefore;
+
+  std::cout.rdbuf(coutBuffer);
+
+  std::vector<uint32_t> sorted = frameNs;
+  std::sort(sorted.begin(), sorted.end());
+  double totalNs{};
+  for (uint32_t ns : frameNs) totalNs += ns;
+  double meanNs = totalNs / nFrames;
+
+  std::cout << nFrames << " frames, " << nEntities << " entities, " << nBars
+            << " bars" << std::endl;
+  std::cout << "ns/frame: mean " << meanNs << ", p50 " << sorted[nFrames / 2]
+            << ", p99 " << sorted[nFrames * 99 / 100] << ", max "
+            << sorted.back() << std::endl;
+  std::cout << "allocations: " << nFrameAllocations << " ("
+            << static_cast<double>(nFrameAllocations) / nFrames << "/frame)"
+            << std::endl;
+
+  for (size_t i{}; i < PerfCounters::N_COUNTERS; i++) {
+    uint64_t value;
+    std::cout << PerfCounters::NAMES[i] << ": ";
+    if (counters.read(i, value)) {
+      std::cout << value << " (" << static_cast<double>(value) / nFrames
+                << "/frame)" << std::endl;
+    } else {
+      std::cout << "n/a" << std::endl;
+    }
+  }
+
+  if (maxNs > 0. && meanNs > maxNs) {
+    std::cerr << "FAIL: " << meanNs << " ns/frame is over the " << maxNs
+              << " ns budget" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -1,36 +1,75 @@
 #ifndef __AUDIO_H_
 #define __AUDIO_H_
 
+#include <string>
+
 #include "bs_types.hpp"
+#include "buffered_stream.hpp"
+#include "latency.hpp"
+#include "sfx_bank.hpp"
 #include "soloud.h"
-#include "soloud_wav.h"
-#include "soloud_wavstream.h"
+#include "tempo_map.hpp"
+
+constexpr const char *AUDIO_DIR = "../audio/";
 
 class AudioEngine {
+  // Headless mixing, fixed so every run comes out the same
+  static constexpr unsigned int HEADLESS_SAMPLE_RATE = 48000;
+  static constexpr unsigned int HEADLESS_CHANNELS = 2;
+  static constexpr unsigned int HEADLESS_MIX_FRAMES = 512;
+
  public:
-  AudioEngine();
+  // Headless uses SoLoud's null driver. There's no device and no mixer
+  // thread, the music only moves when update mixes it along by the frame's
+  // delta time, which makes the clock deterministic.
+  explicit AudioEngine(bool headless = false, const char *audioDir = AUDIO_DIR);
   ~AudioEngine();
 
-  void load(const char *filename, double bpm);
+  // Uses the track's tempo map (<filename>.tempo.json from the beatmap
+  // tool) if there is one. Otherwise a constant bpm, with startOffset
+  // seconds of silence before the first beat.
+  void load(const char *filename, double bpm, double startOffset);
   void play();
+  // To a sixteenth into a bar
+  void seek(int32_t bar, uint32_t beatRel);
+  void setLatencyOffsets(const LatencyOffsets &latencyOffsets);
   void processEvents(const FrameEvents &frameEvents);
+
+  // The beats follow the mixer, so sounds triggered from them line up with
+  // the music. The time and fractional beat are compensated for the audio
+  // latency, they're when the player actually hears it, for judging hits.
   MusicPos update(float deltaTime);
+  // Where the music will be once the current frame is on screen
+  MusicPos getVisualMusicPos() const;
 
  private:
   void playBackground();
   void stopBackground();
 
+  // Headless only. Mixes the given time's worth of audio and throws it
+  // away, which is what moves the clock on.
+  void advance(double seconds);
+
+  // Starts the sound on the given beat, to the sample
+  void scheduleSfx(Sfx sfx, double musicBeat);
+  void cancelScheduledSfx();
+
  private:
   SoLoud::Soloud _soloud;
-  SoLoud::WavStream _wavStream;
-  SoLoud::Wav _downWav;
-  SoLoud::Wav _rightWav;
-  SoLoud::Wav _successWav;
-  double _bpm;
-  double _spb;
+  BufferedStream _musicStream;
+  SfxBank _sfxBank;
+  TempoMap _tempoMap;
+  LatencyOffsets _latencyOffsets;
   int _wavHandle;
-  double _currentTime;
+  double _trackTime;
   MusicPos _musicPos;
+
+  bool _headless;
+  std::string _audioDir;
+  // Frames we still owe the mixer, so the clock doesn't drift when frame
+  // times aren't a whole number of samples
+  double _mixDebt;
+  float _mixBuffer[HEADLESS_MIX_FRAMES * HEADLESS_CHANNELS];
 };
 
 #endif  // __AUDIO_H_
@@ -6,7 +6,9 @@
 #include "bs_entity.hpp"
 #include "bs_types.hpp"
 #include "glm/mat4x4.hpp"
-#include "mesh.hpp"
+
+// NOTE: Only ever pointed at, so the simulation doesn't need the renderer
+struct Model;
 
 namespace bs {
 class GraphicsComponent {
@@ -24,6 +24,16 @@ struct MusicPos {
   uint32_t beatRel;
   uint32_t beat;
 
+  // Follows the track's meter, bars aren't always 16 sixteenths
+  int32_t bar;        // Negative in the lead in
+  uint32_t barBeats;  // Sixteenths in this bar
+
+  // Fractional position, for anything that needs more than whole
+  // sixteenths. Not part of the comparisons below.
+  double time;      // Seconds since the first beat
+  double spb;       // Seconds per sixteenth
+  double beatFrac;  // Fractional beat at that same time
+
   bool operator==(const MusicPos &other) {
     return period == other.period && barRel == other.barRel &&
            beatRel == other.beatRel && beat == other.beat;
@@ -47,12 +57,24 @@ enum class EventType {
   PLAYER_DEATH,
   GAME_START,
   GAME_END,
+  MUSIC_SEEK,
+  SFX_SCHEDULE,
+  CALIBRATION_TICK,
+  CALIBRATION_PULSE,
+  LATENCY_CHANGED,
   DESTROY,
 };
 
+enum class Sfx { DOWN, RIGHT, SUCCESS };
+constexpr size_t N_SFX = 3;
+
 struct FrameEvent {
   EventType type;
   uint8_t entityHandle;
+  int32_t bar;       // MUSIC_SEEK target
+  uint32_t beatRel;  // MUSIC_SEEK sixteenth into that bar
+  Sfx sfx;           // SFX_SCHEDULE sound
+  double musicBeat;  // SFX_SCHEDULE beat to start on, negative in the lead in
 };
 
 struct FrameEvents {
@@ -0,0 +1,90 @@
+#ifndef __BUFFERED_STREAM_H_
+#define __BUFFERED_STREAM_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "soloud.h"
+#include "soloud_wavstream.h"
+
+class BufferedStream;
+
+// Plays from a ring of decoded samples that a decoder thread keeps filled.
+// The mixer only ever copies, so a slow disk or decoder can't stall it.
+class BufferedStreamInstance : public SoLoud::AudioSourceInstance {
+  static constexpr double RING_SECONDS = 4.;
+  static constexpr unsigned int DECODE_FRAMES = 4096;
+  static constexpr int IDLE_MS = 5;
+
+ public:
+  explicit BufferedStreamInstance(BufferedStream *parent);
+  ~BufferedStreamInstance();
+
+  // Mixer thread
+  unsigned int getAudio(float *aBuffer, unsigned int aSamplesToRead,
+                        unsigned int aBufferSize) override;
+  bool hasEnded() override;
+  // Hands the seek to the decoder thread instead of decoding up to it
+  SoLoud::result seek(SoLoud::time aSeconds, float *mScratch,
+                      unsigned int mScratchSize) override;
+
+ private:
+  void decodeLoop();
+  // Blocking mode only, until the decoder has caught up with a seek and
+  // has nFrames ready or has run out
+  void waitForDecoder(unsigned int nFrames);
+
+ private:
+  BufferedStream *_parent;
+  unsigned int _nChannels;
+
+  // Single producer, single consumer. The positions only ever go up and
+  // are in frames, the ring index is the position modulo the size.
+  std::vector<float> _ring;  // Interleaved
+  size_t _ringFrames;
+  std::atomic<uint64_t> _writePos;
+  std::atomic<uint64_t> _readPos;
+
+  // A seek bumps the request, the decoder answers with the same number
+  // once everything from seekWritePos on is from the new position
+  std::atomic<uint32_t> _seekRequest;
+  std::atomic<uint32_t> _seekDone;
+  std::atomic<double> _seekTarget;
+  std::atomic<uint64_t> _seekWritePos;
+  uint32_t _seekApplied;
+
+  std::atomic<bool> _decoderEnded;
+  std::atomic<bool> _quit;
+  std::thread _decoder;
+};
+
+// Drop in for WavStream for the music. Decoding happens on its own thread,
+// ahead of the mixer.
+class BufferedStream : public SoLoud::AudioSource {
+  friend class BufferedStreamInstance;
+
+ public:
+  BufferedStream();
+  ~BufferedStream();
+
+  SoLoud::result load(const char *filename);
+  SoLoud::AudioSourceInstance *createInstance() override;
+
+  // Samples the mixer wanted but the decoder hadn't got to yet
+  uint64_t getUnderrunFrames() const;
+
+  // Makes the mixer wait for the decoder instead of playing silence. Only
+  // for when there's no device to keep up with, like headless runs.
+  void setBlocking(bool blocking);
+
+ private:
+  // Only used to make decoders from, it's never played itself
+  SoLoud::WavStream _wavStream;
+  std::atomic<uint64_t> _underrunFrames;
+  std::atomic<bool> _blocking;
+};
+
+#endif  // __BUFFERED_STREAM_H_
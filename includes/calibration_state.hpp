@@ -0,0 +1,46 @@
+#ifndef __CALIBRATION_STATE_H_
+#define __CALIBRATION_STATE_H_
+
+#include "game_state.hpp"
+#include "judgement.hpp"
+#include "latency.hpp"
+class GameStateManager;
+
+// Plays a metronome and has the player tap along to it. First with only
+// the click to measure the audio offset, then with only a flashing pulse
+// for the visual offset.
+class CalibrationState : public GameState {
+  static constexpr double TICK_INTERVAL = 0.5;  // 120 bpm
+  static constexpr size_t LEAD_IN_TICKS = 4;
+  static constexpr size_t PHASE_TICKS = 24;
+
+  enum class Phase { AUDIO, VISUAL };
+
+ public:
+  CalibrationState(GameStateManager &gameStateManager,
+                   LatencyOffsets &latencyOffsets);
+  void onEnter();
+  void onExit();
+
+  void update(float dt, const MusicPos &mp, const GamepadState &gamepadState,
+              FrameEvents &frameEvents);
+
+  void rUpdate(const MusicPos &mp, const GamepadState &gamepadState,
+               FrameEvents &frameEvents);
+
+ private:
+  void startPhase(Phase phase);
+  void finishPhase(FrameEvents &frameEvents);
+
+ private:
+  LatencyOffsets &_latencyOffsets;
+
+  Phase _phase;
+  double _time;
+  double _lastTick;
+  double _nextTick;
+  size_t _nTicks;
+  HitStats _taps;
+};
+
+#endif  // __CALIBRATION_STATE_H_
@@ -0,0 +1,159 @@
+#ifndef __CHART_H_
+#define __CHART_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include "bs_types.hpp"
+#include "dstack.hpp"
+
+// Every rhythm bar is played over two bars of music. First the talking bar,
+// where the cues are played, then the listening bar where the player repeats
+// them. Event beats are sixteenths relative to the start of a bar.
+// NOTE: Every bar has BAR_BEATS slots in the chart whatever the track's
+// meter is. A 3/4 bar only reaches slot 11, the rest are never played.
+constexpr uint32_t BAR_BEATS = 16;
+constexpr uint32_t RHYTHM_BAR_BEATS = BAR_BEATS * 2;
+
+// Chart beats count from the start of the first talking bar, which plays
+// over the track's lead in. The first listening bar is music bar 0, so
+// chart beat = music bar * BAR_BEATS + beat in bar + CHART_BEAT_OFFSET.
+constexpr uint32_t CHART_BEAT_OFFSET = BAR_BEATS;
+
+// At most one event per sixteenth
+constexpr size_t MAX_BAR_EVENTS = BAR_BEATS;
+
+// Where the rhythmic state should pick up from after a seek
+struct ChartCursor {
+  int16_t barIndex;
+  int16_t eventIndex;
+  bool talking;
+};
+
+// Handles the bar lines and the end of the chart, where the cursor doesn't
+// depend on any events. Past the end it parks after the last event, which
+// is lastBarEvents. Returns false if the caller still has to find the event
+// index within the bar.
+bool seekBarLine(uint32_t beat, size_t nRhythmBars, int16_t lastBarEvents,
+                 ChartCursor &cursor);
+
+// Flattened view of every event in the chart, sorted by absolute beat.
+// Lets us find our place in the chart without walking it from the start.
+class ChartTimeline {
+ public:
+  void build(const RhythmBar *rhythmBars, size_t nRhythmBars,
+             DStack &allocator);
+
+  // Index of the first event at or after the given absolute beat
+  size_t eventOffset(uint32_t beat) const;
+
+  // Cursor for the given chart beat, O(log n) in the number of events
+  ChartCursor seek(uint32_t beat) const;
+
+ private:
+  size_t _nBars;
+  size_t _nEvents;
+
+  // Absolute (talking bar) beat of every event
+  uint32_t *_beats;
+  // Offset into _beats of the first event of each bar, plus one past the end
+  uint32_t *_barOffsets;
+};
+
+struct Chart {
+  size_t nRhythmBars;
+  RhythmBar *rhythmBars;
+  ChartTimeline timeline;
+};
+
+// Parses a json chart into the bottom of the given stack
+bool loadChart(const char *filename, DStack &allocator, Chart &chart);
+
+/*
+** Binary charts
+**
+** A small header followed by one fixed size record per rhythm bar, so any
+** bar can be read straight from the file without an index.
+*/
+struct BinaryChartHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t nRhythmBars;
+};
+
+struct BinaryChartEvent {
+  uint32_t beat;
+  uint32_t gamepadButton;
+};
+
+struct BinaryChartBar {
+  uint32_t nEvents;
+  BinaryChartEvent events[MAX_BAR_EVENTS];
+};
+
+constexpr char BINARY_CHART_MAGIC[4] = {'B', 'S', 'C', 'H'};
+constexpr uint32_t BINARY_CHART_VERSION = 1;
+
+// Converts a json chart into a binary one that can be streamed
+bool convertChart(const char *jsonFilename, const char *binaryFilename);
+
+// Keeps a sliding window of bars from a binary chart resident.
+// Upcoming bars are read on a background thread as the music advances,
+// so memory use is the same no matter how long the chart is.
+class ChartStream {
+ public:
+  static constexpr size_t WINDOW_BARS = 8;
+
+  ChartStream();
+  ~ChartStream();
+
+  bool open(const char *filename, DStack &allocator);
+  // Only takes the window memory, for a stream that's opened later
+  void reserve(DStack &allocator);
+  // Switches to another chart, reusing the window memory from open
+  bool reopen(const char *filename);
+  void close();
+
+  bool isOpen() const;
+  size_t getBarCount() const;
+
+  // Blocks if the loader hasn't got to this bar yet. The bar stays valid
+  // until the next call, the loader won't reuse its slot before then.
+  const RhythmBar &getBar(size_t barIndex);
+
+  // Releases every bar before barIndex and prefetches the ones after
+  void advance(size_t barIndex);
+  // Like advance, but waits until the whole window is resident
+  void prefetch(size_t barIndex);
+
+  ChartCursor seek(uint32_t beat);
+
+ private:
+  void loaderLoop();
+
+ private:
+  std::ifstream _file;
+  size_t _nRhythmBars;
+
+  std::thread _loader;
+  std::mutex _mutex;
+  std::condition_variable _wakeLoader;
+  std::condition_variable _barLoaded;
+  bool _quit;
+
+  // First bar of the resident window
+  size_t _windowStart;
+  // Which bar each slot holds, bar % WINDOW_BARS
+  int64_t _slotBars[WINDOW_BARS];
+  // Last bar handed out by getBar, its slot is left alone
+  int64_t _pinnedBar;
+  RhythmBar _bars[WINDOW_BARS];
+  RhythmEvent *_events;
+};
+
+#endif  // __CHART_H_
@@ -0,0 +1,39 @@
+#ifndef __CHART_WATCHER_H_
+#define __CHART_WATCHER_H_
+
+#include <atomic>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+
+// Watches a chart file on a background thread and calls onChange (on that
+// thread) whenever it's been written. Uses inotify on Linux, everywhere
+// else it polls the modification time.
+class ChartWatcher {
+  static constexpr int POLL_MS = 250;
+
+ public:
+  ChartWatcher();
+  ~ChartWatcher();
+
+  // Copy constructor
+  ChartWatcher(const ChartWatcher &) = delete;
+  // Copy assignment
+  ChartWatcher &operator=(const ChartWatcher &) = delete;
+
+  void start(const char *filename, std::function<void()> onChange);
+  void stop();
+
+ private:
+  void watchLoop();
+
+ private:
+  std::filesystem::path _path;
+  std::function<void()> _onChange;
+
+  std::thread _watcher;
+  std::atomic<bool> _quit;
+};
+
+#endif  // __CHART_WATCHER_H_
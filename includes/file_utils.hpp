@@ -0,0 +1,15 @@
+#ifndef __FILE_UTILS_H_
+#define __FILE_UTILS_H_
+
+#include <stddef.h>
+
+#include <string>
+
+// Writes the header and then the payload next to filename first, and moves
+// it over filename once it's all there. A crash halfway leaves the old file
+// alone instead of one that's cut short. Makes the directory if it has to.
+bool writeFileAtomic(const std::string &filename, const void *header,
+                     size_t headerSize, const void *payload,
+                     size_t payloadSize);
+
+#endif  // __FILE_UTILS_H_
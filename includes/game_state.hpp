@@ -3,13 +3,16 @@
 
 #include "bs_types.hpp"
 
+// Where the levels are, relative to the working directory
+constexpr const char *DATA_DIR = "../data/";
+
 class GameStateManager;
 
 class GameState {
  public:
   GameState(GameStateManager &gameStateManager)
       : _gameStateManager{gameStateManager} {};
-  // virtual ~GameState() = 0;
+  virtual ~GameState() = default;
   // Called after being pushed on the stack
   virtual void onEnter() = 0;
   // Called before being popped off the stack
@@ -6,10 +6,18 @@
 #include "bs_types.hpp"
 #include "dstack.hpp"
 #include "game_state.hpp"
+#include "latency.hpp"
+
+constexpr size_t START_STATE = 0;
+constexpr size_t RHYTHMIC_STATE = 1;
+constexpr size_t END_STATE = 2;
+constexpr size_t CALIBRATION_STATE = 3;
 
 class GameStateManager {
  public:
-  GameStateManager(DStack &allocator);
+  // hotReload watches the level charts for changes, benchmarks leave it off
+  GameStateManager(DStack &allocator, LatencyOffsets &latencyOffsets,
+                   const char *dataDir = DATA_DIR, bool hotReload = true);
   ~GameStateManager();
 
   // Copy constructor
@@ -25,6 +33,12 @@ class GameStateManager {
   void previousState() noexcept;
   void restartState() noexcept;
   void restartGame() noexcept;
+  void setState(size_t gameStateIndex) noexcept;
+  size_t getStateIndex() const noexcept;
+
+  // Practice mode. The rhythmic state keeps the music between the starts
+  // of these two music bars.
+  void setPracticeLoop(int32_t startBar, int32_t endBar);
 
   void update(float dt, const MusicPos &mp, const GamepadState &gamepadState,
               FrameEvents &frameEvents);
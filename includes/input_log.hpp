@@ -0,0 +1,66 @@
+#ifndef __INPUT_LOG_H_
+#define __INPUT_LOG_H_
+
+#include <stdint.h>
+
+#include <fstream>
+
+#include "bs_types.hpp"
+
+// Everything from the outside world that goes into a frame of the game.
+// Replaying these is enough to play a session back exactly.
+struct InputFrame {
+  float deltaTime;
+  GamepadState gamepadState;  // Only the presses, like processInput
+  MusicPos musicPos;          // For the game states
+  MusicPos visualMusicPos;    // For the entities
+};
+
+// The log starts with a header, then one record per frame:
+//   uint8 flags, float deltaTime
+//   uint8 pressed buttons                       if FRAME_PRESSED
+//   music pos, then visual music pos, each as
+//     double time, double beatFrac
+//     uint32 beat, int32 bar, uint8 beatRel,    if FRAME_*_BEAT
+//     uint8 barBeats, double spb
+// The whole beat only changes a few times a second, so it's left out of
+// the frames where it's the same as the last.
+struct InputLogHeader {
+  char magic[4];
+  uint32_t version;
+};
+
+constexpr char INPUT_LOG_MAGIC[4] = {'B', 'S', 'I', 'L'};
+constexpr uint32_t INPUT_LOG_VERSION = 1;
+
+class InputRecorder {
+ public:
+  InputRecorder();
+
+  bool open(const char *filename);
+  void close();
+  bool isOpen() const;
+
+  void record(const InputFrame &frame);
+
+ private:
+  std::ofstream _file;
+  InputFrame _last;
+};
+
+class InputPlayer {
+ public:
+  InputPlayer();
+
+  bool open(const char *filename);
+  bool isOpen() const;
+
+  // False once the log has run out
+  bool next(InputFrame &frame);
+
+ private:
+  std::ifstream _file;
+  InputFrame _last;
+};
+
+#endif  // __INPUT_LOG_H_
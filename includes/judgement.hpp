@@ -0,0 +1,64 @@
+#ifndef __JUDGEMENT_H_
+#define __JUDGEMENT_H_
+
+#include <stdint.h>
+
+#include <cstddef>
+
+#include "bs_types.hpp"
+
+enum class Judgement { PERFECT, OK, BAD, MISS };
+
+// How far off a hit can be, in milliseconds either side of the beat,
+// and still get each grade. Anything later than the bad window is a miss.
+struct JudgementWindows {
+  double perfectMs = 50.;
+  double okMs = 100.;
+  double badMs = 180.;
+};
+
+// Reads the optional "judgement" object from a level's json,
+// e.g. {"judgement": {"perfect": 40, "ok": 90, "bad": 160}}.
+// Leaves the windows alone if it isn't there.
+bool loadJudgementWindows(const char *filename, JudgementWindows &windows);
+
+// Grade for a hit error in ms, or MISS if it's outside every window
+Judgement judge(double errorMs, const JudgementWindows &windows);
+
+// The beat a music bar starts on, worked out from mp. Only works for the
+// bar the music is in and the one after it, false for any other. Hits
+// early enough to land before an event's bar line need the second one.
+bool getBarStartBeat(const MusicPos &mp, int32_t bar, double &startBeat);
+
+// Error in ms of a hit at mp, for an event on eventBeat. Positive when
+// late. Within the judgement windows the tempo is as good as constant.
+// NOTE: mp is already where the player heard the music, the audio engine
+// takes the calibrated latency off it
+double getHitErrorMs(const MusicPos &mp, double eventBeat);
+
+// Running hit error statistics, for tuning the windows against real play.
+// Error is positive when late.
+class HitStats {
+ public:
+  HitStats();
+
+  void reset();
+  void addHit(double errorMs, Judgement judgement);
+  void addMiss();
+
+  size_t getCount(Judgement judgement) const;
+  double getMeanMs() const;
+  double getStdDevMs() const;
+
+  void print() const;
+
+ private:
+  size_t _counts[4];
+
+  // Welford's online mean and variance, over the hits only
+  size_t _nHits;
+  double _mean;
+  double _m2;
+};
+
+#endif  // __JUDGEMENT_H_
@@ -0,0 +1,18 @@
+#ifndef __LATENCY_H_
+#define __LATENCY_H_
+
+// How late the player perceives the game, in ms. Covers the whole chain,
+// e.g. the audio backend's buffers and a bluetooth headset for audio, or
+// the frames in flight, the swapchain and the TV's processing for visuals.
+struct LatencyOffsets {
+  double audioMs = 0.;
+  double visualMs = 0.;
+};
+
+constexpr const char *LATENCY_OFFSETS_FILE = "../data/calibration.json";
+
+// Returns zero offsets if the file doesn't exist yet
+LatencyOffsets loadLatencyOffsets(const char *filename);
+bool saveLatencyOffsets(const char *filename, const LatencyOffsets &offsets);
+
+#endif  // __LATENCY_H_
@@ -8,6 +8,8 @@
 #include "dstack.hpp"
 #include "entity_manager.hpp"
 #include "game_state_manager.hpp"
+#include "input_log.hpp"
+#include "latency.hpp"
 #include "movement_component.hpp"
 #include "soloud.h"
 #include "soloud_wavstream.h"
@@ -17,13 +19,36 @@
 class GLFWwindow;
 class GLFWgamepadstate;
 
+struct BolsterOptions {
+  // No window, renderer or sound device. The game runs on a fixed time step
+  // as fast as it can, and quits once the game is over.
+  bool headless = false;
+  // Log every frame's input to this file
+  const char *recordFile = nullptr;
+  // Play a logged session back instead of taking any input, implies headless
+  const char *replayFile = nullptr;
+  // Practice mode, the music loops from the start of loopStartBar to the
+  // start of loopEndBar
+  bool loop = false;
+  int32_t loopStartBar = 0;
+  int32_t loopEndBar = 0;
+};
+
 class Bolster {
+  static constexpr float HEADLESS_DELTA_TIME = 1.f / 120.f;
+
  public:
-  Bolster();
+  explicit Bolster(const BolsterOptions &options = BolsterOptions{});
   ~Bolster();
+  // Whether the constructor couldn't get everything it was asked for, like
+  // the replay. There's nothing to run then.
+  bool failed() const;
   void run();
 
  private:
+  // Gathers the frame's input, live or from the replay, and records it.
+  // False when it's time to quit.
+  bool nextFrame(InputFrame &frame, double &currentTime);
   void initGlfw();
   void initScene();
   GamepadState processInput(GLFWwindow *);
@@ -36,6 +61,9 @@ class Bolster {
   const char *_windowTitle;
   uint32_t _windowWidth, _windowHeight;
 
+  bool _headless;
+  bool _failed;
+
   DStack _allocator;
 
   float _deltaTime;
@@ -43,6 +71,9 @@ class Bolster {
 
   GamepadState _gamepadState;
 
+  // NOTE: Before the game state manager, calibration writes to these
+  LatencyOffsets _latencyOffsets;
+
   // size_t _nEntities;
   // bs::Entity *_entities;
 
@@ -60,6 +91,9 @@ class Bolster {
 
   AudioEngine _audioEngine;
   VulkanEngine _renderer;
+
+  InputRecorder _inputRecorder;
+  InputPlayer _inputPlayer;
 };
 
 #endif  // __MAIN_H_
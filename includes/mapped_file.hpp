@@ -0,0 +1,36 @@
+#ifndef __MAPPED_FILE_H_
+#define __MAPPED_FILE_H_
+
+#include <stddef.h>
+
+#include <string>
+
+// A whole file mapped read only. Pages are read in as they're touched, so
+// copying out of it is the only time the data goes through memory.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Copy constructor
+  MappedFile(const MappedFile &) = delete;
+  // Copy assignment
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const std::string &filename);
+  void close();
+
+  const void *getData() const;
+  size_t getSize() const;
+
+ private:
+  const void *_data;
+  size_t _size;
+
+#ifdef _WIN32
+  void *_file;
+  void *_mapping;
+#endif
+};
+
+#endif  // __MAPPED_FILE_H_
@@ -0,0 +1,114 @@
+#ifndef __MESH_COOK_H_
+#define __MESH_COOK_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "mesh.hpp"
+#include "tiny_gltf.h"
+
+// A cooked model is the geometry of a glTF model laid out the way it goes
+// to the GPU, so loading it is a copy from the file into staging:
+//
+//   header | nodes | meshes | vertices | indices
+//
+// Each section starts on a 16 byte boundary. Indices are relative to the
+// first vertex of their mesh, and both are in the order mesh_optimize.hpp
+// puts them in.
+constexpr char COOKED_MODEL_MAGIC[4] = {'B', 'S', 'M', 'D'};
+constexpr uint32_t COOKED_MODEL_VERSION = 2;
+
+struct CookedModelHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;  // What it was cooked from, see getModelKey
+  uint32_t nNodes;
+  uint32_t nMeshes;
+  uint32_t nVertices;
+  uint32_t nIndices;
+  uint64_t nodesOffset;
+  uint64_t meshesOffset;
+  uint64_t verticesOffset;
+  uint64_t indicesOffset;
+};
+
+// Depth first from the roots of the scene, so parents come before their
+// children
+struct CookedNode {
+  glm::mat4 matrix;  // Relative to the parent
+  int32_t parent;    // -1 for the roots
+  uint32_t firstMesh;
+  uint32_t nMeshes;
+  uint32_t unused0;  // Pad to vec4
+};
+
+// One per glTF primitive
+struct CookedMesh {
+  uint32_t firstVertex;
+  uint32_t firstIndex;
+  uint32_t nVertices;
+  uint32_t nIndices;
+  uint32_t materialIndex;
+  uint32_t unused0;  // Pad to vec4
+  uint32_t unused1;  // Pad to vec4
+  uint32_t unused2;  // Pad to vec4
+  glm::vec4 boundingSphere;
+};
+
+struct CookedModel {
+  std::vector<CookedNode> nodes;
+  std::vector<CookedMesh> meshes;
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+};
+
+// Points into a cooked model file, wherever it's been read or mapped to
+struct CookedModelView {
+  const CookedModelHeader *header;
+  const CookedNode *nodes;
+  const CookedMesh *meshes;
+  const Vertex *vertices;
+  const uint32_t *indices;
+};
+
+// A hash of the glTF file, and the size and modification time of each of
+// its buffer files in directory. Cooked models are found by it, so editing
+// either gets a new one.
+uint64_t getModelKey(const std::string &gltf, const std::string &directory);
+// The glTF file without its geometry, for loading just the materials and
+// images of a model that's already cooked. Its buffers aren't read then.
+// False if the images need the buffers too.
+bool stripModelGeometry(const std::string &gltf, std::string &stripped);
+// In the cooked directory next to the model, like the textures
+std::string getCookedModelPath(const std::string &directory, uint64_t key);
+
+// What cooking did to the meshes, summed over all of them
+struct CookStats {
+  size_t nSourceVertices;  // As they are in the file
+  size_t nVertices;        // Welded, without the ones nothing uses
+  size_t nTriangles;
+  size_t missesBefore;  // Vertex cache misses in file order
+  size_t missesAfter;
+};
+
+// Every mesh in the first scene of the model
+void cookModel(const tinygltf::Model &model, CookedModel &cooked,
+               CookStats *stats = nullptr);
+
+std::vector<uint8_t> serializeCookedModel(uint64_t key,
+                                          const CookedModel &cooked);
+// Written with writeFileAtomic, like the cooked textures
+bool writeCookedModel(const std::string &filename,
+                      const std::vector<uint8_t> &data);
+// False if it isn't a cooked model, is from another version, was cooked
+// from something else than key or has nodes or meshes pointing outside it
+bool viewCookedModel(const void *data, size_t size, uint64_t key,
+                     CookedModelView &view);
+
+// Jack Ritter. An Efficient Bounding Sphere. 1990
+void computeBoundingSphere(glm::vec4 &result, const glm::vec3 points[],
+                           size_t count);
+
+#endif  // __MESH_COOK_H_
@@ -0,0 +1,51 @@
+#ifndef __MESH_OPTIMIZE_H_
+#define __MESH_OPTIMIZE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+#include "glm/vec3.hpp"
+
+// Reordering passes for indexed triangle lists, run when a model is cooked.
+// Indices are relative to the first vertex of the mesh.
+
+// Post-transform vertex cache we optimize for. Real ones vary, but a
+// FIFO of around this size is close enough for all of them.
+constexpr uint32_t VERTEX_CACHE_SIZE = 16;
+// How much worse than the cache order the overdraw order can make the
+// cache, as a factor of its ACMR
+constexpr float OVERDRAW_THRESHOLD = 1.05f;
+
+// Vertex shader runs when drawn through a FIFO cache of cacheSize.
+// Divided by the number of triangles, that's the ACMR.
+size_t getVertexCacheMisses(const uint32_t *indices, size_t nIndices,
+                            size_t nVertices,
+                            uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Tipsify. Sander, Nehab, Barczak. Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw. 2007
+//
+// Reorders the triangles in place. clusters gets the first triangle of
+// each run it had to jump to a new part of the mesh for.
+void optimizeVertexCache(uint32_t *indices, size_t nIndices, size_t nVertices,
+                         std::vector<uint32_t> &clusters,
+                         uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Same paper. Splits the clusters from optimizeVertexCache further, as long
+// as the ACMR stays within threshold, and sorts them so the ones facing
+// out from the middle of the mesh are drawn first.
+void optimizeOverdraw(uint32_t *indices, size_t nIndices,
+                      const glm::vec3 *positions, size_t nVertices,
+                      const std::vector<uint32_t> &clusters,
+                      float threshold = OVERDRAW_THRESHOLD,
+                      uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// Renumbers the vertices in the order they're first used, so fetching
+// them goes through memory front to back. remap maps old vertices to new
+// ones, ~0u for those no triangle uses. Returns how many are used.
+size_t optimizeVertexFetch(uint32_t *indices, size_t nIndices,
+                           size_t nVertices, std::vector<uint32_t> &remap);
+
+#endif  // __MESH_OPTIMIZE_H_
@@ -2,20 +2,33 @@
 #define __RHYTHMIC_STATE_H_
 
 #include <array>
+#include <atomic>
+#include <mutex>
+#include <optional>
+#include <string>
 
 #include "bs_types.hpp"
+#include "chart.hpp"
+#include "chart_watcher.hpp"
 #include "dstack.hpp"
 #include "game_state.hpp"
+#include "judgement.hpp"
 
 // Forward declaration
 class GameStateManager;
 
 class RhythmicState : public GameState {
-  static constexpr int32_t BEAT_WINDOW = 2;
+  // How many sixteenths ahead the cue sounds are handed to the audio
+  // engine. Has to cover a frame plus the mixer's buffer.
+  static constexpr uint32_t SFX_SCHEDULE_AHEAD = 2;
+  static constexpr size_t RELOAD_STACK_SIZE = 1000000;  // 1mb
 
  public:
+  // Loads <dataDir>level<level>.json, and reloads it whenever it changes
+  // if hotReload is on
   RhythmicState(uint32_t level, GameStateManager &gameStateManager,
-                DStack &allocator);
+                DStack &allocator, const char *dataDir = DATA_DIR,
+                bool hotReload = true);
   void onEnter();
   void onExit();
   void update(float dt, const MusicPos &mp, const GamepadState &gamepadState,
@@ -24,10 +37,43 @@ class RhythmicState : public GameState {
   void rUpdate(const MusicPos &mp, const GamepadState &gamepadState,
                FrameEvents &frameEvents);
 
+  // Jump to any sixteenth of a music bar. Also asks the audio engine to
+  // seek the music along with us.
+  void seek(int32_t bar, uint32_t beatRel, FrameEvents &frameEvents);
+
+  // Practice mode. Keeps seeking back to the start whenever the music
+  // reaches the end. Both are a bar and a sixteenth into it.
+  void setLoop(int32_t startBar, uint32_t startBeat, int32_t endBar,
+               uint32_t endBeat);
+  void clearLoop();
+
+  void setJudgementWindows(const JudgementWindows &windows);
+
+  const HitStats &getHitStats() const;
+
  private:
   void processInput(const GamepadState &gamepadState, const MusicPos &mp,
                     FrameEvents &frameEvents);
-  void loadData(uint32_t level, DStack &allocator);
+  // Returns false if that was the player's last life
+  bool fail(FrameEvents &frameEvents);
+  void loadData(uint32_t level, const char *dataDir, DStack &allocator,
+                bool hotReload);
+
+  // Whichever of the streams isn't the reload back buffer
+  ChartStream &stream();
+  size_t barCount() const;
+  const RhythmBar &getBar(size_t barIndex);
+  const RhythmBar &currentBar();
+
+  // Queues the cue sounds for the next few beats
+  void scheduleCues(const MusicPos &mp, FrameEvents &frameEvents);
+
+  // Called from the watcher thread when the chart file has changed
+  void reloadChart();
+  // Swaps in the reloaded chart, if there is one. Only call this on a bar
+  // line so we never switch charts in the middle of a bar.
+  void applyReload();
+  std::string reloadPath(size_t index) const;
 
  private:
   bool _talking;
@@ -36,9 +82,50 @@ class RhythmicState : public GameState {
   int16_t _rhythmBarIndex;
   int16_t _rhythmEventIndex;
 
-  size_t _nRhythmBars;
+  // The rhythm bar hits are judged against. Its listening bar takes hits
+  // from badMs before its bar line until badMs after its last event, so
+  // it runs into the talking bars on both sides of it.
+  int16_t _judgeBarIndex;
+  int16_t _judgeEventIndex;
+  // The beat the judged listening bar starts on, once we know it
+  bool _judgeBarStartKnown;
+  double _judgeBarStart;
+
+  JudgementWindows _judgementWindows;
+  HitStats _hitStats;
+
+  // Last chart beat we've scheduled cue sounds for
+  int64_t _scheduledBeat;
+
+  bool _looping;
+  int32_t _loopStartBar;
+  uint32_t _loopStartBeat;
+  int32_t _loopEndBar;
+  uint32_t _loopEndBeat;
+
+  // Streamed from a binary chart when we can, otherwise fully resident
+  bool _streaming;
+  Chart _chart;
+  // Double buffered like the reloaded charts, see _reloadBack
+  ChartStream _streams[2];
+  // First bar a reload can be swapped in at, where the watcher prefetches
+  // it from
+  std::atomic<size_t> _nextBar;
+
+  std::string _jsonChart;
+  std::string _binaryChart;
+
+  // Hot reload. Charts are parsed off-thread into whichever of the two
+  // buffers isn't in use, then swapped in on the next bar line.
+  std::mutex _reloadMutex;
+  bool _reloadReady;
+  size_t _reloadBack;
+  // NOTE: Only for reloading a fully resident chart, so only made then
+  std::optional<DStack> _reloadStacks[2];
+  Chart _reloadChart;
 
-  RhythmBar *_rhythmBars;
+  // NOTE: Keep last, it has to be stopped before anything above goes away
+  ChartWatcher _watcher;
   // std::array<RhythmEvent, 4> _rhythmEvents;
 };
 
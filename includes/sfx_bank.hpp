@@ -0,0 +1,64 @@
+#ifndef __SFX_BANK_H_
+#define __SFX_BANK_H_
+
+#include <stdint.h>
+
+#include "bs_types.hpp"
+#include "dstack.hpp"
+#include "soloud.h"
+#include "soloud_wav.h"
+
+// All the one-shot sounds, decoded once at load into one arena. Leading
+// silence is trimmed and everything is resampled to the mixer's rate, so
+// playing a sound is just a copy in the mixer.
+class SfxBank {
+  static constexpr size_t ARENA_SIZE = 1000000 * 8;  // 8mb
+  static constexpr size_t MAX_VOICES = 8;
+  static constexpr size_t MAX_SCHEDULED_VOICES = 16;
+  static constexpr float SILENCE_THRESHOLD = 0.01f;
+
+ public:
+  SfxBank();
+
+  // Copy constructor
+  SfxBank(const SfxBank &) = delete;
+  // Copy assignment
+  SfxBank &operator=(const SfxBank &) = delete;
+
+  // startOffset skips into the file before looking for the first sound
+  bool load(Sfx sfx, const char *filename, unsigned int sampleRate,
+            double startOffset = 0.);
+
+  // Plays on a voice from the pool. Steals the oldest voice if they're all
+  // busy rather than dropping the sound.
+  SoLoud::handle play(SoLoud::Soloud &soloud, Sfx sfx);
+
+  // Starts the sound delaySamples into the next mix. Scheduled sounds have
+  // a pool of their own, so a burst of plays can never steal one that
+  // hasn't sounded yet.
+  SoLoud::handle schedule(SoLoud::Soloud &soloud, Sfx sfx,
+                          unsigned int delaySamples);
+  // Stops everything scheduled, whether it's started or not
+  void stopScheduled(SoLoud::Soloud &soloud);
+
+ private:
+  template <size_t N>
+  struct VoicePool {
+    SoLoud::handle voices[N];
+    uint64_t started[N];
+  };
+
+  // A free voice from the pool, or the one that's been playing the longest
+  template <size_t N>
+  size_t takeVoice(SoLoud::Soloud &soloud, VoicePool<N> &pool);
+
+ private:
+  DStack _arena;
+  SoLoud::Wav _sounds[N_SFX];
+
+  VoicePool<MAX_VOICES> _voices;
+  VoicePool<MAX_SCHEDULED_VOICES> _scheduledVoices;
+  uint64_t _nPlayed;
+};
+
+#endif  // __SFX_BANK_H_
@@ -0,0 +1,93 @@
+#ifndef __TEMPO_MAP_H_
+#define __TEMPO_MAP_H_
+
+#include <stdint.h>
+
+#include <cstddef>
+
+#include "bs_types.hpp"
+
+// A run of constant tempo. Beats are sixteenths, counted from the first
+// beat of the track, times are seconds from the start of the file.
+struct TempoSegment {
+  double time;
+  double beat;
+  double spb;  // Seconds per sixteenth
+};
+
+// A run of bars in the same time signature. Bars count from the one
+// starting on beat 0, and a new meter always starts on a bar line.
+struct MeterSegment {
+  int32_t bar;
+  double beat;        // Where the first bar starts
+  uint32_t barBeats;  // Sixteenths per bar, 12 for 3/4
+};
+
+// Where a beat falls in the bar structure
+struct BarPos {
+  int32_t bar;  // Negative in the lead in
+  uint32_t beatRel;
+  uint32_t barBeats;
+  double barStartBeat;
+};
+
+// Piecewise constant tempo and meter, for tracks that don't keep a steady
+// bpm or stay in 4/4. Written by the beatmap tool as <track>.tempo.json,
+// meters are added to it by hand.
+class TempoMap {
+ public:
+  static constexpr size_t MAX_SEGMENTS = 256;
+  static constexpr size_t MAX_METERS = 64;
+  static constexpr uint32_t DEFAULT_BAR_BEATS = 16;
+
+  TempoMap();
+
+  // A single tempo for the whole track, with the first beat at startTime
+  void setConstant(double bpm, double startTime);
+
+  // Starts a new tempo at the given time. Segments have to be added in
+  // order, the first one is where beat 0 is.
+  bool addSegment(double time, double bpm);
+  // Changes the time signature from the given bar on. Has to be a whole
+  // number of sixteenths, so 3/4 and 7/8 are fine but 5/32 isn't. Meters
+  // have to be added in order, before bar 0 is always 4/4.
+  bool addMeter(int32_t bar, uint32_t numerator, uint32_t denominator);
+  // Clears the meters too
+  void clear();
+
+  bool load(const char *filename);
+  bool save(const char *filename) const;
+
+  // Both are O(log n) in the number of segments. Before the first segment
+  // the first tempo carries on backwards, giving negative beats.
+  double beatAt(double time) const;
+  double timeAt(double beat) const;
+  double spbAt(double time) const;
+
+  // Also O(log n), in the number of meters
+  BarPos barAt(double beat) const;
+  double beatAtBar(int32_t bar) const;
+
+  // Everything about where the music is at the given time in the track
+  MusicPos musicPosAt(double trackTime) const;
+
+  double getStartTime() const;
+  size_t getSegmentCount() const;
+  const TempoSegment &getSegment(size_t index) const;
+
+ private:
+  const TempoSegment &segmentAtTime(double time) const;
+  const TempoSegment &segmentAtBeat(double beat) const;
+  const MeterSegment &meterAtBeat(double beat) const;
+  const MeterSegment &meterAtBar(int32_t bar) const;
+
+ private:
+  size_t _nSegments;
+  TempoSegment _segments[MAX_SEGMENTS];
+
+  // NOTE: Always has at least the 4/4 meter starting on bar 0
+  size_t _nMeters;
+  MeterSegment _meters[MAX_METERS];
+};
+
+#endif  // __TEMPO_MAP_H_
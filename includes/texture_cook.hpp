@@ -0,0 +1,63 @@
+#ifndef __TEXTURE_COOK_H_
+#define __TEXTURE_COOK_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "tiny_gltf.h"
+
+// What a glTF image is sampled as. Decides how its mips are filtered,
+// which block format texconv compresses it to, and whether it's read as
+// sRGB.
+enum class TextureUsage {
+  Color,   // Base color and emissive, BC7 sRGB
+  Normal,  // Tangent space normals, BC5. Only x and y are kept.
+  Data,    // Metallic, roughness and occlusion, BC7 linear
+};
+
+struct TextureImage {
+  uint32_t width;
+  uint32_t height;
+  std::vector<uint8_t> pixels;  // RGBA8
+};
+
+// DXGI_FORMAT values, what the DX10 dds header names formats by
+constexpr uint32_t DXGI_FORMAT_R8G8B8A8_UNORM = 28;
+constexpr uint32_t DXGI_FORMAT_R8G8B8A8_UNORM_SRGB = 29;
+constexpr uint32_t DXGI_FORMAT_BC5_UNORM = 83;
+constexpr uint32_t DXGI_FORMAT_BC7_UNORM = 98;
+constexpr uint32_t DXGI_FORMAT_BC7_UNORM_SRGB = 99;
+
+// One per image in the model. An image that's used as more than one thing
+// is a normal map if it's used as one at all, and then color before data.
+std::vector<TextureUsage> getImageUsages(const tinygltf::Model &model);
+
+// Image loader for tinygltf that keeps the file as it is, without decoding
+// it, in the vector of files passed as the user data. The index is the
+// same as in model.images.
+bool keepImageSource(tinygltf::Image *image, const int imageIndex,
+                     std::string *err, std::string *warn, int reqWidth,
+                     int reqHeight, const unsigned char *bytes, int size,
+                     void *sources);
+bool decodeImage(const std::vector<uint8_t> &source, TextureImage &image);
+
+// Cooked textures are found by a hash of the source file and how it's
+// used, so an edited image or a change to the cooking gets a new entry
+uint64_t getTextureKey(const std::vector<uint8_t> &source, TextureUsage usage);
+// In a cooked directory next to the model. Compressed ones are written by
+// texconv, the others by the engine the first time it loads the source.
+std::string getCookedTexturePath(const std::string &directory, uint64_t key,
+                                 bool compressed);
+
+// The whole chain down to 1x1, starting with the image itself. Color is
+// averaged in linear space and normals are renormalized.
+std::vector<TextureImage> generateMips(TextureImage image, TextureUsage usage);
+
+// A 2D dds with a DX10 header, the levels one after the other. Written next
+// to it first and then moved, so a crash halfway can't leave a broken one.
+bool writeDds(const std::string &filename, uint32_t format, uint32_t width,
+              uint32_t height, const std::vector<std::vector<uint8_t>> &levels);
+
+#endif
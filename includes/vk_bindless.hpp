@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+// One big array of textures that the shaders index into by slot. Slots are
+// written as textures come and go, without rebuilding or rebinding the set,
+// and only the ones in use are ever read, so the rest can stay empty.
+class BindlessTable {
+ public:
+  BindlessTable();
+
+  void init(vk::Device, uint32_t capacity, uint32_t framesInFlight);
+  void destroy();
+
+  // Returns the slot the texture is at
+  uint32_t add(vk::ImageView, vk::Sampler);
+  // The slot isn't handed out again until every frame that might still
+  // read it is done. The view has to live that long too.
+  void remove(uint32_t slot);
+  // Once the frame has been waited for, before anything is recorded in it
+  void beginFrame(uint32_t frame);
+
+  vk::DescriptorSetLayout getLayout() const;
+  vk::DescriptorSet getSet() const;
+
+ private:
+  vk::Device _device;
+  uint32_t _capacity;
+
+  vk::UniqueDescriptorPool _pool;
+  vk::UniqueDescriptorSetLayout _layout;
+  vk::UniqueDescriptorSet _set;
+
+  // Slots that have never been used start at _next
+  uint32_t _next;
+  std::vector<uint32_t> _free;
+
+  // Removed while recording each frame
+  uint32_t _frame;
+  std::vector<std::vector<uint32_t>> _retired;
+};
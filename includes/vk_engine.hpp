@@ -9,6 +9,7 @@
 #include "camera.hpp"
 #include "dstack.hpp"
 #include "glm/mat4x4.hpp"
+#include "mapped_file.hpp"
 #define NOMINMAX
 #include <vulkan/vulkan.hpp>
 
@@ -16,9 +17,14 @@
 #include "bs_graphics_component.hpp"
 #include "bs_types.hpp"
 #include "mesh.hpp"
+#include "mesh_cook.hpp"
 #include "tiny_gltf.h"
+#include "vk_bindless.hpp"
 #include "vk_mem_alloc.h"
+#include "vk_render_graph.hpp"
+#include "vk_texture_stream.hpp"
 #include "vk_types.hpp"
+#include "vk_upload.hpp"
 #include "vk_utils.hpp"
 
 class PipelineBuilder {
@@ -27,29 +33,29 @@ class PipelineBuilder {
   vk::PipelineShaderStageCreateInfo _shaderStages[2]{};
   vk::PipelineVertexInputStateCreateInfo _vertexInputInfo;
   vk::PipelineInputAssemblyStateCreateInfo _inputAssemblyInfo;
-  vk::Viewport _viewport;
-  vk::Rect2D _scissor;
   vk::PipelineViewportStateCreateInfo _viewportStateInfo;
   vk::PipelineRasterizationStateCreateInfo _rasterizationInfo;
   // NOTE: Defaults to off. Requires enabling a GPU feature if used
   vk::PipelineMultisampleStateCreateInfo _multisampleInfo;
   vk::PipelineColorBlendStateCreateInfo _colorBlendingInfo;
   vk::PipelineDepthStencilStateCreateInfo _depthStencilInfo;
-  // Stuff that can be changed during runtime, without recreating the pipeline
-  // vk::DynamicState dynamicStates[] = {vk::DynamicState::eViewport,
-  // vk::DynamicState::eLineWidth};
-
-  // vk::PipelineDynamicStateCreateInfo dynamicStateInfo{
-  // vk::PipelineDynamicStateCreateFlags{}, 2, dynamicStatesInfo};
-  //
-  vk::UniquePipeline buildPipeline(const vk::Device &, const vk::RenderPass &,
+  vk::UniquePipeline buildPipeline(const vk::Device &,
+                                   const vk::PipelineCache &,
+                                   const vk::RenderPass &,
                                    const vk::PipelineLayout &);
 };
 
 constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 2;
+constexpr unsigned int MAX_SWAPCHAIN_IMAGES = 8;
 constexpr unsigned int MAX_DRAW_COMMANDS = 10000;
 constexpr unsigned int MAX_OBJECTS = 10000;
-constexpr unsigned int MAX_TEXTURES = 100;
+constexpr unsigned int MAX_BINDLESS_TEXTURES = 4096;
+// What model textures can take up on the GPU, before their mips are dropped
+constexpr vk::DeviceSize TEXTURE_BUDGET = 512 * 1024 * 1024;
+constexpr unsigned int MAX_PYRAMID_LEVELS = 16;
+
+// NOTE: Relative to the executable, like the shaders
+constexpr const char *PIPELINE_CACHE_FILE = "pipeline_cache.bin";
 
 class VulkanEngine {
  public:
@@ -62,8 +68,15 @@ class VulkanEngine {
   void run();
   void draw(const bs::GraphicsComponent *, size_t numEntities, Camera &, double,
             float);
-  void drawObjects(const bs::GraphicsComponent *, size_t numEntities,
-                   vk::CommandBuffer, double);
+  void cullDraws(vk::CommandBuffer, CullPhase);
+  void drawDepth(vk::CommandBuffer, vk::Buffer drawCommands);
+  void buildDepthPyramid(vk::CommandBuffer);
+  void drawShadows(vk::CommandBuffer);
+  void drawSkybox(vk::CommandBuffer);
+  void drawObjects(vk::CommandBuffer);
+
+  // Briefly brightens the ambient light, e.g. for the calibration metronome
+  void pulseAmbient();
 
  private:
   /*  INIT  */
@@ -71,19 +84,23 @@ class VulkanEngine {
   void initSurface();
   void initPhysicalDevice();
   void initLogicalDevice();
+  void initPipelineCache();
   void initAllocator();
   void initCommandPool();
   void initQueues();
+  void initUploadManager();
   void initSwapchain();
   void initSwapchainImages(DStack &);
-  void initDepthImage();
-  void initRenderPass();
-  void initFramebuffers(DStack &);
+  void initShadowSampler();
+  void initDepthPyramid();
+  void initRenderGraph();
 
   void initDescriptorSetLayout();
+  void initTextureTable();
   void initPipelines();
   void initComputePipelines();
   void initMaterials(const tinygltf::Model &model);
+  void writeMaterials(uint32_t frame);
 
   void initUniformBuffers();
 
@@ -91,10 +108,12 @@ class VulkanEngine {
   void initCubemap();
   void initTextures();
   void initTextureImageSampler();
+  void initTextureStreamer();
   void initTextureDescriptorSet();
 
   void initDescriptorPool();
   void initDescriptorSets();
+  void updateExtentDescriptorSets();
 
   // TODO: Expose all of these as a single
   // loadMeshes type function, that can be used
@@ -109,34 +128,36 @@ class VulkanEngine {
 
  private:
   /*  UTILS  */
-  void immediateSubmit(std::function<void(vk::CommandBuffer cmd)> &&);
-
-  void transitionImageLayout(const vk::Image &, vk::Format, vk::ImageLayout,
-                             vk::ImageLayout, uint32_t);
-  void copyBufferToImage(const vk::Buffer &, const vk::Image &, uint32_t,
-                         uint32_t, uint32_t);
-  void generateMipmaps(const vk::Image &, int32_t, int32_t, uint32_t);
+  void generateMipmaps(vk::CommandBuffer, const vk::Image &, int32_t, int32_t,
+                       uint32_t);
   void recreateSwapchain();
   void updateCameraBuffer(Camera &, float);
   void updateSceneBuffer(float, float);
   void updateObjectBuffer(const bs::GraphicsComponent *, size_t);
+  void requestTextures(const bs::GraphicsComponent *, size_t, const Camera &);
 
   size_t padUniformBufferSize(size_t);
 
-  void loadGltfTextures(const tinygltf::Model &model);
-  void loadGltfNode(const tinygltf::Model &input, const tinygltf::Node &node,
-                    std::vector<Vertex> &vertexBuffer,
-                    std::vector<uint32_t> &indexBuffer, Model &model,
-                    Node *parent);
+  void loadGltfTextures(const tinygltf::Model &model,
+                        const std::string &directory,
+                        const std::vector<std::vector<uint8_t>> &sources);
 
   void loadTextureFromFile(const std::string &, Texture &,
                            bool shouldGenMipmaps);
-  void loadDdsFromFile(const std::string &filename, Texture &outTexture);
-  void loadTexture(const tinygltf::Image &image, Texture &outTexture);
-
-  Model loadModelFromFile(const std::string &,
-                          std::vector<Vertex> &vertexBuffer,
-                          std::vector<uint32_t> &indexBuffer);
+  bool loadDdsFromFile(const std::string &filename, Texture &outTexture,
+                       bool srgb);
+  void loadTexture(uint32_t width, uint32_t height,
+                   const std::vector<std::vector<uint8_t>> &mips,
+                   Texture &outTexture, bool srgb);
+
+  // Materials and textures from the glTF file, meshes from its cooked
+  // model. The view points into meshFile, or into meshData if the model
+  // had to be cooked
+  bool loadModelFromFile(const std::string &, MappedFile &meshFile,
+                         std::vector<uint8_t> &meshData,
+                         CookedModelView &meshes);
+  Model createModel(const CookedModelView &meshes, uint32_t firstVertex,
+                    uint32_t firstIndex);
 
  public:
   DStack *_dstack;
@@ -145,57 +166,91 @@ class VulkanEngine {
   vk::UniqueSurfaceKHR _surface;
   vk::PhysicalDevice _physicalDevice;
   vk::PhysicalDeviceProperties _deviceProperties;
+  // Without it, textures cooked to BCn are skipped for their sources
+  bool _textureCompressionBC;
   vk::UniqueDevice _device;
+  // Saved when the engine goes away, so the next start doesn't have to
+  // compile every pipeline again
+  vk::UniquePipelineCache _pipelineCache;
 
   VmaAllocator _allocator;
 
   vk::UniqueCommandPool _commandPool;
-  vk::UniqueCommandPool _immediateCommandPool;
 
   uint32_t _graphicsQueueFamily;
   uint32_t _presentQueueFamily;
+  // The graphics family, if there's no transfer only family
+  uint32_t _transferQueueFamily;
   vk::Queue _graphicsQueue;
   vk::Queue _presentQueue;
+  vk::Queue _transferQueue;
+
+  UploadManager _uploads;
 
   vk::UniqueSwapchainKHR _swapchain;
   vk::Extent2D _swapchainExtent;
   vk::Format _swapchainImageFormat;
 
+  // NOTE: Owned by the swapchain
   size_t _nSwapchainImages;
-  vk::UniqueImage *_swapchainImages;
+  vk::Image *_swapchainImages{};
 
   size_t _nSwapchainImageViews;
-  vk::UniqueImageView *_swapchainImageViews;
-
-  AllocatedImage _depthImage;
-  vk::UniqueImageView _depthImageView;
+  vk::UniqueImageView *_swapchainImageViews{};
+
+  // NOTE: The depth and shadow map images, render passes and framebuffers
+  // all belong to the render graph
+  rg::RenderGraph _renderGraph;
+  rg::Handle _rgSwapchainImage;
+  rg::Handle _rgDepthImage;
+  rg::Handle _rgShadowMap;
+  rg::Handle _rgIndirectCommands;
+  rg::Handle _rgEarlyCommands;
+  rg::Handle _rgLateCommands;
+  rg::Handle _rgDepthPyramid;
+  rg::Handle _depthPrepass;
+  rg::Handle _shadowPass;
+  rg::Handle _forwardPass;
+
+  // Draws depth for everything that survives culling first, and the
+  // forward pass only shades what's left. Also turns on occlusion culling.
+  bool _depthPrepassEnabled = true;
+
+  // Farthest depth per texel, each level half the size of the one above.
+  // Kept between frames, the early cull phase tests against last frame's.
+  AllocatedImage _depthPyramid;
+  uint32_t _depthPyramidLevels;
+  vk::UniqueImageView _depthPyramidView;
+  std::array<vk::UniqueImageView, MAX_PYRAMID_LEVELS> _depthPyramidMipViews;
+  vk::UniqueSampler _depthPyramidSampler;
+  std::array<vk::UniqueDescriptorSet, MAX_PYRAMID_LEVELS>
+      _depthPyramidDescriptorSets;
 
-  AllocatedImage _shadowDepthImage;
-  vk::UniqueImageView _shadowDepthImageView;
   vk::UniqueSampler _shadowDepthImageSampler;
 
-  vk::UniqueRenderPass _shadowPass;
-  vk::UniqueRenderPass _forwardPass;
-
-  size_t _nFramebuffers;
-  vk::UniqueFramebuffer *_framebuffers;
-
-  vk::UniqueFramebuffer _depthFramebuffer;
-
   vk::UniqueDescriptorPool _descriptorPool;
   vk::UniqueDescriptorSetLayout _globalDescriptorSetLayout;
   vk::UniqueDescriptorSetLayout _objectDescriptorSetLayout;
   vk::UniqueDescriptorSetLayout _singleTextureDescriptorSetLayout;
   vk::UniqueDescriptorSetLayout _computeDescriptorSetLayout;
+  vk::UniqueDescriptorSetLayout _depthPyramidDescriptorSetLayout;
 
   vk::UniqueSampler _textureImageSampler;
+  // The shadow map and the hdr textures
   vk::UniqueDescriptorSet _textureDescriptorSet;
+  // Everything a material can point at, set 3
+  BindlessTable _textureTable;
+  // Model textures, in the same order as the images in the model
+  TextureStreamer _textureStreamer;
+  // The texture each material uses, by index in the streamer. Looked up
+  // again whenever the streamer moves textures to other slots.
+  std::vector<MaterialBufferObject> _materialTextures;
 
-  std::array<vk::UniquePipelineLayout, 1> _computePipelineLayouts;
-  std::array<vk::UniquePipeline, 1> _computePipelines;
+  std::array<vk::UniquePipelineLayout, 2> _computePipelineLayouts;
+  std::array<vk::UniquePipeline, 2> _computePipelines;
 
   std::array<vk::UniquePipelineLayout, 2> _pipelineLayouts;
-  std::array<vk::UniquePipeline, 3> _pipelines;
+  std::array<vk::UniquePipeline, 4> _pipelines;
 
   Model _drawable;
 
@@ -206,19 +261,25 @@ class VulkanEngine {
   // std::unordered_map<std::string, Mesh> _meshes;
   //
 
-  size_t _nTextures;
-  Texture *_textures;
   Texture _hdrTextures[4];
   // std::unordered_map<std::string, Texture> _textures;
 
   AllocatedBuffer _sceneUniformBuffer;
   SceneBufferObject _sceneUbo;
+  float _ambientPulse{};
 
   std::array<FrameData, MAX_FRAMES_IN_FLIGHT> _frames;
 
   // TODO: Get rid of this?
   // std::vector<vk::Fence> _imagesInFlight;
   size_t _currentFrame{};
+  uint32_t _nDrawCommands{};
+
+  glm::mat4 _viewProj{1.0f};
+  glm::mat4 _occlusionViewProj{1.0f};
+  // Of the projection, how big something is on screen per unit of
+  // size over distance
+  float _projectionScale{1.0f};
 
   bool _framebufferResized = false;
 };
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <initializer_list>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "vk_mem_alloc.h"
+
+namespace rg {
+
+using Handle = uint32_t;
+
+// How a pass uses a resource. Each one maps to exactly one layout, set of
+// stages and access mask, so barriers can be worked out from them.
+enum class Access {
+  None,             // Whatever was in there doesn't matter
+  Acquired,         // Straight from the swapchain, waited on at color output
+  ColorAttachment,
+  DepthAttachment,  // Depth test and write
+  DepthRead,        // Depth test only
+  SampledFragment,
+  SampledCompute,
+  StorageReadVertex,
+  StorageReadCompute,
+  StorageWriteCompute,
+  IndirectRead,
+  TransferSrc,
+  TransferDst,
+  Present,
+};
+
+struct State {
+  vk::ImageLayout layout;
+  vk::PipelineStageFlags stages;
+  vk::AccessFlags access;
+};
+
+State getState(Access);
+bool isWrite(Access);
+
+// A single transition outside of any graph, e.g. for texture uploads
+void transition(vk::CommandBuffer, vk::Image, vk::ImageAspectFlags,
+                uint32_t mipLevels, Access from, Access to);
+
+struct ImageDesc {
+  vk::Format format;
+  vk::Extent2D extent;
+  vk::ImageAspectFlags aspect;
+  // Used when it's an attachment and nothing has been written to it yet
+  vk::ClearValue clearValue;
+};
+
+struct Use {
+  Handle resource;
+  Access access;
+};
+
+using RecordFunction = std::function<void(vk::CommandBuffer)>;
+
+// Passes declare what they read and write, and the graph takes care of the
+// barriers, layout transitions and render passes between them.
+//
+// Declare the resources and passes once, compile, then every frame set the
+// imported resources and execute. Everything is built again from scratch
+// when the swapchain changes.
+class RenderGraph {
+  struct Tracking {
+    vk::ImageLayout layout;
+    // The last write, or layout transition, and the reads since then
+    vk::PipelineStageFlags writeStages;
+    vk::AccessFlags writeAccess;
+    vk::PipelineStageFlags readStages;
+    vk::AccessFlags readAccess;
+  };
+
+  struct Resource {
+    const char *name;
+    bool isImage;
+    bool imported;
+    ImageDesc desc;
+    Access before;  // Imported only
+    Access after;
+
+    // Compiled
+    vk::ImageUsageFlags usage;
+    uint32_t firstPass;
+    uint32_t lastPass;
+    uint32_t memorySlot;
+    vk::UniqueImage ownedImage;
+    vk::UniqueImageView ownedView;
+
+    // Per frame
+    vk::Image image;
+    vk::ImageView view;
+    vk::Buffer buffer;
+    Tracking tracking;  // Imported only, transients track their memory
+    bool touched;
+  };
+
+  // Memory shared by transient images that are never alive at the same time
+  struct MemorySlot {
+    vk::MemoryRequirements requirements;
+    std::vector<Handle> resources;
+    VmaAllocation allocation;
+    // Whichever image used it last, also from the frame before
+    Tracking tracking;
+  };
+
+  struct Framebuffer {
+    std::vector<vk::ImageView> views;
+    vk::UniqueFramebuffer framebuffer;
+  };
+
+  struct Pass {
+    const char *name;
+    std::vector<Use> uses;
+    RecordFunction record;
+    bool culled;
+
+    // Compiled, only for passes that draw to attachments
+    std::vector<Handle> attachments;  // Colors first, then depth
+    std::vector<vk::ClearValue> clearValues;
+    vk::Extent2D extent;
+    vk::UniqueRenderPass renderPass;
+    std::vector<Framebuffer> framebuffers;  // One per set of imported views
+  };
+
+ public:
+  RenderGraph();
+  ~RenderGraph();
+
+  // Owned by the graph and only valid during a frame. Images that are never
+  // used by the same passes get aliased to the same memory.
+  Handle createImage(const char *name, const ImageDesc &);
+  // Owned by something else, like the swapchain. It's expected to be in
+  // `before` when the frame starts and is left in `after` when it ends.
+  Handle importImage(const char *name, const ImageDesc &, Access before,
+                     Access after);
+  Handle importBuffer(const char *name, Access before, Access after);
+
+  // Passes run in the order they're added. One that uses an attachment gets
+  // a render pass of its own, and record is called inside it.
+  Handle addPass(const char *name, std::initializer_list<Use> uses,
+                 RecordFunction &&record);
+
+  // Culls the passes nothing depends on, then creates the transient images
+  // and the render passes
+  void compile(const vk::Device &, VmaAllocator);
+  // Destroys everything, declarations included
+  void reset();
+
+  // Imported resources, every frame before execute
+  void setImage(Handle, vk::Image, vk::ImageView);
+  void setBuffer(Handle, vk::Buffer);
+
+  void execute(vk::CommandBuffer);
+
+  vk::RenderPass getRenderPass(Handle pass) const;
+  vk::ImageView getImageView(Handle image) const;
+
+ private:
+  void compileLifetimes();
+  void compileImages();
+  void compileRenderPasses();
+
+  Tracking &getTracking(Resource &);
+  void use(Resource &, Access);
+  void addBarrier(const Resource &, vk::PipelineStageFlags, vk::AccessFlags,
+                  vk::ImageLayout oldLayout, const State &next);
+  void flushBarriers(vk::CommandBuffer);
+  vk::Framebuffer getFramebuffer(Pass &);
+
+ private:
+  vk::Device _device;
+  VmaAllocator _allocator;
+
+  std::vector<Resource> _resources;
+  std::vector<Pass> _passes;
+  std::vector<MemorySlot> _memorySlots;
+
+  // Reused every pass, so executing doesn't allocate
+  vk::PipelineStageFlags _srcStages;
+  vk::PipelineStageFlags _dstStages;
+  std::vector<vk::ImageMemoryBarrier> _imageBarriers;
+  std::vector<vk::BufferMemoryBarrier> _bufferBarriers;
+  std::vector<vk::ImageView> _framebufferViews;
+};
+
+}  // namespace rg
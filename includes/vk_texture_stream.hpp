@@ -0,0 +1,134 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "vk_bindless.hpp"
+#include "vk_mem_alloc.h"
+#include "vk_types.hpp"
+#include "vk_upload.hpp"
+
+// A dds or ktx file as it is on disk, with where each mip level is in it
+struct DdsImage {
+  vk::Format format;  // eUndefined if it's not one we handle
+  bool compressed;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mipLevels;
+  std::vector<ImageLevel> levels;  // Point into data
+  std::vector<uint8_t> data;
+};
+
+bool readDds(const std::string &filename, bool srgb, DdsImage &image);
+
+// Keeps only as many mips of each texture on the GPU as it's drawn at.
+// The smallest ones go up right away, the rest are read on a background
+// thread as they're asked for and swapped in once they've been uploaded.
+// Everything that's more detailed than needed is dropped again when the
+// textures don't fit in the budget anymore.
+//
+// A texture is a whole new image, with a new slot in the bindless table,
+// every time its mips change. The version goes up when that happens, and
+// whatever holds on to slots has to look them up again.
+class TextureStreamer {
+  struct Entry {
+    std::string filename;  // Empty if it's not streamed
+    bool srgb;
+    Texture texture;
+    uint32_t width;
+    uint32_t height;
+    uint32_t tailMip;      // This and smaller are always there
+    uint32_t residentMip;  // The first level of the image
+    uint32_t targetMip;
+    bool loading;
+    float pixels;  // How big it's drawn, the most this frame
+    std::vector<vk::DeviceSize> mipSizes;
+  };
+
+  struct Read {
+    uint32_t texture;
+    uint32_t firstMip;
+    std::string filename;
+    bool srgb;
+    bool ok;
+    DdsImage image;
+  };
+
+  struct Swap {
+    uint32_t texture;
+    uint32_t firstMip;
+    uint64_t value;  // When its upload is done
+    Texture result;
+  };
+
+ public:
+  // Mips this size and smaller are loaded with the texture and stay
+  static constexpr uint32_t TAIL_SIZE = 64;
+  // Reads and uploads in flight at a time, so they keep up with the camera
+  static constexpr size_t MAX_LOADS = 4;
+  // Uploaded per frame, at least one texture is even if it's bigger
+  static constexpr vk::DeviceSize UPLOAD_BYTES_PER_FRAME = 16 * 1024 * 1024;
+
+  TextureStreamer();
+  ~TextureStreamer();
+
+  void init(vk::Device, VmaAllocator, UploadManager &, BindlessTable &,
+            vk::Sampler, vk::DeviceSize budget, uint32_t framesInFlight);
+  void destroy();
+
+  // Textures are numbered in the order they're added. Returns false if the
+  // file can't be read, and then nothing is added.
+  bool add(const std::string &filename, bool srgb);
+  // One that's already there with all of its mips, and never streamed
+  void add(const Texture &);
+
+  uint32_t getSlot(uint32_t texture) const;
+  uint64_t getVersion() const;
+
+  // How many pixels across the texture is drawn at. Asked for every frame
+  // it's seen, the biggest one wins.
+  void request(uint32_t texture, float pixels);
+
+  // Once the frame has been waited for, after the bindless table has
+  // started it. Swaps in what's landed and asks for more.
+  void update(uint32_t frame);
+
+ private:
+  void createImage(const DdsImage &, uint32_t firstMip, Texture &);
+  void destroyTexture(const Texture &);
+  vk::DeviceSize getSize(const Entry &, uint32_t firstMip) const;
+  void plan();
+  void loaderLoop();
+
+ private:
+  vk::Device _device;
+  VmaAllocator _allocator;
+  UploadManager *_uploads;
+  BindlessTable *_table;
+  vk::Sampler _sampler;
+  vk::DeviceSize _budget;
+
+  std::vector<Entry> _entries;
+  uint64_t _version;
+  size_t _nLoads;
+
+  std::vector<Swap> _swaps;
+  // Replaced while recording each frame
+  uint32_t _frame;
+  std::vector<std::vector<Texture>> _retired;
+
+  // Shared with the loader
+  std::thread _loader;
+  std::mutex _mutex;
+  std::condition_variable _wakeLoader;
+  bool _quit;
+  std::deque<Read> _requests;
+  std::deque<Read> _reads;
+};
@@ -5,6 +5,7 @@
 #include <vulkan/vulkan.hpp>
 
 #include "glm/mat4x4.hpp"
+#include "glm/vec2.hpp"
 #include "vk_mem_alloc.h"
 
 // TODO: Unique Buffer
@@ -78,12 +79,27 @@ struct Texture {
   AllocatedImage image;
   vk::ImageView imageView;  // TODO: Unique
   uint32_t mipLevels;
+  uint32_t slot;  // In the bindless texture table, if it's in there
 };
 
 struct MeshPushConstants {
   glm::mat4 model;
 };
 
+// Same as the phases in shader.comp
+enum CullPhase : uint32_t {
+  CULL_FRUSTUM,  // No depth prepass, frustum only
+  CULL_EARLY,    // Against the depth pyramid from the last frame
+  CULL_LATE,     // Against the depth pyramid from this frame
+};
+
+struct CullPushConstants {
+  glm::mat4 occlusionViewProj;  // What the depth pyramid was built with
+  glm::vec2 pyramidSize;
+  uint32_t drawCount;
+  uint32_t phase;
+};
+
 struct FrameData {
   vk::UniqueCommandBuffer _commandBuffer;
   vk::UniqueSemaphore _imageAvailableSemaphore;
@@ -91,10 +107,14 @@ struct FrameData {
   vk::UniqueFence _inFlightFence;
   vk::UniqueDescriptorSet _globalDescriptorSet;
   vk::UniqueDescriptorSet _objectDescriptorSet;
-  vk::UniqueDescriptorSet _computeDescriptorSet;
+  vk::UniqueDescriptorSet _earlyCullDescriptorSet;
+  vk::UniqueDescriptorSet _lateCullDescriptorSet;
   AllocatedBuffer _cameraBuffer;
   AllocatedBuffer _objectStorageBuffer;
   AllocatedBuffer _transformStorageBuffer;
   AllocatedBuffer _materialStorageBuffer;
-  AllocatedBuffer _indirectCommandBuffer;
+  uint64_t _textureVersion{};  // Of the streamer, when materials were written
+  AllocatedBuffer _indirectCommandBuffer;  // Every draw, from the cpu
+  AllocatedBuffer _earlyCommandBuffer;     // What the cull phases let through
+  AllocatedBuffer _lateCommandBuffer;
 };
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+#include "vk_mem_alloc.h"
+#include "vk_render_graph.hpp"
+#include "vk_types.hpp"
+
+// A level's pixels, for uploadImage
+struct ImageLevel {
+  uint32_t mipLevel;
+  uint32_t width;
+  uint32_t height;
+  const void *data;
+  vk::DeviceSize size;
+};
+
+// A staging buffer that stays mapped, handed out front to back and wrapping
+// around. What's allocated belongs to the batch being recorded until close
+// is called with the timeline value of that batch, and comes back once
+// release is called with a value at least as high.
+class StagingRing {
+  struct Region {
+    uint64_t value;
+    uint64_t end;
+  };
+
+ public:
+  StagingRing();
+
+  void init(VmaAllocator, vk::DeviceSize size);
+  void destroy();
+
+  // Returns nullptr if there's no room until something is released
+  void *allocate(vk::DeviceSize size, vk::DeviceSize alignment,
+                 vk::DeviceSize &offset);
+  void close(uint64_t value);
+  void release(uint64_t value);
+
+  // Anything allocated that hasn't been closed yet
+  bool hasOpen() const;
+  vk::Buffer getBuffer() const;
+  vk::DeviceSize getSize() const;
+
+ private:
+  VmaAllocator _allocator;
+  AllocatedBuffer _buffer;
+  void *_data;
+  vk::DeviceSize _size;
+
+  // NOTE: These only ever grow, the offset into the buffer is them modulo
+  // the size. Everything from tail to head is in use.
+  uint64_t _head;
+  uint64_t _tail;
+  uint64_t _closed;
+  std::deque<Region> _regions;
+};
+
+// Collects uploads into batches that run on the transfer queue, when the
+// device has one of its own, and hands the results over to the graphics
+// queue. Nothing blocks unless asked to: submit returns a value on a
+// timeline semaphore that is reached once the batch is done.
+class UploadManager {
+  struct Batch {
+    uint64_t value;
+    vk::UniqueCommandBuffer transferCommands;
+    vk::UniqueCommandBuffer graphicsCommands;
+  };
+
+  // Anything bigger than a chunk goes through the ring a chunk at a time,
+  // so there's always room for the next one while the last is copied
+  static constexpr vk::DeviceSize STAGING_RING_SIZE = 64 * 1024 * 1024;
+  static constexpr vk::DeviceSize STAGING_CHUNK_SIZE = STAGING_RING_SIZE / 4;
+  static constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+ public:
+  UploadManager();
+  ~UploadManager();
+
+  void init(vk::Device, VmaAllocator, uint32_t transferFamily,
+            vk::Queue transferQueue, uint32_t graphicsFamily,
+            vk::Queue graphicsQueue);
+  void destroy();
+
+  // The data is copied into staging memory before these return, so it can
+  // be freed right away. Buffers are ready for any read on the graphics
+  // queue once the batch is done. If the ring fills up, what's recorded so
+  // far is submitted and these wait for the oldest batch to finish.
+  void uploadBuffer(vk::Buffer, vk::DeviceSize offset, const void *data,
+                    vk::DeviceSize size);
+  // Levels that aren't given are left alone, but still end up in `after`.
+  // Block compressed formats pass the size of their blocks, 4 for BCn.
+  void uploadImage(vk::Image, uint32_t mipLevels,
+                   const std::vector<ImageLevel> &, rg::Access after,
+                   uint32_t blockSize = 1);
+  // Recorded on the graphics queue, after everything in the batch has been
+  // handed over. For things the transfer queue can't do, like blits.
+  void record(std::function<void(vk::CommandBuffer)> &&);
+
+  // Returns the value the timeline reaches when it's done, or the last
+  // one if there was nothing to submit
+  uint64_t submit();
+  bool isDone(uint64_t value) const;
+  void wait(uint64_t value) const;
+
+  // Gives back the staging memory of finished batches
+  void collect();
+
+ private:
+  void begin();
+  void *allocateStaging(vk::DeviceSize size, vk::DeviceSize &offset);
+
+ private:
+  vk::Device _device;
+  VmaAllocator _allocator;
+
+  uint32_t _transferFamily;
+  uint32_t _graphicsFamily;
+  vk::Queue _transferQueue;
+  vk::Queue _graphicsQueue;
+
+  vk::UniqueCommandPool _transferCommandPool;
+  vk::UniqueCommandPool _graphicsCommandPool;
+
+  // NOTE: With a separate transfer queue, the graphics queue waits for the
+  // first before taking ownership and then signals the second
+  vk::UniqueSemaphore _transferTimeline;
+  vk::UniqueSemaphore _timeline;
+  uint64_t _lastValue;
+
+  // The batch being recorded, and the ones in flight
+  Batch _current;
+  bool _recording;
+  std::deque<Batch> _pending;
+
+  StagingRing _staging;
+
+  // Ownership transfers, recorded once per batch
+  std::vector<vk::BufferMemoryBarrier> _releaseBuffers;
+  std::vector<vk::ImageMemoryBarrier> _releaseImages;
+  std::vector<vk::BufferMemoryBarrier> _acquireBuffers;
+  std::vector<vk::ImageMemoryBarrier> _acquireImages;
+  vk::PipelineStageFlags _acquireStages;
+  std::vector<std::function<void(vk::CommandBuffer)>> _records;
+};
@@ -31,6 +31,9 @@ struct QueueFamilyIndices {
 QueueFamilyIndices findQueueFamilies(const vk::PhysicalDevice &,
                                      const vk::SurfaceKHR &);
 
+// A family with nothing but transfer, if the device has one
+std::optional<uint32_t> findTransferQueueFamily(const vk::PhysicalDevice &);
+
 struct SwapchainSupportDetails {
   vk::SurfaceCapabilitiesKHR capabilities;
   std::vector<vk::SurfaceFormatKHR> formats;
@@ -64,9 +67,13 @@ std::vector<char> readFile(const std::string &);
 vk::UniqueShaderModule createUniqueShaderModule(const vk::Device &,
                                                 const std::vector<char> &code);
 
-uint32_t getMipLevels(int, int);
+// Empty if there is none, or it was saved by another device or driver
+std::vector<uint8_t> readPipelineCache(const std::string &,
+                                       const vk::PhysicalDeviceProperties &);
+void writePipelineCache(const std::string &,
+                        const vk::PhysicalDeviceProperties &,
+                        const std::vector<uint8_t> &data);
 
-void computeBoundingSphere(glm::vec4 &result, const glm::vec3 points[],
-                           size_t count);
+uint32_t getMipLevels(int, int);
 
 }  // namespace vkutils
@@ -1,8 +0,0 @@
-D:/VulkanSDK/1.2.162.1/Bin32/glslc.exe shader.vert -o vert.spv
-D:/VulkanSDK/1.2.162.1/Bin32/glslc.exe shader.frag -o frag.spv
-D:/VulkanSDK/1.2.162.1/Bin32/glslc.exe shader.comp -o comp.spv
-D:/VulkanSDK/1.2.162.1/Bin32/glslc.exe shadowmap.vert -o shadowmap_vert.spv
-
-D:/VulkanSDK/1.2.162.1/Bin32/glslc.exe skybox.vert -o skybox_vert.spv
-D:/VulkanSDK/1.2.162.1/Bin32/glslc.exe skybox.frag -o skybox_frag.spv
-pause
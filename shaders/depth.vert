@@ -0,0 +1,38 @@
+#version 460
+
+layout(set = 0, binding = 0) uniform CameraBuffer {
+    vec3 viewPos;
+    uint padding;
+    vec4 frustum;
+    mat4 view;
+    mat4 proj;
+    float zNear;
+    float zFar;
+    uint padding2;
+    uint padding3;
+} cameraBuffer;
+
+struct ObjectData {
+    mat4 model;
+    vec4 boundingSphere;
+    uint materialIndex;
+    uint padding1;
+    uint padding2;
+    uint padding3;
+};
+
+layout(std140,set = 1, binding = 0) readonly buffer ObjectBuffer{
+	ObjectData objects[];
+} objectBuffer;
+
+layout(location = 0) in vec3 inPosition;
+
+// NOTE: Has to come out exactly the same as in shader.vert, the forward
+// pass only shades what matches the depth written here
+invariant gl_Position;
+
+void main() {
+    mat4 model = objectBuffer.objects[gl_BaseInstance].model;
+    vec3 fragPos = vec3(model * vec4(inPosition, 1.0));
+    gl_Position = cameraBuffer.proj * cameraBuffer.view * vec4(fragPos, 1.0);
+}
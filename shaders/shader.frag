@@ -1,5 +1,6 @@
 #version 460
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec2 fragTexCoord;
 layout(location = 1) flat in uint objectIndex;
@@ -65,9 +66,13 @@ layout(std140,set = 1, binding = 1) readonly buffer MaterialBuffer{
 	MaterialData materials[];
 } materialBuffer;
 
-layout(set = 2, binding = 0) uniform sampler2D texSamplers[56];
+layout(set = 2, binding = 0) uniform sampler2D shadowMap;
 layout(set = 2, binding = 1) uniform sampler2D hdrSampler[4];
 
+// Bindless, indexed by the slots in the material buffer. Draws are batched
+// into one indirect call, so the index can differ within a wave.
+layout(set = 3, binding = 0) uniform sampler2D textures[];
+
 const float PI = 3.14159265359;
 
 float shadowColor() {
@@ -77,7 +82,7 @@ float shadowColor() {
     vec3 sampleCoord = projCoord * 0.5 + 0.5;
     // projCoord = projCoord * 0.5 + 0.5;
 
-    float closestDepth = texture(texSamplers[0], sampleCoord.xy).r;
+    float closestDepth = texture(shadowMap, sampleCoord.xy).r;
 
     if (projCoord.z >= 0.0 && projCoord.z <= 1.0) {
 
@@ -141,18 +146,20 @@ void main() {
     float gamma = 2.2;
     uint materialIndex = objectBuffer.objects[objectIndex].materialIndex;
 
-    vec4 texColor = texture(texSamplers[materialBuffer.materials[materialIndex].albedoTexture], fragTexCoord);
+    vec4 texColor = texture(textures[nonuniformEXT(materialBuffer.materials[materialIndex].albedoTexture)], fragTexCoord);
     vec3 albedo = pow(texColor.rgb, vec3(gamma));
 
-    vec4 emissiveColor = texture(texSamplers[materialBuffer.materials[materialIndex].emissiveTexture], fragTexCoord);
+    vec4 emissiveColor = texture(textures[nonuniformEXT(materialBuffer.materials[materialIndex].emissiveTexture)], fragTexCoord);
     vec3 emissive = pow(emissiveColor.rgb, vec3(gamma));
 
     // TODO: Do the matrix multiplication in the vertex shader
     // and then do all the lighting calculations in tangent space here
-    vec3 N = texture(texSamplers[materialBuffer.materials[materialIndex].normalTexture], fragTexCoord).rgb;
+    // NOTE: BC5 normal maps only keep x and y, so z is always rebuilt
+    vec2 NXY = texture(textures[nonuniformEXT(materialBuffer.materials[materialIndex].normalTexture)], fragTexCoord).rg * 2.0 - 1.0;
+    vec3 N = vec3(NXY, sqrt(max(1.0 - dot(NXY, NXY), 0.0)));
     N = normalize(TBNTest * N);
 
-    vec3 armColor  = texture(texSamplers[materialBuffer.materials[materialIndex].armTexture], fragTexCoord).rgb;
+    vec3 armColor  = texture(textures[nonuniformEXT(materialBuffer.materials[materialIndex].armTexture)], fragTexCoord).rgb;
 
     float ao = armColor.r;
     float roughness = armColor.g;
@@ -56,6 +56,9 @@ layout(location = 8) out vec3 viewPosTangentSpace;
 layout(location = 9) out vec3 fragPosTangentSpace;
 layout(location = 10) out mat3 TBNTest;
 
+// NOTE: Has to match depth.vert exactly for the depth prepass
+invariant gl_Position;
+
 void main() {
     fragTexCoord = inTexCoord;
 
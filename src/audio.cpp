@@ -2,31 +2,71 @@
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <cassert>
 #include <iostream>
+#include <string>
 
 #include "bs_types.hpp"
 
-AudioEngine::AudioEngine() {
-  _soloud.init();
-  load("../audio/b2.mp3", 84.5);
+AudioEngine::AudioEngine(bool headless, const char *audioDir)
+    : _tempoMap{},
+      _trackTime{0.},
+      _headless{headless},
+      _audioDir{audioDir},
+      _mixDebt{0.},
+      _mixBuffer{} {
+  if (_headless) {
+    _soloud.init(SoLoud::Soloud::CLIP_ROUNDOFF, SoLoud::Soloud::NULLDRIVER,
+                 HEADLESS_SAMPLE_RATE, HEADLESS_MIX_FRAMES, HEADLESS_CHANNELS);
+    // NOTE: The mixer must never get ahead of the decoder, or the same run
+    // could come out differently
+    _musicStream.setBlocking(true);
+  } else {
+    _soloud.init();
+  }
+
+  load((_audioDir + "b2.mp3").c_str(), 84.5, 3.00);
 
-  _downWav.load("../audio/down.wav");
-  _rightWav.load("../audio/right.wav");
-  _successWav.load("../audio/success.mp3");
+  unsigned int sampleRate = _soloud.getBackendSamplerate();
+  _sfxBank.load(Sfx::DOWN, (_audioDir + "down.wav").c_str(), sampleRate);
+  _sfxBank.load(Sfx::RIGHT, (_audioDir + "right.wav").c_str(), sampleRate);
+  _sfxBank.load(Sfx::SUCCESS, (_audioDir + "success.mp3").c_str(), sampleRate,
+                0.38);
 }
 
-AudioEngine::~AudioEngine() { _soloud.deinit(); }
+AudioEngine::~AudioEngine() {
+  _soloud.deinit();
 
-void AudioEngine::load(const char *filename, double bpm) {
-  _wavStream.load(filename);
-  _bpm = bpm;
-  _spb = (1. / (bpm / 60.)) / 4.;  // 16th beat
+  if (_musicStream.getUnderrunFrames() > 0) {
+    std::cout << "Music decoder fell behind by "
+              << _musicStream.getUnderrunFrames() << " samples" << std::endl;
+  }
+}
+
+void AudioEngine::load(const char *filename, double bpm,
+                       double startOffset) {
+  _musicStream.load(filename);
+
+  std::string tempoMapFile = std::string{filename} + ".tempo.json";
+  if (!_tempoMap.load(tempoMapFile.c_str())) {
+    _tempoMap.setConstant(bpm, startOffset);
+  }
 }
 
-void AudioEngine::play() { _wavHandle = _soloud.play(_wavStream); }
+void AudioEngine::play() { _wavHandle = _soloud.play(_musicStream); }
+
+void AudioEngine::seek(int32_t bar, uint32_t beatRel) {
+  _soloud.seek(_wavHandle,
+               _tempoMap.timeAt(_tempoMap.beatAtBar(bar) + beatRel));
+}
+
+void AudioEngine::setLatencyOffsets(const LatencyOffsets &latencyOffsets) {
+  _latencyOffsets = latencyOffsets;
+}
 
 void AudioEngine::playBackground() {
-  _wavHandle = _soloud.playBackground(_wavStream);
+  _wavHandle = _soloud.playBackground(_musicStream);
 }
 
 void AudioEngine::stopBackground() { _soloud.stop(_wavHandle); }
@@ -39,38 +79,92 @@ void AudioEngine::processEvents(const FrameEvents &frameEvents) {
       case EventType::GAME_START:
         playBackground();
         break;
+      case EventType::MUSIC_SEEK:
+        cancelScheduledSfx();
+        seek(frameEvents.events[i].bar,
+             frameEvents.events[i].beatRel);
+        break;
       case EventType::GAME_END:
       case EventType::PLAYER_DEATH:
+        cancelScheduledSfx();
         stopBackground();
         break;
 
-      case EventType::RHYTHM_DOWN:
-        _soloud.play(_downWav);
+      case EventType::SFX_SCHEDULE:
+        scheduleSfx(frameEvents.events[i].sfx,
+                    frameEvents.events[i].musicBeat);
         break;
-      case EventType::RHYTHM_RIGHT:
-        _soloud.play(_rightWav);
+      case EventType::CALIBRATION_TICK:
+        _sfxBank.play(_soloud, Sfx::DOWN);
         break;
       case EventType::PLAYER_PERFECT:
-      case EventType::PLAYER_OK: {
-        int h = _soloud.play(_successWav, 1, 0, 1);  // start paused
-        _soloud.seek(h, 0.38f);                      // seek
-        _soloud.setPause(h, 0);                      // unpause
+      case EventType::PLAYER_OK:
+        _sfxBank.play(_soloud, Sfx::SUCCESS);
         break;
-      }
       default:
         break;
     }
   }
 }
 
+void AudioEngine::scheduleSfx(Sfx sfx, double musicBeat) {
+  // NOTE: Anything else would index past the end of the bank
+  if (static_cast<size_t>(sfx) >= N_SFX) {
+    std::cerr << "Can't schedule unknown sfx " << static_cast<int>(sfx)
+              << std::endl;
+    return;
+  }
+
+  // NOTE: The music's stream position is where the next mix starts, and so
+  // is the delay. Both count in the same samples, which keeps the sound
+  // locked to the music no matter when in the frame we got here. Read it
+  // again rather than using _trackTime, the mixer may have moved on since
+  // the update.
+  double streamPosition = _soloud.getStreamPosition(_wavHandle);
+  double delay = std::max(_tempoMap.timeAt(musicBeat) - streamPosition, 0.);
+
+  _sfxBank.schedule(
+      _soloud, sfx,
+      static_cast<unsigned int>(delay * _soloud.getBackendSamplerate()));
+}
+
+void AudioEngine::cancelScheduledSfx() { _sfxBank.stopScheduled(_soloud); }
+
+void AudioEngine::advance(double seconds) {
+  assert(_headless);
+  _mixDebt += seconds * HEADLESS_SAMPLE_RATE;
+
+  while (_mixDebt >= 1.) {
+    unsigned int nFrames = static_cast<unsigned int>(
+        std::min<double>(_mixDebt, HEADLESS_MIX_FRAMES));
+    _soloud.mix(_mixBuffer, nFrames);
+    _mixDebt -= nFrames;
+  }
+}
+
 MusicPos AudioEngine::update(float deltaTime) {
+  if (_headless) {
+    advance(deltaTime);
+  }
+
   // Calculate current music pos, if playing
-  _currentTime = _soloud.getStreamTime(_wavHandle) - 3.00;
+  // NOTE: Stream time ignores seeks, stream position follows them
+  _trackTime = _soloud.getStreamPosition(_wavHandle);
 
-  _musicPos.beat = _currentTime / _spb;
-  _musicPos.period = _musicPos.beat / 64;
-  _musicPos.barRel = (_musicPos.beat / 64) % 4;
-  _musicPos.beatRel = _musicPos.beat % 16;
+  // Only the fractional position is moved back by the latency, the
+  // whole beats have to stay with the mixer
+  double heardTime = _trackTime - _latencyOffsets.audioMs / 1000.;
+  _musicPos = _tempoMap.musicPosAt(_trackTime);
+  _musicPos.time = heardTime - _tempoMap.getStartTime();
+  _musicPos.beatFrac = _tempoMap.beatAt(heardTime);
 
   return _musicPos;
 }
+
+MusicPos AudioEngine::getVisualMusicPos() const {
+  // The player hears the music audioMs late, and sees the frame visualMs
+  // late. Draw whatever they'll be hearing by the time they see it.
+  return _tempoMap.musicPosAt(
+      _trackTime +
+      (_latencyOffsets.visualMs - _latencyOffsets.audioMs) / 1000.);
+}
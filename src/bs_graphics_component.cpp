@@ -1,5 +1,7 @@
 #include "bs_graphics_component.hpp"
 
+#include "glm/ext/matrix_transform.hpp"
+
 namespace bs {
 // TODO: We only really need to update the transform matrix IF
 // the entity has moved.
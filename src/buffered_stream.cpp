@@ -0,0 +1,201 @@
+#include "buffered_stream.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+BufferedStreamInstance::BufferedStreamInstance(BufferedStream *parent)
+    : _parent{parent},
+      _nChannels{parent->mChannels},
+      _ringFrames{static_cast<size_t>(parent->mBaseSamplerate * RING_SECONDS)},
+      _writePos{0},
+      _readPos{0},
+      _seekRequest{0},
+      _seekDone{0},
+      _seekTarget{0.},
+      _seekWritePos{0},
+      _seekApplied{0},
+      _decoderEnded{false},
+      _quit{false} {
+  _ring.resize(_ringFrames * _nChannels);
+  _decoder = std::thread{&BufferedStreamInstance::decodeLoop, this};
+}
+
+BufferedStreamInstance::~BufferedStreamInstance() {
+  _quit = true;
+  _decoder.join();
+}
+
+void BufferedStreamInstance::decodeLoop() {
+  SoLoud::WavStream &wavStream = _parent->_wavStream;
+  SoLoud::AudioSourceInstance *source = wavStream.createInstance();
+  source->init(wavStream, 0);
+
+  std::vector<float> decoded(DECODE_FRAMES * _nChannels);
+  uint32_t seekHandled{0};
+
+  while (!_quit) {
+    uint32_t seekRequest = _seekRequest.load(std::memory_order_acquire);
+    if (seekRequest != seekHandled) {
+      // Decodes its way up to the target, which is exactly what we don't
+      // want on the mixer thread
+      source->seek(_seekTarget.load(std::memory_order_relaxed),
+                   decoded.data(), DECODE_FRAMES);
+      _decoderEnded.store(false, std::memory_order_relaxed);
+
+      // Everything written from here on is after the seek
+      _seekWritePos.store(_writePos.load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+      _seekDone.store(seekRequest, std::memory_order_release);
+      seekHandled = seekRequest;
+    }
+
+    uint64_t writePos = _writePos.load(std::memory_order_relaxed);
+    uint64_t free =
+        _ringFrames - (writePos - _readPos.load(std::memory_order_acquire));
+
+    if (source->hasEnded()) {
+      _decoderEnded.store(true, std::memory_order_release);
+    }
+    if (free == 0 || _decoderEnded.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_MS));
+      continue;
+    }
+
+    // NOTE: Comes out one channel after the other, the ring is interleaved
+    unsigned int nFrames = source->getAudio(
+        decoded.data(),
+        static_cast<unsigned int>(std::min<uint64_t>(free, DECODE_FRAMES)),
+        DECODE_FRAMES);
+    for (unsigned int i{}; i < nFrames; i++) {
+      size_t frame = (writePos + i) % _ringFrames;
+      for (unsigned int c{}; c < _nChannels; c++) {
+        _ring[frame * _nChannels + c] = decoded[c * DECODE_FRAMES + i];
+      }
+    }
+    _writePos.store(writePos + nFrames, std::memory_order_release);
+
+    // NOTE: Nothing mixes this instance, so its position has to be kept
+    // up by hand for seeking to know where it's starting from
+    source->mStreamPosition += nFrames / source->mSamplerate;
+  }
+
+  delete source;
+}
+
+unsigned int BufferedStreamInstance::getAudio(float *aBuffer,
+                                              unsigned int aSamplesToRead,
+                                              unsigned int aBufferSize) {
+  unsigned int nFrames{};
+
+  if (_parent->_blocking.load(std::memory_order_relaxed)) {
+    waitForDecoder(aSamplesToRead);
+  }
+
+  // Wait for the decoder to catch up with a seek, then drop everything it
+  // had buffered from before it
+  uint32_t seekRequest = _seekRequest.load(std::memory_order_relaxed);
+  bool seeking = _seekApplied != seekRequest;
+  if (seeking && _seekDone.load(std::memory_order_acquire) == seekRequest) {
+    _readPos.store(_seekWritePos.load(std::memory_order_relaxed),
+                   std::memory_order_release);
+    _seekApplied = seekRequest;
+    seeking = false;
+  }
+
+  if (!seeking) {
+    uint64_t readPos = _readPos.load(std::memory_order_relaxed);
+    uint64_t available =
+        _writePos.load(std::memory_order_acquire) - readPos;
+    nFrames = static_cast<unsigned int>(
+        std::min<uint64_t>(aSamplesToRead, available));
+
+    for (unsigned int i{}; i < nFrames; i++) {
+      size_t frame = (readPos + i) % _ringFrames;
+      for (unsigned int c{}; c < _nChannels; c++) {
+        aBuffer[c * aBufferSize + i] = _ring[frame * _nChannels + c];
+      }
+    }
+    _readPos.store(readPos + nFrames, std::memory_order_release);
+  }
+
+  for (unsigned int c{}; c < _nChannels; c++) {
+    std::memset(aBuffer + c * aBufferSize + nFrames, 0,
+                sizeof(float) * (aSamplesToRead - nFrames));
+  }
+
+  // The mixer has already moved the stream position on by the whole
+  // buffer. Take back what we had to fill with silence, so the position
+  // stays on the music and the beats don't drift from it.
+  unsigned int nMissing = aSamplesToRead - nFrames;
+  if (nMissing > 0 && !_decoderEnded.load(std::memory_order_acquire)) {
+    mStreamPosition -= nMissing / mSamplerate;
+    _parent->_underrunFrames.fetch_add(nMissing, std::memory_order_relaxed);
+  }
+
+  return aSamplesToRead;
+}
+
+void BufferedStreamInstance::waitForDecoder(unsigned int nFrames) {
+  uint32_t seekRequest = _seekRequest.load(std::memory_order_relaxed);
+  while (!_quit) {
+    bool seekDone = _seekDone.load(std::memory_order_acquire) == seekRequest;
+    uint64_t readPos = seekDone && _seekApplied != seekRequest
+                           ? _seekWritePos.load(std::memory_order_relaxed)
+                           : _readPos.load(std::memory_order_relaxed);
+
+    if (seekDone &&
+        (_writePos.load(std::memory_order_acquire) - readPos >= nFrames ||
+         _decoderEnded.load(std::memory_order_acquire))) {
+      return;
+    }
+    std::this_thread::yield();
+  }
+}
+
+bool BufferedStreamInstance::hasEnded() {
+  return _seekApplied == _seekRequest.load(std::memory_order_relaxed) &&
+         _decoderEnded.load(std::memory_order_acquire) &&
+         _readPos.load(std::memory_order_relaxed) ==
+             _writePos.load(std::memory_order_acquire);
+}
+
+SoLoud::result BufferedStreamInstance::seek(SoLoud::time aSeconds,
+                                            float *mScratch,
+                                            unsigned int mScratchSize) {
+  // NOTE: Called with the mixer locked, so this never races getAudio
+  _seekTarget.store(aSeconds, std::memory_order_relaxed);
+  _seekRequest.fetch_add(1, std::memory_order_release);
+  mStreamPosition = aSeconds;
+
+  return SoLoud::SO_NO_ERROR;
+}
+
+BufferedStream::BufferedStream() : _underrunFrames{0}, _blocking{false} {}
+
+BufferedStream::~BufferedStream() { stop(); }
+
+SoLoud::result BufferedStream::load(const char *filename) {
+  stop();
+
+  SoLoud::result result = _wavStream.load(filename);
+  if (result != SoLoud::SO_NO_ERROR) {
+    std::cerr << "Couldn't load " << filename << std::endl;
+    return result;
+  }
+
+  mChannels = _wavStream.mChannels;
+  mBaseSamplerate = _wavStream.mBaseSamplerate;
+  return SoLoud::SO_NO_ERROR;
+}
+
+SoLoud::AudioSourceInstance *BufferedStream::createInstance() {
+  return new BufferedStreamInstance(this);
+}
+
+uint64_t BufferedStream::getUnderrunFrames() const {
+  return _underrunFrames.load(std::memory_order_relaxed);
+}
+
+void BufferedStream::setBlocking(bool blocking) { _blocking = blocking; }
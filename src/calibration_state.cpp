@@ -0,0 +1,109 @@
+#include "calibration_state.hpp"
+
+#include <cmath>
+#include <iostream>
+
+#include "bs_types.hpp"
+#include "game_state.hpp"
+#include "game_state_manager.hpp"
+
+CalibrationState::CalibrationState(GameStateManager &gameStateManager,
+                                   LatencyOffsets &latencyOffsets)
+    : GameState{gameStateManager},
+      _latencyOffsets{latencyOffsets},
+      _phase{Phase::AUDIO},
+      _time{0.},
+      _lastTick{0.},
+      _nextTick{0.},
+      _nTicks{0},
+      _taps{} {};
+
+void CalibrationState::onEnter() { startPhase(Phase::AUDIO); };
+
+void CalibrationState::onExit(){};
+
+void CalibrationState::startPhase(Phase phase) {
+  _phase = phase;
+  _time = 0.;
+  _lastTick = 0.;
+  _nextTick = TICK_INTERVAL;
+  _nTicks = 0;
+  _taps.reset();
+
+  if (_phase == Phase::AUDIO) {
+    std::cout << "Calibrating audio. Tap along with the clicks" << std::endl;
+  } else {
+    std::cout << "Calibrating visuals. Tap along with the flashes"
+              << std::endl;
+  }
+}
+
+void CalibrationState::finishPhase(FrameEvents &frameEvents) {
+  double &offset = _phase == Phase::AUDIO ? _latencyOffsets.audioMs
+                                          : _latencyOffsets.visualMs;
+
+  if (_taps.getCount(Judgement::OK) == 0) {
+    std::cout << "No taps, keeping " << offset << "ms" << std::endl;
+  } else {
+    offset = _taps.getMeanMs();
+    std::cout << "Offset " << offset << "ms, " << _taps.getStdDevMs()
+              << "ms stddev" << std::endl;
+  }
+
+  if (_phase == Phase::AUDIO) {
+    startPhase(Phase::VISUAL);
+    return;
+  }
+
+  saveLatencyOffsets(LATENCY_OFFSETS_FILE, _latencyOffsets);
+  frameEvents.addEvent(FrameEvent{.type = EventType::LATENCY_CHANGED});
+  _gameStateManager.setState(START_STATE);
+}
+
+void CalibrationState::update(float dt, const MusicPos &mp,
+                              const GamepadState &gamepadState,
+                              FrameEvents &frameEvents) {
+  _time += dt;
+
+  // NOTE: Uses the frame clock rather than the music, nothing is playing
+  if (_time >= _nextTick) {
+    if (_nTicks == LEAD_IN_TICKS + PHASE_TICKS) {
+      finishPhase(frameEvents);
+      return;
+    }
+
+    frameEvents.addEvent(
+        FrameEvent{.type = _phase == Phase::AUDIO ? EventType::CALIBRATION_TICK
+                                                  : EventType::CALIBRATION_PULSE});
+    // When the tick actually went out, up to a frame after it was due
+    _lastTick = _time;
+    _nextTick += TICK_INTERVAL;
+    _nTicks++;
+  }
+
+  // Give the player a few ticks to find the beat
+  if (_nTicks <= LEAD_IN_TICKS) {
+    return;
+  }
+
+  for (size_t i{}; i < gamepadState.size(); i++) {
+    if (gamepadState[i]) {
+      // Against whichever tick is closest, early or late
+      double sinceLast = _time - _lastTick;
+      double untilNext = _time - _nextTick;
+      double errorMs =
+          (std::abs(sinceLast) < std::abs(untilNext) ? sinceLast : untilNext) *
+          1000.;
+
+      // Too far from any tick to tell which one it was meant for
+      if (std::abs(errorMs) < TICK_INTERVAL * 1000. / 2.) {
+        _taps.addHit(errorMs, Judgement::OK);
+      }
+      break;
+    }
+  }
+};
+
+void CalibrationState::rUpdate(const MusicPos &mp,
+                               const GamepadState &gamepadState,
+                               FrameEvents &frameEvents){};
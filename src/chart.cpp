@@ -0,0 +1,490 @@
+#include "chart.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "bs_types.hpp"
+#include "dstack.hpp"
+#include "file_utils.hpp"
+#include "json.hpp"
+
+// NOTE: Assumes the events of a bar are sorted by beat, which the rhythmic
+// state already relies on when walking them
+void ChartTimeline::build(const RhythmBar *rhythmBars, size_t nRhythmBars,
+                          DStack &allocator) {
+  _nBars = nRhythmBars;
+  _nEvents = 0;
+  for (size_t i{}; i < nRhythmBars; i++) {
+    _nEvents += rhythmBars[i].nEvents;
+  }
+
+  _beats = allocator.alloc<uint32_t, StackDirection::Bottom>(sizeof(uint32_t) *
+                                                             _nEvents);
+  _barOffsets = allocator.alloc<uint32_t, StackDirection::Bottom>(
+      sizeof(uint32_t) * (_nBars + 1));
+
+  uint32_t offset{};
+  for (size_t i{}; i < nRhythmBars; i++) {
+    _barOffsets[i] = offset;
+    for (size_t e{}; e < rhythmBars[i].nEvents; e++) {
+      _beats[offset] = i * RHYTHM_BAR_BEATS + rhythmBars[i].rhythmEvents[e].beat;
+      offset++;
+    }
+  }
+  _barOffsets[_nBars] = offset;
+}
+
+size_t ChartTimeline::eventOffset(uint32_t beat) const {
+  return std::lower_bound(_beats, _beats + _nEvents, beat) - _beats;
+}
+
+bool seekBarLine(uint32_t beat, size_t nRhythmBars, int16_t lastBarEvents,
+                 ChartCursor &cursor) {
+  uint32_t bar = beat / RHYTHM_BAR_BEATS;
+  uint32_t beatRel = beat % BAR_BEATS;
+  bool talking = (beat % RHYTHM_BAR_BEATS) < BAR_BEATS;
+
+  if (nRhythmBars == 0) {
+    cursor = ChartCursor{.barIndex = -1, .eventIndex = 0, .talking = false};
+    return true;
+  }
+
+  // Past the end. Park after the last event of the last listening bar so
+  // that the next bar line ends the game
+  if (bar >= nRhythmBars) {
+    cursor = ChartCursor{.barIndex = static_cast<int16_t>(nRhythmBars - 1),
+                         .eventIndex = lastBarEvents,
+                         .talking = false};
+    return true;
+  }
+
+  // The rhythmic update flips between talking and listening on the first
+  // beat of a bar. When landing right on a bar line we stop one step short
+  // and let it do the flip.
+  if (beatRel == 0) {
+    if (talking) {
+      cursor = ChartCursor{.barIndex = static_cast<int16_t>(bar - 1),
+                           .eventIndex = 0,
+                           .talking = false};
+    } else {
+      cursor = ChartCursor{.barIndex = static_cast<int16_t>(bar),
+                           .eventIndex = 0,
+                           .talking = true};
+    }
+    return true;
+  }
+
+  return false;
+}
+
+ChartCursor ChartTimeline::seek(uint32_t beat) const {
+  ChartCursor cursor{};
+  int16_t lastBarEvents =
+      _nBars > 0 ? static_cast<int16_t>(_barOffsets[_nBars] -
+                                        _barOffsets[_nBars - 1])
+                 : 0;
+  if (seekBarLine(beat, _nBars, lastBarEvents, cursor)) {
+    return cursor;
+  }
+
+  uint32_t bar = beat / RHYTHM_BAR_BEATS;
+  uint32_t beatRel = beat % BAR_BEATS;
+  bool talking = (beat % RHYTHM_BAR_BEATS) < BAR_BEATS;
+
+  // Both the cues and the judgement walk the same events, so the cursor is
+  // the first event of this bar that hasn't been reached yet. The lower
+  // bound can't run past this bar since the next one starts a full rhythm
+  // bar later.
+  size_t offset = eventOffset(bar * RHYTHM_BAR_BEATS + beatRel);
+
+  return ChartCursor{
+      .barIndex = static_cast<int16_t>(bar),
+      .eventIndex = static_cast<int16_t>(offset - _barOffsets[bar]),
+      .talking = talking};
+}
+
+// Every bar an array of events, every event a beat inside the bar and a
+// button. Checked up front so reading them after can't throw.
+static bool checkEvents(const nlohmann::json &events, const char *filename) {
+  auto isUnsigned = [](const nlohmann::json &event, const char *key) {
+    auto value = event.find(key);
+    return value != event.end() && value->is_number_unsigned();
+  };
+
+  for (size_t i{}; i < events.size(); i++) {
+    if (!events[i].is_array()) {
+      std::cerr << "Bar " << i << " of " << filename << " isn't an array"
+                << std::endl;
+      return false;
+    }
+
+    for (const auto &r : events[i]) {
+      if (!r.is_object() || !isUnsigned(r, "beat") ||
+          !isUnsigned(r, "gamepadButton")) {
+        std::cerr << "Bad event in bar " << i << " of " << filename
+                  << std::endl;
+        return false;
+      }
+
+      size_t gamepadButton = r["gamepadButton"].get<size_t>();
+      if (r["beat"].get<uint64_t>() >= BAR_BEATS ||
+          (gamepadButton >= GamepadState{}.size() &&
+           gamepadButton != GAMEPAD_NONE)) {
+        std::cerr << "Event out of range in bar " << i << " of " << filename
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool loadChart(const char *filename, DStack &allocator, Chart &chart) {
+  // Read json file
+  using json = nlohmann::json;
+  std::ifstream i(filename);
+  if (!i) {
+    std::cerr << "Couldn't open chart " << filename << std::endl;
+    return false;
+  }
+
+  // NOTE: Don't throw on bad json, charts get reloaded while they're
+  // still being edited
+  json j = json::parse(i, nullptr, false);
+  if (!j.is_object() || !j["events"].is_array()) {
+    std::cerr << "Couldn't parse chart " << filename << std::endl;
+    return false;
+  }
+  if (!checkEvents(j["events"], filename)) {
+    return false;
+  }
+
+  // Count how many rhythm bars and events we need to allocate
+  chart.nRhythmBars = j["events"].size();
+
+  // Allocate enough room for our rhythm bars
+  chart.rhythmBars = allocator.alloc<RhythmBar, StackDirection::Bottom>(
+      sizeof(RhythmBar) * chart.nRhythmBars);
+  if (!chart.rhythmBars) {
+    std::cerr << "Out of memory loading chart " << filename << std::endl;
+    return false;
+  }
+
+  // ALlocate enough room for our rhythm events per bar
+  for (size_t i{}; i < chart.nRhythmBars; i++) {
+    chart.rhythmBars[i].rhythmEvents =
+        allocator.alloc<RhythmEvent, StackDirection::Bottom>(
+            sizeof(RhythmEvent) * j["events"][i].size());
+    chart.rhythmBars[i].nEvents = j["events"][i].size();
+    if (!chart.rhythmBars[i].rhythmEvents && chart.rhythmBars[i].nEvents) {
+      std::cerr << "Out of memory loading chart " << filename << std::endl;
+      return false;
+    }
+  }
+
+  // Set the correct values
+  size_t barIndex{};
+  for (const auto &e : j["events"]) {
+    size_t eventIndex{};
+    for (const auto &r : e) {
+      RhythmEvent re{.beat = r["beat"].get<uint32_t>(),
+                     .gamepadButton = r["gamepadButton"].get<size_t>()};
+      chart.rhythmBars[barIndex].rhythmEvents[eventIndex] = re;
+      eventIndex++;
+    }
+    barIndex++;
+  }
+
+  chart.timeline.build(chart.rhythmBars, chart.nRhythmBars, allocator);
+
+  return true;
+}
+
+bool convertChart(const char *jsonFilename, const char *binaryFilename) {
+  using json = nlohmann::json;
+  std::ifstream i(jsonFilename);
+  if (!i) {
+    std::cerr << "Couldn't open chart " << jsonFilename << std::endl;
+    return false;
+  }
+
+  json j = json::parse(i, nullptr, false);
+  if (!j.is_object() || !j["events"].is_array()) {
+    std::cerr << "Couldn't parse chart " << jsonFilename << std::endl;
+    return false;
+  }
+  if (!checkEvents(j["events"], jsonFilename)) {
+    return false;
+  }
+
+  BinaryChartHeader header{};
+  memcpy(header.magic, BINARY_CHART_MAGIC, sizeof(header.magic));
+  header.version = BINARY_CHART_VERSION;
+  header.nRhythmBars = static_cast<uint32_t>(j["events"].size());
+
+  std::vector<BinaryChartBar> bars(header.nRhythmBars);
+  size_t barIndex{};
+  for (const auto &e : j["events"]) {
+    if (e.size() > MAX_BAR_EVENTS) {
+      std::cerr << "Too many events in one bar of " << jsonFilename
+                << std::endl;
+      return false;
+    }
+
+    BinaryChartBar &bar = bars[barIndex];
+    bar.nEvents = static_cast<uint32_t>(e.size());
+
+    size_t eventIndex{};
+    for (const auto &r : e) {
+      bar.events[eventIndex] = BinaryChartEvent{
+          .beat = r["beat"].get<uint32_t>(),
+          .gamepadButton = r["gamepadButton"].get<uint32_t>()};
+      eventIndex++;
+    }
+    barIndex++;
+  }
+
+  // NOTE: A chart cut short would be newer than the json, and never
+  // converted again
+  return writeFileAtomic(binaryFilename, &header, sizeof(header), bars.data(),
+                         sizeof(BinaryChartBar) * bars.size());
+}
+
+/******  STREAMING  ******/
+
+ChartStream::ChartStream()
+    : _nRhythmBars{0},
+      _quit{false},
+      _windowStart{0},
+      _slotBars{},
+      _pinnedBar{-1},
+      _bars{},
+      _events{nullptr} {}
+
+ChartStream::~ChartStream() { close(); }
+
+bool ChartStream::open(const char *filename, DStack &allocator) {
+  reserve(allocator);
+  return reopen(filename);
+}
+
+void ChartStream::reserve(DStack &allocator) {
+  // The window is the only thing we ever allocate, so this is all the
+  // memory a chart will take no matter how long it is
+  if (!_events) {
+    _events = allocator.alloc<RhythmEvent, StackDirection::Bottom>(
+        sizeof(RhythmEvent) * WINDOW_BARS * MAX_BAR_EVENTS);
+  }
+}
+
+bool ChartStream::reopen(const char *filename) {
+  assert(_events);
+  close();
+
+  _file.open(filename, std::ios::binary);
+  if (!_file) {
+    std::cerr << "Couldn't open chart " << filename << std::endl;
+    return false;
+  }
+
+  BinaryChartHeader header{};
+  _file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!_file ||
+      memcmp(header.magic, BINARY_CHART_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != BINARY_CHART_VERSION) {
+    std::cerr << "Not a binary chart " << filename << std::endl;
+    _file.close();
+    return false;
+  }
+
+  // NOTE: The loader reads bars without checking, so one that's cut short
+  // would just play as empty bars
+  _file.seekg(0, std::ios::end);
+  uint64_t size = static_cast<uint64_t>(_file.tellg());
+  if (size != sizeof(header) + static_cast<uint64_t>(header.nRhythmBars) *
+                                   sizeof(BinaryChartBar)) {
+    std::cerr << "Binary chart " << filename << " is cut short" << std::endl;
+    _file.close();
+    return false;
+  }
+
+  _nRhythmBars = header.nRhythmBars;
+
+  for (size_t i{}; i < WINDOW_BARS; i++) {
+    _slotBars[i] = -1;
+    _bars[i] = RhythmBar{.nEvents = 0,
+                         .rhythmEvents = &_events[i * MAX_BAR_EVENTS]};
+  }
+
+  _windowStart = 0;
+  _pinnedBar = -1;
+  _quit = false;
+  _loader = std::thread{&ChartStream::loaderLoop, this};
+
+  return true;
+}
+
+void ChartStream::close() {
+  if (_loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _quit = true;
+    }
+    _wakeLoader.notify_one();
+    _loader.join();
+  }
+
+  if (_file.is_open()) {
+    _file.close();
+  }
+}
+
+bool ChartStream::isOpen() const { return _file.is_open(); }
+
+size_t ChartStream::getBarCount() const { return _nRhythmBars; }
+
+const RhythmBar &ChartStream::getBar(size_t barIndex) {
+  assert(barIndex < _nRhythmBars);
+  size_t slot = barIndex % WINDOW_BARS;
+
+  std::unique_lock<std::mutex> lock{_mutex};
+
+  // Jumped out of the window, e.g. a seek. Move it here.
+  if (barIndex < _windowStart || barIndex >= _windowStart + WINDOW_BARS) {
+    _windowStart = barIndex;
+    _wakeLoader.notify_one();
+  }
+
+  // The caller holds on to this one until it asks for another, so the
+  // loader can't refill its slot even once the window has moved past it
+  if (_pinnedBar != static_cast<int64_t>(barIndex)) {
+    _pinnedBar = static_cast<int64_t>(barIndex);
+    _wakeLoader.notify_one();
+  }
+
+  // NOTE: This should only ever wait right after a seek. If it happens
+  // during play the loader has fallen behind
+  _barLoaded.wait(lock, [this, barIndex, slot] {
+    return _slotBars[slot] == static_cast<int64_t>(barIndex);
+  });
+
+  return _bars[slot];
+}
+
+void ChartStream::advance(size_t barIndex) {
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    _windowStart = barIndex;
+  }
+  _wakeLoader.notify_one();
+}
+
+void ChartStream::prefetch(size_t barIndex) {
+  advance(barIndex);
+
+  std::unique_lock<std::mutex> lock{_mutex};
+  size_t windowEnd = std::min(barIndex + WINDOW_BARS, _nRhythmBars);
+  _barLoaded.wait(lock, [this, barIndex, windowEnd] {
+    // Someone else moved the window, there's nothing left to wait for
+    if (_windowStart != barIndex) return true;
+
+    for (size_t b = barIndex; b < windowEnd; b++) {
+      if (_slotBars[b % WINDOW_BARS] != static_cast<int64_t>(b)) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+ChartCursor ChartStream::seek(uint32_t beat) {
+  // NOTE: The last bar might not be resident, and parking anywhere past
+  // its events does the same
+  ChartCursor cursor{};
+  if (seekBarLine(beat, _nRhythmBars, INT16_MAX, cursor)) {
+    if (cursor.barIndex >= 0) {
+      advance(cursor.barIndex);
+    }
+    return cursor;
+  }
+
+  uint32_t bar = beat / RHYTHM_BAR_BEATS;
+  uint32_t beatRel = beat % BAR_BEATS;
+  bool talking = (beat % RHYTHM_BAR_BEATS) < BAR_BEATS;
+
+  advance(bar);
+  const RhythmBar &rhythmBar = getBar(bar);
+
+  // Only the one bar is resident, but it never holds more than a handful
+  // of events
+  const RhythmEvent *event = std::lower_bound(
+      rhythmBar.rhythmEvents, rhythmBar.rhythmEvents + rhythmBar.nEvents,
+      beatRel, [](const RhythmEvent &e, uint32_t b) { return e.beat < b; });
+
+  return ChartCursor{
+      .barIndex = static_cast<int16_t>(bar),
+      .eventIndex = static_cast<int16_t>(event - rhythmBar.rhythmEvents),
+      .talking = talking};
+}
+
+void ChartStream::loaderLoop() {
+  std::unique_lock<std::mutex> lock{_mutex};
+
+  while (!_quit) {
+    // Find the first bar of the window that isn't resident yet, and whose
+    // slot isn't still held by the pinned bar
+    int64_t bar = -1;
+    size_t windowEnd = std::min(_windowStart + WINDOW_BARS, _nRhythmBars);
+    for (size_t b = _windowStart; b < windowEnd; b++) {
+      int64_t slotBar = _slotBars[b % WINDOW_BARS];
+      if (slotBar != static_cast<int64_t>(b) &&
+          (slotBar < 0 || slotBar != _pinnedBar)) {
+        bar = static_cast<int64_t>(b);
+        break;
+      }
+    }
+
+    if (bar < 0) {
+      _wakeLoader.wait(lock);
+      continue;
+    }
+
+    // Whatever was in this slot has been passed, release it
+    size_t slot = bar % WINDOW_BARS;
+    _slotBars[slot] = -1;
+
+    // Don't hold the lock while we're waiting on the disk
+    lock.unlock();
+
+    BinaryChartBar record{};
+    _file.clear();
+    _file.seekg(sizeof(BinaryChartHeader) + bar * sizeof(BinaryChartBar));
+    _file.read(reinterpret_cast<char *>(&record), sizeof(record));
+
+    lock.lock();
+
+    // The window might have moved on while we were reading
+    if (bar < static_cast<int64_t>(_windowStart) ||
+        bar >= static_cast<int64_t>(_windowStart + WINDOW_BARS)) {
+      continue;
+    }
+
+    RhythmBar &rhythmBar = _bars[slot];
+    rhythmBar.nEvents = std::min<size_t>(record.nEvents, MAX_BAR_EVENTS);
+    for (size_t e{}; e < rhythmBar.nEvents; e++) {
+      rhythmBar.rhythmEvents[e] =
+          RhythmEvent{.beat = record.events[e].beat,
+                      .gamepadButton = record.events[e].gamepadButton};
+    }
+
+    _slotBars[slot] = bar;
+    _barLoaded.notify_all();
+  }
+}
@@ -0,0 +1,103 @@
+#include "chart_watcher.hpp"
+
+#include <chrono>
+#include <iostream>
+
+#ifdef __linux__
+  #include <poll.h>
+  #include <sys/inotify.h>
+  #include <unistd.h>
+#endif
+
+ChartWatcher::ChartWatcher() : _quit{false} {}
+
+ChartWatcher::~ChartWatcher() { stop(); }
+
+void ChartWatcher::start(const char *filename, std::function<void()> onChange) {
+  stop();
+
+  _path = filename;
+  _onChange = std::move(onChange);
+  _quit = false;
+  _watcher = std::thread{&ChartWatcher::watchLoop, this};
+}
+
+void ChartWatcher::stop() {
+  if (_watcher.joinable()) {
+    _quit = true;
+    _watcher.join();
+  }
+}
+
+#ifdef __linux__
+
+void ChartWatcher::watchLoop() {
+  int fd = inotify_init1(IN_NONBLOCK);
+  if (fd < 0) {
+    std::cerr << "Couldn't init inotify, not watching " << _path << std::endl;
+    return;
+  }
+
+  // NOTE: Watch the directory rather than the file. Most editors save by
+  // writing a new file and renaming it over the old one.
+  std::filesystem::path dir = _path.parent_path();
+  if (dir.empty()) {
+    dir = ".";
+  }
+  std::string name = _path.filename().string();
+
+  int wd = inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd < 0) {
+    std::cerr << "Couldn't watch " << dir << std::endl;
+    close(fd);
+    return;
+  }
+
+  alignas(inotify_event) char buffer[4096];
+  pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+
+  while (!_quit) {
+    // Time out now and then to check if we should quit
+    if (poll(&pfd, 1, POLL_MS) <= 0) {
+      continue;
+    }
+
+    bool changed{false};
+    ssize_t len;
+    while ((len = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char *p = buffer; p < buffer + len;) {
+        auto event = reinterpret_cast<inotify_event *>(p);
+        if (event->len && name == event->name) {
+          changed = true;
+        }
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+
+    if (changed) {
+      _onChange();
+    }
+  }
+
+  inotify_rm_watch(fd, wd);
+  close(fd);
+}
+
+#else
+
+void ChartWatcher::watchLoop() {
+  std::error_code ec;
+  auto lastWrite = std::filesystem::last_write_time(_path, ec);
+
+  while (!_quit) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(POLL_MS));
+
+    auto writeTime = std::filesystem::last_write_time(_path, ec);
+    if (!ec && writeTime != lastWrite) {
+      lastWrite = writeTime;
+      _onChange();
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,45 @@
+#include "file_utils.hpp"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+bool writeFileAtomic(const std::string &filename, const void *header,
+                     size_t headerSize, const void *payload,
+                     size_t payloadSize) {
+  std::error_code ec;
+  std::filesystem::path parent = std::filesystem::path(filename).parent_path();
+  if (!parent.empty()) {
+    std::filesystem::create_directories(parent, ec);
+  }
+
+  std::string tempFilename = filename + ".tmp";
+  std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+  if (!file.is_open()) {
+    std::cerr << "Couldn't write " << filename << std::endl;
+    return false;
+  }
+
+  file.write(static_cast<const char *>(header), headerSize);
+  file.write(static_cast<const char *>(payload), payloadSize);
+  file.close();
+
+  if (!file) {
+    std::cerr << "Couldn't write " << filename << std::endl;
+    std::remove(tempFilename.c_str());
+    return false;
+  }
+
+  // NOTE: Replaces the old one in a single step, on Windows too, where
+  // std::rename won't overwrite
+  std::filesystem::rename(tempFilename, filename, ec);
+  if (ec) {
+    std::cerr << "Couldn't write " << filename << ": " << ec.message()
+              << std::endl;
+    std::remove(tempFilename.c_str());
+    return false;
+  }
+
+  return true;
+}
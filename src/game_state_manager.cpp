@@ -1,31 +1,50 @@
 #include "game_state_manager.hpp"
 
+#include <cassert>
 #include <iostream>
 
 #include "bs_types.hpp"
+#include "calibration_state.hpp"
 #include "end_state.hpp"
 #include "rhythmic_state.hpp"
 #include "start_state.hpp"
 
-GameStateManager::GameStateManager(DStack &allocator)
+GameStateManager::GameStateManager(DStack &allocator,
+                                   LatencyOffsets &latencyOffsets,
+                                   const char *dataDir, bool hotReload)
     : _gameStateIndex{0}, _gameStates{} {
   // Alloc room for all our game states
-  _gameStates[0] = allocator.alloc<StartState, StackDirection::Bottom>();
-  _gameStates[1] = allocator.alloc<RhythmicState, StackDirection::Bottom>();
-  _gameStates[2] = allocator.alloc<EndState, StackDirection::Bottom>();
+  _gameStates[START_STATE] =
+      allocator.alloc<StartState, StackDirection::Bottom>();
+  _gameStates[RHYTHMIC_STATE] =
+      allocator.alloc<RhythmicState, StackDirection::Bottom>();
+  _gameStates[END_STATE] = allocator.alloc<EndState, StackDirection::Bottom>();
+  _gameStates[CALIBRATION_STATE] =
+      allocator.alloc<CalibrationState, StackDirection::Bottom>();
   //
   // Init the game states
-  new (_gameStates[0]) StartState{*this};
-  new (_gameStates[1]) RhythmicState{1, *this, allocator};
-  new (_gameStates[2]) EndState{*this};
+  new (_gameStates[START_STATE]) StartState{*this};
+  new (_gameStates[RHYTHMIC_STATE])
+      RhythmicState{1, *this, allocator, dataDir, hotReload};
+  new (_gameStates[END_STATE]) EndState{*this};
+  new (_gameStates[CALIBRATION_STATE])
+      CalibrationState{*this, latencyOffsets};
 
   _gameStates[_gameStateIndex]->onEnter();
 }
 
-GameStateManager::~GameStateManager() {}
+GameStateManager::~GameStateManager() {
+  // NOTE: The states live in the stack allocator, so nothing else runs
+  // their destructors. The rhythmic state has a loader thread to join.
+  for (auto gameState : _gameStates) {
+    if (gameState) {
+      gameState->~GameState();
+    }
+  }
+}
 
 void GameStateManager::nextState() noexcept {
-  if (_gameStateIndex + 1 < _gameStates.size()) {
+  if (_gameStateIndex < END_STATE) {
     _gameStates[_gameStateIndex]->onExit();
     _gameStateIndex++;
     _gameStates[_gameStateIndex]->onEnter();
@@ -51,6 +70,22 @@ void GameStateManager::restartGame() noexcept {
   _gameStates[_gameStateIndex]->onEnter();
 }
 
+void GameStateManager::setState(size_t gameStateIndex) noexcept {
+  assert(_gameStates[gameStateIndex]);
+  _gameStates[_gameStateIndex]->onExit();
+  _gameStateIndex = gameStateIndex;
+  _gameStates[_gameStateIndex]->onEnter();
+}
+
+size_t GameStateManager::getStateIndex() const noexcept {
+  return _gameStateIndex;
+}
+
+void GameStateManager::setPracticeLoop(int32_t startBar, int32_t endBar) {
+  static_cast<RhythmicState *>(_gameStates[RHYTHMIC_STATE])
+      ->setLoop(startBar, 0, endBar, 0);
+}
+
 void GameStateManager::update(float dt, const MusicPos &mp,
                               const GamepadState &gamepadState,
                               FrameEvents &frameEvents) {
@@ -0,0 +1,159 @@
+#include "input_log.hpp"
+
+#include <cstring>
+#include <iostream>
+
+static constexpr uint8_t FRAME_PRESSED = 1 << 0;
+static constexpr uint8_t FRAME_MUSIC_BEAT = 1 << 1;
+static constexpr uint8_t FRAME_VISUAL_BEAT = 1 << 2;
+
+// Nothing ever plays at this tempo, so the first frame always writes its beat
+static constexpr MusicPos NO_MUSIC_POS{.spb = -1.};
+
+template <typename T>
+static void writeValue(std::ofstream &o, T value) {
+  o.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T>
+static T readValue(std::ifstream &i) {
+  T value{};
+  i.read(reinterpret_cast<char *>(&value), sizeof(value));
+  return value;
+}
+
+static bool beatChanged(const MusicPos &a, const MusicPos &b) {
+  return a.beat != b.beat || a.bar != b.bar || a.beatRel != b.beatRel ||
+         a.barBeats != b.barBeats || a.spb != b.spb;
+}
+
+static void writeMusicPos(std::ofstream &o, const MusicPos &musicPos,
+                          bool withBeat) {
+  writeValue(o, musicPos.time);
+  writeValue(o, musicPos.beatFrac);
+
+  if (withBeat) {
+    writeValue(o, musicPos.beat);
+    writeValue(o, musicPos.bar);
+    writeValue(o, static_cast<uint8_t>(musicPos.beatRel));
+    writeValue(o, static_cast<uint8_t>(musicPos.barBeats));
+    writeValue(o, musicPos.spb);
+  }
+}
+
+static void readMusicPos(std::ifstream &i, MusicPos &musicPos,
+                         bool withBeat) {
+  musicPos.time = readValue<double>(i);
+  musicPos.beatFrac = readValue<double>(i);
+
+  if (withBeat) {
+    musicPos.beat = readValue<uint32_t>(i);
+    musicPos.bar = readValue<int32_t>(i);
+    musicPos.beatRel = readValue<uint8_t>(i);
+    musicPos.barBeats = readValue<uint8_t>(i);
+    musicPos.spb = readValue<double>(i);
+    // Derived from the bar, same as the audio engine does
+    musicPos.period = static_cast<uint32_t>(musicPos.bar) / 4;
+    musicPos.barRel = static_cast<uint32_t>(musicPos.bar) % 4;
+  }
+}
+
+InputRecorder::InputRecorder()
+    : _last{.musicPos = NO_MUSIC_POS, .visualMusicPos = NO_MUSIC_POS} {}
+
+bool InputRecorder::open(const char *filename) {
+  _file.open(filename, std::ios::binary | std::ios::trunc);
+  if (!_file) {
+    std::cerr << "Couldn't write input log " << filename << std::endl;
+    return false;
+  }
+
+  InputLogHeader header{.version = INPUT_LOG_VERSION};
+  memcpy(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic));
+  writeValue(_file, header);
+
+  _last.musicPos = NO_MUSIC_POS;
+  _last.visualMusicPos = NO_MUSIC_POS;
+  return _file.good();
+}
+
+void InputRecorder::close() { _file.close(); }
+
+bool InputRecorder::isOpen() const { return _file.is_open(); }
+
+void InputRecorder::record(const InputFrame &frame) {
+  uint8_t pressed{};
+  for (size_t i{}; i < frame.gamepadState.size(); i++) {
+    if (frame.gamepadState[i]) {
+      pressed |= 1 << i;
+    }
+  }
+
+  bool musicBeat = beatChanged(frame.musicPos, _last.musicPos);
+  bool visualBeat = beatChanged(frame.visualMusicPos, _last.visualMusicPos);
+
+  uint8_t flags = (pressed ? FRAME_PRESSED : 0) |
+                  (musicBeat ? FRAME_MUSIC_BEAT : 0) |
+                  (visualBeat ? FRAME_VISUAL_BEAT : 0);
+
+  writeValue(_file, flags);
+  writeValue(_file, frame.deltaTime);
+  if (pressed) {
+    writeValue(_file, pressed);
+  }
+  writeMusicPos(_file, frame.musicPos, musicBeat);
+  writeMusicPos(_file, frame.visualMusicPos, visualBeat);
+
+  _last = frame;
+}
+
+InputPlayer::InputPlayer()
+    : _last{.musicPos = NO_MUSIC_POS, .visualMusicPos = NO_MUSIC_POS} {}
+
+bool InputPlayer::open(const char *filename) {
+  _file.open(filename, std::ios::binary);
+  if (!_file) {
+    std::cerr << "Couldn't open input log " << filename << std::endl;
+    return false;
+  }
+
+  InputLogHeader header = readValue<InputLogHeader>(_file);
+  if (!_file ||
+      memcmp(header.magic, INPUT_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != INPUT_LOG_VERSION) {
+    std::cerr << "Not an input log " << filename << std::endl;
+    _file.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool InputPlayer::isOpen() const { return _file.is_open(); }
+
+bool InputPlayer::next(InputFrame &frame) {
+  uint8_t flags = readValue<uint8_t>(_file);
+  if (!_file) {
+    return false;
+  }
+
+  // Whatever wasn't written carries over from the last frame
+  frame = _last;
+  frame.deltaTime = readValue<float>(_file);
+
+  uint8_t pressed = flags & FRAME_PRESSED ? readValue<uint8_t>(_file) : 0;
+  for (size_t i{}; i < frame.gamepadState.size(); i++) {
+    frame.gamepadState[i] = pressed & (1 << i);
+  }
+
+  readMusicPos(_file, frame.musicPos, flags & FRAME_MUSIC_BEAT);
+  readMusicPos(_file, frame.visualMusicPos, flags & FRAME_VISUAL_BEAT);
+
+  if (!_file) {
+    std::cerr << "Input log ends in the middle of a frame" << std::endl;
+    return false;
+  }
+
+  _last = frame;
+  return true;
+}
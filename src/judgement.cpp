@@ -0,0 +1,101 @@
+#include "judgement.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include "json.hpp"
+
+bool loadJudgementWindows(const char *filename, JudgementWindows &windows) {
+  using json = nlohmann::json;
+  std::ifstream i(filename);
+  if (!i) {
+    return false;
+  }
+
+  json j = json::parse(i, nullptr, false);
+  if (j.is_discarded() || !j.contains("judgement")) {
+    return false;
+  }
+
+  const json &w = j["judgement"];
+  windows.perfectMs = w.value("perfect", windows.perfectMs);
+  windows.okMs = w.value("ok", windows.okMs);
+  windows.badMs = w.value("bad", windows.badMs);
+
+  return true;
+}
+
+Judgement judge(double errorMs, const JudgementWindows &windows) {
+  double absError = std::abs(errorMs);
+
+  if (absError <= windows.perfectMs) {
+    return Judgement::PERFECT;
+  } else if (absError <= windows.okMs) {
+    return Judgement::OK;
+  } else if (absError <= windows.badMs) {
+    return Judgement::BAD;
+  }
+
+  return Judgement::MISS;
+}
+
+bool getBarStartBeat(const MusicPos &mp, int32_t bar, double &startBeat) {
+  // NOTE: Beats wrap around in the lead in, so the bar start has to go
+  // back through a signed int
+  double currentStartBeat = static_cast<int32_t>(mp.beat - mp.beatRel);
+
+  if (bar == mp.bar) {
+    startBeat = currentStartBeat;
+  } else if (bar == mp.bar + 1) {
+    startBeat = currentStartBeat + mp.barBeats;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+double getHitErrorMs(const MusicPos &mp, double eventBeat) {
+  return (mp.beatFrac - eventBeat) * mp.spb * 1000.;
+}
+
+HitStats::HitStats() { reset(); }
+
+void HitStats::reset() {
+  for (auto &count : _counts) {
+    count = 0;
+  }
+  _nHits = 0;
+  _mean = 0.;
+  _m2 = 0.;
+}
+
+void HitStats::addHit(double errorMs, Judgement judgement) {
+  _counts[static_cast<size_t>(judgement)]++;
+
+  _nHits++;
+  double delta = errorMs - _mean;
+  _mean += delta / _nHits;
+  _m2 += delta * (errorMs - _mean);
+}
+
+void HitStats::addMiss() { _counts[static_cast<size_t>(Judgement::MISS)]++; }
+
+size_t HitStats::getCount(Judgement judgement) const {
+  return _counts[static_cast<size_t>(judgement)];
+}
+
+double HitStats::getMeanMs() const { return _mean; }
+
+double HitStats::getStdDevMs() const {
+  return _nHits > 1 ? std::sqrt(_m2 / (_nHits - 1)) : 0.;
+}
+
+void HitStats::print() const {
+  std::cout << "perfect: " << getCount(Judgement::PERFECT)
+            << " ok: " << getCount(Judgement::OK)
+            << " bad: " << getCount(Judgement::BAD)
+            << " miss: " << getCount(Judgement::MISS) << std::endl;
+  std::cout << "hit error: " << getMeanMs() << "ms mean, " << getStdDevMs()
+            << "ms stddev" << std::endl;
+}
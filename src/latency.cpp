@@ -0,0 +1,41 @@
+#include "latency.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#include "json.hpp"
+
+LatencyOffsets loadLatencyOffsets(const char *filename) {
+  using json = nlohmann::json;
+  LatencyOffsets offsets{};
+
+  std::ifstream i(filename);
+  if (!i) {
+    return offsets;
+  }
+
+  json j = json::parse(i, nullptr, false);
+  if (j.is_discarded()) {
+    std::cerr << "Couldn't parse " << filename << std::endl;
+    return offsets;
+  }
+
+  offsets.audioMs = j.value("audioMs", offsets.audioMs);
+  offsets.visualMs = j.value("visualMs", offsets.visualMs);
+
+  return offsets;
+}
+
+bool saveLatencyOffsets(const char *filename, const LatencyOffsets &offsets) {
+  using json = nlohmann::json;
+  std::ofstream o(filename);
+  if (!o) {
+    std::cerr << "Couldn't write " << filename << std::endl;
+    return false;
+  }
+
+  json j = {{"audioMs", offsets.audioMs}, {"visualMs", offsets.visualMs}};
+  o << j.dump(4) << std::endl;
+
+  return o.good();
+}
@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <string>
@@ -20,32 +22,61 @@
 static float lastMouseX = 400, lastMouseY = 300;
 static Camera camera{glm::vec3{0.0f, 0.0f, 3.5f}};
 
-Bolster::Bolster()
-    : _windowTitle{"Bolster"},
+Bolster::Bolster(const BolsterOptions& options)
+    : _window{nullptr},
+      _windowTitle{"Bolster"},
       _windowWidth{1200},
       _windowHeight{900},
+      _headless{options.headless},
+      _failed{false},
       _allocator{1000000 * 100},  // 100mb
       _deltaTime{0.0f},
       _lastFrameTime{0.0f},
-      _gameStateManager{_allocator},
-      _entityManager{_allocator} {
-  initGlfw();
+      // NOTE: Headless runs have to come out the same on every machine, so
+      // they ignore the local calibration
+      _latencyOffsets{_headless ? LatencyOffsets{}
+                                : loadLatencyOffsets(LATENCY_OFFSETS_FILE)},
+      // NOTE: Nor can a chart change under them halfway through
+      _gameStateManager{_allocator, _latencyOffsets, DATA_DIR, !_headless},
+      _entityManager{_allocator},
+      _audioEngine{_headless} {
+  _audioEngine.setLatencyOffsets(_latencyOffsets);
+  if (options.loop) {
+    _gameStateManager.setPracticeLoop(options.loopStartBar,
+                                      options.loopEndBar);
+  }
 
-  _renderer.init(_window, _allocator);
-  //
+  if (!_headless) {
+    initGlfw();
+    _renderer.init(_window, _allocator);
+  }
 
   initScene();
 
+  if (options.recordFile) {
+    _inputRecorder.open(options.recordFile);
+  }
+  if (options.replayFile && !_inputPlayer.open(options.replayFile)) {
+    _failed = true;
+    return;
+  }
+
   // TODO: Some kind of resource manager and stuff
-  _renderer.setupDrawables(_entityManager._graphicsComponents,
-                           _entityManager._nGraphicsComponents);
+  if (!_headless) {
+    _renderer.setupDrawables(_entityManager._graphicsComponents,
+                             _entityManager._nGraphicsComponents);
+  }
 }
 
 Bolster::~Bolster() {
-  glfwDestroyWindow(_window);
-  glfwTerminate();
+  if (_window) {
+    glfwDestroyWindow(_window);
+    glfwTerminate();
+  }
 }
 
+bool Bolster::failed() const { return _failed; }
+
 void Bolster::initScene() {
   auto sf = _entityManager.createEntity();
   _entityManager.addComponent(
@@ -149,6 +180,16 @@ GamepadState Bolster::processInput(GLFWwindow* window) {
     _gamepadState[GAMEPAD_Y] = false;
   }
 
+  if (gamepadState.buttons[GLFW_GAMEPAD_BUTTON_DPAD_UP] ||
+      glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS) {
+    if (!_gamepadState[GAMEPAD_UP]) {
+      newState[GAMEPAD_UP] = true;
+      _gamepadState[GAMEPAD_UP] = true;
+    }
+  } else {
+    _gamepadState[GAMEPAD_UP] = false;
+  }
+
   newState[GAMEPAD_DOWN] =
       (gamepadState.buttons[GLFW_GAMEPAD_BUTTON_DPAD_DOWN] &&
        !_gamepadState[GAMEPAD_DOWN]);
@@ -162,28 +203,72 @@ GamepadState Bolster::processInput(GLFWwindow* window) {
   return newState;
 }
 
-void Bolster::run() {
-  // bs::DialogueComponent dialogueComponent{};
+bool Bolster::nextFrame(InputFrame& frame, double& currentTime) {
+  if (_inputPlayer.isOpen()) {
+    // Everything comes from the log, the audio engine is left alone
+    if (!_inputPlayer.next(frame)) {
+      return false;
+    }
+    currentTime = _lastFrameTime + frame.deltaTime;
+  } else if (_headless) {
+    if (_gameStateManager.getStateIndex() == END_STATE) {
+      return false;
+    }
 
-  MusicPos lastMusicPos{999, 999, 999, 999};
+    // Virtual clock, every frame is exactly as long as the last
+    frame.deltaTime = HEADLESS_DELTA_TIME;
+    currentTime = _lastFrameTime + HEADLESS_DELTA_TIME;
 
-  while (!glfwWindowShouldClose(_window)) {
+    frame.musicPos = _audioEngine.update(frame.deltaTime);
+    frame.visualMusicPos = _audioEngine.getVisualMusicPos();
+
+    // Nobody to press start
+    frame.gamepadState = GamepadState{};
+    frame.gamepadState[GAMEPAD_A] =
+        _gameStateManager.getStateIndex() == START_STATE;
+  } else {
+    if (glfwWindowShouldClose(_window)) {
+      return false;
+    }
     glfwPollEvents();
 
-    auto currentTime = glfwGetTime();
-    _deltaTime = currentTime - _lastFrameTime;
-    _lastFrameTime = currentTime;
+    currentTime = glfwGetTime();
+    frame.deltaTime = currentTime - _lastFrameTime;
+
+    frame.musicPos = _audioEngine.update(frame.deltaTime);
+    // Visual cues are drawn against where the music will be when the frame
+    // is actually on screen
+    frame.visualMusicPos = _audioEngine.getVisualMusicPos();
+    frame.gamepadState = processInput(_window);
+  }
+
+  _deltaTime = frame.deltaTime;
+  _lastFrameTime = currentTime;
+
+  if (_inputRecorder.isOpen()) {
+    _inputRecorder.record(frame);
+  }
 
-    // NOTE: There is a problem where we use the audio engine's music pos
-    // to generate events in the game state's. But sometimes, those events
-    // should trigger audio things to happen.
-    //
-    // So, we need to separate thos two things, and first get the music pos,
-    // then after the game state update, we do a processEvents type call to
-    // the audio engine
-    MusicPos musicPos = _audioEngine.update(_deltaTime);
+  return true;
+}
 
-    GamepadState gamepadState = processInput(_window);
+void Bolster::run() {
+  // bs::DialogueComponent dialogueComponent{};
+
+  MusicPos lastMusicPos{999, 999, 999, 999};
+
+  // NOTE: There is a problem where we use the audio engine's music pos
+  // to generate events in the game state's. But sometimes, those events
+  // should trigger audio things to happen.
+  //
+  // So, we need to separate thos two things, and first get the music pos,
+  // then after the game state update, we do a processEvents type call to
+  // the audio engine
+  InputFrame frame{};
+  double currentTime{};
+  while (nextFrame(frame, currentTime)) {
+    const MusicPos& musicPos = frame.musicPos;
+    const GamepadState& gamepadState = frame.gamepadState;
 
     FrameEvents frameEvents{
         .events = _allocator.alloc<FrameEvent, StackDirection::Top>(
@@ -198,7 +283,7 @@ void Bolster::run() {
       lastMusicPos = musicPos;
     }
 
-    _entityManager.update(_deltaTime, musicPos, frameEvents);
+    _entityManager.update(_deltaTime, frame.visualMusicPos, frameEvents);
 
     _audioEngine.processEvents(frameEvents);
 
@@ -256,18 +341,26 @@ void Bolster::run() {
     camera.update(_deltaTime);
 
     // Render
-    _renderer.draw(_entityManager._graphicsComponents,
-                   _entityManager._nGraphicsComponents, camera, currentTime,
-                   _deltaTime);
+    if (!_headless) {
+      _renderer.draw(_entityManager._graphicsComponents,
+                     _entityManager._nGraphicsComponents, camera, currentTime,
+                     _deltaTime);
+    }
 
     // Delete stuff that needs to be deleted
     for (size_t i{}; i < frameEvents.nEvents; i++) {
       auto& event = frameEvents.events[i];
-      if (event.type == EventType::DESTROY) {
+      if (event.type == EventType::CALIBRATION_PULSE && !_headless) {
+        _renderer.pulseAmbient();
+      } else if (event.type == EventType::LATENCY_CHANGED) {
+        _audioEngine.setLatencyOffsets(_latencyOffsets);
+      } else if (event.type == EventType::DESTROY) {
         // std::cout << "DESTRYOUUIUIUO" << std::endl;
         _entityManager.deleteEntity(event.entityHandle);
-        _renderer.setupDrawables(_entityManager._graphicsComponents,
-                                 _entityManager._nGraphicsComponents);
+        if (!_headless) {
+          _renderer.setupDrawables(_entityManager._graphicsComponents,
+                                   _entityManager._nGraphicsComponents);
+        }
       }
     }
 
@@ -275,8 +368,38 @@ void Bolster::run() {
   }
 }
 
-int main() {
-  Bolster bolster{};
+int main(int argc, char** argv) {
+  BolsterOptions options{};
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0) {
+      options.headless = true;
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      options.recordFile = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      // NOTE: Replays don't need the window or the sound, just the log
+      options.replayFile = argv[++i];
+      options.headless = true;
+    } else if (strcmp(argv[i], "--loop") == 0 && i + 2 < argc) {
+      options.loop = true;
+      options.loopStartBar =
+          static_cast<int32_t>(strtol(argv[++i], nullptr, 10));
+      options.loopEndBar =
+          static_cast<int32_t>(strtol(argv[++i], nullptr, 10));
+      if (options.loopStartBar >= options.loopEndBar) {
+        std::cerr << "--loop needs a start bar before the end bar"
+                  << std::endl;
+        return 1;
+      }
+    } else {
+      std::cerr << "Unknown option " << argv[i] << std::endl;
+      return 1;
+    }
+  }
+
+  Bolster bolster{options};
+  if (bolster.failed()) {
+    return 1;
+  }
   bolster.run();
 
   return 0;
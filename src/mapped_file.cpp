@@ -0,0 +1,113 @@
+#include "mapped_file.hpp"
+
+#ifdef _WIN32
+  #define NOMINMAX
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+MappedFile::MappedFile()
+    : _data{nullptr}, _size{}, _file{nullptr}, _mapping{nullptr} {}
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return false;
+  }
+  _file = file;
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    close();
+    return false;
+  }
+  _size = static_cast<size_t>(size.QuadPart);
+
+  _mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (!_mapping) {
+    close();
+    return false;
+  }
+
+  _data = MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (!_data) {
+    close();
+    return false;
+  }
+
+  return true;
+}
+
+void MappedFile::close() {
+  if (_data) UnmapViewOfFile(_data);
+  if (_mapping) CloseHandle(_mapping);
+  if (_file) CloseHandle(_file);
+
+  _data = nullptr;
+  _size = 0;
+  _mapping = nullptr;
+  _file = nullptr;
+}
+
+#else
+
+MappedFile::MappedFile() : _data{nullptr}, _size{} {}
+
+bool MappedFile::open(const std::string &filename) {
+  close();
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+
+  // NOTE: The mapping keeps the file open, so the descriptor isn't needed
+  void *data =
+      mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE,
+           fd, 0);
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  // It's read front to back, once
+  madvise(data, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+
+  _data = data;
+  _size = static_cast<size_t>(st.st_size);
+  return true;
+}
+
+void MappedFile::close() {
+  if (_data) {
+    munmap(const_cast<void *>(_data), _size);
+  }
+
+  _data = nullptr;
+  _size = 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+const void *MappedFile::getData() const { return _data; }
+
+size_t MappedFile::getSize() const { return _size; }
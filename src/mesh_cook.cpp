@@ -0,0 +1,529 @@
+#include "mesh_cook.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+#include "file_utils.hpp"
+#include "glm/ext/matrix_transform.hpp"
+#include "glm/gtc/quaternion.hpp"
+#include "glm/gtc/type_ptr.hpp"
+#include "json.hpp"
+#include "mesh_optimize.hpp"
+
+uint64_t getModelKey(const std::string &gltf, const std::string &directory) {
+  using json = nlohmann::json;
+
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ull;
+  auto add = [&hash](const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i{}; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  };
+
+  add(gltf.data(), gltf.size());
+
+  // NOTE: Buffers in files count by their size and modification time.
+  // Reading all of them to find out nothing changed would cost as much as
+  // not having the cache. Embedded ones are part of the text already.
+  json j = json::parse(gltf, nullptr, false);
+  auto buffers = j.find("buffers");
+  if (buffers != j.end() && buffers->is_array()) {
+    for (const json &buffer : *buffers) {
+      auto uri = buffer.find("uri");
+      if (uri == buffer.end() || !uri->is_string() ||
+          uri->get<std::string>().rfind("data:", 0) == 0) {
+        continue;
+      }
+
+      std::error_code ec;
+      std::filesystem::path path =
+          std::filesystem::path(directory) / uri->get<std::string>();
+      uint64_t size = std::filesystem::file_size(path, ec);
+      auto time = std::filesystem::last_write_time(path, ec);
+      int64_t ticks = static_cast<int64_t>(time.time_since_epoch().count());
+      add(&size, sizeof(size));
+      add(&ticks, sizeof(ticks));
+    }
+  }
+
+  add(&COOKED_MODEL_VERSION, sizeof(COOKED_MODEL_VERSION));
+
+  return hash;
+}
+
+bool stripModelGeometry(const std::string &gltf, std::string &stripped) {
+  using json = nlohmann::json;
+
+  json j = json::parse(gltf, nullptr, false);
+  if (!j.is_object()) {
+    return false;
+  }
+
+  // NOTE: Images stored in a buffer need the buffers
+  auto images = j.find("images");
+  if (images != j.end() && images->is_array()) {
+    for (const json &image : *images) {
+      if (image.contains("bufferView")) {
+        return false;
+      }
+    }
+  }
+
+  for (const char *section :
+       {"buffers", "bufferViews", "accessors", "meshes", "nodes", "scene",
+        "scenes", "skins", "animations"}) {
+    j.erase(section);
+  }
+
+  stripped = j.dump();
+  return true;
+}
+
+std::string getCookedModelPath(const std::string &directory, uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.model",
+           static_cast<unsigned long long>(key));
+  return directory + "cooked/" + name;
+}
+
+/******  COOK  ******/
+
+// The local node matrix
+// It's either made up from translation, rotation, scale or a 4x4 matrix
+static glm::mat4 getNodeMatrix(const tinygltf::Node &node) {
+  glm::mat4 matrix{1.0f};
+
+  if (node.translation.size() == 3) {
+    matrix = glm::translate(matrix,
+                            glm::vec3(glm::make_vec3(node.translation.data())));
+  }
+  if (node.rotation.size() == 4) {
+    glm::quat q = glm::make_quat(node.rotation.data());
+    matrix *= glm::mat4(q);
+  }
+  if (node.scale.size() == 3) {
+    matrix = glm::scale(matrix, glm::vec3(glm::make_vec3(node.scale.data())));
+  }
+  if (node.matrix.size() == 16) {
+    matrix = glm::make_mat4x4(node.matrix.data());
+  }
+
+  return matrix;
+}
+
+// Vertices and indices are read via accessors and buffer views
+struct Stream {
+  const uint8_t *data;  // nullptr if the primitive doesn't have it
+  size_t stride;
+  size_t count;
+};
+
+static Stream getStream(const tinygltf::Model &model, int accessorIndex) {
+  const tinygltf::Accessor &accessor = model.accessors[accessorIndex];
+  const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+  const tinygltf::Buffer &buffer = model.buffers[view.buffer];
+
+  return Stream{&buffer.data[accessor.byteOffset + view.byteOffset],
+                static_cast<size_t>(accessor.ByteStride(view)),
+                accessor.count};
+}
+
+static Stream getAttribute(const tinygltf::Model &model,
+                           const tinygltf::Primitive &primitive,
+                           const char *name) {
+  auto attribute = primitive.attributes.find(name);
+  if (attribute == primitive.attributes.end()) {
+    return Stream{nullptr, 0, 0};
+  }
+  return getStream(model, attribute->second);
+}
+
+static const float *getElement(const Stream &stream, size_t i) {
+  return reinterpret_cast<const float *>(stream.data + i * stream.stride);
+}
+
+// Welds identical vertices together, then puts the triangles in cache and
+// overdraw order and the vertices in the order they're drawn
+static void optimizeMesh(std::vector<Vertex> &vertices,
+                         std::vector<uint32_t> &indices, CookStats *stats) {
+  // NOTE: Left as it is if it isn't a triangle list we can make sense of
+  if (indices.size() % 3 != 0 ||
+      std::any_of(indices.begin(), indices.end(),
+                  [&](uint32_t i) { return i >= vertices.size(); })) {
+    return;
+  }
+
+  size_t nSourceVertices = vertices.size();
+
+  // Exporters split vertices along every seam, even where nothing differs
+  std::unordered_map<Vertex, uint32_t> unique{};
+  unique.reserve(vertices.size());
+  std::vector<Vertex> welded{};
+  std::vector<uint32_t> remap(vertices.size());
+  for (size_t v{}; v < vertices.size(); v++) {
+    auto [it, inserted] = unique.try_emplace(
+        vertices[v], static_cast<uint32_t>(welded.size()));
+    if (inserted) {
+      welded.push_back(vertices[v]);
+    }
+    remap[v] = it->second;
+  }
+  for (uint32_t &index : indices) {
+    index = remap[index];
+  }
+  vertices = std::move(welded);
+
+  size_t missesBefore =
+      getVertexCacheMisses(indices.data(), indices.size(), vertices.size());
+
+  std::vector<uint32_t> clusters{};
+  optimizeVertexCache(indices.data(), indices.size(), vertices.size(),
+                      clusters);
+
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t v{}; v < vertices.size(); v++) {
+    positions[v] = vertices[v]._position;
+  }
+  optimizeOverdraw(indices.data(), indices.size(), positions.data(),
+                   vertices.size(), clusters);
+
+  size_t nUsed = optimizeVertexFetch(indices.data(), indices.size(),
+                                     vertices.size(), remap);
+  std::vector<Vertex> ordered(nUsed);
+  for (size_t v{}; v < vertices.size(); v++) {
+    if (remap[v] != ~0u) {
+      ordered[remap[v]] = vertices[v];
+    }
+  }
+  vertices = std::move(ordered);
+
+  if (stats) {
+    stats->nSourceVertices += nSourceVertices;
+    stats->nVertices += vertices.size();
+    stats->nTriangles += indices.size() / 3;
+    stats->missesBefore += missesBefore;
+    stats->missesAfter +=
+        getVertexCacheMisses(indices.data(), indices.size(), vertices.size());
+  }
+}
+
+static void cookPrimitive(const tinygltf::Model &model,
+                          const tinygltf::Primitive &primitive,
+                          CookedModel &cooked, CookStats *stats) {
+  CookedMesh outputMesh{};
+  outputMesh.firstVertex = static_cast<uint32_t>(cooked.vertices.size());
+  outputMesh.firstIndex = static_cast<uint32_t>(cooked.indices.size());
+  outputMesh.materialIndex = primitive.material;
+
+  // Vertices
+  Stream positions = getAttribute(model, primitive, "POSITION");
+  Stream normals = getAttribute(model, primitive, "NORMAL");
+  Stream texCoords = getAttribute(model, primitive, "TEXCOORD_0");
+  Stream tangents = getAttribute(model, primitive, "TANGENT");
+
+  std::vector<Vertex> vertices{};
+  vertices.reserve(positions.count);
+
+  for (size_t i{}; i < positions.count; i++) {
+    Vertex vertex{};
+    vertex._position = glm::make_vec3(getElement(positions, i));
+    if (normals.data) {
+      vertex._normal = glm::normalize(glm::make_vec3(getElement(normals, i)));
+    }
+    if (texCoords.data) {
+      vertex._texCoord = glm::make_vec2(getElement(texCoords, i));
+    }
+    if (tangents.data) {
+      vertex._tangent = glm::make_vec4(getElement(tangents, i));
+    }
+
+    vertices.push_back(vertex);
+  }
+
+  // Indices
+  std::vector<uint32_t> indices{};
+  if (primitive.indices > -1) {
+    const tinygltf::Accessor &accessor = model.accessors[primitive.indices];
+    Stream stream = getStream(model, primitive.indices);
+    indices.reserve(stream.count);
+
+    for (size_t i{}; i < stream.count; i++) {
+      const uint8_t *index = stream.data + i * stream.stride;
+      switch (accessor.componentType) {
+        case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
+          uint32_t value;
+          memcpy(&value, index, sizeof(value));
+          indices.push_back(value);
+          break;
+        }
+        case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
+          uint16_t value;
+          memcpy(&value, index, sizeof(value));
+          indices.push_back(value);
+          break;
+        }
+        case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
+          indices.push_back(*index);
+          break;
+        }
+        default:
+          std::cerr << "Index component type " << accessor.componentType
+                    << " not supported!" << std::endl;
+          abort();
+      }
+    }
+  } else {
+    // NOTE: Not indexed, every three vertices are a triangle
+    for (uint32_t i{}; i < vertices.size(); i++) {
+      indices.push_back(i);
+    }
+  }
+
+  optimizeMesh(vertices, indices, stats);
+
+  outputMesh.nVertices = static_cast<uint32_t>(vertices.size());
+  outputMesh.nIndices = static_cast<uint32_t>(indices.size());
+
+  if (!vertices.empty()) {
+    // Used for calculating the bounding sphere
+    std::vector<glm::vec3> vertexPositions(vertices.size());
+    for (size_t v{}; v < vertices.size(); v++) {
+      vertexPositions[v] = vertices[v]._position;
+    }
+    computeBoundingSphere(outputMesh.boundingSphere, vertexPositions.data(),
+                          vertexPositions.size());
+  }
+
+  cooked.vertices.insert(cooked.vertices.end(), vertices.begin(),
+                         vertices.end());
+  cooked.indices.insert(cooked.indices.end(), indices.begin(), indices.end());
+  cooked.meshes.push_back(outputMesh);
+}
+
+static void cookNode(const tinygltf::Model &model, int nodeIndex,
+                     int32_t parent, CookedModel &cooked, CookStats *stats) {
+  const tinygltf::Node &node = model.nodes[nodeIndex];
+
+  CookedNode outputNode{};
+  outputNode.matrix = getNodeMatrix(node);
+  outputNode.parent = parent;
+  outputNode.firstMesh = static_cast<uint32_t>(cooked.meshes.size());
+
+  if (node.mesh > -1) {
+    for (const auto &primitive : model.meshes[node.mesh].primitives) {
+      cookPrimitive(model, primitive, cooked, stats);
+    }
+  }
+  outputNode.nMeshes =
+      static_cast<uint32_t>(cooked.meshes.size()) - outputNode.firstMesh;
+
+  int32_t index = static_cast<int32_t>(cooked.nodes.size());
+  cooked.nodes.push_back(outputNode);
+
+  for (int child : node.children) {
+    cookNode(model, child, index, cooked, stats);
+  }
+}
+
+void cookModel(const tinygltf::Model &model, CookedModel &cooked,
+               CookStats *stats) {
+  if (model.scenes.empty()) return;
+
+  const tinygltf::Scene &scene = model.scenes[0];
+  for (int node : scene.nodes) {
+    cookNode(model, node, -1, cooked, stats);
+  }
+}
+
+/******  FILE  ******/
+
+static uint64_t alignSection(uint64_t offset) {
+  return (offset + 15) & ~15ull;
+}
+
+std::vector<uint8_t> serializeCookedModel(uint64_t key,
+                                          const CookedModel &cooked) {
+  CookedModelHeader header{};
+  memcpy(header.magic, COOKED_MODEL_MAGIC, sizeof(header.magic));
+  header.version = COOKED_MODEL_VERSION;
+  header.key = key;
+  header.nNodes = static_cast<uint32_t>(cooked.nodes.size());
+  header.nMeshes = static_cast<uint32_t>(cooked.meshes.size());
+  header.nVertices = static_cast<uint32_t>(cooked.vertices.size());
+  header.nIndices = static_cast<uint32_t>(cooked.indices.size());
+
+  header.nodesOffset = alignSection(sizeof(header));
+  header.meshesOffset =
+      alignSection(header.nodesOffset + header.nNodes * sizeof(CookedNode));
+  header.verticesOffset =
+      alignSection(header.meshesOffset + header.nMeshes * sizeof(CookedMesh));
+  header.indicesOffset =
+      alignSection(header.verticesOffset + header.nVertices * sizeof(Vertex));
+  uint64_t size = header.indicesOffset + header.nIndices * sizeof(uint32_t);
+
+  std::vector<uint8_t> data(size);
+  auto copy = [&data](uint64_t offset, const void *section, size_t size) {
+    if (size > 0) memcpy(&data[offset], section, size);
+  };
+  copy(0, &header, sizeof(header));
+  copy(header.nodesOffset, cooked.nodes.data(),
+       cooked.nodes.size() * sizeof(CookedNode));
+  copy(header.meshesOffset, cooked.meshes.data(),
+       cooked.meshes.size() * sizeof(CookedMesh));
+  copy(header.verticesOffset, cooked.vertices.data(),
+       cooked.vertices.size() * sizeof(Vertex));
+  copy(header.indicesOffset, cooked.indices.data(),
+       cooked.indices.size() * sizeof(uint32_t));
+
+  return data;
+}
+
+bool writeCookedModel(const std::string &filename,
+                      const std::vector<uint8_t> &data) {
+  return writeFileAtomic(filename, nullptr, 0, data.data(), data.size());
+}
+
+bool viewCookedModel(const void *data, size_t size, uint64_t key,
+                     CookedModelView &view) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  if (!data || size < sizeof(CookedModelHeader)) {
+    return false;
+  }
+
+  const CookedModelHeader *header =
+      reinterpret_cast<const CookedModelHeader *>(bytes);
+  if (memcmp(header->magic, COOKED_MODEL_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != COOKED_MODEL_VERSION || header->key != key) {
+    return false;
+  }
+
+  // NOTE: A file that was cut short, or written by something else
+  auto fits = [size](uint64_t offset, uint64_t sectionSize) {
+    return offset % 16 == 0 && offset <= size && sectionSize <= size - offset;
+  };
+  if (!fits(header->nodesOffset, header->nNodes * sizeof(CookedNode)) ||
+      !fits(header->meshesOffset, header->nMeshes * sizeof(CookedMesh)) ||
+      !fits(header->verticesOffset, header->nVertices * sizeof(Vertex)) ||
+      !fits(header->indicesOffset, header->nIndices * sizeof(uint32_t))) {
+    std::cerr << "Cooked model is broken" << std::endl;
+    return false;
+  }
+
+  const CookedNode *nodes =
+      reinterpret_cast<const CookedNode *>(bytes + header->nodesOffset);
+  const CookedMesh *meshes =
+      reinterpret_cast<const CookedMesh *>(bytes + header->meshesOffset);
+
+  // NOTE: createModel follows these without looking, so they have to point
+  // inside the file. Parents come before their children.
+  auto within = [](uint32_t first, uint32_t count, uint32_t total) {
+    return first <= total && count <= total - first;
+  };
+  for (uint32_t i{}; i < header->nNodes; i++) {
+    const CookedNode &node = nodes[i];
+    if (node.parent < -1 || node.parent >= static_cast<int64_t>(i) ||
+        !within(node.firstMesh, node.nMeshes, header->nMeshes)) {
+      std::cerr << "Cooked model has a broken node " << i << std::endl;
+      return false;
+    }
+  }
+  for (uint32_t i{}; i < header->nMeshes; i++) {
+    const CookedMesh &mesh = meshes[i];
+    if (!within(mesh.firstVertex, mesh.nVertices, header->nVertices) ||
+        !within(mesh.firstIndex, mesh.nIndices, header->nIndices)) {
+      std::cerr << "Cooked model has a broken mesh " << i << std::endl;
+      return false;
+    }
+  }
+
+  view.header = header;
+  view.nodes = nodes;
+  view.meshes = meshes;
+  view.vertices =
+      reinterpret_cast<const Vertex *>(bytes + header->verticesOffset);
+  view.indices =
+      reinterpret_cast<const uint32_t *>(bytes + header->indicesOffset);
+  return true;
+}
+
+/******  BOUNDS  ******/
+
+// Jack Ritter. An Efficient Bounding Sphere. 1990
+void computeBoundingSphere(glm::vec4 &result, const glm::vec3 points[],
+                           size_t count) {
+  assert(count > 0);
+
+  // find extremum points along all 3 axes; for each axis we get a pair of
+  // points with min/max coordinates
+  size_t pmin[3] = {0, 0, 0};
+  size_t pmax[3] = {0, 0, 0};
+
+  for (size_t i = 0; i < count; ++i) {
+    glm::vec3 p = points[i];
+
+    for (int axis = 0; axis < 3; ++axis) {
+      pmin[axis] = (p[axis] < points[pmin[axis]][axis]) ? i : pmin[axis];
+      pmax[axis] = (p[axis] > points[pmax[axis]][axis]) ? i : pmax[axis];
+    }
+  }
+
+  // find the pair of points with largest distance
+  float paxisd2 = 0;
+  int paxis = 0;
+
+  for (int axis = 0; axis < 3; ++axis) {
+    glm::vec3 p1 = points[pmin[axis]];
+    glm::vec3 p2 = points[pmax[axis]];
+
+    float d2 = (p2[0] - p1[0]) * (p2[0] - p1[0]) +
+               (p2[1] - p1[1]) * (p2[1] - p1[1]) +
+               (p2[2] - p1[2]) * (p2[2] - p1[2]);
+
+    if (d2 > paxisd2) {
+      paxisd2 = d2;
+      paxis = axis;
+    }
+  }
+
+  // use the longest segment as the initial sphere diameter
+  glm::vec3 p1 = points[pmin[paxis]];
+  glm::vec3 p2 = points[pmax[paxis]];
+
+  float center[3] = {(p1[0] + p2[0]) / 2, (p1[1] + p2[1]) / 2,
+                     (p1[2] + p2[2]) / 2};
+  float radius = sqrtf(paxisd2) / 2;
+
+  // iteratively adjust the sphere up until all points fit
+  for (size_t i = 0; i < count; ++i) {
+    glm::vec3 p = points[i];
+    float d2 = (p[0] - center[0]) * (p[0] - center[0]) +
+               (p[1] - center[1]) * (p[1] - center[1]) +
+               (p[2] - center[2]) * (p[2] - center[2]);
+
+    if (d2 > radius * radius) {
+      float d = sqrtf(d2);
+      assert(d > 0);
+
+      float k = 0.5f + (radius / d) / 2;
+
+      center[0] = center[0] * k + p[0] * (1 - k);
+      center[1] = center[1] * k + p[1] * (1 - k);
+      center[2] = center[2] * k + p[2] * (1 - k);
+      radius = (radius + d) / 2;
+    }
+  }
+
+  result[0] = center[0];
+  result[1] = center[1];
+  result[2] = center[2];
+  result[3] = radius;
+}
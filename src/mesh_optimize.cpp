@@ -0,0 +1,285 @@
+#include "mesh_optimize.hpp"
+
+#include <algorithm>
+
+#include "glm/geometric.hpp"
+
+// Triangles using each vertex, all in one array. The ones using vertex v
+// are triangles[offsets[v]] up to triangles[offsets[v + 1]].
+struct Adjacency {
+  std::vector<uint32_t> offsets;
+  std::vector<uint32_t> triangles;
+};
+
+static void buildAdjacency(const uint32_t *indices, size_t nIndices,
+                           size_t nVertices, Adjacency &adjacency) {
+  adjacency.offsets.assign(nVertices + 1, 0);
+  for (size_t i{}; i < nIndices; i++) {
+    adjacency.offsets[indices[i] + 1]++;
+  }
+  for (size_t v{}; v < nVertices; v++) {
+    adjacency.offsets[v + 1] += adjacency.offsets[v];
+  }
+
+  std::vector<uint32_t> next(adjacency.offsets.begin(),
+                             adjacency.offsets.end() - 1);
+  adjacency.triangles.resize(nIndices);
+  for (size_t i{}; i < nIndices; i++) {
+    adjacency.triangles[next[indices[i]]++] = static_cast<uint32_t>(i / 3);
+  }
+}
+
+/******  CACHE  ******/
+
+// NOTE: A FIFO cache as timestamps. A vertex is in it if it went in less
+// than cacheSize misses ago. Starting the clock at cacheSize + 1 makes
+// every vertex miss the first time, and moving it on that far empties it.
+static bool touchVertex(uint32_t vertex, std::vector<uint32_t> &cacheTime,
+                        uint32_t &time, uint32_t cacheSize) {
+  if (time - cacheTime[vertex] > cacheSize) {
+    cacheTime[vertex] = time++;
+    return true;
+  }
+  return false;
+}
+
+size_t getVertexCacheMisses(const uint32_t *indices, size_t nIndices,
+                            size_t nVertices, uint32_t cacheSize) {
+  std::vector<uint32_t> cacheTime(nVertices, 0);
+  uint32_t time = cacheSize + 1;
+
+  size_t misses{};
+  for (size_t i{}; i < nIndices; i++) {
+    if (touchVertex(indices[i], cacheTime, time, cacheSize)) {
+      misses++;
+    }
+  }
+  return misses;
+}
+
+void optimizeVertexCache(uint32_t *indices, size_t nIndices, size_t nVertices,
+                         std::vector<uint32_t> &clusters, uint32_t cacheSize) {
+  clusters.clear();
+
+  size_t nTriangles = nIndices / 3;
+  nIndices = nTriangles * 3;
+  if (nTriangles == 0) return;
+
+  Adjacency adjacency{};
+  buildAdjacency(indices, nIndices, nVertices, adjacency);
+
+  // Triangles left to draw for each vertex
+  std::vector<uint32_t> live(nVertices);
+  for (size_t v{}; v < nVertices; v++) {
+    live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+  }
+
+  std::vector<uint32_t> cacheTime(nVertices, 0);
+  uint32_t time = cacheSize + 1;
+
+  std::vector<bool> emitted(nTriangles, false);
+  std::vector<uint32_t> output;
+  output.reserve(nIndices);
+
+  // Recently drawn vertices, to go back to when a fan runs out
+  std::vector<uint32_t> deadEnd;
+  deadEnd.reserve(nIndices);
+  size_t cursor{};
+
+  auto skipDeadEnd = [&]() -> int64_t {
+    while (!deadEnd.empty()) {
+      uint32_t vertex = deadEnd.back();
+      deadEnd.pop_back();
+      if (live[vertex] > 0) return vertex;
+    }
+    for (; cursor < nVertices; cursor++) {
+      if (live[cursor] > 0) return static_cast<int64_t>(cursor);
+    }
+    return -1;
+  };
+
+  std::vector<uint32_t> candidates;
+  int64_t fan = skipDeadEnd();
+  bool jumped = true;
+
+  while (fan >= 0) {
+    if (jumped) {
+      clusters.push_back(static_cast<uint32_t>(output.size() / 3));
+    }
+
+    // Draw every triangle around the fanning vertex
+    candidates.clear();
+    for (uint32_t a = adjacency.offsets[fan]; a < adjacency.offsets[fan + 1];
+         a++) {
+      uint32_t triangle = adjacency.triangles[a];
+      if (emitted[triangle]) continue;
+
+      for (size_t k{}; k < 3; k++) {
+        uint32_t vertex = indices[triangle * 3 + k];
+        output.push_back(vertex);
+        deadEnd.push_back(vertex);
+        candidates.push_back(vertex);
+        live[vertex]--;
+        touchVertex(vertex, cacheTime, time, cacheSize);
+      }
+      emitted[triangle] = true;
+    }
+
+    // Fan next around the oldest vertex that will still be in the cache
+    // after its own triangles are drawn, or any with triangles left
+    int64_t next = -1;
+    int64_t best = -1;
+    for (uint32_t vertex : candidates) {
+      if (live[vertex] == 0) continue;
+
+      int64_t priority{};
+      uint32_t age = time - cacheTime[vertex];
+      if (age + 2 * live[vertex] <= cacheSize) {
+        priority = age;
+      }
+      if (priority > best) {
+        best = priority;
+        next = vertex;
+      }
+    }
+
+    jumped = next < 0;
+    fan = jumped ? skipDeadEnd() : next;
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+/******  OVERDRAW  ******/
+
+struct Cluster {
+  uint32_t start;
+  uint32_t end;
+  float sortKey;
+};
+
+void optimizeOverdraw(uint32_t *indices, size_t nIndices,
+                      const glm::vec3 *positions, size_t nVertices,
+                      const std::vector<uint32_t> &clusters, float threshold,
+                      uint32_t cacheSize) {
+  size_t nTriangles = nIndices / 3;
+  nIndices = nTriangles * 3;
+  if (nTriangles == 0 || clusters.empty()) return;
+
+  // Split a cluster wherever the cache has done well enough since the last
+  // split that starting over with an empty one costs little. Clusters can
+  // end up drawn in any order, so each of them starts with an empty cache.
+  float target =
+      threshold *
+      static_cast<float>(getVertexCacheMisses(indices, nIndices, nVertices,
+                                              cacheSize)) /
+      static_cast<float>(nTriangles);
+
+  std::vector<uint32_t> cacheTime(nVertices, 0);
+  uint32_t time = cacheSize + 1;
+
+  std::vector<Cluster> split;
+  for (size_t c{}; c < clusters.size(); c++) {
+    uint32_t end = c + 1 < clusters.size()
+                       ? clusters[c + 1]
+                       : static_cast<uint32_t>(nTriangles);
+    uint32_t start = clusters[c];
+    size_t misses{};
+    time += cacheSize + 1;
+
+    for (uint32_t t = start; t < end; t++) {
+      for (size_t k{}; k < 3; k++) {
+        if (touchVertex(indices[t * 3 + k], cacheTime, time, cacheSize)) {
+          misses++;
+        }
+      }
+
+      if (t + 1 < end &&
+          static_cast<float>(misses) <= target * (t - start + 1)) {
+        split.push_back(Cluster{start, t + 1, 0.f});
+        start = t + 1;
+        misses = 0;
+        time += cacheSize + 1;
+      }
+    }
+    split.push_back(Cluster{start, end, 0.f});
+  }
+
+  // Clusters facing away from the middle of the mesh are the ones most
+  // likely to be in front of the rest of it, so they go first
+  auto getTriangle = [&](uint32_t t, glm::vec3 &centroid, glm::vec3 &normal) {
+    const glm::vec3 &p0 = positions[indices[t * 3 + 0]];
+    const glm::vec3 &p1 = positions[indices[t * 3 + 1]];
+    const glm::vec3 &p2 = positions[indices[t * 3 + 2]];
+    centroid = (p0 + p1 + p2) / 3.f;
+    // Its length is twice the area
+    normal = glm::cross(p1 - p0, p2 - p0);
+  };
+
+  glm::vec3 meshCentroid{0.f};
+  float meshArea{};
+  for (uint32_t t{}; t < nTriangles; t++) {
+    glm::vec3 centroid, normal;
+    getTriangle(t, centroid, normal);
+    float area = glm::length(normal);
+    meshCentroid += centroid * area;
+    meshArea += area;
+  }
+  if (meshArea > 0.f) {
+    meshCentroid = meshCentroid / meshArea;
+  }
+
+  for (Cluster &cluster : split) {
+    glm::vec3 clusterCentroid{0.f};
+    glm::vec3 clusterNormal{0.f};
+    float clusterArea{};
+    for (uint32_t t = cluster.start; t < cluster.end; t++) {
+      glm::vec3 centroid, normal;
+      getTriangle(t, centroid, normal);
+      float area = glm::length(normal);
+      clusterCentroid += centroid * area;
+      clusterNormal += normal;
+      clusterArea += area;
+    }
+
+    // NOTE: Degenerate clusters keep their place among each other, in
+    // front of the ones facing inwards
+    float normalLength = glm::length(clusterNormal);
+    if (clusterArea > 0.f && normalLength > 0.f) {
+      cluster.sortKey =
+          glm::dot(clusterCentroid / clusterArea - meshCentroid,
+                   clusterNormal / normalLength);
+    }
+  }
+
+  std::stable_sort(split.begin(), split.end(),
+                   [](const Cluster &a, const Cluster &b) {
+                     return a.sortKey > b.sortKey;
+                   });
+
+  std::vector<uint32_t> output;
+  output.reserve(nIndices);
+  for (const Cluster &cluster : split) {
+    output.insert(output.end(), indices + cluster.start * 3,
+                  indices + cluster.end * 3);
+  }
+  std::copy(output.begin(), output.end(), indices);
+}
+
+/******  FETCH  ******/
+
+size_t optimizeVertexFetch(uint32_t *indices, size_t nIndices,
+                           size_t nVertices, std::vector<uint32_t> &remap) {
+  remap.assign(nVertices, ~0u);
+
+  uint32_t next{};
+  for (size_t i{}; i < nIndices; i++) {
+    uint32_t &vertex = remap[indices[i]];
+    if (vertex == ~0u) {
+      vertex = next++;
+    }
+    indices[i] = vertex;
+  }
+
+  return next;
+}
@@ -1,61 +1,151 @@
 #include "rhythmic_state.hpp"
 
+#include <algorithm>
 #include <array>
+#include <cassert>
 #include <cmath>
-#include <fstream>
+#include <filesystem>
 #include <iostream>
 #include <string>
 
 #include "bs_types.hpp"
+#include "chart.hpp"
 #include "dstack.hpp"
 #include "game_state_manager.hpp"
-#include "json.hpp"
 
 RhythmicState::RhythmicState(uint32_t level, GameStateManager &gameStateManager,
-                             DStack &allocator)
+                             DStack &allocator, const char *dataDir,
+                             bool hotReload)
     : GameState{gameStateManager},
       _talking{false},
       _playerHealth{3},
       _rhythmBarIndex{-1},
       _rhythmEventIndex{0},
-      _nRhythmBars{0} {
-  loadData(level, allocator);
-}
-
-void RhythmicState::loadData(uint32_t level, DStack &allocator) {
-  // Read json file
-  using json = nlohmann::json;
-  std::ifstream i("../data/level1.json");
-  json j;
-  i >> j;
-
-  // Count how many rhythm bars and events we need to allocate
-  _nRhythmBars = j["events"].size();
-
-  // Allocate enough room for our rhythm bars
-  _rhythmBars = allocator.alloc<RhythmBar, StackDirection::Bottom>(
-      sizeof(RhythmBar) * _nRhythmBars);
-
-  // ALlocate enough room for our rhythm events per bar
-  for (size_t i{}; i < _nRhythmBars; i++) {
-    _rhythmBars[i].rhythmEvents =
-        allocator.alloc<RhythmEvent, StackDirection::Bottom>(
-            sizeof(RhythmEvent) * j["events"][i].size());
-    _rhythmBars[i].nEvents = j["events"][i].size();
-  }
-
-  // Set the correct values
-  size_t barIndex{};
-  for (const auto &e : j["events"]) {
-    size_t eventIndex{};
-    for (const auto &r : e) {
-      RhythmEvent re{.beat = r["beat"].get<uint32_t>(),
-                     .gamepadButton = r["gamepadButton"].get<size_t>()};
-      _rhythmBars[barIndex].rhythmEvents[eventIndex] = re;
-      eventIndex++;
+      _judgeBarIndex{0},
+      _judgeEventIndex{0},
+      _judgeBarStartKnown{false},
+      _judgeBarStart{0.},
+      _judgementWindows{},
+      _hitStats{},
+      _scheduledBeat{-1},
+      _looping{false},
+      _loopStartBar{0},
+      _loopStartBeat{0},
+      _loopEndBar{0},
+      _loopEndBeat{0},
+      _streaming{false},
+      _chart{},
+      _streams{},
+      _nextBar{0},
+      _reloadReady{false},
+      _reloadBack{0},
+      _reloadStacks{},
+      _reloadChart{},
+      _watcher{} {
+  loadData(level, dataDir, allocator, hotReload);
+}
+
+void RhythmicState::loadData(uint32_t level, const char *dataDir,
+                             DStack &allocator, bool hotReload) {
+  std::string base = dataDir + ("level" + std::to_string(level));
+  _jsonChart = base + ".json";
+  _binaryChart = base + ".bsc";
+
+  // Stream the chart so only a few bars are ever resident. Convert the
+  // json if there's no binary chart yet, or if it's out of date.
+  std::error_code ec;
+  bool converted = true;
+  if (!std::filesystem::exists(_binaryChart, ec) ||
+      (std::filesystem::exists(_jsonChart, ec) &&
+       std::filesystem::last_write_time(_jsonChart, ec) >
+           std::filesystem::last_write_time(_binaryChart, ec))) {
+    converted = convertChart(_jsonChart.c_str(), _binaryChart.c_str());
+  }
+
+  _streaming = converted && stream().open(_binaryChart.c_str(), allocator);
+  if (_streaming) {
+    // Reloads are opened in the other one
+    _streams[_reloadBack].reserve(allocator);
+  } else {
+    // NOTE: Fall back on keeping the whole chart in memory
+    loadChart(_jsonChart.c_str(), allocator, _chart);
+  }
+
+  loadJudgementWindows(_jsonChart.c_str(), _judgementWindows);
+
+  if (hotReload) {
+    if (!_streaming) {
+      for (auto &stack : _reloadStacks) {
+        stack.emplace(RELOAD_STACK_SIZE);
+      }
+    }
+    _watcher.start(_jsonChart.c_str(), [this] { reloadChart(); });
+  }
+}
+
+std::string RhythmicState::reloadPath(size_t index) const {
+  return _binaryChart + ".reload" + std::to_string(index);
+}
+
+void RhythmicState::reloadChart() {
+  std::lock_guard<std::mutex> lock{_reloadMutex};
+
+  // The back buffer is never in use, so it's fine to overwrite a reload
+  // that hasn't been swapped in yet
+  if (_streaming) {
+    ChartStream &back = _streams[_reloadBack];
+    std::string path = reloadPath(_reloadBack);
+    back.close();
+    _reloadReady = convertChart(_jsonChart.c_str(), path.c_str()) &&
+                   back.reopen(path.c_str());
+
+    // NOTE: Read in the bars it'll be swapped in at here, so the swap on
+    // the main thread never waits on the disk
+    if (_reloadReady) {
+      back.prefetch(_nextBar);
     }
-    barIndex++;
+  } else {
+    DStack &stack = *_reloadStacks[_reloadBack];
+    stack.clearBottom();
+    _reloadReady = loadChart(_jsonChart.c_str(), stack, _reloadChart);
   }
+
+  if (_reloadReady) {
+    std::cout << "Reloaded " << _jsonChart << std::endl;
+  }
+}
+
+void RhythmicState::applyReload() {
+  // Never wait on the watcher, just pick it up on the next bar instead
+  std::unique_lock<std::mutex> lock{_reloadMutex, std::try_to_lock};
+  if (!lock.owns_lock() || !_reloadReady) {
+    return;
+  }
+
+  // NOTE: A reloaded stream is already open and prefetched, swapping the
+  // buffers is all it takes
+  if (!_streaming) {
+    _chart = _reloadChart;
+  }
+
+  _reloadBack = 1 - _reloadBack;
+  _reloadReady = false;
+}
+
+ChartStream &RhythmicState::stream() { return _streams[1 - _reloadBack]; }
+
+size_t RhythmicState::barCount() const {
+  return _streaming ? _streams[1 - _reloadBack].getBarCount()
+                    : _chart.nRhythmBars;
+}
+
+const RhythmBar &RhythmicState::getBar(size_t barIndex) {
+  return _streaming ? stream().getBar(barIndex) : _chart.rhythmBars[barIndex];
+}
+
+const RhythmBar &RhythmicState::currentBar() {
+  assert(_rhythmBarIndex >= 0);
+  return getBar(_rhythmBarIndex);
 }
 
 void RhythmicState::onEnter() {
@@ -64,90 +154,264 @@ void RhythmicState::onEnter() {
   _playerHealth = 3;
   _rhythmBarIndex = -1;
   _rhythmEventIndex = 0;
-}
+  _judgeBarIndex = 0;
+  _judgeEventIndex = 0;
+  _judgeBarStartKnown = false;
 
-void RhythmicState::onExit() {}
+  _scheduledBeat = -1;
+  _hitStats.reset();
 
-void RhythmicState::processInput(const GamepadState &gamepadState,
-                                 const MusicPos &mp, FrameEvents &frameEvents) {
-  if (_rhythmEventIndex >= _rhythmBars[_rhythmBarIndex].nEvents ||
-      _rhythmBarIndex < 0) {  // TODO: Fix the rhythm bar index starting at 0
-    return;
+  _nextBar = 0;
+  if (_streaming) {
+    stream().advance(0);
   }
+}
+
+void RhythmicState::onExit() { _hitStats.print(); }
 
-  RhythmEvent rhythmEvent =
-      _rhythmBars[_rhythmBarIndex].rhythmEvents[_rhythmEventIndex];
+// Whether bar:beat comes before otherBar:otherBeat
+static bool isBefore(int32_t bar, uint32_t beat, int32_t otherBar,
+                     uint32_t otherBeat) {
+  return bar < otherBar || (bar == otherBar && beat < otherBeat);
+}
+
+void RhythmicState::seek(int32_t bar, uint32_t beatRel,
+                         FrameEvents &frameEvents) {
+  // NOTE: Charts have BAR_BEATS slots in every bar whatever the meter, so
+  // the bar is turned into chart beats here and the timeline does the rest
+  assert(beatRel < BAR_BEATS);
+  uint32_t chartBeat =
+      static_cast<uint32_t>(bar) * BAR_BEATS + beatRel + CHART_BEAT_OFFSET;
+  ChartCursor cursor =
+      _streaming ? stream().seek(chartBeat) : _chart.timeline.seek(chartBeat);
+  _rhythmBarIndex = cursor.barIndex;
+  _rhythmEventIndex = cursor.eventIndex;
+  _talking = cursor.talking;
+  // NOTE: The cursor stops a step short of a talking bar line, and a
+  // talking bar's listening bar is still all ahead of us
+  _judgeBarIndex = static_cast<int16_t>(chartBeat / RHYTHM_BAR_BEATS);
+  _judgeEventIndex = _judgeBarIndex == cursor.barIndex && !cursor.talking
+                         ? cursor.eventIndex
+                         : 0;
+  _judgeBarStartKnown = false;
+  _nextBar = _rhythmBarIndex + 1;
+  _scheduledBeat = -1;
+
+  frameEvents.addEvent(FrameEvent{
+      .type = EventType::MUSIC_SEEK, .bar = bar, .beatRel = beatRel});
+}
+
+void RhythmicState::setLoop(int32_t startBar, uint32_t startBeat,
+                            int32_t endBar, uint32_t endBeat) {
+  assert(isBefore(startBar, startBeat, endBar, endBeat));
+  _looping = true;
+  _loopStartBar = startBar;
+  _loopStartBeat = startBeat;
+  _loopEndBar = endBar;
+  _loopEndBeat = endBeat;
+}
+
+void RhythmicState::clearLoop() { _looping = false; }
+
+void RhythmicState::setJudgementWindows(const JudgementWindows &windows) {
+  assert(windows.perfectMs <= windows.okMs && windows.okMs <= windows.badMs);
+  _judgementWindows = windows;
+}
+
+const HitStats &RhythmicState::getHitStats() const { return _hitStats; }
+
+bool RhythmicState::fail(FrameEvents &frameEvents) {
+  _playerHealth--;
+  _judgeEventIndex++;
+
+  if (_playerHealth <= 0) {
+    std::cout << "DEAD" << std::endl;
+    frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_DEATH});
+    _gameStateManager.nextState();
+    return false;
+  }
 
-  int32_t distance = mp.beatRel - rhythmEvent.beat;
+  frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_FAIL});
+  return true;
+}
 
-  // If the player was too late to hit the target
-  if (distance > BEAT_WINDOW) {
-    _playerHealth--;
-    _rhythmEventIndex++;
-    std::cout << "miss" << std::endl;
+// The music bar the player repeats a rhythm bar in
+static int32_t listeningBar(size_t barIndex) {
+  return (static_cast<int32_t>(barIndex * RHYTHM_BAR_BEATS) + BAR_BEATS -
+          CHART_BEAT_OFFSET) /
+         BAR_BEATS;
+}
 
-    if (_playerHealth <= 0) {
-      std::cout << "DEAD" << std::endl;
-      frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_DEATH});
-      _gameStateManager.nextState();
+void RhythmicState::processInput(const GamepadState &gamepadState,
+                                 const MusicPos &mp, FrameEvents &frameEvents) {
+  // Miss whatever the player was too late to hit, and move on to the next
+  // listening bar once the music is past this one and it's all judged
+  while (_judgeBarIndex < barCount()) {
+    double barStart;
+    if (getBarStartBeat(mp, listeningBar(_judgeBarIndex), barStart)) {
+      _judgeBarStart = barStart;
+      _judgeBarStartKnown = true;
+    }
+    if (!_judgeBarStartKnown) {
+      // NOTE: Too far ahead of the bar to judge anything yet
       return;
     }
 
-    frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_FAIL});
+    const RhythmBar &rhythmBar = getBar(_judgeBarIndex);
+    while (_judgeEventIndex < rhythmBar.nEvents) {
+      double eventBeat =
+          _judgeBarStart + rhythmBar.rhythmEvents[_judgeEventIndex].beat;
+      if (getHitErrorMs(mp, eventBeat) <= _judgementWindows.badMs) {
+        break;
+      }
+      std::cout << "miss" << std::endl;
+      _hitStats.addMiss();
+      if (!fail(frameEvents)) {
+        return;
+      }
+    }
+
+    if (_judgeEventIndex < rhythmBar.nEvents ||
+        mp.bar <= listeningBar(_judgeBarIndex)) {
+      break;
+    }
+    _judgeBarIndex++;
+    _judgeEventIndex = 0;
+    _judgeBarStartKnown = false;
+  }
+
+  if (_judgeBarIndex >= barCount() || !_judgeBarStartKnown) {
     return;
   }
 
+  const RhythmBar &rhythmBar = getBar(_judgeBarIndex);
+  if (_judgeEventIndex >= rhythmBar.nEvents) {
+    return;
+  }
+
+  RhythmEvent rhythmEvent = rhythmBar.rhythmEvents[_judgeEventIndex];
+
+  double errorMs = getHitErrorMs(mp, _judgeBarStart + rhythmEvent.beat);
+
+  // Wrong buttons count anywhere in the listening bar, and anywhere out
+  // of it the event could be hit
+  bool judging = mp.bar == listeningBar(_judgeBarIndex) ||
+                 errorMs >= -_judgementWindows.badMs;
+
   // If pressed any incorrect button
-  for (size_t i{}; i < gamepadState.size(); i++) {
+  for (size_t i{}; judging && i < gamepadState.size(); i++) {
     if (i != rhythmEvent.gamepadButton && gamepadState[i]) {
-      _playerHealth--;
-      _rhythmEventIndex++;
-
       std::cout << "wrong" << std::endl;
-      if (_playerHealth <= 0) {
-        std::cout << "DEAD" << std::endl;
-        frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_DEATH});
-        _gameStateManager.nextState();
-        return;
-      }
-
-      frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_FAIL});
+      fail(frameEvents);
       return;
     }
   }
 
   // If pressed the correct button
-  // TODO: Need higher resolution here. Being perfect is too easy
   if (rhythmEvent.gamepadButton != GAMEPAD_NONE &&
       gamepadState[rhythmEvent.gamepadButton]) {
-    const auto absDistance = abs(distance);
-
-    if (absDistance == 0) {
-      std::cout << "perfect" << std::endl;
-      frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_PERFECT});
-    } else if (absDistance < 2) {
-      std::cout << "ok" << std::endl;
-      frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_OK});
-    } else {
-      std::cout << "bad" << std::endl;
-      frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_BAD});
+    Judgement judgement = judge(errorMs, _judgementWindows);
+
+    switch (judgement) {
+      case Judgement::PERFECT:
+        std::cout << "perfect " << errorMs << "ms" << std::endl;
+        frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_PERFECT});
+        break;
+      case Judgement::OK:
+        std::cout << "ok " << errorMs << "ms" << std::endl;
+        frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_OK});
+        break;
+      case Judgement::BAD:
+        std::cout << "bad " << errorMs << "ms" << std::endl;
+        frameEvents.addEvent(FrameEvent{.type = EventType::PLAYER_BAD});
+        break;
+      case Judgement::MISS:
+        // NOTE: Too early to count for anything, ignore it
+        return;
     }
-    _rhythmEventIndex++;
+
+    _hitStats.addHit(errorMs, judgement);
+    _judgeEventIndex++;
     return;
   }
 }
 
+void RhythmicState::scheduleCues(const MusicPos &mp,
+                                 FrameEvents &frameEvents) {
+  // Walk the next few beats bar by bar, the bars can be any length
+  // NOTE: Assumes the next bar is at least SFX_SCHEDULE_AHEAD long
+  int64_t bar = mp.bar;
+  uint32_t beatRel = mp.beatRel;
+
+  for (uint32_t ahead{}; ahead <= SFX_SCHEDULE_AHEAD; ahead++) {
+    if (beatRel >= mp.barBeats) {
+      bar++;
+      beatRel = 0;
+    }
+
+    int64_t chartBeat = bar * BAR_BEATS + beatRel + CHART_BEAT_OFFSET;
+    int32_t musicBeat = static_cast<int32_t>(mp.beat) + ahead;
+    beatRel++;
+
+    if (chartBeat <= _scheduledBeat || chartBeat < 0) {
+      continue;
+    }
+    _scheduledBeat = chartBeat;
+
+    size_t barIndex = chartBeat / RHYTHM_BAR_BEATS;
+
+    // Cues are only played in the talking bars
+    if (chartBeat % RHYTHM_BAR_BEATS >= BAR_BEATS || barIndex >= barCount()) {
+      continue;
+    }
+
+    const RhythmBar &rhythmBar = getBar(barIndex);
+    for (size_t e{}; e < rhythmBar.nEvents; e++) {
+      const RhythmEvent &rhythmEvent = rhythmBar.rhythmEvents[e];
+      if (rhythmEvent.beat != chartBeat % BAR_BEATS) {
+        continue;
+      }
+
+      Sfx sfx;
+      switch (rhythmEvent.gamepadButton) {
+        case GAMEPAD_A:
+          sfx = Sfx::DOWN;
+          break;
+        case GAMEPAD_B:
+          sfx = Sfx::RIGHT;
+          break;
+        default:
+          continue;
+      }
+
+      frameEvents.addEvent(
+          FrameEvent{.type = EventType::SFX_SCHEDULE,
+                     .sfx = sfx,
+                     .musicBeat = static_cast<double>(musicBeat)});
+    }
+  }
+}
+
 void RhythmicState::update(float dt, const MusicPos &mp,
                            const GamepadState &gamepadState,
                            FrameEvents &frameEvents) {
-  if (!_talking) {
-    processInput(gamepadState, mp, frameEvents);
-  }
+  // NOTE: Judged in the talking bars as well, hits can land on either
+  // side of a listening bar's bar lines
+  processInput(gamepadState, mp, frameEvents);
 }
 
 void RhythmicState::rUpdate(const MusicPos &mp,
                             const GamepadState &gamepadState,
                             FrameEvents &frameEvents) {
+  // Jump back to the start of the practice loop. Also catches us up
+  // if the music hasn't reached the loop yet.
+  if (_looping &&
+      (!isBefore(mp.bar, mp.beatRel, _loopEndBar, _loopEndBeat) ||
+       isBefore(mp.bar, mp.beatRel, _loopStartBar, _loopStartBeat))) {
+    seek(_loopStartBar, _loopStartBeat, frameEvents);
+    return;
+  }
+
   // For every new bar, switch between talking and listening
   if (mp.beatRel == 0) {
     // If going from talking to listening
@@ -155,24 +419,35 @@ void RhythmicState::rUpdate(const MusicPos &mp,
       _rhythmEventIndex = 0;
       _talking = false;
     } else {  // Going from listening to a new round of talking
+      applyReload();
+
       _rhythmBarIndex++;
       _rhythmEventIndex = 0;
       _talking = true;
 
-      if (_rhythmBarIndex >= _nRhythmBars) {
+      if (_rhythmBarIndex >= barCount()) {
         _rhythmBarIndex = 0;
         frameEvents.addEvent(FrameEvent{.type = EventType::GAME_END});
         _gameStateManager.nextState();
         return;
       }
+
+      // Release the bars we've passed and start loading the next ones
+      _nextBar = _rhythmBarIndex + 1;
+      if (_streaming) {
+        // NOTE: The bar we're judging can still be the one before
+        stream().advance(std::min(_judgeBarIndex, _rhythmBarIndex));
+      }
     }
   }
 
+  scheduleCues(mp, frameEvents);
+
   if (_talking) {
-    if (_rhythmEventIndex < _rhythmBars[_rhythmBarIndex].nEvents) {
-      auto rhythmEvent =
-          _rhythmBars[_rhythmBarIndex].rhythmEvents[_rhythmEventIndex];
-      if (rhythmEvent.beat % 16 == mp.beatRel) {
+    const RhythmBar &rhythmBar = currentBar();
+    if (_rhythmEventIndex < rhythmBar.nEvents) {
+      auto rhythmEvent = rhythmBar.rhythmEvents[_rhythmEventIndex];
+      if (rhythmEvent.beat == mp.beatRel) {
         std::cout << "rhythmEvent: " << rhythmEvent.gamepadButton << std::endl;
         switch (rhythmEvent.gamepadButton) {
           case GAMEPAD_A:
@@ -0,0 +1,128 @@
+#include "sfx_bank.hpp"
+
+#include <cmath>
+#include <iostream>
+
+SfxBank::SfxBank()
+    : _arena{ARENA_SIZE}, _voices{}, _scheduledVoices{}, _nPlayed{0} {}
+
+bool SfxBank::load(Sfx sfx, const char *filename, unsigned int sampleRate,
+                   double startOffset) {
+  // Let SoLoud do the decoding, then keep our own copy of the samples
+  SoLoud::Wav decoded;
+  if (decoded.load(filename) != SoLoud::SO_NO_ERROR) {
+    std::cerr << "Couldn't load " << filename << std::endl;
+    return false;
+  }
+
+  // NOTE: Wav keeps the channels one after the other, not interleaved
+  unsigned int nChannels = decoded.mChannels;
+  size_t nSamples = decoded.mSampleCount;
+  float inRate = decoded.mBaseSamplerate;
+  const float *in = decoded.mData;
+
+  // Skip ahead to the first sample that isn't silence, in any channel
+  size_t start = std::min<size_t>(startOffset * inRate, nSamples);
+  for (; start < nSamples; start++) {
+    bool silent{true};
+    for (unsigned int c{}; c < nChannels; c++) {
+      if (std::abs(in[c * nSamples + start]) > SILENCE_THRESHOLD) {
+        silent = false;
+      }
+    }
+    if (!silent) {
+      break;
+    }
+  }
+
+  if (start == nSamples) {
+    std::cerr << "Nothing but silence in " << filename << std::endl;
+    return false;
+  }
+
+  // Linear resample to the mixer rate
+  double step = inRate / sampleRate;
+  size_t nOut = static_cast<size_t>((nSamples - start) / step);
+
+  float *out = _arena.alloc<float, StackDirection::Bottom>(sizeof(float) *
+                                                           nOut * nChannels);
+  if (!out) {
+    std::cerr << "Out of sfx memory loading " << filename << std::endl;
+    return false;
+  }
+
+  for (unsigned int c{}; c < nChannels; c++) {
+    const float *channelIn = in + c * nSamples;
+    float *channelOut = out + c * nOut;
+
+    for (size_t i{}; i < nOut; i++) {
+      double pos = start + i * step;
+      size_t i0 = static_cast<size_t>(pos);
+      size_t i1 = std::min(i0 + 1, nSamples - 1);
+      float t = static_cast<float>(pos - i0);
+      channelOut[i] = channelIn[i0] + (channelIn[i1] - channelIn[i0]) * t;
+    }
+  }
+
+  // Point the sound straight at the arena, no copy and no ownership
+  _sounds[static_cast<size_t>(sfx)].loadRawWave(
+      out, nOut * nChannels, static_cast<float>(sampleRate), nChannels, false,
+      false);
+
+  return true;
+}
+
+template <size_t N>
+size_t SfxBank::takeVoice(SoLoud::Soloud &soloud, VoicePool<N> &pool) {
+  size_t voice{};
+  for (size_t i{}; i < N; i++) {
+    if (!soloud.isValidVoiceHandle(pool.voices[i])) {
+      voice = i;
+      break;
+    }
+    if (pool.started[i] < pool.started[voice]) {
+      voice = i;
+    }
+  }
+
+  if (soloud.isValidVoiceHandle(pool.voices[voice])) {
+    soloud.stop(pool.voices[voice]);
+  }
+
+  pool.started[voice] = ++_nPlayed;
+  return voice;
+}
+
+SoLoud::handle SfxBank::play(SoLoud::Soloud &soloud, Sfx sfx) {
+  size_t voice = takeVoice(soloud, _voices);
+  SoLoud::handle h = soloud.play(_sounds[static_cast<size_t>(sfx)]);
+  _voices.voices[voice] = h;
+
+  return h;
+}
+
+SoLoud::handle SfxBank::schedule(SoLoud::Soloud &soloud, Sfx sfx,
+                                 unsigned int delaySamples) {
+  // NOTE: Scheduled in order, so the oldest has always sounded first
+  size_t voice = takeVoice(soloud, _scheduledVoices);
+
+  // Start paused, so the mixer can't pick it up before the delay is set
+  SoLoud::handle h =
+      soloud.play(_sounds[static_cast<size_t>(sfx)], -1.f, 0.f, true);
+  soloud.setDelaySamples(h, delaySamples);
+  soloud.setPause(h, false);
+  _scheduledVoices.voices[voice] = h;
+
+  return h;
+}
+
+void SfxBank::stopScheduled(SoLoud::Soloud &soloud) {
+  // Stopping a voice that has already finished is fine, the handle is
+  // just invalid by then
+  for (auto &h : _scheduledVoices.voices) {
+    if (h) {
+      soloud.stop(h);
+      h = 0;
+    }
+  }
+}
@@ -11,7 +11,7 @@ StartState::StartState(GameStateManager &gameStateManager)
     : GameState{gameStateManager} {};
 
 void StartState::onEnter() {
-  std::cout << "Press any button to start" << std::endl;
+  std::cout << "Press any button to start, or up to calibrate" << std::endl;
 };
 void StartState::onExit(){};
 
@@ -19,6 +19,11 @@ void StartState::onExit(){};
 void StartState::update(float dt, const MusicPos &mp,
                         const GamepadState &gamepadState,
                         FrameEvents &frameEvents) {
+  if (gamepadState[GAMEPAD_UP]) {
+    _gameStateManager.setState(CALIBRATION_STATE);
+    return;
+  }
+
   for (size_t i{}; i < gamepadState.size(); i++) {
     if (gamepadState[i]) {
       frameEvents.addEvent(FrameEvent{.type = EventType::GAME_START});
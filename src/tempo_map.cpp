@@ -0,0 +1,239 @@
+#include "tempo_map.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+#include "json.hpp"
+
+// A whole note
+static constexpr uint32_t BAR_SIXTEENTHS = 16;
+
+// Quarter notes per minute to seconds per sixteenth
+static double bpmToSpb(double bpm) { return (1. / (bpm / 60.)) / 4.; }
+
+TempoMap::TempoMap() : _nSegments{0}, _segments{}, _nMeters{0}, _meters{} {
+  clear();
+}
+
+void TempoMap::setConstant(double bpm, double startTime) {
+  clear();
+  addSegment(startTime, bpm);
+}
+
+bool TempoMap::addSegment(double time, double bpm) {
+  if (_nSegments == MAX_SEGMENTS || bpm <= 0.) {
+    return false;
+  }
+
+  double beat{};
+  if (_nSegments > 0) {
+    const TempoSegment &last = _segments[_nSegments - 1];
+    if (time <= last.time) {
+      return false;
+    }
+    beat = last.beat + (time - last.time) / last.spb;
+  }
+
+  _segments[_nSegments] =
+      TempoSegment{.time = time, .beat = beat, .spb = bpmToSpb(bpm)};
+  _nSegments++;
+
+  return true;
+}
+
+bool TempoMap::addMeter(int32_t bar, uint32_t numerator,
+                        uint32_t denominator) {
+  if (_nMeters == MAX_METERS || numerator == 0 || denominator == 0 ||
+      (numerator * BAR_SIXTEENTHS) % denominator != 0) {
+    return false;
+  }
+
+  const MeterSegment &last = _meters[_nMeters - 1];
+  if (bar < last.bar) {
+    return false;
+  }
+
+  MeterSegment meter{
+      .bar = bar,
+      .beat = last.beat + static_cast<double>(bar - last.bar) * last.barBeats,
+      .barBeats = numerator * BAR_SIXTEENTHS / denominator};
+
+  // A meter on the same bar replaces the one before, so a map can change
+  // the default 4/4 from bar 0
+  if (bar == last.bar) {
+    _meters[_nMeters - 1] = meter;
+  } else {
+    _meters[_nMeters++] = meter;
+  }
+
+  return true;
+}
+
+void TempoMap::clear() {
+  _nSegments = 0;
+  _nMeters = 1;
+  _meters[0] =
+      MeterSegment{.bar = 0, .beat = 0., .barBeats = DEFAULT_BAR_BEATS};
+}
+
+bool TempoMap::load(const char *filename) {
+  using json = nlohmann::json;
+  std::ifstream i(filename);
+  if (!i) {
+    return false;
+  }
+
+  json j = json::parse(i, nullptr, false);
+  if (j.is_discarded() || !j["segments"].is_array() ||
+      j["segments"].empty()) {
+    std::cerr << "Couldn't parse tempo map " << filename << std::endl;
+    return false;
+  }
+
+  clear();
+  for (const auto &s : j["segments"]) {
+    if (!addSegment(s["time"].get<double>(), s["bpm"].get<double>())) {
+      std::cerr << "Bad tempo segment in " << filename << std::endl;
+      clear();
+      return false;
+    }
+  }
+
+  if (j.contains("meters")) {
+    for (const auto &m : j["meters"]) {
+      if (!addMeter(m["bar"].get<int32_t>(), m["numerator"].get<uint32_t>(),
+                    m["denominator"].get<uint32_t>())) {
+        std::cerr << "Bad meter in " << filename << std::endl;
+        clear();
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool TempoMap::save(const char *filename) const {
+  using json = nlohmann::json;
+  json segments = json::array();
+  for (size_t i{}; i < _nSegments; i++) {
+    segments.push_back({{"time", _segments[i].time},
+                        {"bpm", 60. / (_segments[i].spb * 4.)}});
+  }
+
+  json meters = json::array();
+  for (size_t i{}; i < _nMeters; i++) {
+    // NOTE: Written back in sixteenths, which loses 6/8 vs 3/4
+    meters.push_back({{"bar", _meters[i].bar},
+                      {"numerator", _meters[i].barBeats},
+                      {"denominator", BAR_SIXTEENTHS}});
+  }
+
+  std::ofstream o(filename);
+  if (!o) {
+    std::cerr << "Couldn't write tempo map " << filename << std::endl;
+    return false;
+  }
+
+  o << json{{"segments", segments}, {"meters", meters}}.dump(4) << std::endl;
+  return o.good();
+}
+
+const TempoSegment &TempoMap::segmentAtTime(double time) const {
+  assert(_nSegments > 0);
+  // Last segment starting at or before the time, or the first one
+  auto s = std::upper_bound(
+      _segments, _segments + _nSegments, time,
+      [](double t, const TempoSegment &segment) { return t < segment.time; });
+  return s == _segments ? _segments[0] : *(s - 1);
+}
+
+const TempoSegment &TempoMap::segmentAtBeat(double beat) const {
+  assert(_nSegments > 0);
+  auto s = std::upper_bound(
+      _segments, _segments + _nSegments, beat,
+      [](double b, const TempoSegment &segment) { return b < segment.beat; });
+  return s == _segments ? _segments[0] : *(s - 1);
+}
+
+const MeterSegment &TempoMap::meterAtBeat(double beat) const {
+  auto m = std::upper_bound(
+      _meters, _meters + _nMeters, beat,
+      [](double b, const MeterSegment &meter) { return b < meter.beat; });
+  return m == _meters ? _meters[0] : *(m - 1);
+}
+
+const MeterSegment &TempoMap::meterAtBar(int32_t bar) const {
+  auto m = std::upper_bound(
+      _meters, _meters + _nMeters, bar,
+      [](int32_t b, const MeterSegment &meter) { return b < meter.bar; });
+  return m == _meters ? _meters[0] : *(m - 1);
+}
+
+double TempoMap::beatAt(double time) const {
+  const TempoSegment &segment = segmentAtTime(time);
+  return segment.beat + (time - segment.time) / segment.spb;
+}
+
+double TempoMap::timeAt(double beat) const {
+  const TempoSegment &segment = segmentAtBeat(beat);
+  return segment.time + (beat - segment.beat) * segment.spb;
+}
+
+double TempoMap::spbAt(double time) const { return segmentAtTime(time).spb; }
+
+BarPos TempoMap::barAt(double beat) const {
+  const MeterSegment &meter = meterAtBeat(beat);
+
+  // NOTE: Floor, so the lead in counts down through negative bars
+  double bars = std::floor((beat - meter.beat) / meter.barBeats);
+  double barStartBeat = meter.beat + bars * meter.barBeats;
+
+  return BarPos{
+      .bar = meter.bar + static_cast<int32_t>(bars),
+      .beatRel = std::min(static_cast<uint32_t>(beat - barStartBeat),
+                          meter.barBeats - 1),
+      .barBeats = meter.barBeats,
+      .barStartBeat = barStartBeat};
+}
+
+double TempoMap::beatAtBar(int32_t bar) const {
+  const MeterSegment &meter = meterAtBar(bar);
+  return meter.beat + static_cast<double>(bar - meter.bar) * meter.barBeats;
+}
+
+MusicPos TempoMap::musicPosAt(double trackTime) const {
+  double beat = beatAt(trackTime);
+  BarPos barPos = barAt(beat);
+
+  // NOTE: Beats are negative before the first one. Truncate and let them
+  // wrap around, the rhythmic state counts on the lead in wrapping.
+  MusicPos musicPos{};
+  musicPos.beat = static_cast<uint32_t>(
+      static_cast<int64_t>(barPos.barStartBeat) + barPos.beatRel);
+  musicPos.bar = barPos.bar;
+  musicPos.barBeats = barPos.barBeats;
+  musicPos.period = static_cast<uint32_t>(barPos.bar) / 4;
+  musicPos.barRel = static_cast<uint32_t>(barPos.bar) % 4;
+  musicPos.beatRel = barPos.beatRel;
+  musicPos.time = trackTime - getStartTime();
+  musicPos.spb = spbAt(trackTime);
+  musicPos.beatFrac = beat;
+
+  return musicPos;
+}
+
+double TempoMap::getStartTime() const {
+  assert(_nSegments > 0);
+  return _segments[0].time;
+}
+
+size_t TempoMap::getSegmentCount() const { return _nSegments; }
+
+const TempoSegment &TempoMap::getSegment(size_t index) const {
+  assert(index < _nSegments);
+  return _segments[index];
+}
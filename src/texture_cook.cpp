@@ -0,0 +1,218 @@
+#include "texture_cook.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+#include "file_utils.hpp"
+#include "stb_image.h"
+
+// Part of every key. Bumped when cooking changes, so that old entries
+// aren't picked up anymore.
+static constexpr uint8_t COOK_VERSION = 1;
+
+std::vector<TextureUsage> getImageUsages(const tinygltf::Model &model) {
+  std::vector<TextureUsage> usages(model.images.size(), TextureUsage::Data);
+
+  auto use = [&](int textureIndex, TextureUsage usage) {
+    if (textureIndex < 0) return;
+
+    int source = model.textures[textureIndex].source;
+    if (source < 0) return;
+
+    TextureUsage &current = usages[source];
+    if (current == TextureUsage::Normal) return;
+    if (usage == TextureUsage::Data && current == TextureUsage::Color) return;
+    current = usage;
+  };
+
+  for (const tinygltf::Material &material : model.materials) {
+    use(material.pbrMetallicRoughness.baseColorTexture.index,
+        TextureUsage::Color);
+    use(material.emissiveTexture.index, TextureUsage::Color);
+    use(material.normalTexture.index, TextureUsage::Normal);
+    use(material.pbrMetallicRoughness.metallicRoughnessTexture.index,
+        TextureUsage::Data);
+    use(material.occlusionTexture.index, TextureUsage::Data);
+  }
+
+  return usages;
+}
+
+bool keepImageSource(tinygltf::Image *, const int imageIndex, std::string *,
+                     std::string *, int, int, const unsigned char *bytes,
+                     int size, void *sources) {
+  auto &files = *static_cast<std::vector<std::vector<uint8_t>> *>(sources);
+  if (files.size() <= static_cast<size_t>(imageIndex)) {
+    files.resize(imageIndex + 1);
+  }
+  files[imageIndex].assign(bytes, bytes + size);
+
+  return true;
+}
+
+bool decodeImage(const std::vector<uint8_t> &source, TextureImage &image) {
+  int width, height, channels;
+  stbi_uc *pixels =
+      stbi_load_from_memory(source.data(), static_cast<int>(source.size()),
+                            &width, &height, &channels, STBI_rgb_alpha);
+  if (!pixels) {
+    return false;
+  }
+
+  image.width = static_cast<uint32_t>(width);
+  image.height = static_cast<uint32_t>(height);
+  image.pixels.assign(pixels, pixels + width * height * 4);
+  stbi_image_free(pixels);
+  return true;
+}
+
+// FNV-1a
+uint64_t getTextureKey(const std::vector<uint8_t> &source, TextureUsage usage) {
+  uint64_t hash = 14695981039346656037ull;
+  auto add = [&hash](uint8_t byte) { hash = (hash ^ byte) * 1099511628211ull; };
+
+  for (uint8_t byte : source) {
+    add(byte);
+  }
+  add(static_cast<uint8_t>(usage));
+  add(COOK_VERSION);
+
+  return hash;
+}
+
+std::string getCookedTexturePath(const std::string &directory, uint64_t key,
+                                 bool compressed) {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx%s",
+           static_cast<unsigned long long>(key),
+           compressed ? ".bc.dds" : ".dds");
+  return directory + "cooked/" + name;
+}
+
+/******  MIPS  ******/
+
+static float srgbToLinear(uint8_t value) {
+  static const std::array<float, 256> table = [] {
+    std::array<float, 256> t{};
+    for (size_t i{}; i < t.size(); i++) {
+      float v = i / 255.f;
+      t[i] = v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+    }
+    return t;
+  }();
+
+  return table[value];
+}
+
+static uint8_t linearToSrgb(float value) {
+  float v = value <= 0.0031308f
+                ? value * 12.92f
+                : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+  return static_cast<uint8_t>(std::clamp(v * 255.f + 0.5f, 0.f, 255.f));
+}
+
+// Averages each 2x2. On odd sizes, the last row or column is used twice.
+static TextureImage downsample(const TextureImage &src, TextureUsage usage) {
+  TextureImage dst{std::max(src.width / 2, 1u), std::max(src.height / 2, 1u),
+                   {}};
+  dst.pixels.resize(dst.width * dst.height * 4);
+
+  for (uint32_t y{}; y < dst.height; y++) {
+    uint32_t y0 = std::min(y * 2, src.height - 1);
+    uint32_t y1 = std::min(y * 2 + 1, src.height - 1);
+    for (uint32_t x{}; x < dst.width; x++) {
+      uint32_t x0 = std::min(x * 2, src.width - 1);
+      uint32_t x1 = std::min(x * 2 + 1, src.width - 1);
+
+      const uint8_t *texels[4] = {&src.pixels[(y0 * src.width + x0) * 4],
+                                  &src.pixels[(y0 * src.width + x1) * 4],
+                                  &src.pixels[(y1 * src.width + x0) * 4],
+                                  &src.pixels[(y1 * src.width + x1) * 4]};
+      uint8_t *out = &dst.pixels[(y * dst.width + x) * 4];
+
+      float sum[4]{};
+      for (const uint8_t *texel : texels) {
+        for (int c{}; c < 4; c++) {
+          if (usage == TextureUsage::Color && c < 3) {
+            sum[c] += srgbToLinear(texel[c]);
+          } else if (usage == TextureUsage::Normal && c < 3) {
+            sum[c] += texel[c] / 127.5f - 1.f;
+          } else {
+            sum[c] += texel[c];
+          }
+        }
+      }
+
+      if (usage == TextureUsage::Color) {
+        for (int c{}; c < 3; c++) out[c] = linearToSrgb(sum[c] / 4.f);
+      } else if (usage == TextureUsage::Normal) {
+        float length =
+            std::sqrt(sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]);
+        float n[3] = {0.f, 0.f, 1.f};
+        if (length > 1e-6f) {
+          for (int c{}; c < 3; c++) n[c] = sum[c] / length;
+        }
+        for (int c{}; c < 3; c++) {
+          out[c] = static_cast<uint8_t>(
+              std::clamp((n[c] * 0.5f + 0.5f) * 255.f + 0.5f, 0.f, 255.f));
+        }
+      } else {
+        for (int c{}; c < 3; c++) {
+          out[c] = static_cast<uint8_t>(sum[c] / 4.f + 0.5f);
+        }
+      }
+      out[3] = static_cast<uint8_t>(sum[3] / 4.f + 0.5f);
+    }
+  }
+
+  return dst;
+}
+
+std::vector<TextureImage> generateMips(TextureImage image, TextureUsage usage) {
+  std::vector<TextureImage> levels{};
+  levels.push_back(std::move(image));
+
+  while (levels.back().width > 1 || levels.back().height > 1) {
+    levels.push_back(downsample(levels.back(), usage));
+  }
+
+  return levels;
+}
+
+/******  DDS  ******/
+
+bool writeDds(const std::string &filename, uint32_t format, uint32_t width,
+              uint32_t height,
+              const std::vector<std::vector<uint8_t>> &levels) {
+  // Magic, then DDS_HEADER with a DX10 pixel format and the
+  // DDS_HEADER_DXT10 after it
+  uint32_t header[37]{};
+  header[0] = 0x20534444;  // "DDS "
+  header[1] = 124;
+  // Caps, height, width, pixel format, mip count and linear size are set
+  header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+  header[3] = height;
+  header[4] = width;
+  header[5] = static_cast<uint32_t>(levels[0].size());
+  header[7] = static_cast<uint32_t>(levels.size());
+  header[19] = 32;
+  header[20] = 0x4;         // Four cc
+  header[21] = 0x30315844;  // "DX10"
+  header[27] = 0x1000 | 0x8 | 0x400000;  // Texture, complex, mipmap
+
+  // DDS_HEADER_DXT10, a single 2D texture
+  header[32] = format;
+  header[33] = 3;
+  header[35] = 1;
+
+  std::vector<uint8_t> data;
+  for (const auto &level : levels) {
+    data.insert(data.end(), level.begin(), level.end());
+  }
+
+  return writeFileAtomic(filename, header, sizeof(header), data.data(),
+                         data.size());
+}
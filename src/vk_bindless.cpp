@@ -0,0 +1,99 @@
+#include "vk_bindless.hpp"
+
+#include <cassert>
+#include <cstdlib>
+#include <iostream>
+
+BindlessTable::BindlessTable()
+    : _device{}, _capacity{}, _next{}, _frame{} {}
+
+void BindlessTable::init(vk::Device device, uint32_t capacity,
+                         uint32_t framesInFlight) {
+  _device = device;
+  _capacity = capacity;
+  _retired.resize(framesInFlight);
+
+  // NOTE: Update after bind lets slots be written while the set is bound,
+  // and unused while pending lets that happen with frames still in flight
+  vk::DescriptorBindingFlags bindingFlags =
+      vk::DescriptorBindingFlagBits::ePartiallyBound |
+      vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+      vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending;
+  vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsCi{1,
+                                                               &bindingFlags};
+
+  vk::DescriptorSetLayoutBinding binding{
+      0, vk::DescriptorType::eCombinedImageSampler, capacity,
+      vk::ShaderStageFlagBits::eFragment};
+
+  vk::DescriptorSetLayoutCreateInfo layoutCi{
+      vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool, 1,
+      &binding};
+  layoutCi.pNext = &bindingFlagsCi;
+  _layout = _device.createDescriptorSetLayoutUnique(layoutCi);
+
+  vk::DescriptorPoolSize poolSize{vk::DescriptorType::eCombinedImageSampler,
+                                  capacity};
+  vk::DescriptorPoolCreateInfo poolCi{
+      vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet |
+          vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+      1, 1, &poolSize};
+  _pool = _device.createDescriptorPoolUnique(poolCi);
+
+  vk::DescriptorSetAllocateInfo allocInfo{_pool.get(), 1, &_layout.get()};
+  _set = std::move(_device.allocateDescriptorSetsUnique(allocInfo)[0]);
+}
+
+void BindlessTable::destroy() {
+  _set = {};
+  _pool = {};
+  _layout = {};
+  _next = 0;
+  _free.clear();
+  for (auto &retired : _retired) {
+    retired.clear();
+  }
+}
+
+uint32_t BindlessTable::add(vk::ImageView imageView, vk::Sampler sampler) {
+  uint32_t slot;
+  if (!_free.empty()) {
+    slot = _free.back();
+    _free.pop_back();
+  } else {
+    if (_next >= _capacity) {
+      std::cerr << "Out of bindless texture slots" << std::endl;
+      abort();
+    }
+    slot = _next++;
+  }
+
+  vk::DescriptorImageInfo imageInfo{sampler, imageView,
+                                    vk::ImageLayout::eShaderReadOnlyOptimal};
+  _device.updateDescriptorSets(
+      vk::WriteDescriptorSet{_set.get(), 0, slot, 1,
+                             vk::DescriptorType::eCombinedImageSampler,
+                             &imageInfo},
+      nullptr);
+
+  return slot;
+}
+
+void BindlessTable::remove(uint32_t slot) {
+  assert(slot < _next);
+  _retired[_frame].push_back(slot);
+}
+
+void BindlessTable::beginFrame(uint32_t frame) {
+  // NOTE: Frames finish in order, so with this one done, so is every frame
+  // that was recorded before the slots here were removed
+  _frame = frame;
+  _free.insert(_free.end(), _retired[frame].begin(), _retired[frame].end());
+  _retired[frame].clear();
+}
+
+vk::DescriptorSetLayout BindlessTable::getLayout() const {
+  return _layout.get();
+}
+
+vk::DescriptorSet BindlessTable::getSet() const { return _set.get(); }
@@ -8,6 +8,7 @@
 #include <algorithm>
 #include <chrono>
 #include <cstdio>
+#include <fstream>
 #include <glm/gtc/type_ptr.hpp>
 #include <ios>
 #include <iostream>
@@ -26,6 +27,9 @@
 #include "glm/ext/matrix_transform.hpp"
 #include "glm/fwd.hpp"
 #include "glm/matrix.hpp"
+#include "mapped_file.hpp"
+#include "mesh_cook.hpp"
+#include "texture_cook.hpp"
 #include "vk_initializers.hpp"
 #include "vk_types.hpp"
 #include "vk_utils.hpp"
@@ -40,14 +44,19 @@
 #define TINYGLTF_NOEXCEPTION  // optional. disable exception handling.
 #include "tiny_gltf.h"
 
-#define DDSKTX_IMPLEMENT
-#include "dds-ktx.h"
-
 vk::UniquePipeline PipelineBuilder::buildPipeline(
-    const vk::Device &device, const vk::RenderPass &renderPass,
+    const vk::Device &device, const vk::PipelineCache &pipelineCache,
+    const vk::RenderPass &renderPass,
     const vk::PipelineLayout &pipelineLayout) {
+  // NOTE: Viewport and scissor are set when drawing, so the pipelines don't
+  // depend on the swapchain extent
   _viewportStateInfo = vk::PipelineViewportStateCreateInfo{
-      vk::PipelineViewportStateCreateFlags{}, 1, &_viewport, 1, &_scissor};
+      vk::PipelineViewportStateCreateFlags{}, 1, nullptr, 1, nullptr};
+
+  vk::DynamicState dynamicStates[] = {vk::DynamicState::eViewport,
+                                      vk::DynamicState::eScissor};
+  vk::PipelineDynamicStateCreateInfo dynamicStateInfo{
+      vk::PipelineDynamicStateCreateFlags{}, 2, dynamicStates};
 
   vk::GraphicsPipelineCreateInfo pipelineInfo{};
   pipelineInfo.stageCount = _stageCount;
@@ -59,19 +68,27 @@ vk::UniquePipeline PipelineBuilder::buildPipeline(
   pipelineInfo.pMultisampleState = &_multisampleInfo;
   pipelineInfo.pDepthStencilState = &_depthStencilInfo;
   pipelineInfo.pColorBlendState = &_colorBlendingInfo;
-  // pipelineInfo.pDynamicState = nullptr;
+  pipelineInfo.pDynamicState = &dynamicStateInfo;
   pipelineInfo.layout = pipelineLayout;
   pipelineInfo.renderPass = renderPass;
   pipelineInfo.subpass =
       0;  // index of subpass where this pipeline will be used
-  auto result = device.createGraphicsPipelineUnique(nullptr, pipelineInfo);
+  auto result =
+      device.createGraphicsPipelineUnique(pipelineCache, pipelineInfo);
   assert(result.result == vk::Result::eSuccess);
 
   return std::move(result.value);
 }
 
 VulkanEngine::VulkanEngine() {}
-VulkanEngine::~VulkanEngine() {}
+VulkanEngine::~VulkanEngine() {
+  // NOTE: Never created when running headless
+  if (_pipelineCache) {
+    vkutils::writePipelineCache(
+        PIPELINE_CACHE_FILE, _deviceProperties,
+        _device->getPipelineCacheData(_pipelineCache.get()));
+  }
+}
 
 void VulkanEngine::init(GLFWwindow *window, DStack &dstack) {
   _dstack = &dstack;
@@ -81,25 +98,34 @@ void VulkanEngine::init(GLFWwindow *window, DStack &dstack) {
   initSurface();
   initPhysicalDevice();
   initLogicalDevice();
+  initPipelineCache();
   initAllocator();
   initCommandPool();
   initQueues();
+  initUploadManager();
   initSwapchain();
   initSwapchainImages(dstack);
-  initDepthImage();
-  initRenderPass();
-  initFramebuffers(dstack);
+  initShadowSampler();
+  initDepthPyramid();
+  initRenderGraph();
 
   initDescriptorPool();
   initDescriptorSetLayout();
+  initTextureTable();
   initPipelines();
   initComputePipelines();
 
   initUniformBuffers();
 
+  initTextureImageSampler();
+  initTextureStreamer();
   initHdrTexture();
   initMesh();
 
+  // NOTE: Everything loaded so far goes up in one batch. Frames are
+  // submitted after it on the graphics queue, so nothing waits for it here.
+  _uploads.submit();
+
   initDrawCommandBuffers();
 
   initDescriptorSets();
@@ -154,12 +180,23 @@ void VulkanEngine::initPhysicalDevice() {
             vkutils::querySwapchainSupport(pd, _surface.get());
 
         auto supportedFeatures = pd.getFeatures();
+        auto vulkan12Features =
+            pd.getFeatures2<vk::PhysicalDeviceFeatures2,
+                            vk::PhysicalDeviceVulkan12Features>()
+                .get<vk::PhysicalDeviceVulkan12Features>();
 
         return queueFamilyIndices.isComplete() &&
                vkutils::checkDeviceExtensionSupport(pd) &&
                !swapChainSupport.formats.empty() &&
                !swapChainSupport.presentModes.empty() &&
-               supportedFeatures.samplerAnisotropy;
+               supportedFeatures.samplerAnisotropy &&
+               vulkan12Features.timelineSemaphore &&
+               vulkan12Features.runtimeDescriptorArray &&
+               vulkan12Features.descriptorBindingPartiallyBound &&
+               vulkan12Features
+                   .descriptorBindingSampledImageUpdateAfterBind &&
+               vulkan12Features.descriptorBindingUpdateUnusedWhilePending &&
+               vulkan12Features.shaderSampledImageArrayNonUniformIndexing;
       });
 
   assert(device != physicalDevices.end());
@@ -167,14 +204,17 @@ void VulkanEngine::initPhysicalDevice() {
 
   _graphicsQueueFamily = queueFamilyIndices.graphicsFamily.value();
   _presentQueueFamily = queueFamilyIndices.presentFamily.value();
+  _transferQueueFamily = vkutils::findTransferQueueFamily(*device).value_or(
+      _graphicsQueueFamily);
   _physicalDevice = *device;
   _deviceProperties = _physicalDevice.getProperties();
+  _textureCompressionBC = _physicalDevice.getFeatures().textureCompressionBC;
 }
 
 void VulkanEngine::initLogicalDevice() {
   std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-  std::set<uint32_t> uniqueQueueFamilies{_graphicsQueueFamily,
-                                         _presentQueueFamily};
+  std::set<uint32_t> uniqueQueueFamilies{
+      _graphicsQueueFamily, _presentQueueFamily, _transferQueueFamily};
 
   float queuePriority = 1.0f;
   for (auto queueFamilyIndex : uniqueQueueFamilies) {
@@ -186,10 +226,22 @@ void VulkanEngine::initLogicalDevice() {
   deviceFeatures.samplerAnisotropy = true;
   deviceFeatures.multiDrawIndirect = true;
   deviceFeatures.sampleRateShading = true;
+  deviceFeatures.textureCompressionBC = _textureCompressionBC;
+
+  // For the upload manager
+  vk::PhysicalDeviceVulkan12Features vulkan12Features{};
+  vulkan12Features.timelineSemaphore = true;
+  // For the bindless texture table
+  vulkan12Features.runtimeDescriptorArray = true;
+  vulkan12Features.descriptorBindingPartiallyBound = true;
+  vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = true;
+  vulkan12Features.descriptorBindingUpdateUnusedWhilePending = true;
+  vulkan12Features.shaderSampledImageArrayNonUniformIndexing = true;
 
   vk::DeviceCreateInfo createInfo(
       vk::DeviceCreateFlags{}, static_cast<uint32_t>(queueCreateInfos.size()),
       queueCreateInfos.data());
+  createInfo.pNext = &vulkan12Features;
 
   createInfo.pEnabledFeatures = &deviceFeatures;
 
@@ -208,6 +260,17 @@ void VulkanEngine::initLogicalDevice() {
   _device = _physicalDevice.createDeviceUnique(createInfo);
 }
 
+void VulkanEngine::initPipelineCache() {
+  auto cacheData =
+      vkutils::readPipelineCache(PIPELINE_CACHE_FILE, _deviceProperties);
+
+  vk::PipelineCacheCreateInfo createInfo{};
+  createInfo.initialDataSize = cacheData.size();
+  createInfo.pInitialData = cacheData.data();
+
+  _pipelineCache = _device->createPipelineCacheUnique(createInfo);
+}
+
 void VulkanEngine::initAllocator() {
   VmaAllocatorCreateInfo allocatorInfo = {};
   allocatorInfo.physicalDevice = _physicalDevice;
@@ -219,6 +282,12 @@ void VulkanEngine::initAllocator() {
 void VulkanEngine::initQueues() {
   _graphicsQueue = _device->getQueue(_graphicsQueueFamily, 0);
   _presentQueue = _device->getQueue(_presentQueueFamily, 0);
+  _transferQueue = _device->getQueue(_transferQueueFamily, 0);
+}
+
+void VulkanEngine::initUploadManager() {
+  _uploads.init(_device.get(), _allocator, _transferQueueFamily,
+                _transferQueue, _graphicsQueueFamily, _graphicsQueue);
 }
 
 void VulkanEngine::initSwapchain() {
@@ -264,6 +333,8 @@ void VulkanEngine::initSwapchain() {
   createInfo.compositeAlpha = vk::CompositeAlphaFlagBitsKHR::eOpaque;
   createInfo.presentMode = presentMode;
   createInfo.clipped = VK_TRUE;
+  // Lets the driver hand over resources from the one being replaced
+  createInfo.oldSwapchain = _swapchain.get();
 
   _swapchainExtent = extent;
   _swapchainImageFormat = surfaceFormat.format;
@@ -272,81 +343,42 @@ void VulkanEngine::initSwapchain() {
 
 void VulkanEngine::initSwapchainImages(DStack &dstack) {
   auto swapchainImages = _device->getSwapchainImagesKHR(_swapchain.get());
+  assert(swapchainImages.size() <= MAX_SWAPCHAIN_IMAGES);
+
+  // NOTE: Allocated once with room for as many as we'll ever get, so
+  // recreating the swapchain doesn't grow the stack
+  if (!_swapchainImages) {
+    _swapchainImages = dstack.alloc<vk::Image, StackDirection::Bottom>(
+        sizeof(vk::Image) * MAX_SWAPCHAIN_IMAGES);
+    _swapchainImageViews =
+        dstack.alloc<vk::UniqueImageView, StackDirection::Bottom>(
+            sizeof(vk::UniqueImageView) * MAX_SWAPCHAIN_IMAGES);
+
+    for (size_t i{}; i < MAX_SWAPCHAIN_IMAGES; i++) {
+      new (&_swapchainImageViews[i]) vk::UniqueImageView{};
+    }
+  }
 
   _nSwapchainImages = swapchainImages.size();
-  _swapchainImages = dstack.alloc<vk::UniqueImage, StackDirection::Bottom>(
-      sizeof(vk::UniqueImage) * swapchainImages.size());
-
   for (size_t i{}; i < _nSwapchainImages; i++) {
-    new (&_swapchainImages[i]) vk::UniqueImage{swapchainImages[i]};
+    _swapchainImages[i] = swapchainImages[i];
   }
 
   _nSwapchainImageViews = _nSwapchainImages;
-  _swapchainImageViews =
-      dstack.alloc<vk::UniqueImageView, StackDirection::Bottom>(
-          sizeof(vk::UniqueImageView) * _nSwapchainImageViews);
-
   for (size_t i{}; i < _nSwapchainImageViews; i++) {
     vk::ImageViewCreateInfo createInfo{
         vk::ImageViewCreateFlags{},
-        _swapchainImages[i].get(),
+        _swapchainImages[i],
         vk::ImageViewType::e2D,
         _swapchainImageFormat,
         vk::ComponentMapping{},
         vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1}};
 
-    new (&_swapchainImageViews[i])
-        vk::UniqueImageView(_device->createImageViewUnique(createInfo));
-    // _swapchainImageViews[i] = _device->createImageView(createInfo);
+    _swapchainImageViews[i] = _device->createImageViewUnique(createInfo);
   }
 }
 
-void VulkanEngine::initDepthImage() {
-  // Depth image used for final render
-  auto depthFormat = vkutils::findDepthFormat(_physicalDevice);
-
-  vk::ImageCreateInfo imageCi(
-      {}, vk::ImageType::e2D, depthFormat,
-      vk::Extent3D{_swapchainExtent.width, _swapchainExtent.height, 1}, 1, 1,
-      vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
-      vk::ImageUsageFlagBits::eDepthStencilAttachment,
-      vk::SharingMode::eExclusive);
-
-  vkutils::allocateImage(_allocator, imageCi, VMA_MEMORY_USAGE_GPU_ONLY,
-                         _depthImage);
-
-  vk::ImageViewCreateInfo imageViewCi{
-      vk::ImageViewCreateFlags{},
-      _depthImage._image,
-      vk::ImageViewType::e2D,
-      depthFormat,
-      vk::ComponentMapping{},
-      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1}};
-
-  _depthImageView = _device->createImageViewUnique(imageViewCi);
-
-  // Depth image used for shadow mapping
-  vk::ImageCreateInfo shadowImageCi(
-      {}, vk::ImageType::e2D, depthFormat, vk::Extent3D{2048, 2048, 1}, 1, 1,
-      vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
-      vk::ImageUsageFlagBits::eDepthStencilAttachment |
-          vk::ImageUsageFlagBits::eSampled,
-      vk::SharingMode::eExclusive);
-
-  vkutils::allocateImage(_allocator, shadowImageCi, VMA_MEMORY_USAGE_GPU_ONLY,
-                         _shadowDepthImage);
-
-  vk::ImageViewCreateInfo shadowImageViewCi{
-      vk::ImageViewCreateFlags{},
-      _shadowDepthImage._image,
-      vk::ImageViewType::e2D,
-      depthFormat,
-      vk::ComponentMapping{},
-      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eDepth, 0, 1, 0, 1}};
-
-  _shadowDepthImageView = _device->createImageViewUnique(shadowImageViewCi);
-
-  // Sampler
+void VulkanEngine::initShadowSampler() {
   vk::SamplerCreateInfo samplerCi{};
   samplerCi.magFilter = vk::Filter::eLinear;
   samplerCi.minFilter = vk::Filter::eLinear;
@@ -371,93 +403,212 @@ void VulkanEngine::initDepthImage() {
   _shadowDepthImageSampler = _device->createSamplerUnique(samplerCi);
 }
 
-void VulkanEngine::initRenderPass() {
-  vk::SubpassDependency forwardPassDependencies{
-      VK_SUBPASS_EXTERNAL,
-      0,
-      vk::PipelineStageFlagBits::eColorAttachmentOutput |
-          vk::PipelineStageFlagBits::eEarlyFragmentTests,
-      vk::PipelineStageFlagBits::eColorAttachmentOutput |
-          vk::PipelineStageFlagBits::eEarlyFragmentTests,
+void VulkanEngine::initDepthPyramid() {
+  if (_depthPyramid._image) {
+    _depthPyramidView = {};
+    _depthPyramidMipViews = {};
+    vmaDestroyImage(_allocator, _depthPyramid._image,
+                    _depthPyramid._allocation);
+  }
+
+  // NOTE: Level 0 is the size of the depth buffer, so the first reduction
+  // is a straight copy and every level after it is exactly half
+  _depthPyramidLevels = std::min(
+      vkutils::getMipLevels(_swapchainExtent.width, _swapchainExtent.height),
+      MAX_PYRAMID_LEVELS);
+
+  vk::ImageCreateInfo imageCi{
       {},
-      vk::AccessFlagBits::eColorAttachmentWrite |
-          vk::AccessFlagBits::eDepthStencilAttachmentWrite};
-
-  _forwardPass =
-      vkinit::buildRenderPass(_device.get(), true, _swapchainImageFormat,
-                              vkutils::findDepthFormat(_physicalDevice),
-                              vk::AttachmentStoreOp::eDontCare,
-                              vk::ImageLayout::eDepthStencilAttachmentOptimal,
-                              &forwardPassDependencies, 1);
-
-  std::array<vk::SubpassDependency, 2> shadowPassDependencies;
-  shadowPassDependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-  shadowPassDependencies[0].dstSubpass = 0;
-  shadowPassDependencies[0].srcStageMask =
-      vk::PipelineStageFlagBits::eFragmentShader;
-  shadowPassDependencies[0].dstStageMask =
-      vk::PipelineStageFlagBits::eEarlyFragmentTests;
-  shadowPassDependencies[0].srcAccessMask = vk::AccessFlagBits::eShaderRead;
-  shadowPassDependencies[0].dstAccessMask =
-      vk::AccessFlagBits::eDepthStencilAttachmentWrite;
-  shadowPassDependencies[0].dependencyFlags = vk::DependencyFlagBits::eByRegion;
-
-  shadowPassDependencies[1].srcSubpass = 0;
-  shadowPassDependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-  shadowPassDependencies[1].srcStageMask =
-      vk::PipelineStageFlagBits::eLateFragmentTests;
-  shadowPassDependencies[1].dstStageMask =
-      vk::PipelineStageFlagBits::eFragmentShader;
-  shadowPassDependencies[1].srcAccessMask =
-      vk::AccessFlagBits::eDepthStencilAttachmentWrite;
-  shadowPassDependencies[1].dstAccessMask = vk::AccessFlagBits::eShaderRead;
-  shadowPassDependencies[1].dependencyFlags = vk::DependencyFlagBits::eByRegion;
-
-  _shadowPass = vkinit::buildRenderPass(
-      _device.get(), false, {}, vkutils::findDepthFormat(_physicalDevice),
-      vk::AttachmentStoreOp::eStore,
-      vk::ImageLayout::eDepthStencilReadOnlyOptimal,
-      shadowPassDependencies.data(), shadowPassDependencies.size());
-}
+      vk::ImageType::e2D,
+      vk::Format::eR32Sfloat,
+      vk::Extent3D{_swapchainExtent.width, _swapchainExtent.height, 1},
+      _depthPyramidLevels,
+      1,
+      vk::SampleCountFlagBits::e1,
+      vk::ImageTiling::eOptimal,
+      vk::ImageUsageFlagBits::eStorage | vk::ImageUsageFlagBits::eSampled |
+          vk::ImageUsageFlagBits::eTransferDst,
+      vk::SharingMode::eExclusive};
 
-void VulkanEngine::initFramebuffers(DStack &dstack) {
-  // Final render framebuffer
-  _nFramebuffers = _nSwapchainImageViews;
-  _framebuffers = dstack.alloc<vk::UniqueFramebuffer, StackDirection::Bottom>(
-      sizeof(vk::UniqueFramebuffer) * _nFramebuffers);
-
-  for (size_t i{}; i < _nFramebuffers; i++) {
-    std::array<vk::ImageView, 2> attachments = {_swapchainImageViews[i].get(),
-                                                _depthImageView.get()};
-
-    vk::FramebufferCreateInfo createInfo{};
-    createInfo.renderPass = _forwardPass.get();
-    createInfo.attachmentCount = 2;
-    createInfo.pAttachments = attachments.data();
-    createInfo.width = _swapchainExtent.width;
-    createInfo.height = _swapchainExtent.height;
-    createInfo.layers = 1;
-
-    // NOTE: Need to use placement-new in order to construct the Unique
-    // classes into preallocated memory, else the destructor will be called
-    // at the end of scope
-    //
-    // However, this means that I have to explicitly call the destructor of
-    // these objects, I think. Will have to experiment a bit with that.
-    new (&_framebuffers[i])
-        vk::UniqueFramebuffer{_device->createFramebufferUnique(createInfo)};
+  vkutils::allocateImage(_allocator, imageCi, VMA_MEMORY_USAGE_GPU_ONLY,
+                         _depthPyramid);
+
+  vk::ImageViewCreateInfo viewCi{
+      vk::ImageViewCreateFlags{},
+      _depthPyramid._image,
+      vk::ImageViewType::e2D,
+      vk::Format::eR32Sfloat,
+      vk::ComponentMapping{},
+      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0,
+                                _depthPyramidLevels, 0, 1}};
+  _depthPyramidView = _device->createImageViewUnique(viewCi);
+
+  // One per level, for the reduction to write to
+  for (uint32_t i{}; i < _depthPyramidLevels; i++) {
+    viewCi.subresourceRange.baseMipLevel = i;
+    viewCi.subresourceRange.levelCount = 1;
+    _depthPyramidMipViews[i] = _device->createImageViewUnique(viewCi);
+  }
+
+  if (!_depthPyramidSampler) {
+    vk::SamplerCreateInfo samplerCi{};
+    samplerCi.magFilter = vk::Filter::eNearest;
+    samplerCi.minFilter = vk::Filter::eNearest;
+    samplerCi.mipmapMode = vk::SamplerMipmapMode::eNearest;
+    samplerCi.addressModeU = vk::SamplerAddressMode::eClampToEdge;
+    samplerCi.addressModeV = vk::SamplerAddressMode::eClampToEdge;
+    samplerCi.addressModeW = vk::SamplerAddressMode::eClampToEdge;
+    samplerCi.minLod = 0.0f;
+    samplerCi.maxLod = static_cast<float>(MAX_PYRAMID_LEVELS);
+
+    _depthPyramidSampler = _device->createSamplerUnique(samplerCi);
   }
-  // Shadow map framebuffer
+
+  // Nothing is occluded until the first frame has built it. Recorded with
+  // the uploads, on the graphics queue ahead of any frame.
+  _uploads.record([this](vk::CommandBuffer cmd) {
+    rg::transition(cmd, _depthPyramid._image, vk::ImageAspectFlagBits::eColor,
+                   _depthPyramidLevels, rg::Access::None,
+                   rg::Access::TransferDst);
+
+    cmd.clearColorImage(
+        _depthPyramid._image, vk::ImageLayout::eTransferDstOptimal,
+        vk::ClearColorValue{std::array<float, 4>{1.0f, 1.0f, 1.0f, 1.0f}},
+        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0,
+                                  _depthPyramidLevels, 0, 1});
+
+    rg::transition(cmd, _depthPyramid._image, vk::ImageAspectFlagBits::eColor,
+                   _depthPyramidLevels, rg::Access::TransferDst,
+                   rg::Access::SampledCompute);
+  });
+}
+
+void VulkanEngine::initRenderGraph() {
+  auto depthFormat = vkutils::findDepthFormat(_physicalDevice);
+
+  _rgSwapchainImage = _renderGraph.importImage(
+      "swapchain image",
+      rg::ImageDesc{
+          .format = _swapchainImageFormat,
+          .extent = _swapchainExtent,
+          .aspect = vk::ImageAspectFlagBits::eColor,
+          .clearValue = vk::ClearColorValue{std::array<float, 4>{
+              0.0f, 0.0f, 0.0f, 0.0f}}},
+      rg::Access::Acquired, rg::Access::Present);
+
+  // Every draw, as set up by setupDrawables. The culling passes write the
+  // ones that are actually drawn into the early and late buffers.
+  _rgIndirectCommands = _renderGraph.importBuffer(
+      "indirect commands", rg::Access::None, rg::Access::IndirectRead);
+  _rgEarlyCommands = _renderGraph.importBuffer(
+      "early draw commands", rg::Access::None, rg::Access::IndirectRead);
+  _rgLateCommands = _renderGraph.importBuffer(
+      "late draw commands", rg::Access::None, rg::Access::IndirectRead);
+
+  _rgDepthPyramid = _renderGraph.importImage(
+      "depth pyramid",
+      rg::ImageDesc{.format = vk::Format::eR32Sfloat,
+                    .extent = _swapchainExtent,
+                    .aspect = vk::ImageAspectFlagBits::eColor},
+      rg::Access::SampledCompute, rg::Access::SampledCompute);
+
   // TODO: Width and height
-  vk::FramebufferCreateInfo createInfo{};
-  createInfo.renderPass = _shadowPass.get();
-  createInfo.attachmentCount = 1;
-  createInfo.pAttachments = &_shadowDepthImageView.get();
-  createInfo.width = 2048;
-  createInfo.height = 2048;
-  createInfo.layers = 1;
-
-  _depthFramebuffer = _device->createFramebufferUnique(createInfo);
+  _rgShadowMap = _renderGraph.createImage(
+      "shadow map",
+      rg::ImageDesc{.format = depthFormat,
+                    .extent = vk::Extent2D{2048, 2048},
+                    .aspect = vk::ImageAspectFlagBits::eDepth,
+                    .clearValue = vk::ClearDepthStencilValue{1.0f, 0}});
+
+  _rgDepthImage = _renderGraph.createImage(
+      "depth",
+      rg::ImageDesc{.format = depthFormat,
+                    .extent = _swapchainExtent,
+                    .aspect = vk::ImageAspectFlagBits::eDepth,
+                    .clearValue = vk::ClearDepthStencilValue{1.0f, 0}});
+
+  if (_depthPrepassEnabled) {
+    // NOTE: Two phase occlusion culling. What was visible against last
+    // frame's pyramid is drawn first, then the pyramid is rebuilt from that
+    // depth and whatever it rejected gets tested again.
+    _renderGraph.addPass(
+        "cull early",
+        {{_rgIndirectCommands, rg::Access::StorageReadCompute},
+         {_rgDepthPyramid, rg::Access::SampledCompute},
+         {_rgEarlyCommands, rg::Access::StorageWriteCompute}},
+        [this](vk::CommandBuffer cmd) { cullDraws(cmd, CULL_EARLY); });
+
+    _depthPrepass = _renderGraph.addPass(
+        "depth prepass early",
+        {{_rgDepthImage, rg::Access::DepthAttachment},
+         {_rgEarlyCommands, rg::Access::IndirectRead}},
+        [this](vk::CommandBuffer cmd) {
+          drawDepth(cmd, _frames[_currentFrame]._earlyCommandBuffer._buffer);
+        });
+
+    _renderGraph.addPass("hi-z",
+                         {{_rgDepthImage, rg::Access::SampledCompute},
+                          {_rgDepthPyramid, rg::Access::StorageWriteCompute}},
+                         [this](vk::CommandBuffer cmd) {
+                           buildDepthPyramid(cmd);
+                         });
+
+    _renderGraph.addPass(
+        "cull late",
+        {{_rgIndirectCommands, rg::Access::StorageReadCompute},
+         {_rgDepthPyramid, rg::Access::SampledCompute},
+         {_rgEarlyCommands, rg::Access::StorageReadCompute},
+         {_rgLateCommands, rg::Access::StorageWriteCompute}},
+        [this](vk::CommandBuffer cmd) { cullDraws(cmd, CULL_LATE); });
+
+    _renderGraph.addPass(
+        "depth prepass late",
+        {{_rgDepthImage, rg::Access::DepthAttachment},
+         {_rgLateCommands, rg::Access::IndirectRead}},
+        [this](vk::CommandBuffer cmd) {
+          drawDepth(cmd, _frames[_currentFrame]._lateCommandBuffer._buffer);
+        });
+  } else {
+    _renderGraph.addPass(
+        "cull",
+        {{_rgIndirectCommands, rg::Access::StorageReadCompute},
+         {_rgEarlyCommands, rg::Access::StorageWriteCompute}},
+        [this](vk::CommandBuffer cmd) { cullDraws(cmd, CULL_FRUSTUM); });
+  }
+
+  // NOTE: Shadow casters can be off screen, so these aren't culled
+  _shadowPass = _renderGraph.addPass(
+      "shadow",
+      {{_rgShadowMap, rg::Access::DepthAttachment},
+       {_rgIndirectCommands, rg::Access::IndirectRead}},
+      [this](vk::CommandBuffer cmd) { drawShadows(cmd); });
+
+  if (_depthPrepassEnabled) {
+    _forwardPass = _renderGraph.addPass(
+        "forward",
+        {{_rgSwapchainImage, rg::Access::ColorAttachment},
+         {_rgDepthImage, rg::Access::DepthRead},
+         {_rgShadowMap, rg::Access::SampledFragment},
+         {_rgEarlyCommands, rg::Access::IndirectRead},
+         {_rgLateCommands, rg::Access::IndirectRead}},
+        [this](vk::CommandBuffer cmd) {
+          drawSkybox(cmd);
+          drawObjects(cmd);
+        });
+  } else {
+    _forwardPass = _renderGraph.addPass(
+        "forward",
+        {{_rgSwapchainImage, rg::Access::ColorAttachment},
+         {_rgDepthImage, rg::Access::DepthAttachment},
+         {_rgShadowMap, rg::Access::SampledFragment},
+         {_rgEarlyCommands, rg::Access::IndirectRead}},
+        [this](vk::CommandBuffer cmd) {
+          drawSkybox(cmd);
+          drawObjects(cmd);
+        });
+  }
+
+  _renderGraph.compile(_device.get(), _allocator);
 }
 
 void VulkanEngine::initCommandPool() {
@@ -465,7 +616,6 @@ void VulkanEngine::initCommandPool() {
       vk::CommandPoolCreateFlagBits::eResetCommandBuffer};
   createInfo.queueFamilyIndex = _graphicsQueueFamily;
   _commandPool = _device->createCommandPoolUnique(createInfo);
-  _immediateCommandPool = _device->createCommandPoolUnique(createInfo);
 }
 
 // TODO: Shader reflectance
@@ -500,8 +650,35 @@ void VulkanEngine::initDescriptorSetLayout() {
   cameraBufferBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
   cameraBufferBinding.pImmutableSamplers = nullptr;
 
-  std::array<vk::DescriptorSetLayoutBinding, 3> computeBindings = {
-      indirectDrawBufferBinding, objectBufferBinding, cameraBufferBinding};
+  // Every draw, before culling
+  vk::DescriptorSetLayoutBinding sourceDrawBufferBinding{};
+  sourceDrawBufferBinding.binding = 3;
+  sourceDrawBufferBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  sourceDrawBufferBinding.descriptorCount = 1;
+  sourceDrawBufferBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  sourceDrawBufferBinding.pImmutableSamplers = nullptr;
+
+  // What the early phase drew
+  vk::DescriptorSetLayoutBinding earlyDrawBufferBinding{};
+  earlyDrawBufferBinding.binding = 4;
+  earlyDrawBufferBinding.descriptorType = vk::DescriptorType::eStorageBuffer;
+  earlyDrawBufferBinding.descriptorCount = 1;
+  earlyDrawBufferBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  earlyDrawBufferBinding.pImmutableSamplers = nullptr;
+
+  // Depth pyramid
+  vk::DescriptorSetLayoutBinding depthPyramidBinding{};
+  depthPyramidBinding.binding = 5;
+  depthPyramidBinding.descriptorType =
+      vk::DescriptorType::eCombinedImageSampler;
+  depthPyramidBinding.descriptorCount = 1;
+  depthPyramidBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  depthPyramidBinding.pImmutableSamplers = nullptr;
+
+  std::array<vk::DescriptorSetLayoutBinding, 6> computeBindings = {
+      indirectDrawBufferBinding, objectBufferBinding,
+      cameraBufferBinding,       sourceDrawBufferBinding,
+      earlyDrawBufferBinding,    depthPyramidBinding};
   vk::DescriptorSetLayoutCreateInfo computeCreateInfo{};
   computeCreateInfo.bindingCount =
       static_cast<uint32_t>(computeBindings.size());
@@ -510,6 +687,37 @@ void VulkanEngine::initDescriptorSetLayout() {
   _computeDescriptorSetLayout =
       _device->createDescriptorSetLayoutUnique(computeCreateInfo);
 
+  /*
+  **
+  ** Depth Pyramid Set
+  **
+  */
+  // The level above, or the depth buffer
+  vk::DescriptorSetLayoutBinding pyramidSrcBinding{};
+  pyramidSrcBinding.binding = 0;
+  pyramidSrcBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  pyramidSrcBinding.descriptorCount = 1;
+  pyramidSrcBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  pyramidSrcBinding.pImmutableSamplers = nullptr;
+
+  // The level being reduced into
+  vk::DescriptorSetLayoutBinding pyramidDstBinding{};
+  pyramidDstBinding.binding = 1;
+  pyramidDstBinding.descriptorType = vk::DescriptorType::eStorageImage;
+  pyramidDstBinding.descriptorCount = 1;
+  pyramidDstBinding.stageFlags = vk::ShaderStageFlagBits::eCompute;
+  pyramidDstBinding.pImmutableSamplers = nullptr;
+
+  std::array<vk::DescriptorSetLayoutBinding, 2> pyramidBindings = {
+      pyramidSrcBinding, pyramidDstBinding};
+  vk::DescriptorSetLayoutCreateInfo pyramidCreateInfo{};
+  pyramidCreateInfo.bindingCount =
+      static_cast<uint32_t>(pyramidBindings.size());
+  pyramidCreateInfo.pBindings = pyramidBindings.data();
+
+  _depthPyramidDescriptorSetLayout =
+      _device->createDescriptorSetLayoutUnique(pyramidCreateInfo);
+
   /*
   **
   ** Global Set
@@ -570,18 +778,14 @@ void VulkanEngine::initDescriptorSetLayout() {
   ** Texture Set
   **
   */
-  // Texture sampler
-  // NOTE: For now, we'll use the first one to bind our
-  // shadow pass depth attachment
-  // TODO: Move the shadow attachment into its own binding
-  vk::DescriptorSetLayoutBinding samplerLayoutBinding{};
-  samplerLayoutBinding.binding = 0;
-  samplerLayoutBinding.descriptorType =
-      vk::DescriptorType::eCombinedImageSampler;
-  // TODO: Set some max number of samples we can load
-  samplerLayoutBinding.descriptorCount = MAX_TEXTURES;
-  samplerLayoutBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
-  samplerLayoutBinding.pImmutableSamplers = nullptr;
+  // Shadow pass depth attachment. Model textures are in the bindless
+  // texture table, set 3.
+  vk::DescriptorSetLayoutBinding shadowMapBinding{};
+  shadowMapBinding.binding = 0;
+  shadowMapBinding.descriptorType = vk::DescriptorType::eCombinedImageSampler;
+  shadowMapBinding.descriptorCount = 1;
+  shadowMapBinding.stageFlags = vk::ShaderStageFlagBits::eFragment;
+  shadowMapBinding.pImmutableSamplers = nullptr;
 
   vk::DescriptorSetLayoutBinding hdrTextureBinding{};
   hdrTextureBinding.binding = 1;
@@ -593,7 +797,7 @@ void VulkanEngine::initDescriptorSetLayout() {
   hdrTextureBinding.pImmutableSamplers = nullptr;
 
   std::array<vk::DescriptorSetLayoutBinding, 2> textureBindings = {
-      samplerLayoutBinding, hdrTextureBinding};
+      shadowMapBinding, hdrTextureBinding};
   vk::DescriptorSetLayoutCreateInfo textureCreateInfo{};
   textureCreateInfo.bindingCount =
       static_cast<uint32_t>(textureBindings.size());
@@ -603,14 +807,19 @@ void VulkanEngine::initDescriptorSetLayout() {
       _device->createDescriptorSetLayoutUnique(textureCreateInfo);
 }
 
+void VulkanEngine::initTextureTable() {
+  _textureTable.init(_device.get(), MAX_BINDLESS_TEXTURES,
+                     MAX_FRAMES_IN_FLIGHT);
+}
+
 void VulkanEngine::initPipelines() {
   // Pipeline Layout
   vk::PipelineLayoutCreateInfo createInfo{};
   vk::DescriptorSetLayout setLayouts[] = {
       _globalDescriptorSetLayout.get(), _objectDescriptorSetLayout.get(),
-      _singleTextureDescriptorSetLayout.get()};
+      _singleTextureDescriptorSetLayout.get(), _textureTable.getLayout()};
 
-  createInfo.setLayoutCount = 3;
+  createInfo.setLayoutCount = 4;
   createInfo.pSetLayouts = setLayouts;
 
   vk::PipelineLayoutCreateInfo shadowLayoutCi{};
@@ -670,12 +879,6 @@ void VulkanEngine::initPipelines() {
       vk::PipelineInputAssemblyStateCreateFlags{},
       vk::PrimitiveTopology::eTriangleList, false};
 
-  vk::Viewport viewport{
-      0.0f, 0.0f, (float)_swapchainExtent.width, (float)_swapchainExtent.height,
-      0.0f, 1.0f};
-
-  vk::Rect2D scissor = {vk::Offset2D{0, 0}, _swapchainExtent};
-
   vk::PipelineRasterizationStateCreateInfo rasterizationInfo{
       vk::PipelineRasterizationStateCreateFlags{},
       false,
@@ -696,13 +899,44 @@ void VulkanEngine::initPipelines() {
   pipelineBuilder._depthStencilInfo = depthStencilInfo;
   pipelineBuilder._vertexInputInfo = vertexInputInfo;
   pipelineBuilder._inputAssemblyInfo = inputAssemblyInfo;
-  pipelineBuilder._viewport = viewport;
-  pipelineBuilder._scissor = scissor;
   pipelineBuilder._rasterizationInfo = rasterizationInfo;
   pipelineBuilder._multisampleInfo = multisampleInfo;
 
+  if (_depthPrepassEnabled) {
+    // NOTE: Depth is already in there, only shade what matches it
+    pipelineBuilder._depthStencilInfo.depthWriteEnable = false;
+    pipelineBuilder._depthStencilInfo.depthCompareOp =
+        vk::CompareOp::eLessOrEqual;
+  }
+
   _pipelines[0] = pipelineBuilder.buildPipeline(
-      _device.get(), _forwardPass.get(), _pipelineLayouts[0].get());
+      _device.get(), _pipelineCache.get(),
+      _renderGraph.getRenderPass(_forwardPass), _pipelineLayouts[0].get());
+
+  /*
+  **
+  ** Depth Prepass Pipeline
+  **
+  */
+  if (_depthPrepassEnabled) {
+    vertShaderCode = vkutils::readFile("../shaders/depth_vert.spv");
+    vertShaderModule =
+        vkutils::createUniqueShaderModule(_device.get(), vertShaderCode);
+    vertShaderStageInfo.module = vertShaderModule.get();
+
+    PipelineBuilder depthBuilder = pipelineBuilder;
+    depthBuilder._shaderStages[0] = vertShaderStageInfo;
+    depthBuilder._stageCount = 1;
+    depthBuilder._colorBlendingInfo.attachmentCount = 0;
+    depthBuilder._depthStencilInfo.depthWriteEnable = true;
+    depthBuilder._depthStencilInfo.depthCompareOp = vk::CompareOp::eLess;
+    depthBuilder._multisampleInfo = vk::PipelineMultisampleStateCreateInfo{};
+
+    _pipelines[3] = depthBuilder.buildPipeline(
+        _device.get(), _pipelineCache.get(),
+        _renderGraph.getRenderPass(_depthPrepass),
+        _pipelineLayouts[1].get());
+  }
 
   /*
   **
@@ -723,7 +957,8 @@ void VulkanEngine::initPipelines() {
   pipelineBuilder._depthStencilInfo.depthTestEnable = false;
   pipelineBuilder._depthStencilInfo.depthWriteEnable = false;
   _pipelines[1] = pipelineBuilder.buildPipeline(
-      _device.get(), _forwardPass.get(), _pipelineLayouts[0].get());
+      _device.get(), _pipelineCache.get(),
+      _renderGraph.getRenderPass(_forwardPass), _pipelineLayouts[0].get());
 
   /*
   **
@@ -752,23 +987,32 @@ void VulkanEngine::initPipelines() {
   // Default to off
   pipelineBuilder._multisampleInfo = vk::PipelineMultisampleStateCreateInfo{};
 
-  pipelineBuilder._viewport.width = 2048;
-  pipelineBuilder._viewport.height = 2048;
-  pipelineBuilder._scissor.extent = vk::Extent2D{2048, 2048};
-
   _pipelines[2] = pipelineBuilder.buildPipeline(
-      _device.get(), _shadowPass.get(), _pipelineLayouts[1].get());
+      _device.get(), _pipelineCache.get(),
+      _renderGraph.getRenderPass(_shadowPass), _pipelineLayouts[1].get());
 }
 
 void VulkanEngine::initComputePipelines() {
+  vk::PushConstantRange cullPushConstants{vk::ShaderStageFlagBits::eCompute, 0,
+                                          sizeof(CullPushConstants)};
+
   vk::PipelineLayoutCreateInfo layoutCreateInfo{};
   vk::DescriptorSetLayout setLayouts[] = {_computeDescriptorSetLayout.get()};
   layoutCreateInfo.setLayoutCount = 1;
   layoutCreateInfo.pSetLayouts = setLayouts;
+  layoutCreateInfo.pushConstantRangeCount = 1;
+  layoutCreateInfo.pPushConstantRanges = &cullPushConstants;
 
   _computePipelineLayouts[0] =
       _device->createPipelineLayoutUnique(layoutCreateInfo);
 
+  vk::PipelineLayoutCreateInfo pyramidLayoutCreateInfo{};
+  pyramidLayoutCreateInfo.setLayoutCount = 1;
+  pyramidLayoutCreateInfo.pSetLayouts = &_depthPyramidDescriptorSetLayout.get();
+
+  _computePipelineLayouts[1] =
+      _device->createPipelineLayoutUnique(pyramidLayoutCreateInfo);
+
   vk::ComputePipelineCreateInfo pipelineCreateInfo{};
 
   auto computeShaderCode = vkutils::readFile("../shaders/comp.spv");
@@ -780,9 +1024,26 @@ void VulkanEngine::initComputePipelines() {
   pipelineCreateInfo.stage = computeShaderStageInfo;
   pipelineCreateInfo.layout = _computePipelineLayouts[0].get();
 
-  auto result = _device->createComputePipelineUnique({}, pipelineCreateInfo);
+  auto result = _device->createComputePipelineUnique(_pipelineCache.get(),
+                                                      pipelineCreateInfo);
   assert(result.result == vk::Result::eSuccess);
   _computePipelines[0] = std::move(result.value);
+
+  /*
+  **
+  ** Hi-Z Pipeline
+  **
+  */
+  computeShaderCode = vkutils::readFile("../shaders/hiz.spv");
+  computeShaderModule =
+      vkutils::createUniqueShaderModule(_device.get(), computeShaderCode);
+  pipelineCreateInfo.stage.module = computeShaderModule.get();
+  pipelineCreateInfo.layout = _computePipelineLayouts[1].get();
+
+  result = _device->createComputePipelineUnique(_pipelineCache.get(),
+                                                pipelineCreateInfo);
+  assert(result.result == vk::Result::eSuccess);
+  _computePipelines[1] = std::move(result.value);
 }
 
 void VulkanEngine::initUniformBuffers() {
@@ -840,45 +1101,62 @@ void VulkanEngine::initMaterials(const tinygltf::Model &model) {
   // TODO: Optional textures and AO texture
   const std::vector<tinygltf::Material> &materials = model.materials;
 
-  for (size_t i{}; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    void *materialData;
-    vmaMapMemory(_allocator, _frames[i]._materialStorageBuffer._allocation,
-                 &materialData);
-    MaterialBufferObject *materialSSBO = (MaterialBufferObject *)materialData;
-
-    for (size_t y{}; y < materials.size(); y++) {
-      auto baseColorIndex =
-          materials[y].pbrMetallicRoughness.baseColorTexture.index;
-      auto armIndex =
-          materials[y].pbrMetallicRoughness.metallicRoughnessTexture.index;
-      auto emissiveIndex = materials[y].emissiveTexture.index;
-      auto normalIndex = materials[y].normalTexture.index;
-      auto aoIndex = materials[y].occlusionTexture.index;
-
-      // Just store the image source index for now
-      // We don't really care about the differnt sampler types
-      // TODO: Create all the required samplers?
-      // TODO: Handle missing textures
-      materialSSBO[y].albedoTexture =
-          baseColorIndex != -1 ? model.textures[baseColorIndex].source + 1 : 1;
-      materialSSBO[y].armTexture =
-          armIndex != -1 ? model.textures[armIndex].source + 1 : 1;
-      materialSSBO[y].emissiveTexture =
-          aoIndex > -1 ? model.textures[aoIndex].source + 1 : 1;
-      // emissiveIndex != -1 ? model.textures[emissiveIndex].source + 1 : 1;
-      materialSSBO[y].normalTexture =
-          normalIndex != -1 ? model.textures[normalIndex].source + 1 : 1;
-    }
+  _materialTextures.resize(materials.size());
+  for (size_t y{}; y < materials.size(); y++) {
+    auto baseColorIndex =
+        materials[y].pbrMetallicRoughness.baseColorTexture.index;
+    auto armIndex =
+        materials[y].pbrMetallicRoughness.metallicRoughnessTexture.index;
+    auto emissiveIndex = materials[y].emissiveTexture.index;
+    auto normalIndex = materials[y].normalTexture.index;
+    auto aoIndex = materials[y].occlusionTexture.index;
+
+    // Store the image, the streamer has the slot it's at right now
+    // We don't really care about the differnt sampler types
+    // TODO: Create all the required samplers?
+    // TODO: Handle missing textures
+    auto source = [&](int textureIndex) {
+      return textureIndex != -1 ? model.textures[textureIndex].source : 0;
+    };
+    _materialTextures[y].albedoTexture = source(baseColorIndex);
+    _materialTextures[y].armTexture = source(armIndex);
+    _materialTextures[y].emissiveTexture = source(aoIndex);
+    // source(emissiveIndex);
+    _materialTextures[y].normalTexture = source(normalIndex);
+  }
 
-    vmaUnmapMemory(_allocator, _frames[i]._materialStorageBuffer._allocation);
+  for (uint32_t i{}; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    writeMaterials(i);
   }
 }
 
+// NOTE: Only once the frame has been waited for, the GPU reads these
+void VulkanEngine::writeMaterials(uint32_t frame) {
+  void *materialData;
+  vmaMapMemory(_allocator, _frames[frame]._materialStorageBuffer._allocation,
+               &materialData);
+  MaterialBufferObject *materialSSBO = (MaterialBufferObject *)materialData;
+
+  for (size_t y{}; y < _materialTextures.size(); y++) {
+    const MaterialBufferObject &textures = _materialTextures[y];
+    materialSSBO[y].albedoTexture =
+        _textureStreamer.getSlot(textures.albedoTexture);
+    materialSSBO[y].armTexture = _textureStreamer.getSlot(textures.armTexture);
+    materialSSBO[y].emissiveTexture =
+        _textureStreamer.getSlot(textures.emissiveTexture);
+    materialSSBO[y].normalTexture =
+        _textureStreamer.getSlot(textures.normalTexture);
+  }
+
+  vmaUnmapMemory(_allocator, _frames[frame]._materialStorageBuffer._allocation);
+  _frames[frame]._textureVersion = _textureStreamer.getVersion();
+}
+
 void VulkanEngine::initHdrTexture() {
   stbi_set_flip_vertically_on_load(true);
   loadTextureFromFile("../textures/output_skybox.hdr", _hdrTextures[0], false);
   loadTextureFromFile("../textures/output_iem.hdr", _hdrTextures[1], false);
-  loadDdsFromFile("../textures/test.dds", _hdrTextures[2]);
+  loadDdsFromFile("../textures/test.dds", _hdrTextures[2], true);
   // loadTextureFromFile("../textures/output_pmrem.hdr", _hdrTextures[2],
   // false);
   loadTextureFromFile("../textures/ibl_brdf_lut.png", _hdrTextures[3], false);
@@ -905,11 +1183,18 @@ void VulkanEngine::initTextureImageSampler() {
   createInfo.mipmapMode = vk::SamplerMipmapMode::eLinear;
   createInfo.mipLodBias = 0.0f;
   createInfo.minLod = 0.0f;
-  createInfo.maxLod = static_cast<float>(_textures[1].mipLevels);
+  // NOTE: Shared by every texture, so no clamp on the mip count
+  createInfo.maxLod = VK_LOD_CLAMP_NONE;
 
   _textureImageSampler = _device->createSamplerUnique(createInfo);
 }
 
+void VulkanEngine::initTextureStreamer() {
+  _textureStreamer.init(_device.get(), _allocator, _uploads, _textureTable,
+                        _textureImageSampler.get(), TEXTURE_BUDGET,
+                        MAX_FRAMES_IN_FLIGHT);
+}
+
 void VulkanEngine::initTextureDescriptorSet() {
   // Alloc and write texture descriptor sets
   vk::DescriptorSetAllocateInfo dInfo{};
@@ -920,37 +1205,15 @@ void VulkanEngine::initTextureDescriptorSet() {
   _textureDescriptorSet =
       std::move(_device->allocateDescriptorSetsUnique(dInfo)[0]);
 
-  // Populate descriptor with the texture we want
-  std::vector<vk::DescriptorImageInfo> imageInfos{};
-  imageInfos.reserve(MAX_TEXTURES);
-
-  // The shadow pass depth attachment
-  imageInfos.push_back(vk::DescriptorImageInfo{
-      _shadowDepthImageSampler.get(), _shadowDepthImageView.get(),
-      vk::ImageLayout::eDepthStencilReadOnlyOptimal});
-
-  // TODO: Fix this to write some sensible default into all the unused slots
-  for (size_t i{}; i < MAX_TEXTURES - 1; i++) {
-    if (i < _nTextures) {
-      imageInfos.push_back(vk::DescriptorImageInfo{
-          _textureImageSampler.get(), _textures[i].imageView,
-          vk::ImageLayout::eShaderReadOnlyOptimal});
-    } else {
-      imageInfos.push_back(vk::DescriptorImageInfo{
-          _textureImageSampler.get(), _textures[0].imageView,
-          vk::ImageLayout::eShaderReadOnlyOptimal});
-    }
-  }
-
   std::vector<vk::WriteDescriptorSet> descriptorWrites{};
-  descriptorWrites.reserve(_nTextures + 1);
 
-  // Remember that the shadow pass depth attachment is at index == 0
-  for (size_t i = 0; i < imageInfos.size(); i++) {
-    descriptorWrites.push_back(vk::WriteDescriptorSet{
-        _textureDescriptorSet.get(), 0, static_cast<uint32_t>(i), 1,
-        vk::DescriptorType::eCombinedImageSampler, &imageInfos[i]});
-  }
+  // The shadow pass depth attachment
+  vk::DescriptorImageInfo shadowMapInfo{
+      _shadowDepthImageSampler.get(), _renderGraph.getImageView(_rgShadowMap),
+      rg::getState(rg::Access::SampledFragment).layout};
+  descriptorWrites.push_back(vk::WriteDescriptorSet{
+      _textureDescriptorSet.get(), 0, 0, 1,
+      vk::DescriptorType::eCombinedImageSampler, &shadowMapInfo});
 
   // Populate the hdr texture descriptor
   vk::DescriptorImageInfo skyboxInfo{_textureImageSampler.get(),
@@ -986,37 +1249,60 @@ void VulkanEngine::initTextureDescriptorSet() {
 }
 
 void VulkanEngine::initDescriptorPool() {
-  std::array<vk::DescriptorPoolSize, 3> poolSizes{};
+  std::array<vk::DescriptorPoolSize, 4> poolSizes{};
   poolSizes[0].type = vk::DescriptorType::eUniformBuffer;
   poolSizes[0].descriptorCount = 10;
 
   poolSizes[1].type = vk::DescriptorType::eCombinedImageSampler;
-  poolSizes[1].descriptorCount = 10;
+  poolSizes[1].descriptorCount = 10 + MAX_PYRAMID_LEVELS;
 
   poolSizes[2].type = vk::DescriptorType::eStorageBuffer;
-  poolSizes[2].descriptorCount = 10;
+  poolSizes[2].descriptorCount = 30;
+
+  poolSizes[3].type = vk::DescriptorType::eStorageImage;
+  poolSizes[3].descriptorCount = MAX_PYRAMID_LEVELS;
 
   vk::DescriptorPoolCreateInfo createInfo{};
   createInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
   createInfo.pPoolSizes = poolSizes.data();
-  createInfo.maxSets = 10;
+  createInfo.maxSets = 10 + MAX_PYRAMID_LEVELS;
 
   _descriptorPool = _device->createDescriptorPoolUnique(createInfo);
 }
 
 void VulkanEngine::initDescriptorSets() {
-  std::array<vk::DescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> computeLayouts{};
+  // One for each culling phase
+  std::array<vk::DescriptorSetLayout, MAX_FRAMES_IN_FLIGHT * 2>
+      computeLayouts{};
   computeLayouts.fill(_computeDescriptorSetLayout.get());
 
   // Allocate compute descriptor sets
   vk::DescriptorSetAllocateInfo computeAllocInfo{};
   computeAllocInfo.descriptorPool = _descriptorPool.get();
-  computeAllocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+  computeAllocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT * 2;
   computeAllocInfo.pSetLayouts = computeLayouts.data();
 
   auto cds = _device->allocateDescriptorSetsUnique(computeAllocInfo);
   for (size_t i{}; i < MAX_FRAMES_IN_FLIGHT; i++) {
-    _frames[i]._computeDescriptorSet = std::move(cds[i]);
+    _frames[i]._earlyCullDescriptorSet = std::move(cds[i * 2]);
+    _frames[i]._lateCullDescriptorSet = std::move(cds[i * 2 + 1]);
+  }
+
+  // Allocate depth pyramid descriptor sets, one per level it can have
+  // NOTE: Without the prepass the depth buffer is never sampled
+  if (_depthPrepassEnabled) {
+    std::array<vk::DescriptorSetLayout, MAX_PYRAMID_LEVELS> pyramidLayouts{};
+    pyramidLayouts.fill(_depthPyramidDescriptorSetLayout.get());
+
+    vk::DescriptorSetAllocateInfo pyramidAllocInfo{};
+    pyramidAllocInfo.descriptorPool = _descriptorPool.get();
+    pyramidAllocInfo.descriptorSetCount = MAX_PYRAMID_LEVELS;
+    pyramidAllocInfo.pSetLayouts = pyramidLayouts.data();
+
+    auto pds = _device->allocateDescriptorSetsUnique(pyramidAllocInfo);
+    for (size_t i{}; i < MAX_PYRAMID_LEVELS; i++) {
+      _depthPyramidDescriptorSets[i] = std::move(pds[i]);
+    }
   }
 
   std::array<vk::DescriptorSetLayout, MAX_FRAMES_IN_FLIGHT> globalLayouts{};
@@ -1079,34 +1365,69 @@ void VulkanEngine::initDescriptorSets() {
         padUniformBufferSize(sizeof(SceneBufferObject) * i);
     sceneBufferInfo.range = sizeof(SceneBufferObject);
 
-    // Compute descriptors
-    std::array<vk::WriteDescriptorSet, 3> computeDescriptorWrites{};
-
-    computeDescriptorWrites[0].dstSet = _frames[i]._computeDescriptorSet.get();
-    computeDescriptorWrites[0].dstBinding = 0;
-    computeDescriptorWrites[0].dstArrayElement = 0;
-    computeDescriptorWrites[0].descriptorType =
-        vk::DescriptorType::eStorageBuffer;
-    computeDescriptorWrites[0].descriptorCount = 1;
-    computeDescriptorWrites[0].pBufferInfo = &indirectCommandBufferInfo;
-
-    computeDescriptorWrites[1].dstSet = _frames[i]._computeDescriptorSet.get();
-    computeDescriptorWrites[1].dstBinding = 1;
-    computeDescriptorWrites[1].dstArrayElement = 0;
-    computeDescriptorWrites[1].descriptorType =
-        vk::DescriptorType::eStorageBuffer;
-    computeDescriptorWrites[1].descriptorCount = 1;
-    computeDescriptorWrites[1].pBufferInfo = &objectBufferInfo;
+    vk::DescriptorBufferInfo earlyCommandBufferInfo{};
+    earlyCommandBufferInfo.buffer = _frames[i]._earlyCommandBuffer._buffer;
+    earlyCommandBufferInfo.offset = 0;
+    earlyCommandBufferInfo.range = indirectCommandBufferInfo.range;
 
-    computeDescriptorWrites[2].dstSet = _frames[i]._computeDescriptorSet.get();
-    computeDescriptorWrites[2].dstBinding = 2;
-    computeDescriptorWrites[2].dstArrayElement = 0;
-    computeDescriptorWrites[2].descriptorType =
-        vk::DescriptorType::eUniformBuffer;
-    computeDescriptorWrites[2].descriptorCount = 1;
-    computeDescriptorWrites[2].pBufferInfo = &cameraBufferInfo;
+    vk::DescriptorBufferInfo lateCommandBufferInfo{};
+    lateCommandBufferInfo.buffer = _frames[i]._lateCommandBuffer._buffer;
+    lateCommandBufferInfo.offset = 0;
+    lateCommandBufferInfo.range = indirectCommandBufferInfo.range;
 
-    _device->updateDescriptorSets(computeDescriptorWrites, nullptr);
+    // Compute descriptors
+    // NOTE: The early set writes the early buffer, the late one writes the
+    // late buffer and reads what the early one wrote
+    vk::DescriptorSet cullSets[] = {_frames[i]._earlyCullDescriptorSet.get(),
+                                    _frames[i]._lateCullDescriptorSet.get()};
+    vk::DescriptorBufferInfo *outputInfos[] = {&earlyCommandBufferInfo,
+                                               &lateCommandBufferInfo};
+
+    for (size_t phase{}; phase < 2; phase++) {
+      std::array<vk::WriteDescriptorSet, 5> computeDescriptorWrites{};
+
+      computeDescriptorWrites[0].dstSet = cullSets[phase];
+      computeDescriptorWrites[0].dstBinding = 0;
+      computeDescriptorWrites[0].dstArrayElement = 0;
+      computeDescriptorWrites[0].descriptorType =
+          vk::DescriptorType::eStorageBuffer;
+      computeDescriptorWrites[0].descriptorCount = 1;
+      computeDescriptorWrites[0].pBufferInfo = outputInfos[phase];
+
+      computeDescriptorWrites[1].dstSet = cullSets[phase];
+      computeDescriptorWrites[1].dstBinding = 1;
+      computeDescriptorWrites[1].dstArrayElement = 0;
+      computeDescriptorWrites[1].descriptorType =
+          vk::DescriptorType::eStorageBuffer;
+      computeDescriptorWrites[1].descriptorCount = 1;
+      computeDescriptorWrites[1].pBufferInfo = &objectBufferInfo;
+
+      computeDescriptorWrites[2].dstSet = cullSets[phase];
+      computeDescriptorWrites[2].dstBinding = 2;
+      computeDescriptorWrites[2].dstArrayElement = 0;
+      computeDescriptorWrites[2].descriptorType =
+          vk::DescriptorType::eUniformBuffer;
+      computeDescriptorWrites[2].descriptorCount = 1;
+      computeDescriptorWrites[2].pBufferInfo = &cameraBufferInfo;
+
+      computeDescriptorWrites[3].dstSet = cullSets[phase];
+      computeDescriptorWrites[3].dstBinding = 3;
+      computeDescriptorWrites[3].dstArrayElement = 0;
+      computeDescriptorWrites[3].descriptorType =
+          vk::DescriptorType::eStorageBuffer;
+      computeDescriptorWrites[3].descriptorCount = 1;
+      computeDescriptorWrites[3].pBufferInfo = &indirectCommandBufferInfo;
+
+      computeDescriptorWrites[4].dstSet = cullSets[phase];
+      computeDescriptorWrites[4].dstBinding = 4;
+      computeDescriptorWrites[4].dstArrayElement = 0;
+      computeDescriptorWrites[4].descriptorType =
+          vk::DescriptorType::eStorageBuffer;
+      computeDescriptorWrites[4].descriptorCount = 1;
+      computeDescriptorWrites[4].pBufferInfo = &earlyCommandBufferInfo;
+
+      _device->updateDescriptorSets(computeDescriptorWrites, nullptr);
+    }
 
     // Global descriptors
     std::array<vk::WriteDescriptorSet, 2> globalDescriptorWrites{};
@@ -1151,6 +1472,67 @@ void VulkanEngine::initDescriptorSets() {
     // up
     _device->updateDescriptorSets(objectDescriptorWrites, nullptr);
   }
+
+  updateExtentDescriptorSets();
+}
+
+// The shadow map, depth buffer and depth pyramid are all recreated with the
+// swapchain, so everything pointing at them is written again
+void VulkanEngine::updateExtentDescriptorSets() {
+  std::vector<vk::WriteDescriptorSet> descriptorWrites{};
+
+  // The shadow pass depth attachment
+  vk::DescriptorImageInfo shadowMapInfo{
+      _shadowDepthImageSampler.get(), _renderGraph.getImageView(_rgShadowMap),
+      rg::getState(rg::Access::SampledFragment).layout};
+  descriptorWrites.push_back(
+      vk::WriteDescriptorSet{_textureDescriptorSet.get(), 0, 0, 1,
+                             vk::DescriptorType::eCombinedImageSampler,
+                             &shadowMapInfo});
+
+  vk::DescriptorImageInfo depthPyramidInfo{
+      _depthPyramidSampler.get(), _depthPyramidView.get(),
+      rg::getState(rg::Access::SampledCompute).layout};
+  for (size_t i{}; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    vk::DescriptorSet cullSets[] = {_frames[i]._earlyCullDescriptorSet.get(),
+                                    _frames[i]._lateCullDescriptorSet.get()};
+    for (vk::DescriptorSet cullSet : cullSets) {
+      descriptorWrites.push_back(vk::WriteDescriptorSet{
+          cullSet, 5, 0, 1, vk::DescriptorType::eCombinedImageSampler,
+          &depthPyramidInfo});
+    }
+  }
+
+  // NOTE: Level 0 reads the depth buffer, which the graph has in read only
+  // layout. The levels after read the one above, still in general layout
+  // from being written.
+  std::array<vk::DescriptorImageInfo, MAX_PYRAMID_LEVELS> srcInfos{};
+  std::array<vk::DescriptorImageInfo, MAX_PYRAMID_LEVELS> dstInfos{};
+  if (_depthPrepassEnabled) {
+    for (uint32_t i{}; i < _depthPyramidLevels; i++) {
+      srcInfos[i].sampler = _depthPyramidSampler.get();
+      if (i == 0) {
+        srcInfos[i].imageView = _renderGraph.getImageView(_rgDepthImage);
+        srcInfos[i].imageLayout =
+            rg::getState(rg::Access::SampledCompute).layout;
+      } else {
+        srcInfos[i].imageView = _depthPyramidMipViews[i - 1].get();
+        srcInfos[i].imageLayout = vk::ImageLayout::eGeneral;
+      }
+
+      dstInfos[i].imageView = _depthPyramidMipViews[i].get();
+      dstInfos[i].imageLayout = vk::ImageLayout::eGeneral;
+
+      descriptorWrites.push_back(vk::WriteDescriptorSet{
+          _depthPyramidDescriptorSets[i].get(), 0, 0, 1,
+          vk::DescriptorType::eCombinedImageSampler, &srcInfos[i]});
+      descriptorWrites.push_back(vk::WriteDescriptorSet{
+          _depthPyramidDescriptorSets[i].get(), 1, 0, 1,
+          vk::DescriptorType::eStorageImage, &dstInfos[i]});
+    }
+  }
+
+  _device->updateDescriptorSets(descriptorWrites, nullptr);
 }
 
 void VulkanEngine::initDrawCommandBuffers() {
@@ -1173,6 +1555,20 @@ void VulkanEngine::initDrawCommandBuffers() {
                             VMA_MEMORY_USAGE_CPU_TO_GPU,
                             vk::SharingMode::eExclusive,
                             _frames[i]._indirectCommandBuffer);
+
+    // Only ever written by the culling passes
+    vkutils::allocateBuffer(_allocator, indirectBufferSize,
+                            vk::BufferUsageFlagBits::eIndirectBuffer |
+                                vk::BufferUsageFlagBits::eStorageBuffer,
+                            VMA_MEMORY_USAGE_GPU_ONLY,
+                            vk::SharingMode::eExclusive,
+                            _frames[i]._earlyCommandBuffer);
+    vkutils::allocateBuffer(_allocator, indirectBufferSize,
+                            vk::BufferUsageFlagBits::eIndirectBuffer |
+                                vk::BufferUsageFlagBits::eStorageBuffer,
+                            VMA_MEMORY_USAGE_GPU_ONLY,
+                            vk::SharingMode::eExclusive,
+                            _frames[i]._lateCommandBuffer);
   }
 }
 
@@ -1201,9 +1597,8 @@ void VulkanEngine::setupDrawables(
           indirectCommand[commandIndex].indexCount = mesh.indexSize;
           indirectCommand[commandIndex].instanceCount = 1;
           indirectCommand[commandIndex].firstIndex = mesh.indexOffset;
-          // NOTE: This is 0, since we store the offset directly into the
-          // index buffer!
-          indirectCommand[commandIndex].vertexOffset = 0;  // mesh.vertexOffset;
+          // NOTE: Cooked indices start at 0 for every mesh
+          indirectCommand[commandIndex].vertexOffset = mesh.vertexOffset;
           indirectCommand[commandIndex].firstInstance = commandIndex;
 
           commandIndex++;
@@ -1211,6 +1606,8 @@ void VulkanEngine::setupDrawables(
       }
     }
     vmaUnmapMemory(_allocator, _frames[i]._indirectCommandBuffer._allocation);
+
+    _nDrawCommands = static_cast<uint32_t>(commandIndex);
   }
 }
 
@@ -1251,15 +1648,35 @@ void VulkanEngine::initMesh() {
   indexBuffer.push_back(2);
   indexBuffer.push_back(1);
 
-  Model adamHeadModel =
-      loadModelFromFile("../models/mech/scene.gltf", vertexBuffer, indexBuffer);
-  _drawable = std::move(adamHeadModel);
+  MappedFile meshFile;
+  std::vector<uint8_t> meshData;
+  CookedModelView meshes{};
+  if (!loadModelFromFile("../models/mech/scene.gltf", meshFile, meshData,
+                         meshes)) {
+    abort();
+  }
+
+  // The model goes in after the skybox
+  uint32_t firstVertex = static_cast<uint32_t>(vertexBuffer.size());
+  uint32_t firstIndex = static_cast<uint32_t>(indexBuffer.size());
+  _drawable = createModel(meshes, firstVertex, firstIndex);
 
-  size_t vertexBufferSize = sizeof(Vertex) * vertexBuffer.size();
-  size_t indexBufferSize = sizeof(uint32_t) * indexBuffer.size();
+  size_t vertexBufferSize =
+      sizeof(Vertex) * (firstVertex + meshes.header->nVertices);
+  size_t indexBufferSize =
+      sizeof(uint32_t) * (firstIndex + meshes.header->nIndices);
 
   initMeshBuffers(vertexBufferSize, indexBufferSize);
   uploadMeshes(vertexBuffer, indexBuffer);
+
+  // NOTE: Straight from the cooked file into staging. The upload copies
+  // it, so the file can be closed as soon as this returns
+  _uploads.uploadBuffer(_vertexBuffer._buffer, sizeof(Vertex) * firstVertex,
+                        meshes.vertices,
+                        sizeof(Vertex) * meshes.header->nVertices);
+  _uploads.uploadBuffer(_indexBuffer._buffer, sizeof(uint32_t) * firstIndex,
+                        meshes.indices,
+                        sizeof(uint32_t) * meshes.header->nIndices);
 }
 
 // Allocate buffers the size of all loaded meshes
@@ -1281,194 +1698,77 @@ void VulkanEngine::initMeshBuffers(size_t vertexBufferSize,
                           vk::SharingMode::eExclusive, _indexBuffer);
 }
 
-// Fills the vertex and index buffers
-// with all uploaded meshes
+// Fills the start of the vertex and index buffers
+// with meshes built in memory
 void VulkanEngine::uploadMeshes(const std::vector<Vertex> &vertices,
                                 const std::vector<uint32_t> &indices) {
-  // Fill vertex buffer
-  AllocatedBuffer vertexStagingBuffer;
-  vkutils::allocateBuffer(_allocator, _vertexBufferSize,
-                          vk::BufferUsageFlagBits::eTransferSrc,
-                          VMA_MEMORY_USAGE_CPU_TO_GPU,
-                          vk::SharingMode::eExclusive, vertexStagingBuffer);
-
-  // Copy vertex data to staging buffer
-  void *data;
-  vmaMapMemory(_allocator, vertexStagingBuffer._allocation, &data);
-  memcpy(data, vertices.data(), _vertexBufferSize);
-  vmaUnmapMemory(_allocator, vertexStagingBuffer._allocation);
-
-  // Copy staging buffer to vertex buffer
-  vk::BufferCopy copyRegion{0, 0, _vertexBufferSize};
-  immediateSubmit([&](vk::CommandBuffer cmd) {
-    cmd.copyBuffer(vertexStagingBuffer._buffer, _vertexBuffer._buffer,
-                   copyRegion);
-  });
-
-  // Fill index buffer
-  AllocatedBuffer indexStagingBuffer;
-  vkutils::allocateBuffer(_allocator, _indexBufferSize,
-                          vk::BufferUsageFlagBits::eTransferSrc,
-                          VMA_MEMORY_USAGE_CPU_TO_GPU,
-                          vk::SharingMode::eExclusive, indexStagingBuffer);
-
-  vmaMapMemory(_allocator, indexStagingBuffer._allocation, &data);
-  memcpy(data, indices.data(), _indexBufferSize);
-  vmaUnmapMemory(_allocator, indexStagingBuffer._allocation);
-
-  // Copy staging buffer to index buffer
-  immediateSubmit([&](vk::CommandBuffer cmd) {
-    copyRegion = vk::BufferCopy{0, 0, _indexBufferSize};
-    cmd.copyBuffer(indexStagingBuffer._buffer, _indexBuffer._buffer,
-                   copyRegion);
-  });
+  _uploads.uploadBuffer(_vertexBuffer._buffer, 0, vertices.data(),
+                        sizeof(Vertex) * vertices.size());
+  _uploads.uploadBuffer(_indexBuffer._buffer, 0, indices.data(),
+                        sizeof(uint32_t) * indices.size());
 }
 
 /******  UTILS  ******/
 
-// TODO: Submit these things on its own queue in a separate thread
-// Then need to figure out how to transfer ownership and stuff?
-void VulkanEngine::immediateSubmit(
-    std::function<void(vk::CommandBuffer cmd)> &&function) {
-  vk::CommandBufferAllocateInfo allocInfo{_immediateCommandPool.get(),
-                                          vk::CommandBufferLevel::ePrimary, 1};
-
-  auto commandBuffers = _device->allocateCommandBuffersUnique(allocInfo);
-
-  vk::CommandBufferBeginInfo beginInfo{
-      vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
-  commandBuffers[0]->begin(beginInfo);
-
-  function(commandBuffers[0].get());
-
-  commandBuffers[0]->end();
-  vk::SubmitInfo submitInfo{{}, {}, {}, 1, &commandBuffers[0].get()};
-
-  _graphicsQueue.submit({submitInfo});
-  _graphicsQueue.waitIdle();
-
-  _device->resetCommandPool(_immediateCommandPool.get());
-}
-
-void VulkanEngine::transitionImageLayout(const vk::Image &image,
-                                         vk::Format format,
-                                         vk::ImageLayout oldLayout,
-                                         vk::ImageLayout newLayout,
-                                         uint32_t mipLevels) {
-  immediateSubmit([&](vk::CommandBuffer cmd) {
-    vk::ImageMemoryBarrier barrier{
-        {},
-        {},
-        oldLayout,
-        newLayout,
-        VK_QUEUE_FAMILY_IGNORED,
-        VK_QUEUE_FAMILY_IGNORED,
-        image,
-        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, mipLevels,
-                                  0, 1}};
-
-    vk::PipelineStageFlags srcStage, dstStage;
-
-    if (oldLayout == vk::ImageLayout::eUndefined &&
-        newLayout == vk::ImageLayout::eTransferDstOptimal) {
-      barrier.srcAccessMask = {};
-      barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
-
-      srcStage = vk::PipelineStageFlagBits::eTopOfPipe;
-      dstStage = vk::PipelineStageFlagBits::eTransfer;
-    } else if (oldLayout == vk::ImageLayout::eTransferDstOptimal &&
-               newLayout == vk::ImageLayout::eShaderReadOnlyOptimal) {
-      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-      barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-      srcStage = vk::PipelineStageFlagBits::eTransfer;
-      dstStage = vk::PipelineStageFlagBits::eFragmentShader;
-    } else {
-      abort();
-    }
+void VulkanEngine::generateMipmaps(vk::CommandBuffer cmd,
+                                   const vk::Image &image, int32_t texWidth,
+                                   int32_t texHeight, uint32_t mipLevels) {
+  vk::ImageMemoryBarrier barrier{};
+  barrier.image = image;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.subresourceRange =
+      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
+
+  int32_t mipWidth = texWidth;
+  int32_t mipHeight = texHeight;
+
+  for (uint32_t i = 1; i < mipLevels; i++) {
+    barrier.subresourceRange.baseMipLevel = i - 1;
+    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
 
-    cmd.pipelineBarrier(srcStage, dstStage, {}, {}, {}, barrier);
-  });
-}
+    cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                        vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
+                        barrier);
 
-void VulkanEngine::copyBufferToImage(const vk::Buffer &buffer,
-                                     const vk::Image &image, uint32_t width,
-                                     uint32_t height, uint32_t mipLevel) {
-  immediateSubmit([&](vk::CommandBuffer cmd) {
-    vk::BufferImageCopy copyRegion{
-        0,
-        0,
-        0,
-        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, mipLevel, 0,
+    vk::ImageBlit blit{
+        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, i - 1, 0,
                                    1},
-        vk::Offset3D{0, 0, 0},
-        vk::Extent3D{width, height, 1}};
+        {vk::Offset3D{0, 0, 0}, vk::Offset3D{mipWidth, mipHeight, 1}},
+        vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, i, 0, 1},
+        {vk::Offset3D{0, 0, 0},
+         vk::Offset3D{mipWidth > 1 ? mipWidth / 2 : 1,
+                      mipHeight > 1 ? mipHeight / 2 : 1, 1}}};
 
-    cmd.copyBufferToImage(buffer, image, vk::ImageLayout::eTransferDstOptimal,
-                          1, &copyRegion);
-  });
-}
-
-void VulkanEngine::generateMipmaps(const vk::Image &image, int32_t texWidth,
-                                   int32_t texHeight, uint32_t mipLevels) {
-  immediateSubmit([&](vk::CommandBuffer cmd) {
-    vk::ImageMemoryBarrier barrier{};
-    barrier.image = image;
-    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-    barrier.subresourceRange =
-        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1};
-
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++) {
-      barrier.subresourceRange.baseMipLevel = i - 1;
-      barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
-      barrier.newLayout = vk::ImageLayout::eTransferSrcOptimal;
-      barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-      barrier.dstAccessMask = vk::AccessFlagBits::eTransferRead;
-
-      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                          vk::PipelineStageFlagBits::eTransfer, {}, {}, {},
-                          barrier);
-
-      vk::ImageBlit blit{
-          vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, i - 1, 0,
-                                     1},
-          {vk::Offset3D{0, 0, 0}, vk::Offset3D{mipWidth, mipHeight, 1}},
-          vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor, i, 0, 1},
-          {vk::Offset3D{0, 0, 0},
-           vk::Offset3D{mipWidth > 1 ? mipWidth / 2 : 1,
-                        mipHeight > 1 ? mipHeight / 2 : 1, 1}}};
-
-      cmd.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image,
-                    vk::ImageLayout::eTransferDstOptimal, 1, &blit,
-                    vk::Filter::eLinear);
-
-      barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
-      barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-      barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
-      barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
-
-      cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
-                          vk::PipelineStageFlagBits::eFragmentShader, {}, {},
-                          {}, barrier);
-
-      if (mipWidth > 1) mipWidth /= 2;
-      if (mipHeight > 1) mipHeight /= 2;
-    }
+    cmd.blitImage(image, vk::ImageLayout::eTransferSrcOptimal, image,
+                  vk::ImageLayout::eTransferDstOptimal, 1, &blit,
+                  vk::Filter::eLinear);
 
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-    barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+    barrier.oldLayout = vk::ImageLayout::eTransferSrcOptimal;
     barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
-    barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+    barrier.srcAccessMask = vk::AccessFlagBits::eTransferRead;
     barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
 
     cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
                         vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
                         barrier);
-  });
+
+    if (mipWidth > 1) mipWidth /= 2;
+    if (mipHeight > 1) mipHeight /= 2;
+  }
+
+  barrier.subresourceRange.baseMipLevel = mipLevels - 1;
+  barrier.oldLayout = vk::ImageLayout::eTransferDstOptimal;
+  barrier.newLayout = vk::ImageLayout::eShaderReadOnlyOptimal;
+  barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
+  barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+
+  cmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                      vk::PipelineStageFlagBits::eFragmentShader, {}, {}, {},
+                      barrier);
 }
 
 void VulkanEngine::recreateSwapchain() {
@@ -1484,39 +1784,28 @@ void VulkanEngine::recreateSwapchain() {
 
   _device->waitIdle();
 
-  _swapchain = {};
-  initSwapchain();
-
-  // _swapchainImages.clear();
-  // _swapchainImageViews.clear();
-  // initSwapchainImages();
-
-  _forwardPass = {};
-  initRenderPass();
-
-  //_pipelineLayout = {};
-  // initPipelineLayout();
-
-  // TODO: recreate the materials and stuff?
-  _pipelines = {};
-  _pipelineLayouts = {};
-  initPipelines();
-  // initMaterials();
-
-  _depthImage = {};
-  initDepthImage();
+  // NOTE: Only what depends on the size is recreated. Viewport and scissor
+  // are dynamic, and the pipelines work with the graph's new render passes
+  // since they're compatible with the old ones.
+  for (size_t i{}; i < _nSwapchainImageViews; i++) {
+    _swapchainImageViews[i] = {};
+  }
 
-  //_framebuffers.clear();
-  // initFramebuffers();
+  vk::Format oldFormat = _swapchainImageFormat;
+  initSwapchain();
+  initSwapchainImages(*_dstack);
 
-  initUniformBuffers();
+  _renderGraph.reset();
+  initDepthPyramid();
+  _uploads.submit();
+  initRenderGraph();
 
-  _descriptorPool = {};
-  initDescriptorPool();
-
-  initDescriptorSets();
+  // Not when resizing, but e.g. moving to a monitor with another format
+  if (_swapchainImageFormat != oldFormat) {
+    initPipelines();
+  }
 
-  initDrawCommandBuffers();
+  updateExtentDescriptorSets();
 }
 
 void VulkanEngine::updateCameraBuffer(Camera &camera, float deltaTime) {
@@ -1535,6 +1824,10 @@ void VulkanEngine::updateCameraBuffer(Camera &camera, float deltaTime) {
   ubo.proj = projection;
   ubo.proj[1][1] *= -1;
 
+  _projectionScale = projection[1][1];
+
+  _viewProj = ubo.proj * ubo.view;
+
   glm::mat4 projectionT = glm::transpose(projection);
 
   glm::vec4 frustumX =
@@ -1557,13 +1850,17 @@ void VulkanEngine::updateCameraBuffer(Camera &camera, float deltaTime) {
   vmaUnmapMemory(_allocator, _frames[_currentFrame]._cameraBuffer._allocation);
 }
 
+void VulkanEngine::pulseAmbient() { _ambientPulse = 1.0f; }
+
 void VulkanEngine::updateSceneBuffer(float currentTime, float deltaTime) {
   // NOTE: The scene buffer stores the scene data for both frames
   // in one buffer, and uses offsets to write into the correct buffer
   // and likewise offsets in the descriptor for the shader to access the
   // correct buffer data
 
-  _sceneUbo.ambientColor = glm::vec4{0.4f, 0.3f, 0.4f, 1.0f};
+  _sceneUbo.ambientColor = glm::vec4{0.4f, 0.3f, 0.4f, 1.0f} +
+                          glm::vec4{glm::vec3{_ambientPulse}, 0.0f};
+  _ambientPulse = std::max(_ambientPulse - deltaTime * 8.0f, 0.0f);
 
   // Directional light
   glm::vec3 lightPos;
@@ -1646,6 +1943,46 @@ void VulkanEngine::updateObjectBuffer(const bs::GraphicsComponent *entities,
                  _frames[_currentFrame]._objectStorageBuffer._allocation);
 }
 
+// Every mesh asks for its material's textures at the size it's drawn at.
+// That's its bounding sphere on screen, assuming the textures are spread
+// over it once.
+void VulkanEngine::requestTextures(const bs::GraphicsComponent *entities,
+                                   size_t nEntities, const Camera &camera) {
+  float screenHeight = static_cast<float>(_swapchainExtent.height);
+
+  for (size_t i{}; i < nEntities; i++) {
+    const bs::GraphicsComponent &object = entities[i];
+    float scale = std::max({glm::length(glm::vec3{object._transform[0]}),
+                            glm::length(glm::vec3{object._transform[1]}),
+                            glm::length(glm::vec3{object._transform[2]})});
+
+    for (size_t n{}; n < object._model->nNodes; n++) {
+      Node &node = object._model->nodes[n];
+      for (size_t m{}; m < node.nMeshes; m++) {
+        const Mesh &mesh = node.meshes[m];
+        if (mesh.materialIndex >= _materialTextures.size()) continue;
+
+        glm::vec3 center = glm::vec3{
+            object._transform * glm::vec4{glm::vec3{mesh.boundingSphere}, 1.f}};
+        float radius = mesh.boundingSphere.w * scale;
+        float distance = glm::length(center - camera.mPos);
+
+        // NOTE: Inside of it, anything could be right up against the camera
+        float pixels = distance > radius
+                           ? radius / distance * _projectionScale * screenHeight
+                           : screenHeight;
+
+        const MaterialBufferObject &textures =
+            _materialTextures[mesh.materialIndex];
+        _textureStreamer.request(textures.albedoTexture, pixels);
+        _textureStreamer.request(textures.armTexture, pixels);
+        _textureStreamer.request(textures.emissiveTexture, pixels);
+        _textureStreamer.request(textures.normalTexture, pixels);
+      }
+    }
+  }
+}
+
 void VulkanEngine::draw(const bs::GraphicsComponent *entities,
                         size_t numEntities, Camera &camera, double currentTime,
                         float deltaTime) {
@@ -1655,6 +1992,9 @@ void VulkanEngine::draw(const bs::GraphicsComponent *entities,
 
   assert(waitResult == vk::Result::eSuccess);
 
+  _uploads.collect();
+  _textureTable.beginFrame(_currentFrame);
+
   // Aquire next swapchain image
   auto imageIndex = _device->acquireNextImageKHR(
       _swapchain.get(), 1000000000,
@@ -1671,8 +2011,19 @@ void VulkanEngine::draw(const bs::GraphicsComponent *entities,
   ** Buffer updates
   **
   */
+  // NOTE: The pyramid in there is from last frame, so the early cull has
+  // to project with last frame's matrices
+  _occlusionViewProj = _viewProj;
   updateCameraBuffer(camera, deltaTime);
   updateSceneBuffer(currentTime, deltaTime);
+  updateObjectBuffer(entities, numEntities);
+
+  requestTextures(entities, numEntities, camera);
+  _textureStreamer.update(_currentFrame);
+  if (_frames[_currentFrame]._textureVersion !=
+      _textureStreamer.getVersion()) {
+    writeMaterials(_currentFrame);
+  }
 
   /*
   **
@@ -1686,51 +2037,169 @@ void VulkanEngine::draw(const bs::GraphicsComponent *entities,
 
   /*
   **
-  ** Compute Culling
+  ** Render Graph
   **
   */
-  // commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
-  //                            _computePipelines[0].get());
+  // NOTE: Barriers, layout transitions and render passes for everything in
+  // here come from the graph, see initRenderGraph
+  _renderGraph.setImage(_rgSwapchainImage,
+                        _swapchainImages[imageIndex.value],
+                        _swapchainImageViews[imageIndex.value].get());
+  _renderGraph.setImage(_rgDepthPyramid, _depthPyramid._image,
+                        _depthPyramidView.get());
+  _renderGraph.setBuffer(_rgIndirectCommands,
+                         _frames[_currentFrame]._indirectCommandBuffer._buffer);
+  _renderGraph.setBuffer(_rgEarlyCommands,
+                         _frames[_currentFrame]._earlyCommandBuffer._buffer);
+  _renderGraph.setBuffer(_rgLateCommands,
+                         _frames[_currentFrame]._lateCommandBuffer._buffer);
+  _renderGraph.execute(commandBuffer);
 
-  // commandBuffer.bindDescriptorSets(
-  //     vk::PipelineBindPoint::eCompute, _computePipelineLayouts[0].get(), 0,
-  //     _frames[_currentFrame]._computeDescriptorSet.get(), nullptr);
+  commandBuffer.end();
 
-  // uint32_t groupCount = (static_cast<uint32_t>(numEntities) / 256) + 1;
-  // commandBuffer.dispatch(groupCount, 1, 1);
+  /*
+  **
+  ** Submit Draw
+  **
+  */
+  vk::SubmitInfo submitInfo{};
+  vk::Semaphore waitSemaphores[] = {
+      _frames[_currentFrame]._imageAvailableSemaphore.get()};
+  vk::PipelineStageFlags waitStages[] = {
+      vk::PipelineStageFlagBits::eColorAttachmentOutput};
+  submitInfo.waitSemaphoreCount = 1;
+  submitInfo.pWaitSemaphores = waitSemaphores;
+  submitInfo.pWaitDstStageMask = waitStages;
+  submitInfo.commandBufferCount = 1;
+  submitInfo.pCommandBuffers = &commandBuffer;
+
+  vk::Semaphore signalSemaphore[] = {
+      _frames[_currentFrame]._renderFinishedSemaphore.get()};
+  submitInfo.signalSemaphoreCount = 1;
+  submitInfo.pSignalSemaphores = signalSemaphore;
 
-  // vk::BufferMemoryBarrier barrier{
-  //     vk::AccessFlagBits::eShaderWrite,
-  //     vk::AccessFlagBits::eShaderRead,
-  //     _graphicsQueueFamily,
-  //     _graphicsQueueFamily,
-  //     _frames[_currentFrame]._indirectCommandBuffer._buffer,
-  //     {},
-  //     sizeof(DrawIndexedIndirectCommandBufferObject) * MAX_DRAW_COMMANDS};
+  auto resetResult =
+      _device->resetFences(1, &_frames[_currentFrame]._inFlightFence.get());
+  assert(resetResult == vk::Result::eSuccess);
 
-  // commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
-  //                               vk::PipelineStageFlagBits::eVertexShader, {},
-  //                               {}, {barrier}, {});
+  _graphicsQueue.submit(std::array<vk::SubmitInfo, 1>{submitInfo},
+                        _frames[_currentFrame]._inFlightFence.get());
 
   /*
   **
-  ** Shadow Pass
+  ** Present
   **
   */
+  vk::SwapchainKHR swapchains[] = {_swapchain.get()};
+  vk::PresentInfoKHR presentInfo{1, signalSemaphore, 1, swapchains,
+                                 &imageIndex.value};
+
+  auto presentResult = _presentQueue.presentKHR(&presentInfo);
+
+  if (presentResult == vk::Result::eErrorOutOfDateKHR ||
+      presentResult == vk::Result::eSuboptimalKHR || _framebufferResized) {
+    _framebufferResized = false;
+    recreateSwapchain();
+  } else {
+    assert(presentResult == vk::Result::eSuccess);
+  }
+
+  _currentFrame = (_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+}
+
+void VulkanEngine::cullDraws(vk::CommandBuffer commandBuffer,
+                             CullPhase phase) {
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             _computePipelines[0].get());
+
+  vk::DescriptorSet descriptorSet =
+      phase == CULL_LATE ? _frames[_currentFrame]._lateCullDescriptorSet.get()
+                         : _frames[_currentFrame]._earlyCullDescriptorSet.get();
+  commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                   _computePipelineLayouts[0].get(), 0,
+                                   descriptorSet, nullptr);
+
+  CullPushConstants constants{};
+  // NOTE: The late phase tests against the pyramid built this frame
+  constants.occlusionViewProj =
+      phase == CULL_LATE ? _viewProj : _occlusionViewProj;
+  constants.pyramidSize = glm::vec2{_swapchainExtent.width,
+                                    _swapchainExtent.height};
+  constants.drawCount = _nDrawCommands;
+  constants.phase = phase;
+  commandBuffer.pushConstants(_computePipelineLayouts[0].get(),
+                              vk::ShaderStageFlagBits::eCompute, 0,
+                              sizeof(CullPushConstants), &constants);
+
+  uint32_t groupCount = (_nDrawCommands + 255) / 256;
+  commandBuffer.dispatch(groupCount, 1, 1);
+}
+
+void VulkanEngine::drawDepth(vk::CommandBuffer commandBuffer,
+                             vk::Buffer drawCommands) {
+  vk::Viewport viewport{
+      0.0f, 0.0f, (float)_swapchainExtent.width, (float)_swapchainExtent.height,
+      0.0f, 1.0f};
+  commandBuffer.setViewport(0, 1, &viewport);
 
-  // TODO: Maybe these already have sensible default?
-  std::array<vk::ClearValue, 2> clearValues{
-      vk::ClearColorValue{std::array<float, 4>{0.0f, 0.0f, 0.0f, 0.0f}},
-      vk::ClearDepthStencilValue{1.0f, 0}};
+  vk::Rect2D scissor = {vk::Offset2D{0, 0}, _swapchainExtent};
+  commandBuffer.setScissor(0, 1, &scissor);
+
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
+                             _pipelines[3].get());
 
-  vk::RenderPassBeginInfo shadowPassInfo{
-      _shadowPass.get(), _depthFramebuffer.get(),
-      vk::Rect2D{vk::Offset2D{0, 0}, vk::Extent2D{2048, 2048}}};
-  shadowPassInfo.clearValueCount = 1;
-  shadowPassInfo.pClearValues = &clearValues[1];
+  // Bind the global descriptor set
+  commandBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics, _pipelineLayouts[1].get(), 0,
+      _frames[_currentFrame]._globalDescriptorSet.get(), nullptr);
 
-  commandBuffer.beginRenderPass(shadowPassInfo, vk::SubpassContents::eInline);
+  // Bind the object descriptor set
+  commandBuffer.bindDescriptorSets(
+      vk::PipelineBindPoint::eGraphics, _pipelineLayouts[1].get(), 1,
+      _frames[_currentFrame]._objectDescriptorSet.get(), nullptr);
+
+  commandBuffer.bindVertexBuffers(0, {_vertexBuffer._buffer}, {0});
+  commandBuffer.bindIndexBuffer(_indexBuffer._buffer, 0,
+                                vk::IndexType::eUint32);
+
+  uint32_t drawStride = sizeof(DrawIndexedIndirectCommandBufferObject);
+  commandBuffer.drawIndexedIndirect(drawCommands, 0, _nDrawCommands,
+                                    drawStride);
+}
+
+void VulkanEngine::buildDepthPyramid(vk::CommandBuffer commandBuffer) {
+  commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute,
+                             _computePipelines[1].get());
+
+  for (uint32_t i{}; i < _depthPyramidLevels; i++) {
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute,
+                                     _computePipelineLayouts[1].get(), 0,
+                                     _depthPyramidDescriptorSets[i].get(),
+                                     nullptr);
+
+    uint32_t width = std::max(_swapchainExtent.width >> i, 1u);
+    uint32_t height = std::max(_swapchainExtent.height >> i, 1u);
+    commandBuffer.dispatch((width + 15) / 16, (height + 15) / 16, 1);
+
+    // NOTE: The graph only sees the pass, so the next level waiting for this
+    // one is up to us
+    vk::ImageMemoryBarrier barrier{
+        vk::AccessFlagBits::eShaderWrite,
+        vk::AccessFlagBits::eShaderRead,
+        vk::ImageLayout::eGeneral,
+        vk::ImageLayout::eGeneral,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        _depthPyramid._image,
+        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, i, 1, 0,
+                                  1}};
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader,
+                                  vk::PipelineStageFlagBits::eComputeShader,
+                                  {}, {}, {}, barrier);
+  }
+}
 
+void VulkanEngine::drawShadows(vk::CommandBuffer commandBuffer) {
   vk::Viewport viewport{0.0f, 0.0f, (float)2048, (float)2048, 0.0f, 1.0f};
   commandBuffer.setViewport(0, 1, &viewport);
 
@@ -1756,38 +2225,19 @@ void VulkanEngine::draw(const bs::GraphicsComponent *entities,
 
   uint32_t drawStride = sizeof(DrawIndexedIndirectCommandBufferObject);
   commandBuffer.drawIndexedIndirect(
-      _frames[_currentFrame]._indirectCommandBuffer._buffer, 0, numEntities,
+      _frames[_currentFrame]._indirectCommandBuffer._buffer, 0, _nDrawCommands,
       drawStride);
+}
 
-  commandBuffer.endRenderPass();
-
-  /*
-  **
-  ** Forward Pass
-  **
-  */
-  vk::RenderPassBeginInfo forwardPassInfo{
-      _forwardPass.get(), _framebuffers[imageIndex.value].get(),
-      vk::Rect2D{vk::Offset2D{0, 0}, vk::Extent2D{_swapchainExtent}}};
-
-  forwardPassInfo.clearValueCount = 2;
-  forwardPassInfo.pClearValues = clearValues.data();
-
-  commandBuffer.beginRenderPass(forwardPassInfo, vk::SubpassContents::eInline);
-
-  vk::Viewport viewport2{
+void VulkanEngine::drawSkybox(vk::CommandBuffer commandBuffer) {
+  vk::Viewport viewport{
       0.0f, 0.0f, (float)_swapchainExtent.width, (float)_swapchainExtent.height,
       0.0f, 1.0f};
-  commandBuffer.setViewport(0, 1, &viewport2);
+  commandBuffer.setViewport(0, 1, &viewport);
 
-  vk::Rect2D scissor2 = {vk::Offset2D{0, 0}, _swapchainExtent};
-  commandBuffer.setScissor(0, 1, &scissor2);
+  vk::Rect2D scissor = {vk::Offset2D{0, 0}, _swapchainExtent};
+  commandBuffer.setScissor(0, 1, &scissor);
 
-  /*
-  **
-  ** Skybox rendering
-  **
-  */
   commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
                              _pipelines[1].get());
   // Bind the global descriptor set
@@ -1800,93 +2250,36 @@ void VulkanEngine::draw(const bs::GraphicsComponent *entities,
       vk::PipelineBindPoint::eGraphics, _pipelineLayouts[0].get(), 1,
       _frames[_currentFrame]._objectDescriptorSet.get(), nullptr);
 
-  // Bind the texture descriptor array
+  // Bind the shadow map and hdr textures, and the bindless texture table
+  vk::DescriptorSet textureSets[] = {_textureDescriptorSet.get(),
+                                     _textureTable.getSet()};
   commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics,
-                                   _pipelineLayouts[0].get(), 2,
-                                   _textureDescriptorSet.get(), nullptr);
+                                   _pipelineLayouts[0].get(), 2, textureSets,
+                                   nullptr);
   commandBuffer.drawIndexed(6, 1, 0, 0, 0);
-
-  /*
-  **
-  ** PBR rendering
-  **
-  */
-  drawObjects(entities, numEntities, commandBuffer, currentTime);
-
-  commandBuffer.endRenderPass();
-  commandBuffer.end();
-
-  /*
-  **
-  ** Submit Draw
-  **
-  */
-  vk::SubmitInfo submitInfo{};
-  vk::Semaphore waitSemaphores[] = {
-      _frames[_currentFrame]._imageAvailableSemaphore.get()};
-  vk::PipelineStageFlags waitStages[] = {
-      vk::PipelineStageFlagBits::eColorAttachmentOutput};
-  submitInfo.waitSemaphoreCount = 1;
-  submitInfo.pWaitSemaphores = waitSemaphores;
-  submitInfo.pWaitDstStageMask = waitStages;
-  submitInfo.commandBufferCount = 1;
-  submitInfo.pCommandBuffers = &commandBuffer;
-
-  vk::Semaphore signalSemaphore[] = {
-      _frames[_currentFrame]._renderFinishedSemaphore.get()};
-  submitInfo.signalSemaphoreCount = 1;
-  submitInfo.pSignalSemaphores = signalSemaphore;
-
-  auto resetResult =
-      _device->resetFences(1, &_frames[_currentFrame]._inFlightFence.get());
-  assert(resetResult == vk::Result::eSuccess);
-
-  _graphicsQueue.submit(std::array<vk::SubmitInfo, 1>{submitInfo},
-                        _frames[_currentFrame]._inFlightFence.get());
-
-  /*
-  **
-  ** Present
-  **
-  */
-  vk::SwapchainKHR swapchains[] = {_swapchain.get()};
-  vk::PresentInfoKHR presentInfo{1, signalSemaphore, 1, swapchains,
-                                 &imageIndex.value};
-
-  auto presentResult = _presentQueue.presentKHR(&presentInfo);
-
-  if (presentResult == vk::Result::eErrorOutOfDateKHR ||
-      presentResult == vk::Result::eSuboptimalKHR || _framebufferResized) {
-    _framebufferResized = false;
-    recreateSwapchain();
-  } else {
-    assert(presentResult == vk::Result::eSuccess);
-  }
-
-  _currentFrame = (_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
-void VulkanEngine::drawObjects(const bs::GraphicsComponent *entities,
-                               size_t nEntities,
-                               vk::CommandBuffer commandBuffer,
-                               double currentTime) {
-  updateObjectBuffer(entities, nEntities);
-
+void VulkanEngine::drawObjects(vk::CommandBuffer commandBuffer) {
   // Bind the uber pipeline
-  // NOTE: This pipeline is similar enough to the shadow pass one
-  // that we don't need to rebind the global and object descriptor sets
+  // NOTE: This pipeline is similar enough to the skybox one
+  // that we don't need to rebind the descriptor sets
   commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics,
                              _pipelines[0].get());
 
   // TODO: Multiple binds for multiple pipelines and whatnot
   uint32_t drawStride = sizeof(DrawIndexedIndirectCommandBufferObject);
 
-  // TODO: We don't want to max out the number of draws every frame
-  // This can be fixed using drawIndirectCount where the GPU controls
-  // the number of draw calls we do.
+  // NOTE: Culled draws are still there, with an instance count of 0.
+  // drawIndirectCount would let the GPU skip them entirely.
   commandBuffer.drawIndexedIndirect(
-      _frames[_currentFrame]._indirectCommandBuffer._buffer, 0,
-      MAX_DRAW_COMMANDS, drawStride);
+      _frames[_currentFrame]._earlyCommandBuffer._buffer, 0, _nDrawCommands,
+      drawStride);
+
+  if (_depthPrepassEnabled) {
+    commandBuffer.drawIndexedIndirect(
+        _frames[_currentFrame]._lateCommandBuffer._buffer, 0, _nDrawCommands,
+        drawStride);
+  }
 }
 
 size_t VulkanEngine::padUniformBufferSize(size_t originalSize) {
@@ -1901,60 +2294,44 @@ size_t VulkanEngine::padUniformBufferSize(size_t originalSize) {
 }
 
 // TODO: Use sampler info from gltf to create a more correct image sampler
-void VulkanEngine::loadTexture(const tinygltf::Image &image,
-                               Texture &outTexture) {
-  vk::DeviceSize imageSize = image.width * image.height * 4;
-  outTexture.mipLevels = vkutils::getMipLevels(image.width, image.height);
-
-  AllocatedBuffer stagingBuffer{};
-  vkutils::allocateBuffer(
-      _allocator, imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-      VMA_MEMORY_USAGE_CPU_TO_GPU, vk::SharingMode::eExclusive, stagingBuffer);
-
-  void *data;
-  vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
-  memcpy(data, image.image.data(), static_cast<size_t>(imageSize));
-  vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+void VulkanEngine::loadTexture(uint32_t width, uint32_t height,
+                               const std::vector<std::vector<uint8_t>> &mips,
+                               Texture &outTexture, bool srgb) {
+  outTexture.mipLevels = static_cast<uint32_t>(mips.size());
+  vk::Format format =
+      srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
 
   vk::ImageCreateInfo imageCreateInfo{
       {},
       vk::ImageType::e2D,
-      vk::Format::eR8G8B8A8Srgb,
-      vk::Extent3D{static_cast<uint32_t>(image.width),
-                   static_cast<uint32_t>(image.height), 1},
+      format,
+      vk::Extent3D{width, height, 1},
       outTexture.mipLevels,
       1,
       vk::SampleCountFlagBits::e1,
       vk::ImageTiling::eOptimal,
-      vk::ImageUsageFlagBits::eTransferSrc |
-          vk::ImageUsageFlagBits::eTransferDst |
-          vk::ImageUsageFlagBits::eSampled,
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
       vk::SharingMode::eExclusive};
 
   vkutils::allocateImage(_allocator, imageCreateInfo, VMA_MEMORY_USAGE_GPU_ONLY,
                          outTexture.image);
 
-  transitionImageLayout(outTexture.image._image, vk::Format::eB8G8R8A8Srgb,
-                        vk::ImageLayout::eUndefined,
-                        vk::ImageLayout::eTransferDstOptimal,
-                        outTexture.mipLevels);
-
-  copyBufferToImage(stagingBuffer._buffer, outTexture.image._image,
-                    static_cast<uint32_t>(image.width),
-                    static_cast<uint32_t>(image.height), 0);
-
-  generateMipmaps(outTexture.image._image, static_cast<uint32_t>(image.width),
-                  static_cast<uint32_t>(image.height), outTexture.mipLevels);
+  std::vector<ImageLevel> levels{};
+  for (uint32_t mip{}; mip < outTexture.mipLevels; mip++) {
+    levels.push_back(ImageLevel{mip, std::max(width >> mip, 1u),
+                                std::max(height >> mip, 1u), mips[mip].data(),
+                                mips[mip].size()});
+  }
 
-  vmaDestroyBuffer(_allocator, stagingBuffer._buffer,
-                   stagingBuffer._allocation);
+  _uploads.uploadImage(outTexture.image._image, outTexture.mipLevels, levels,
+                       rg::Access::SampledFragment);
 
   // Texture image view
   vk::ImageViewCreateInfo imageViewCi{
       vk::ImageViewCreateFlags{},
       outTexture.image._image,
       vk::ImageViewType::e2D,
-      vk::Format::eR8G8B8A8Srgb,
+      format,
       vk::ComponentMapping{},
       vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0,
                                 outTexture.mipLevels, 0, 1}};
@@ -1962,110 +2339,56 @@ void VulkanEngine::loadTexture(const tinygltf::Image &image,
   outTexture.imageView = _device->createImageView(imageViewCi);
 }
 
-void VulkanEngine::loadDdsFromFile(const std::string &filename,
-                                   Texture &outTexture) {
-  // TODO: Get dstack pointer and reset after
-  // texture data is no longer needed
-  //
-  // Read binary file into buffer
-  char *contents;
-  std::ifstream istr(filename, std::ios::binary);
-  std::streamsize streamSize{};
-  auto stackMarker = _dstack->getMarkerBottom();
-
-  if (istr) {
-    std::streambuf *pbuf = istr.rdbuf();
-    streamSize = pbuf->pubseekoff(0, istr.end);
-    pbuf->pubseekoff(0, istr.beg);  // rewind
-
-    contents = _dstack->alloc<char, StackDirection::Bottom>(streamSize);
-    pbuf->sgetn(contents, streamSize);
-
-    istr.close();
+bool VulkanEngine::loadDdsFromFile(const std::string &filename,
+                                   Texture &outTexture, bool srgb) {
+  DdsImage dds{};
+  if (!readDds(filename, srgb, dds)) {
+    return false;
   }
 
-  // Parse the dds file
-  ddsktx_texture_info tc = {0};
-  if (ddsktx_parse(&tc, contents, streamSize, NULL)) {
-    outTexture.mipLevels = tc.num_mips;
-
-    // Create the image
-    vk::ImageCreateInfo imageCreateInfo{
-        {},
-        vk::ImageType::e2D,
-        vk::Format::eR8G8B8A8Srgb,
-        vk::Extent3D{static_cast<uint32_t>(tc.width),
-                     static_cast<uint32_t>(tc.height), 1},
-        static_cast<uint32_t>(tc.num_mips),
-        1,
-        vk::SampleCountFlagBits::e1,
-        vk::ImageTiling::eOptimal,
-        vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
-        vk::SharingMode::eExclusive};
-
-    vkutils::allocateImage(_allocator, imageCreateInfo,
-                           VMA_MEMORY_USAGE_GPU_ONLY, outTexture.image);
-
-    transitionImageLayout(outTexture.image._image, vk::Format::eB8G8R8A8Srgb,
-                          vk::ImageLayout::eUndefined,
-                          vk::ImageLayout::eTransferDstOptimal,
-                          outTexture.mipLevels);
-
-    // For each mip level, allocate staging buffer,
-    // copy file data to buffer, copy staging buffer
-    // to image buffer.
-    // TODO: Do this in one single copy buffer to image command?
-    for (int mip = 0; mip < tc.num_mips; mip++) {
-      // TODO: Allocated buffer should hold a unique buffer
-      // so that it gets deallocated at end of scope
-      ddsktx_sub_data sub_data;
-      ddsktx_get_sub(&tc, &sub_data, contents, streamSize, 0, 0, mip);
-
-      if (ddsktx_format_compressed(tc.format)) {
-        std::cerr << "Compressed textures not supported :(" << std::endl;
-        abort();
-      }
-
-      vk::DeviceSize imageSize = sub_data.width * sub_data.height * 4;
-
-      AllocatedBuffer stagingBuffer{};
-      vkutils::allocateBuffer(_allocator, imageSize,
-                              vk::BufferUsageFlagBits::eTransferSrc,
-                              VMA_MEMORY_USAGE_CPU_TO_GPU,
-                              vk::SharingMode::eExclusive, stagingBuffer);
+  if (dds.compressed && !_textureCompressionBC) {
+    std::cerr << filename << ": Block compression isn't supported"
+              << std::endl;
+    return false;
+  }
 
-      void *data;
-      vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
-      memcpy(data, sub_data.buff, static_cast<size_t>(imageSize));
-      vmaUnmapMemory(_allocator, stagingBuffer._allocation);
+  outTexture.mipLevels = dds.mipLevels;
 
-      copyBufferToImage(stagingBuffer._buffer, outTexture.image._image,
-                        static_cast<uint32_t>(sub_data.width),
-                        static_cast<uint32_t>(sub_data.height), mip);
+  // Create the image
+  vk::ImageCreateInfo imageCreateInfo{
+      {},
+      vk::ImageType::e2D,
+      dds.format,
+      vk::Extent3D{dds.width, dds.height, 1},
+      dds.mipLevels,
+      1,
+      vk::SampleCountFlagBits::e1,
+      vk::ImageTiling::eOptimal,
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+      vk::SharingMode::eExclusive};
 
-      vmaDestroyBuffer(_allocator, stagingBuffer._buffer,
-                       stagingBuffer._allocation);
-    }
+  vkutils::allocateImage(_allocator, imageCreateInfo,
+                         VMA_MEMORY_USAGE_GPU_ONLY, outTexture.image);
 
-    transitionImageLayout(outTexture.image._image, vk::Format::eB8G8R8A8Srgb,
-                          vk::ImageLayout::eTransferDstOptimal,
-                          vk::ImageLayout::eShaderReadOnlyOptimal,
-                          outTexture.mipLevels);
+  // NOTE: All the levels go up with a single copy, block compressed ones
+  // are copied a row of 4x4 blocks at a time
+  _uploads.uploadImage(outTexture.image._image, outTexture.mipLevels,
+                       dds.levels, rg::Access::SampledFragment,
+                       dds.compressed ? 4 : 1);
 
-    // Texture image view
-    vk::ImageViewCreateInfo imageViewCi{
-        vk::ImageViewCreateFlags{},
-        outTexture.image._image,
-        vk::ImageViewType::e2D,
-        vk::Format::eR8G8B8A8Srgb,
-        vk::ComponentMapping{},
-        vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0,
-                                  outTexture.mipLevels, 0, 1}};
+  // Texture image view
+  vk::ImageViewCreateInfo imageViewCi{
+      vk::ImageViewCreateFlags{},
+      outTexture.image._image,
+      vk::ImageViewType::e2D,
+      dds.format,
+      vk::ComponentMapping{},
+      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0,
+                                outTexture.mipLevels, 0, 1}};
 
-    outTexture.imageView = _device->createImageView(imageViewCi);
+  outTexture.imageView = _device->createImageView(imageViewCi);
 
-    _dstack->freeBottomToMarker(stackMarker);
-  }
+  return true;
 }
 
 void VulkanEngine::loadTextureFromFile(const std::string &filename,
@@ -2081,16 +2404,6 @@ void VulkanEngine::loadTextureFromFile(const std::string &filename,
 
   assert(pixels);
 
-  AllocatedBuffer stagingBuffer{};
-  vkutils::allocateBuffer(
-      _allocator, imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-      VMA_MEMORY_USAGE_CPU_TO_GPU, vk::SharingMode::eExclusive, stagingBuffer);
-
-  void *data;
-  vmaMapMemory(_allocator, stagingBuffer._allocation, &data);
-  memcpy(data, pixels, static_cast<size_t>(imageSize));
-  vmaUnmapMemory(_allocator, stagingBuffer._allocation);
-
   vk::ImageCreateInfo imageCreateInfo{
       {},
       vk::ImageType::e2D,
@@ -2109,23 +2422,17 @@ void VulkanEngine::loadTextureFromFile(const std::string &filename,
   vkutils::allocateImage(_allocator, imageCreateInfo, VMA_MEMORY_USAGE_GPU_ONLY,
                          texture.image);
 
-  transitionImageLayout(texture.image._image, vk::Format::eB8G8R8A8Srgb,
-                        vk::ImageLayout::eUndefined,
-                        vk::ImageLayout::eTransferDstOptimal,
-                        texture.mipLevels);
-
-  copyBufferToImage(stagingBuffer._buffer, texture.image._image,
-                    static_cast<uint32_t>(texWidth),
-                    static_cast<uint32_t>(texHeight), 0);
+  _uploads.uploadImage(texture.image._image, texture.mipLevels,
+                       {{0, static_cast<uint32_t>(texWidth),
+                         static_cast<uint32_t>(texHeight), pixels, imageSize}},
+                       shouldGenMipmaps ? rg::Access::TransferDst
+                                        : rg::Access::SampledFragment);
 
   if (shouldGenMipmaps) {
-    generateMipmaps(texture.image._image, static_cast<uint32_t>(texWidth),
-                    static_cast<uint32_t>(texHeight), texture.mipLevels);
-  } else {
-    transitionImageLayout(texture.image._image, vk::Format::eB8G8R8A8Srgb,
-                          vk::ImageLayout::eTransferDstOptimal,
-                          vk::ImageLayout::eShaderReadOnlyOptimal,
-                          texture.mipLevels);
+    _uploads.record([this, image = texture.image._image, texWidth, texHeight,
+                     mipLevels = texture.mipLevels](vk::CommandBuffer cmd) {
+      generateMipmaps(cmd, image, texWidth, texHeight, mipLevels);
+    });
   }
 
   // Texture image view
@@ -2142,266 +2449,191 @@ void VulkanEngine::loadTextureFromFile(const std::string &filename,
   stbi_image_free(pixels);
 }
 
-// Load all the model images and upload them to the GPU
+// What an image that couldn't be decoded is drawn with. White leaves the
+// material's factors as they are, and the normal points straight out.
+static std::vector<uint8_t> getDefaultPixel(TextureUsage usage) {
+  if (usage == TextureUsage::Normal) {
+    return {128, 128, 255, 255};
+  }
+  return {255, 255, 255, 255};
+}
+
+// Load all the model images and hand them to the texture streamer
 // in the same order that they are stored in the model
 // This is important since our materials hold indices into
-// this array
+// the streamer
 //
-// NOTE: The reason we need to hold these textures in memory
-// is because we need to be able to destroy the image and image views
-// when they are no longer in use.
-void VulkanEngine::loadGltfTextures(const tinygltf::Model &model) {
-  _nTextures = model.images.size();
-  _textures = _dstack->alloc<Texture, StackDirection::Bottom>(sizeof(Texture) *
-                                                              _nTextures);
-
-  size_t i{};
+// NOTE: Only the smallest mips are uploaded here, the streamer reads
+// the rest from the cooked files once they're drawn big enough
+void VulkanEngine::loadGltfTextures(
+    const tinygltf::Model &model, const std::string &directory,
+    const std::vector<std::vector<uint8_t>> &sources) {
+  // Normal maps and data aren't color, so they're read as they are
+  std::vector<TextureUsage> usages = getImageUsages(model);
+
   for (size_t i{}; i < model.images.size(); i++) {
-    const tinygltf::Image &image = model.images[i];
+    bool srgb = usages[i] == TextureUsage::Color;
+    uint64_t key = getTextureKey(sources[i], usages[i]);
+    std::string cooked = getCookedTexturePath(directory, key, false);
+
+    // Compressed by texconv if it's been run, then what an earlier start
+    // cooked. If neither is there, it's cooked now for the next one.
+    if ((_textureCompressionBC &&
+         _textureStreamer.add(getCookedTexturePath(directory, key, true),
+                              srgb)) ||
+        _textureStreamer.add(cooked, srgb)) {
+      continue;
+    }
+
+    TextureImage image{};
+    if (!decodeImage(sources[i], image)) {
+      // NOTE: Materials index the streamer by image, so the slot still has
+      // to be filled. Nothing is cooked, the next start tries again.
+      std::cerr << "Couldn't decode image " << i << " " << model.images[i].uri
+                << ", using a default texture" << std::endl;
+      Texture texture;
+      loadTexture(1, 1, {getDefaultPixel(usages[i])}, texture, srgb);
+      _textureStreamer.add(texture);
+      continue;
+    }
+
+    uint32_t width = image.width;
+    uint32_t height = image.height;
+    std::vector<std::vector<uint8_t>> mips{};
+    for (TextureImage &mip : generateMips(std::move(image), usages[i])) {
+      mips.push_back(std::move(mip.pixels));
+    }
+
+    if (writeDds(cooked,
+                 srgb ? DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+                      : DXGI_FORMAT_R8G8B8A8_UNORM,
+                 width, height, mips) &&
+        _textureStreamer.add(cooked, srgb)) {
+      continue;
+    }
+
+    // NOTE: Without a cooked file there's nothing to stream from, so all
+    // of it goes up now
     Texture texture;
-    loadTexture(image, texture);
-    _textures[i] = std::move(texture);
+    loadTexture(width, height, mips, texture, srgb);
+    _textureStreamer.add(texture);
   }
 
-  initTextureImageSampler();
   initTextureDescriptorSet();
 }
 
-void VulkanEngine::loadGltfNode(const tinygltf::Model &input,
-                                const tinygltf::Node &node,
-                                std::vector<Vertex> &vertexBuffer,
-                                std::vector<uint32_t> &indexBuffer,
-                                Model &model, Node *parent) {
-  Node outputNode{};
+bool VulkanEngine::loadModelFromFile(const std::string &filename,
+                                     MappedFile &meshFile,
+                                     std::vector<uint8_t> &meshData,
+                                     CookedModelView &meshes) {
+  std::string warn, err;
 
-  // NOTE: This was wrong. We were setting the parent to be the local
-  // address on the stack, which will be freed at the end of this function.
-  // We need to set this to be the address on the stack.
-  //
-  // We probably want to do some smart pointer stuff or SOMETHING
-  // here to make this a bit easier to understand
-  outputNode.parent = parent;
-  outputNode.matrix = glm::mat4{1.0f};
-
-  // Get the local node matrix
-  // It's either made up from translation, rotation, scale or a 4x4 matrix
-  if (node.translation.size() == 3) {
-    outputNode.matrix = glm::translate(
-        outputNode.matrix, glm::vec3(glm::make_vec3(node.translation.data())));
-  }
-  if (node.rotation.size() == 4) {
-    glm::quat q = glm::make_quat(node.rotation.data());
-    outputNode.matrix *= glm::mat4(q);
+  /*
+  **
+  ** GLTF Loading
+  **
+  */
+  // NOTE: Read here rather than by tinygltf, since the text is part of the
+  // cooked model key
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Couldn't open gltf file " << filename << std::endl;
+    return false;
   }
-  if (node.scale.size() == 3) {
-    outputNode.matrix = glm::scale(
-        outputNode.matrix, glm::vec3(glm::make_vec3(node.scale.data())));
+  std::string gltf{std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>()};
+  std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+  // NOTE: Cooked by meshcook, or by us the first time the model is loaded
+  uint64_t key = getModelKey(gltf, directory);
+  std::string cooked = getCookedModelPath(directory, key);
+  bool isCooked =
+      meshFile.open(cooked) &&
+      viewCookedModel(meshFile.getData(), meshFile.getSize(), key, meshes);
+  if (!isCooked) {
+    meshFile.close();
   }
-  if (node.matrix.size() == 16) {
-    outputNode.matrix = glm::make_mat4x4(node.matrix.data());
-  };
-
-  // If the node contains mesh data, we load vertices and indices from the
-  // buffers In glTF this is done via accessors and buffer views
-  if (node.mesh > -1) {
-    const auto &mesh = input.meshes[node.mesh];
-
-    // Allocate room for the meshes
-    outputNode.nMeshes = mesh.primitives.size();
-    outputNode.meshes = _dstack->alloc<Mesh, StackDirection::Bottom>(
-        sizeof(Mesh) * outputNode.nMeshes);
-
-    for (const auto &primitive : mesh.primitives) {
-      std::vector<glm::vec3>
-          vertexPositions{};  // Used for calculation bounding sphere
-      uint32_t vertexStart = static_cast<uint32_t>(vertexBuffer.size());
-      uint32_t indexStart = static_cast<uint32_t>(indexBuffer.size());
-
-      Mesh outputMesh{};
-
-      outputMesh.vertexOffset = vertexStart;
-      outputMesh.indexOffset = indexStart;
-      outputMesh.materialIndex = primitive.material;
-
-      // Vertices
-      {
-        const float *positionBuffer;
-        const float *normalBuffer;
-        const float *texcoordsBuffer;
-        const float *tangentBuffer;
-        size_t vertexCount = 0;
-
-        if (primitive.attributes.find("POSITION") !=
-            primitive.attributes.end()) {
-          const tinygltf::Accessor &accessor =
-              input.accessors[primitive.attributes.find("POSITION")->second];
-          const tinygltf::BufferView &view =
-              input.bufferViews[accessor.bufferView];
-          positionBuffer = reinterpret_cast<const float *>(
-              &(input.buffers[view.buffer]
-                    .data[accessor.byteOffset + view.byteOffset]));
-          vertexCount = accessor.count;
-          outputMesh.vertexSize = static_cast<uint32_t>(vertexCount);
-        }
-
-        if (primitive.attributes.find("NORMAL") != primitive.attributes.end()) {
-          const tinygltf::Accessor &accessor =
-              input.accessors[primitive.attributes.find("NORMAL")->second];
-          const tinygltf::BufferView &view =
-              input.bufferViews[accessor.bufferView];
-          normalBuffer = reinterpret_cast<const float *>(
-              &(input.buffers[view.buffer]
-                    .data[accessor.byteOffset + view.byteOffset]));
-        }
-
-        if (primitive.attributes.find("TEXCOORD_0") !=
-            primitive.attributes.end()) {
-          const tinygltf::Accessor &accessor =
-              input.accessors[primitive.attributes.find("TEXCOORD_0")->second];
-          const tinygltf::BufferView &view =
-              input.bufferViews[accessor.bufferView];
-          texcoordsBuffer = reinterpret_cast<const float *>(
-              &(input.buffers[view.buffer]
-                    .data[accessor.byteOffset + view.byteOffset]));
-        }
-
-        if (primitive.attributes.find("TANGENT") !=
-            primitive.attributes.end()) {
-          const tinygltf::Accessor &accessor =
-              input.accessors[primitive.attributes.find("TANGENT")->second];
-          const tinygltf::BufferView &view =
-              input.bufferViews[accessor.bufferView];
-          tangentBuffer = reinterpret_cast<const float *>(
-              &(input.buffers[view.buffer]
-                    .data[accessor.byteOffset + view.byteOffset]));
-        }
 
-        for (size_t i{}; i < vertexCount; i++) {
-          Vertex vertex{};
-          vertex._position =
-              glm::vec3{positionBuffer[3 * i + 0], positionBuffer[3 * i + 1],
-                        positionBuffer[3 * i + 2]};
-          vertex._normal = glm::normalize(
-              glm::vec3(normalBuffer ? glm::vec3{normalBuffer[3 * i + 0],
-                                                 normalBuffer[3 * i + 1],
-                                                 normalBuffer[3 * i + 2]}
-                                     : glm::vec3{0.0f}));
-          vertex._texCoord = texcoordsBuffer
-                                 ? glm::vec2{texcoordsBuffer[2 * i + 0],
-                                             texcoordsBuffer[2 * i + 1]}
-                                 : glm::vec3{0.0f};
-          vertex._tangent = tangentBuffer ? glm::vec4{tangentBuffer[4 * i + 0],
-                                                      tangentBuffer[4 * i + 1],
-                                                      tangentBuffer[4 * i + 2],
-                                                      tangentBuffer[4 * i + 3]}
-                                          : glm::vec4{0.0f};
-
-          vertexBuffer.push_back(vertex);
-          vertexPositions.push_back(vertex._position);
-        }
-      }
+  // The geometry is already cooked, so only the materials and images are
+  // left to load, and the buffers don't have to be read
+  std::string stripped{};
+  const std::string &source =
+      isCooked && stripModelGeometry(gltf, stripped) ? stripped : gltf;
 
-      // Indices
-      {
-        const tinygltf::Accessor &accessor = input.accessors[primitive.indices];
-        const tinygltf::BufferView &bufferView =
-            input.bufferViews[accessor.bufferView];
-        const tinygltf::Buffer &buffer = input.buffers[bufferView.buffer];
-
-        outputMesh.indexSize = static_cast<uint32_t>(accessor.count);
-
-        switch (accessor.componentType) {
-          case TINYGLTF_PARAMETER_TYPE_UNSIGNED_INT: {
-            uint32_t *buf = new uint32_t[accessor.count];
-            memcpy(buf,
-                   &buffer.data[accessor.byteOffset + bufferView.byteOffset],
-                   accessor.count * sizeof(uint32_t));
-            for (size_t index = 0; index < accessor.count; index++) {
-              indexBuffer.push_back(buf[index] + vertexStart);
-            }
-            break;
-          }
-          case TINYGLTF_PARAMETER_TYPE_UNSIGNED_SHORT: {
-            uint16_t *buf = new uint16_t[accessor.count];
-            memcpy(buf,
-                   &buffer.data[accessor.byteOffset + bufferView.byteOffset],
-                   accessor.count * sizeof(uint16_t));
-            for (size_t index = 0; index < accessor.count; index++) {
-              indexBuffer.push_back(buf[index] + vertexStart);
-            }
-            break;
-          }
-          case TINYGLTF_PARAMETER_TYPE_UNSIGNED_BYTE: {
-            uint8_t *buf = new uint8_t[accessor.count];
-            memcpy(buf,
-                   &buffer.data[accessor.byteOffset + bufferView.byteOffset],
-                   accessor.count * sizeof(uint8_t));
-            for (size_t index = 0; index < accessor.count; index++) {
-              indexBuffer.push_back(buf[index] + vertexStart);
-            }
-            break;
-          }
-          default:
-            std::cerr << "Index component type " << accessor.componentType
-                      << " not supported!" << std::endl;
-            abort();
-        }
-      }
-      vkutils::computeBoundingSphere(outputMesh.boundingSphere,
-                                     vertexPositions.data(),
-                                     vertexPositions.size());
+  tinygltf::TinyGLTF loader;
+  tinygltf::Model input;
 
-      outputNode.meshes[outputNode.currentIndex] = outputMesh;
-      outputNode.currentIndex++;
-    }
+  // NOTE: Images are kept as they are in the file, and only decoded if
+  // there's no cooked version of them
+  std::vector<std::vector<uint8_t>> imageSources{};
+  loader.SetImageLoader(keepImageSource, &imageSources);
+
+  if (!loader.LoadASCIIFromString(&input, &err, &warn, source.data(),
+                                  static_cast<unsigned int>(source.size()),
+                                  directory)) {
+    std::cerr << "Couldn't load gltf file " << filename << ": " << err
+              << std::endl;
+    return false;
   }
-  model.nodes[model.currentIndex] = outputNode;
-  model.currentIndex++;
-
-  // Load node's children
-  if (node.children.size() > 0) {
-    for (size_t i = 0; i < node.children.size(); i++) {
-      loadGltfNode(input, input.nodes[node.children[i]], vertexBuffer,
-                   indexBuffer, model, &model.nodes[model.currentIndex - 1]);
-    }
-  }
-}
 
-Model VulkanEngine::loadModelFromFile(const std::string &filename,
-                                      std::vector<Vertex> &vertexBuffer,
-                                      std::vector<uint32_t> &indexBuffer) {
-  std::string warn, err;
+  // Load and upload the texture image data to the GPU
+  imageSources.resize(input.images.size());
+  loadGltfTextures(input, directory, imageSources);
+
+  // After this we have a materialSSBO with the correct
+  // texture slots in the bindless texture table
+  initMaterials(input);
 
-  Model model{};
   /*
   **
-  ** GLTF Loading
+  ** Meshes
   **
   */
-  tinygltf::TinyGLTF loader;
-  tinygltf::Model input;
+  if (isCooked) {
+    return true;
+  }
 
-  if (!loader.LoadASCIIFromFile(&input, &err, &warn, filename)) {
-    std::cout << "Couldn't load gltf file " << std::endl;
+  CookedModel model{};
+  cookModel(input, model);
+  meshData = serializeCookedModel(key, model);
+  if (!writeCookedModel(cooked, meshData)) {
+    std::cerr << "Couldn't write cooked model " << cooked << std::endl;
   }
 
-  // Allocate enough room to hold all our nodes
-  model.nNodes = input.nodes.size();
-  model.nodes =
-      _dstack->alloc<Node, StackDirection::Bottom>(sizeof(Node) * model.nNodes);
-  model.currentIndex = 0;
+  // It's mapped from the file next time
+  return viewCookedModel(meshData.data(), meshData.size(), key, meshes);
+}
 
-  // After this we have a materialSSBO with the correct
-  // texture indices in the texture sampler buffer array
-  initMaterials(input);
+Model VulkanEngine::createModel(const CookedModelView &meshes,
+                                uint32_t firstVertex, uint32_t firstIndex) {
+  const CookedModelHeader &header = *meshes.header;
 
-  // Load and upload the texture image data to the GPU
-  loadGltfTextures(input);
+  Model model{};
+  model.nNodes = header.nNodes;
+  model.nodes =
+      _dstack->alloc<Node, StackDirection::Bottom>(sizeof(Node) * model.nNodes);
+  model.currentIndex = model.nNodes;
+
+  Mesh *outputMeshes = _dstack->alloc<Mesh, StackDirection::Bottom>(
+      sizeof(Mesh) * header.nMeshes);
+  for (size_t i{}; i < header.nMeshes; i++) {
+    const CookedMesh &mesh = meshes.meshes[i];
+    outputMeshes[i] = Mesh{firstVertex + mesh.firstVertex,
+                           firstIndex + mesh.firstIndex,
+                           mesh.nVertices,
+                           mesh.nIndices,
+                           mesh.materialIndex,
+                           mesh.boundingSphere};
+  }
 
-  const tinygltf::Scene &scene = input.scenes[0];
-  for (size_t i{}; i < scene.nodes.size(); i++) {
-    const tinygltf::Node node = input.nodes[scene.nodes[i]];
-    loadGltfNode(input, node, vertexBuffer, indexBuffer, model, nullptr);
+  // NOTE: Parents are always cooked before their children, so they're
+  // already in place
+  for (size_t i{}; i < header.nNodes; i++) {
+    const CookedNode &node = meshes.nodes[i];
+    model.nodes[i] = Node{node.nMeshes, node.nMeshes,
+                          &outputMeshes[node.firstMesh],
+                          node.parent < 0 ? nullptr : &model.nodes[node.parent],
+                          node.matrix};
   }
 
   return model;
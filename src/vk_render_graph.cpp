@@ -0,0 +1,595 @@
+#include "vk_render_graph.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace rg {
+
+State getState(Access access) {
+  using Layout = vk::ImageLayout;
+  using Stage = vk::PipelineStageFlagBits;
+  using AccessBits = vk::AccessFlagBits;
+
+  switch (access) {
+    case Access::None:
+      return {Layout::eUndefined, Stage::eTopOfPipe, {}};
+    case Access::Acquired:
+      return {Layout::eUndefined, Stage::eColorAttachmentOutput, {}};
+    case Access::ColorAttachment:
+      return {Layout::eColorAttachmentOptimal, Stage::eColorAttachmentOutput,
+              AccessBits::eColorAttachmentRead |
+                  AccessBits::eColorAttachmentWrite};
+    case Access::DepthAttachment:
+      return {Layout::eDepthStencilAttachmentOptimal,
+              Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+              AccessBits::eDepthStencilAttachmentRead |
+                  AccessBits::eDepthStencilAttachmentWrite};
+    case Access::DepthRead:
+      return {Layout::eDepthStencilReadOnlyOptimal,
+              Stage::eEarlyFragmentTests | Stage::eLateFragmentTests,
+              AccessBits::eDepthStencilAttachmentRead};
+    case Access::SampledFragment:
+      return {Layout::eShaderReadOnlyOptimal, Stage::eFragmentShader,
+              AccessBits::eShaderRead};
+    case Access::SampledCompute:
+      return {Layout::eShaderReadOnlyOptimal, Stage::eComputeShader,
+              AccessBits::eShaderRead};
+    case Access::StorageReadVertex:
+      return {Layout::eGeneral, Stage::eVertexShader, AccessBits::eShaderRead};
+    case Access::StorageReadCompute:
+      return {Layout::eGeneral, Stage::eComputeShader, AccessBits::eShaderRead};
+    case Access::StorageWriteCompute:
+      return {Layout::eGeneral, Stage::eComputeShader,
+              AccessBits::eShaderRead | AccessBits::eShaderWrite};
+    case Access::IndirectRead:
+      return {Layout::eUndefined, Stage::eDrawIndirect,
+              AccessBits::eIndirectCommandRead};
+    case Access::TransferSrc:
+      return {Layout::eTransferSrcOptimal, Stage::eTransfer,
+              AccessBits::eTransferRead};
+    case Access::TransferDst:
+      return {Layout::eTransferDstOptimal, Stage::eTransfer,
+              AccessBits::eTransferWrite};
+    case Access::Present:
+      return {Layout::ePresentSrcKHR, Stage::eBottomOfPipe, {}};
+  }
+
+  abort();
+}
+
+bool isWrite(Access access) {
+  return access == Access::ColorAttachment ||
+         access == Access::DepthAttachment ||
+         access == Access::StorageWriteCompute ||
+         access == Access::TransferDst;
+}
+
+static bool isAttachment(Access access) {
+  return access == Access::ColorAttachment ||
+         access == Access::DepthAttachment || access == Access::DepthRead;
+}
+
+static vk::ImageUsageFlags getUsage(Access access) {
+  switch (access) {
+    case Access::ColorAttachment:
+      return vk::ImageUsageFlagBits::eColorAttachment;
+    case Access::DepthAttachment:
+    case Access::DepthRead:
+      return vk::ImageUsageFlagBits::eDepthStencilAttachment;
+    case Access::SampledFragment:
+    case Access::SampledCompute:
+      return vk::ImageUsageFlagBits::eSampled;
+    case Access::StorageReadVertex:
+    case Access::StorageReadCompute:
+    case Access::StorageWriteCompute:
+      return vk::ImageUsageFlagBits::eStorage;
+    case Access::TransferSrc:
+      return vk::ImageUsageFlagBits::eTransferSrc;
+    case Access::TransferDst:
+      return vk::ImageUsageFlagBits::eTransferDst;
+    default:
+      return {};
+  }
+}
+
+void transition(vk::CommandBuffer cmd, vk::Image image,
+                vk::ImageAspectFlags aspect, uint32_t mipLevels, Access from,
+                Access to) {
+  State src = getState(from);
+  State dst = getState(to);
+
+  vk::ImageMemoryBarrier barrier{
+      isWrite(from) ? src.access : vk::AccessFlags{},
+      dst.access,
+      src.layout,
+      dst.layout,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_QUEUE_FAMILY_IGNORED,
+      image,
+      vk::ImageSubresourceRange{aspect, 0, mipLevels, 0, 1}};
+
+  cmd.pipelineBarrier(src.stages, dst.stages, {}, {}, {}, barrier);
+}
+
+RenderGraph::RenderGraph() : _device{}, _allocator{} {}
+
+RenderGraph::~RenderGraph() { reset(); }
+
+/******  DECLARE  ******/
+
+Handle RenderGraph::createImage(const char *name, const ImageDesc &desc) {
+  Resource &resource = _resources.emplace_back();
+  resource.name = name;
+  resource.isImage = true;
+  resource.imported = false;
+  resource.desc = desc;
+  return static_cast<Handle>(_resources.size() - 1);
+}
+
+Handle RenderGraph::importImage(const char *name, const ImageDesc &desc,
+                                Access before, Access after) {
+  Resource &resource = _resources.emplace_back();
+  resource.name = name;
+  resource.isImage = true;
+  resource.imported = true;
+  resource.desc = desc;
+  resource.before = before;
+  resource.after = after;
+  return static_cast<Handle>(_resources.size() - 1);
+}
+
+Handle RenderGraph::importBuffer(const char *name, Access before,
+                                 Access after) {
+  Resource &resource = _resources.emplace_back();
+  resource.name = name;
+  resource.isImage = false;
+  resource.imported = true;
+  resource.before = before;
+  resource.after = after;
+  return static_cast<Handle>(_resources.size() - 1);
+}
+
+Handle RenderGraph::addPass(const char *name, std::initializer_list<Use> uses,
+                            RecordFunction &&record) {
+  Pass &pass = _passes.emplace_back();
+  pass.name = name;
+  pass.uses = uses;
+  pass.record = std::move(record);
+  pass.culled = false;
+  return static_cast<Handle>(_passes.size() - 1);
+}
+
+/******  COMPILE  ******/
+
+void RenderGraph::compile(const vk::Device &device, VmaAllocator allocator) {
+  _device = device;
+  _allocator = allocator;
+
+  compileLifetimes();
+  compileImages();
+  compileRenderPasses();
+}
+
+void RenderGraph::compileLifetimes() {
+  // Anything imported is seen outside the graph, so whatever writes it has
+  // to run. Walking backwards, so do the passes those read from.
+  std::vector<bool> needed(_resources.size());
+  for (size_t i{}; i < _resources.size(); i++) {
+    needed[i] = _resources[i].imported;
+  }
+
+  for (size_t p = _passes.size(); p-- > 0;) {
+    Pass &pass = _passes[p];
+    pass.culled = std::none_of(
+        pass.uses.begin(), pass.uses.end(), [&](const Use &use) {
+          return isWrite(use.access) && needed[use.resource];
+        });
+
+    if (pass.culled) {
+      std::cout << "Render graph: culled " << pass.name << std::endl;
+      continue;
+    }
+    for (const Use &use : pass.uses) {
+      needed[use.resource] = true;
+    }
+  }
+
+  for (Resource &resource : _resources) {
+    resource.usage = {};
+    resource.firstPass = UINT32_MAX;
+    resource.lastPass = 0;
+  }
+
+  for (uint32_t p{}; p < _passes.size(); p++) {
+    if (_passes[p].culled) continue;
+
+    for (const Use &use : _passes[p].uses) {
+      Resource &resource = _resources[use.resource];
+      resource.usage |= getUsage(use.access);
+      resource.firstPass = std::min(resource.firstPass, p);
+      resource.lastPass = std::max(resource.lastPass, p);
+    }
+  }
+}
+
+void RenderGraph::compileImages() {
+  std::vector<Handle> transients{};
+  for (Handle h{}; h < _resources.size(); h++) {
+    Resource &resource = _resources[h];
+    if (!resource.isImage || resource.imported ||
+        resource.firstPass == UINT32_MAX) {
+      continue;
+    }
+
+    vk::ImageCreateInfo imageCi(
+        {}, vk::ImageType::e2D, resource.desc.format,
+        vk::Extent3D{resource.desc.extent.width, resource.desc.extent.height,
+                     1},
+        1, 1, vk::SampleCountFlagBits::e1, vk::ImageTiling::eOptimal,
+        resource.usage, vk::SharingMode::eExclusive);
+
+    resource.ownedImage = _device.createImageUnique(imageCi);
+    resource.image = resource.ownedImage.get();
+    transients.push_back(h);
+  }
+
+  // Biggest first, each into the first slot where nothing it holds is alive
+  // at the same time and the memory types work out
+  std::sort(transients.begin(), transients.end(), [&](Handle a, Handle b) {
+    return _device.getImageMemoryRequirements(_resources[a].image).size >
+           _device.getImageMemoryRequirements(_resources[b].image).size;
+  });
+
+  for (Handle h : transients) {
+    Resource &resource = _resources[h];
+    vk::MemoryRequirements requirements =
+        _device.getImageMemoryRequirements(resource.image);
+
+    resource.memorySlot = UINT32_MAX;
+    for (uint32_t s{}; s < _memorySlots.size(); s++) {
+      MemorySlot &slot = _memorySlots[s];
+      if (!(slot.requirements.memoryTypeBits & requirements.memoryTypeBits)) {
+        continue;
+      }
+
+      bool overlaps =
+          std::any_of(slot.resources.begin(), slot.resources.end(),
+                      [&](Handle other) {
+                        return _resources[other].firstPass <=
+                                   resource.lastPass &&
+                               resource.firstPass <= _resources[other].lastPass;
+                      });
+      if (!overlaps) {
+        resource.memorySlot = s;
+        break;
+      }
+    }
+
+    if (resource.memorySlot == UINT32_MAX) {
+      resource.memorySlot = static_cast<uint32_t>(_memorySlots.size());
+      _memorySlots.push_back(MemorySlot{requirements});
+    } else {
+      MemorySlot &slot = _memorySlots[resource.memorySlot];
+      slot.requirements.size =
+          std::max(slot.requirements.size, requirements.size);
+      slot.requirements.alignment =
+          std::max(slot.requirements.alignment, requirements.alignment);
+      slot.requirements.memoryTypeBits &= requirements.memoryTypeBits;
+    }
+    _memorySlots[resource.memorySlot].resources.push_back(h);
+  }
+
+  VmaAllocationCreateInfo allocationCi{};
+  allocationCi.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+  for (MemorySlot &slot : _memorySlots) {
+    VkMemoryRequirements requirements = slot.requirements;
+    auto result = vmaAllocateMemory(_allocator, &requirements, &allocationCi,
+                                    &slot.allocation, nullptr);
+    assert(result == VK_SUCCESS);
+
+    slot.tracking =
+        Tracking{.layout = vk::ImageLayout::eUndefined,
+                 .readStages = vk::PipelineStageFlagBits::eTopOfPipe};
+
+    for (Handle h : slot.resources) {
+      Resource &resource = _resources[h];
+      vmaBindImageMemory(_allocator, slot.allocation,
+                         static_cast<VkImage>(resource.image));
+
+      vk::ImageViewCreateInfo viewCi{
+          vk::ImageViewCreateFlags{},
+          resource.image,
+          vk::ImageViewType::e2D,
+          resource.desc.format,
+          vk::ComponentMapping{},
+          vk::ImageSubresourceRange{resource.desc.aspect, 0, 1, 0, 1}};
+      resource.ownedView = _device.createImageViewUnique(viewCi);
+      resource.view = resource.ownedView.get();
+    }
+  }
+
+  std::cout << "Render graph: " << transients.size() << " transient images in "
+            << _memorySlots.size() << " allocations" << std::endl;
+}
+
+void RenderGraph::compileRenderPasses() {
+  // Whether anything's been written to the resource yet, going through the
+  // passes in order. Decides between clearing and loading attachments.
+  std::vector<bool> defined(_resources.size());
+  for (size_t i{}; i < _resources.size(); i++) {
+    const Resource &resource = _resources[i];
+    defined[i] = resource.imported && resource.before != Access::None &&
+                 resource.before != Access::Acquired;
+  }
+
+  for (uint32_t p{}; p < _passes.size(); p++) {
+    Pass &pass = _passes[p];
+    if (pass.culled) continue;
+
+    std::vector<vk::AttachmentDescription> descriptions{};
+    std::vector<vk::AttachmentReference> colorRefs{};
+    vk::AttachmentDescription depthDescription{};
+    vk::AttachmentReference depthRef{};
+    Handle depth{};
+    bool hasDepth{};
+
+    for (const Use &use : pass.uses) {
+      if (!isAttachment(use.access)) continue;
+
+      const Resource &resource = _resources[use.resource];
+      vk::ImageLayout layout = getState(use.access).layout;
+
+      vk::AttachmentDescription description{};
+      description.format = resource.desc.format;
+      description.samples = vk::SampleCountFlagBits::e1;
+      description.loadOp = defined[use.resource] ? vk::AttachmentLoadOp::eLoad
+                                                 : vk::AttachmentLoadOp::eClear;
+      // Nobody looks at it after this pass, so don't bother writing it out
+      description.storeOp = resource.imported || resource.lastPass > p
+                                ? vk::AttachmentStoreOp::eStore
+                                : vk::AttachmentStoreOp::eDontCare;
+      description.stencilLoadOp = vk::AttachmentLoadOp::eDontCare;
+      description.stencilStoreOp = vk::AttachmentStoreOp::eDontCare;
+      // NOTE: The graph does the transitions with barriers, the render pass
+      // itself never changes the layout
+      description.initialLayout = layout;
+      description.finalLayout = layout;
+
+      if (use.access == Access::ColorAttachment) {
+        colorRefs.push_back(vk::AttachmentReference{
+            static_cast<uint32_t>(descriptions.size()), layout});
+        descriptions.push_back(description);
+        pass.attachments.push_back(use.resource);
+        pass.clearValues.push_back(resource.desc.clearValue);
+      } else {
+        assert(!hasDepth);
+        hasDepth = true;
+        depth = use.resource;
+        depthDescription = description;
+        depthRef.layout = layout;
+      }
+      pass.extent = resource.desc.extent;
+    }
+
+    for (const Use &use : pass.uses) {
+      if (isWrite(use.access)) defined[use.resource] = true;
+    }
+
+    // Depth always goes after the colors
+    if (hasDepth) {
+      depthRef.attachment = static_cast<uint32_t>(descriptions.size());
+      descriptions.push_back(depthDescription);
+      pass.attachments.push_back(depth);
+      pass.clearValues.push_back(_resources[depth].desc.clearValue);
+    }
+
+    if (descriptions.empty()) continue;
+
+    vk::SubpassDescription subpass{vk::SubpassDescriptionFlags{},
+                                   vk::PipelineBindPoint::eGraphics};
+    subpass.colorAttachmentCount = static_cast<uint32_t>(colorRefs.size());
+    subpass.pColorAttachments = colorRefs.data();
+    subpass.pDepthStencilAttachment = hasDepth ? &depthRef : nullptr;
+
+    vk::RenderPassCreateInfo createInfo{
+        {}, static_cast<uint32_t>(descriptions.size()), descriptions.data(), 1,
+        &subpass};
+
+    pass.renderPass = _device.createRenderPassUnique(createInfo);
+  }
+}
+
+void RenderGraph::reset() {
+  // NOTE: The images have to go before the memory they're bound to
+  _passes.clear();
+  _resources.clear();
+  for (MemorySlot &slot : _memorySlots) {
+    vmaFreeMemory(_allocator, slot.allocation);
+  }
+  _memorySlots.clear();
+}
+
+/******  EXECUTE  ******/
+
+void RenderGraph::setImage(Handle handle, vk::Image image,
+                           vk::ImageView view) {
+  Resource &resource = _resources[handle];
+  assert(resource.imported && resource.isImage);
+  resource.image = image;
+  resource.view = view;
+}
+
+void RenderGraph::setBuffer(Handle handle, vk::Buffer buffer) {
+  Resource &resource = _resources[handle];
+  assert(resource.imported && !resource.isImage);
+  resource.buffer = buffer;
+}
+
+RenderGraph::Tracking &RenderGraph::getTracking(Resource &resource) {
+  if (resource.imported) {
+    return resource.tracking;
+  }
+
+  // The first time a transient is used in a frame, the memory it's in still
+  // has whatever the image before it left there
+  Tracking &tracking = _memorySlots[resource.memorySlot].tracking;
+  if (!resource.touched) {
+    tracking.layout = vk::ImageLayout::eUndefined;
+    resource.touched = true;
+  }
+  return tracking;
+}
+
+void RenderGraph::use(Resource &resource, Access access) {
+  Tracking &tracking = getTracking(resource);
+  State next = getState(access);
+  bool write = isWrite(access);
+  bool transition = resource.isImage && tracking.layout != next.layout;
+
+  if (!write && !transition) {
+    // Reads only wait for the last write, and only once per stage
+    bool visible = (tracking.readStages & next.stages) == next.stages &&
+                   (tracking.readAccess & next.access) == next.access;
+    if (tracking.writeStages && !visible) {
+      addBarrier(resource, tracking.writeStages, tracking.writeAccess,
+                 tracking.layout, next);
+    }
+    tracking.readStages |= next.stages;
+    tracking.readAccess |= next.access;
+    return;
+  }
+
+  // Writes and transitions wait for everything since the last write
+  addBarrier(resource, tracking.writeStages | tracking.readStages,
+             tracking.writeAccess, tracking.layout, next);
+
+  tracking.layout = next.layout;
+  tracking.writeStages = next.stages;
+  tracking.writeAccess = write ? next.access : vk::AccessFlags{};
+  tracking.readStages = write ? vk::PipelineStageFlags{} : next.stages;
+  tracking.readAccess = write ? vk::AccessFlags{} : next.access;
+}
+
+void RenderGraph::addBarrier(const Resource &resource,
+                             vk::PipelineStageFlags srcStages,
+                             vk::AccessFlags srcAccess,
+                             vk::ImageLayout oldLayout, const State &next) {
+  _srcStages |= srcStages;
+  _dstStages |= next.stages;
+
+  if (resource.isImage) {
+    _imageBarriers.push_back(vk::ImageMemoryBarrier{
+        srcAccess, next.access, oldLayout, next.layout,
+        VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, resource.image,
+        vk::ImageSubresourceRange{resource.desc.aspect, 0,
+                                  VK_REMAINING_MIP_LEVELS, 0,
+                                  VK_REMAINING_ARRAY_LAYERS}});
+  } else {
+    _bufferBarriers.push_back(vk::BufferMemoryBarrier{
+        srcAccess, next.access, VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED, resource.buffer, 0, VK_WHOLE_SIZE});
+  }
+}
+
+void RenderGraph::flushBarriers(vk::CommandBuffer cmd) {
+  if (!_srcStages) {
+    _srcStages = vk::PipelineStageFlagBits::eTopOfPipe;
+  }
+  if (!_imageBarriers.empty() || !_bufferBarriers.empty()) {
+    cmd.pipelineBarrier(_srcStages, _dstStages, {}, {}, _bufferBarriers,
+                        _imageBarriers);
+  }
+
+  _srcStages = {};
+  _dstStages = {};
+  _imageBarriers.clear();
+  _bufferBarriers.clear();
+}
+
+vk::Framebuffer RenderGraph::getFramebuffer(Pass &pass) {
+  _framebufferViews.clear();
+  for (Handle h : pass.attachments) {
+    _framebufferViews.push_back(_resources[h].view);
+  }
+
+  for (const Framebuffer &framebuffer : pass.framebuffers) {
+    if (framebuffer.views == _framebufferViews) {
+      return framebuffer.framebuffer.get();
+    }
+  }
+
+  // NOTE: Only happens the first few frames, once per swapchain image
+  vk::FramebufferCreateInfo createInfo{};
+  createInfo.renderPass = pass.renderPass.get();
+  createInfo.attachmentCount = static_cast<uint32_t>(_framebufferViews.size());
+  createInfo.pAttachments = _framebufferViews.data();
+  createInfo.width = pass.extent.width;
+  createInfo.height = pass.extent.height;
+  createInfo.layers = 1;
+
+  pass.framebuffers.push_back(Framebuffer{
+      _framebufferViews, _device.createFramebufferUnique(createInfo)});
+  return pass.framebuffers.back().framebuffer.get();
+}
+
+void RenderGraph::execute(vk::CommandBuffer cmd) {
+  for (Resource &resource : _resources) {
+    resource.touched = false;
+    if (resource.imported) {
+      // Whatever happened before the frame counts as a write if it was one,
+      // otherwise it's only something a transition has to wait for
+      State before = getState(resource.before);
+      if (isWrite(resource.before)) {
+        resource.tracking = Tracking{.layout = before.layout,
+                                     .writeStages = before.stages,
+                                     .writeAccess = before.access};
+      } else {
+        resource.tracking = Tracking{.layout = before.layout,
+                                     .readStages = before.stages};
+      }
+    }
+  }
+
+  for (Pass &pass : _passes) {
+    if (pass.culled) continue;
+
+    for (const Use &use : pass.uses) {
+      this->use(_resources[use.resource], use.access);
+    }
+    flushBarriers(cmd);
+
+    if (!pass.renderPass) {
+      pass.record(cmd);
+      continue;
+    }
+
+    vk::RenderPassBeginInfo beginInfo{
+        pass.renderPass.get(), getFramebuffer(pass),
+        vk::Rect2D{vk::Offset2D{0, 0}, pass.extent}};
+    beginInfo.clearValueCount = static_cast<uint32_t>(pass.clearValues.size());
+    beginInfo.pClearValues = pass.clearValues.data();
+
+    cmd.beginRenderPass(beginInfo, vk::SubpassContents::eInline);
+    pass.record(cmd);
+    cmd.endRenderPass();
+  }
+
+  for (Resource &resource : _resources) {
+    if (resource.imported) {
+      use(resource, resource.after);
+    }
+  }
+  flushBarriers(cmd);
+}
+
+vk::RenderPass RenderGraph::getRenderPass(Handle pass) const {
+  return _passes[pass].renderPass.get();
+}
+
+vk::ImageView RenderGraph::getImageView(Handle image) const {
+  return _resources[image].view;
+}
+
+}  // namespace rg
@@ -0,0 +1,428 @@
+#include "vk_texture_stream.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+#include "vk_utils.hpp"
+
+#define DDSKTX_IMPLEMENT
+#include "dds-ktx.h"
+
+/******  DDS  ******/
+
+// The format a dds or ktx file is uploaded as, eUndefined if it's not
+// one we handle
+static vk::Format getDdsFormat(ddsktx_format format, bool srgb) {
+  switch (format) {
+    case DDSKTX_FORMAT_BC1:
+      return srgb ? vk::Format::eBc1RgbaSrgbBlock
+                  : vk::Format::eBc1RgbaUnormBlock;
+    case DDSKTX_FORMAT_BC3:
+      return srgb ? vk::Format::eBc3SrgbBlock : vk::Format::eBc3UnormBlock;
+    case DDSKTX_FORMAT_BC4:
+      return vk::Format::eBc4UnormBlock;
+    case DDSKTX_FORMAT_BC5:
+      return vk::Format::eBc5UnormBlock;
+    case DDSKTX_FORMAT_BC7:
+      return srgb ? vk::Format::eBc7SrgbBlock : vk::Format::eBc7UnormBlock;
+    case DDSKTX_FORMAT_RGBA8:
+      return srgb ? vk::Format::eR8G8B8A8Srgb : vk::Format::eR8G8B8A8Unorm;
+    default:
+      return vk::Format::eUndefined;
+  }
+}
+
+bool readDds(const std::string &filename, bool srgb, DdsImage &image) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  if (!file) {
+    return false;
+  }
+
+  image.data.resize(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(image.data.data()), image.data.size());
+  file.close();
+
+  int size = static_cast<int>(image.data.size());
+  ddsktx_texture_info tc = {0};
+  if (!ddsktx_parse(&tc, image.data.data(), size, NULL)) {
+    std::cerr << "Couldn't parse " << filename << std::endl;
+    return false;
+  }
+
+  image.format = getDdsFormat(tc.format, srgb);
+  image.compressed = ddsktx_format_compressed(tc.format);
+  if (image.format == vk::Format::eUndefined) {
+    std::cerr << filename << ": " << ddsktx_format_str(tc.format)
+              << " isn't supported" << std::endl;
+    return false;
+  }
+
+  image.width = static_cast<uint32_t>(tc.width);
+  image.height = static_cast<uint32_t>(tc.height);
+  image.mipLevels = static_cast<uint32_t>(tc.num_mips);
+
+  image.levels.clear();
+  for (int mip = 0; mip < tc.num_mips; mip++) {
+    ddsktx_sub_data sub_data;
+    ddsktx_get_sub(&tc, &sub_data, image.data.data(), size, 0, 0, mip);
+
+    image.levels.push_back(ImageLevel{
+        static_cast<uint32_t>(mip), static_cast<uint32_t>(sub_data.width),
+        static_cast<uint32_t>(sub_data.height), sub_data.buff,
+        static_cast<vk::DeviceSize>(sub_data.size_bytes)});
+  }
+
+  return true;
+}
+
+/******  TEXTURE STREAMER  ******/
+
+TextureStreamer::TextureStreamer()
+    : _device{},
+      _allocator{},
+      _uploads{},
+      _table{},
+      _sampler{},
+      _budget{},
+      _version{},
+      _nLoads{},
+      _frame{},
+      _quit{} {}
+
+TextureStreamer::~TextureStreamer() { destroy(); }
+
+void TextureStreamer::init(vk::Device device, VmaAllocator allocator,
+                           UploadManager &uploads, BindlessTable &table,
+                           vk::Sampler sampler, vk::DeviceSize budget,
+                           uint32_t framesInFlight) {
+  _device = device;
+  _allocator = allocator;
+  _uploads = &uploads;
+  _table = &table;
+  _sampler = sampler;
+  _budget = budget;
+  _retired.resize(framesInFlight);
+
+  _quit = false;
+  _loader = std::thread{&TextureStreamer::loaderLoop, this};
+}
+
+void TextureStreamer::destroy() {
+  if (_loader.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock{_mutex};
+      _quit = true;
+    }
+    _wakeLoader.notify_one();
+    _loader.join();
+  }
+
+  if (!_device) return;
+
+  // NOTE: Frames and uploads might still be using any of these
+  _device.waitIdle();
+
+  for (Entry &entry : _entries) {
+    destroyTexture(entry.texture);
+  }
+  for (Swap &swap : _swaps) {
+    destroyTexture(swap.result);
+  }
+  for (auto &retired : _retired) {
+    for (Texture &texture : retired) {
+      destroyTexture(texture);
+    }
+    retired.clear();
+  }
+
+  _entries.clear();
+  _swaps.clear();
+  _requests.clear();
+  _reads.clear();
+  _device = vk::Device{};
+}
+
+bool TextureStreamer::add(const std::string &filename, bool srgb) {
+  DdsImage image{};
+  if (!readDds(filename, srgb, image)) {
+    return false;
+  }
+
+  Entry entry{};
+  entry.filename = filename;
+  entry.srgb = srgb;
+  entry.width = image.width;
+  entry.height = image.height;
+
+  for (const ImageLevel &level : image.levels) {
+    entry.mipSizes.push_back(level.size);
+  }
+
+  // NOTE: Without mips there's nothing to stream, and the whole thing is
+  // the tail
+  entry.tailMip = 0;
+  while (entry.tailMip + 1 < image.mipLevels &&
+         std::max(image.levels[entry.tailMip].width,
+                  image.levels[entry.tailMip].height) > TAIL_SIZE) {
+    entry.tailMip++;
+  }
+  entry.residentMip = entry.tailMip;
+  entry.targetMip = entry.tailMip;
+
+  createImage(image, entry.tailMip, entry.texture);
+  entry.texture.slot = _table->add(entry.texture.imageView, _sampler);
+
+  _entries.push_back(std::move(entry));
+  return true;
+}
+
+void TextureStreamer::add(const Texture &texture) {
+  Entry entry{};
+  entry.texture = texture;
+  entry.texture.slot = _table->add(texture.imageView, _sampler);
+  _entries.push_back(std::move(entry));
+}
+
+uint32_t TextureStreamer::getSlot(uint32_t texture) const {
+  return _entries[texture].texture.slot;
+}
+
+uint64_t TextureStreamer::getVersion() const { return _version; }
+
+void TextureStreamer::request(uint32_t texture, float pixels) {
+  Entry &entry = _entries[texture];
+  entry.pixels = std::max(entry.pixels, pixels);
+}
+
+void TextureStreamer::update(uint32_t frame) {
+  _frame = frame;
+  for (Texture &texture : _retired[frame]) {
+    destroyTexture(texture);
+  }
+  _retired[frame].clear();
+
+  /*
+  **
+  ** Swap in what's been uploaded
+  **
+  */
+  for (auto it = _swaps.begin(); it != _swaps.end();) {
+    if (!_uploads->isDone(it->value)) {
+      it++;
+      continue;
+    }
+
+    Entry &entry = _entries[it->texture];
+    _table->remove(entry.texture.slot);
+    _retired[frame].push_back(entry.texture);
+
+    entry.texture = it->result;
+    entry.texture.slot = _table->add(entry.texture.imageView, _sampler);
+    entry.residentMip = it->firstMip;
+    entry.loading = false;
+    _nLoads--;
+    _version++;
+
+    it = _swaps.erase(it);
+  }
+
+  /*
+  **
+  ** Upload what the loader has read
+  **
+  */
+  std::deque<Read> reads{};
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    vk::DeviceSize uploaded = 0;
+    while (!_reads.empty() && uploaded < UPLOAD_BYTES_PER_FRAME) {
+      Read &read = _reads.front();
+      if (read.ok) {
+        uploaded += getSize(_entries[read.texture], read.firstMip);
+      }
+      reads.push_back(std::move(read));
+      _reads.pop_front();
+    }
+  }
+
+  std::vector<Swap> swaps{};
+  for (Read &read : reads) {
+    Entry &entry = _entries[read.texture];
+
+    // NOTE: If the file has changed since it was added, it's left at what
+    // it has now
+    if (!read.ok || read.image.mipLevels != entry.mipSizes.size()) {
+      std::cerr << "Couldn't stream " << entry.filename << std::endl;
+      entry.filename.clear();
+      entry.loading = false;
+      _nLoads--;
+      continue;
+    }
+
+    Swap swap{read.texture, read.firstMip, 0, {}};
+    createImage(read.image, read.firstMip, swap.result);
+    swaps.push_back(swap);
+  }
+
+  if (!swaps.empty()) {
+    uint64_t value = _uploads->submit();
+    for (Swap &swap : swaps) {
+      swap.value = value;
+      _swaps.push_back(swap);
+    }
+  }
+
+  plan();
+
+  for (Entry &entry : _entries) {
+    entry.pixels = 0.f;
+  }
+}
+
+void TextureStreamer::createImage(const DdsImage &image, uint32_t firstMip,
+                                  Texture &texture) {
+  texture.mipLevels = image.mipLevels - firstMip;
+
+  vk::ImageCreateInfo imageCreateInfo{
+      {},
+      vk::ImageType::e2D,
+      image.format,
+      vk::Extent3D{image.levels[firstMip].width,
+                   image.levels[firstMip].height, 1},
+      texture.mipLevels,
+      1,
+      vk::SampleCountFlagBits::e1,
+      vk::ImageTiling::eOptimal,
+      vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+      vk::SharingMode::eExclusive};
+
+  vkutils::allocateImage(_allocator, imageCreateInfo,
+                         VMA_MEMORY_USAGE_GPU_ONLY, texture.image);
+
+  // The image starts at firstMip, so its levels are numbered from there
+  std::vector<ImageLevel> levels(image.levels.begin() + firstMip,
+                                 image.levels.end());
+  for (ImageLevel &level : levels) {
+    level.mipLevel -= firstMip;
+  }
+
+  _uploads->uploadImage(texture.image._image, texture.mipLevels, levels,
+                        rg::Access::SampledFragment, image.compressed ? 4 : 1);
+
+  vk::ImageViewCreateInfo imageViewCi{
+      vk::ImageViewCreateFlags{},
+      texture.image._image,
+      vk::ImageViewType::e2D,
+      image.format,
+      vk::ComponentMapping{},
+      vk::ImageSubresourceRange{vk::ImageAspectFlagBits::eColor, 0,
+                                texture.mipLevels, 0, 1}};
+
+  texture.imageView = _device.createImageView(imageViewCi);
+}
+
+void TextureStreamer::destroyTexture(const Texture &texture) {
+  _device.destroyImageView(texture.imageView);
+  vmaDestroyImage(_allocator, texture.image._image, texture.image._allocation);
+}
+
+vk::DeviceSize TextureStreamer::getSize(const Entry &entry,
+                                        uint32_t firstMip) const {
+  return std::accumulate(entry.mipSizes.begin() + firstMip,
+                         entry.mipSizes.end(), vk::DeviceSize{0});
+}
+
+// Hands out the budget biggest on screen first. Tails are always there, so
+// they come off the top. A texture gets the mip it's drawn at, or the most
+// detailed one that still fits.
+void TextureStreamer::plan() {
+  std::vector<uint32_t> order{};
+  vk::DeviceSize resident = 0;
+  vk::DeviceSize remaining = _budget;
+  for (uint32_t i{}; i < _entries.size(); i++) {
+    const Entry &entry = _entries[i];
+    if (entry.filename.empty()) continue;
+
+    order.push_back(i);
+    resident += getSize(entry, entry.residentMip);
+    remaining -= std::min(remaining, getSize(entry, entry.tailMip));
+  }
+
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return _entries[a].pixels > _entries[b].pixels;
+  });
+
+  for (uint32_t i : order) {
+    Entry &entry = _entries[i];
+
+    uint32_t wanted = entry.tailMip;
+    while (wanted > 0 &&
+           std::max(entry.width >> wanted, entry.height >> wanted) <
+               entry.pixels) {
+      wanted--;
+    }
+
+    vk::DeviceSize tailSize = getSize(entry, entry.tailMip);
+    while (wanted < entry.tailMip &&
+           getSize(entry, wanted) - tailSize > remaining) {
+      wanted++;
+    }
+    remaining -= getSize(entry, wanted) - tailSize;
+    entry.targetMip = wanted;
+  }
+
+  // NOTE: More detail than is needed is kept until something else needs
+  // the room, so looking away and back doesn't load it all again
+  bool overBudget = resident > _budget;
+
+  std::vector<Read> requests{};
+  for (uint32_t i : order) {
+    if (_nLoads + requests.size() >= MAX_LOADS) break;
+
+    Entry &entry = _entries[i];
+    if (entry.loading) continue;
+
+    if (entry.targetMip < entry.residentMip ||
+        (overBudget && entry.targetMip > entry.residentMip)) {
+      entry.loading = true;
+      requests.push_back(
+          Read{i, entry.targetMip, entry.filename, entry.srgb, false, {}});
+    }
+  }
+
+  if (requests.empty()) return;
+
+  _nLoads += requests.size();
+  {
+    std::lock_guard<std::mutex> lock{_mutex};
+    for (Read &request : requests) {
+      _requests.push_back(std::move(request));
+    }
+  }
+  _wakeLoader.notify_one();
+}
+
+void TextureStreamer::loaderLoop() {
+  std::unique_lock<std::mutex> lock{_mutex};
+
+  while (!_quit) {
+    if (_requests.empty()) {
+      _wakeLoader.wait(lock);
+      continue;
+    }
+
+    Read read = std::move(_requests.front());
+    _requests.pop_front();
+
+    // Don't hold the lock while we're waiting on the disk
+    lock.unlock();
+    read.ok = readDds(read.filename, read.srgb, read.image);
+    lock.lock();
+
+    _reads.push_back(std::move(read));
+  }
+}
@@ -0,0 +1,443 @@
+#include "vk_upload.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+/******  STAGING RING  ******/
+
+StagingRing::StagingRing()
+    : _allocator{},
+      _buffer{},
+      _data{},
+      _size{},
+      _head{},
+      _tail{},
+      _closed{} {}
+
+void StagingRing::init(VmaAllocator allocator, vk::DeviceSize size) {
+  _allocator = allocator;
+  _size = size;
+
+  vk::BufferCreateInfo bufferCi{{},
+                                size,
+                                vk::BufferUsageFlagBits::eTransferSrc,
+                                vk::SharingMode::eExclusive};
+  VkBufferCreateInfo bi = static_cast<VkBufferCreateInfo>(bufferCi);
+
+  VmaAllocationCreateInfo allocCi{};
+  allocCi.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+  allocCi.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VkBuffer tempBuffer;
+  VmaAllocationInfo allocInfo{};
+  vmaCreateBuffer(_allocator, &bi, &allocCi, &tempBuffer,
+                  &_buffer._allocation, &allocInfo);
+  _buffer._buffer = vk::Buffer{tempBuffer};
+  _data = allocInfo.pMappedData;
+}
+
+void StagingRing::destroy() {
+  if (!_data) return;
+
+  vmaDestroyBuffer(_allocator, _buffer._buffer, _buffer._allocation);
+  _buffer = AllocatedBuffer{};
+  _data = nullptr;
+  _head = _tail = _closed = 0;
+  _regions.clear();
+}
+
+void *StagingRing::allocate(vk::DeviceSize size, vk::DeviceSize alignment,
+                            vk::DeviceSize &offset) {
+  assert(size <= _size);
+
+  uint64_t head = (_head + alignment - 1) & ~(alignment - 1);
+  // Doesn't fit before the end, so it starts over at the front
+  if (head % _size + size > _size) {
+    head += _size - head % _size;
+  }
+  if (head + size - _tail > _size) {
+    return nullptr;
+  }
+
+  _head = head + size;
+  offset = head % _size;
+  return static_cast<char *>(_data) + offset;
+}
+
+void StagingRing::close(uint64_t value) {
+  if (_head == _closed) return;
+
+  _regions.push_back(Region{value, _head});
+  _closed = _head;
+}
+
+void StagingRing::release(uint64_t value) {
+  while (!_regions.empty() && _regions.front().value <= value) {
+    _tail = _regions.front().end;
+    _regions.pop_front();
+  }
+
+  // NOTE: Nothing in use, so the next allocation doesn't have to wrap
+  if (_tail == _head) {
+    _head = _tail = _closed = 0;
+  }
+}
+
+bool StagingRing::hasOpen() const { return _head != _closed; }
+
+vk::Buffer StagingRing::getBuffer() const { return _buffer._buffer; }
+
+vk::DeviceSize StagingRing::getSize() const { return _size; }
+
+/******  UPLOAD MANAGER  ******/
+
+UploadManager::UploadManager()
+    : _device{}, _allocator{}, _lastValue{}, _recording{} {}
+
+UploadManager::~UploadManager() { destroy(); }
+
+void UploadManager::init(vk::Device device, VmaAllocator allocator,
+                         uint32_t transferFamily, vk::Queue transferQueue,
+                         uint32_t graphicsFamily, vk::Queue graphicsQueue) {
+  _device = device;
+  _allocator = allocator;
+  _transferFamily = transferFamily;
+  _transferQueue = transferQueue;
+  _graphicsFamily = graphicsFamily;
+  _graphicsQueue = graphicsQueue;
+
+  _transferCommandPool = _device.createCommandPoolUnique(
+      vk::CommandPoolCreateInfo{vk::CommandPoolCreateFlagBits::eTransient,
+                                _transferFamily});
+  _graphicsCommandPool = _device.createCommandPoolUnique(
+      vk::CommandPoolCreateInfo{vk::CommandPoolCreateFlagBits::eTransient,
+                                _graphicsFamily});
+
+  vk::SemaphoreTypeCreateInfo timelineCi{vk::SemaphoreType::eTimeline, 0};
+  vk::SemaphoreCreateInfo semaphoreCi{};
+  semaphoreCi.pNext = &timelineCi;
+  _transferTimeline = _device.createSemaphoreUnique(semaphoreCi);
+  _timeline = _device.createSemaphoreUnique(semaphoreCi);
+
+  _staging.init(_allocator, STAGING_RING_SIZE);
+}
+
+void UploadManager::destroy() {
+  if (!_device) return;
+
+  // NOTE: A batch that was never submitted just gets thrown away
+  if (_recording) {
+    _current.value = 0;
+    _pending.push_back(std::move(_current));
+    _recording = false;
+  }
+  wait(_lastValue);
+  _pending.clear();
+  _staging.destroy();
+
+  _timeline = {};
+  _transferTimeline = {};
+  _graphicsCommandPool = {};
+  _transferCommandPool = {};
+  _device = vk::Device{};
+}
+
+/******  RECORD  ******/
+
+void UploadManager::begin() {
+  if (_recording) return;
+
+  vk::CommandBufferAllocateInfo transferAllocInfo{
+      _transferCommandPool.get(), vk::CommandBufferLevel::ePrimary, 1};
+  vk::CommandBufferAllocateInfo graphicsAllocInfo{
+      _graphicsCommandPool.get(), vk::CommandBufferLevel::ePrimary, 1};
+
+  _current = Batch{};
+  _current.transferCommands =
+      std::move(_device.allocateCommandBuffersUnique(transferAllocInfo)[0]);
+  _current.graphicsCommands =
+      std::move(_device.allocateCommandBuffersUnique(graphicsAllocInfo)[0]);
+
+  vk::CommandBufferBeginInfo beginInfo{
+      vk::CommandBufferUsageFlagBits::eOneTimeSubmit};
+  _current.transferCommands->begin(beginInfo);
+
+  _recording = true;
+}
+
+void *UploadManager::allocateStaging(vk::DeviceSize size,
+                                     vk::DeviceSize &offset) {
+  void *data;
+  while (!(data = _staging.allocate(size, STAGING_ALIGNMENT, offset))) {
+    // NOTE: The ring is full. What's recorded so far has to go up before
+    // any of it can come back, then it's the oldest batch we wait for.
+    if (_staging.hasOpen()) {
+      submit();
+      begin();
+    }
+    assert(!_pending.empty());
+    wait(_pending.front().value);
+    collect();
+  }
+
+  return data;
+}
+
+void UploadManager::uploadBuffer(vk::Buffer dst, vk::DeviceSize dstOffset,
+                                 const void *data, vk::DeviceSize size) {
+  begin();
+
+  for (vk::DeviceSize copied = 0; copied < size;) {
+    vk::DeviceSize chunk = std::min(size - copied, STAGING_CHUNK_SIZE);
+
+    vk::DeviceSize stagingOffset;
+    memcpy(allocateStaging(chunk, stagingOffset),
+           static_cast<const char *>(data) + copied, chunk);
+
+    vk::BufferCopy region{stagingOffset, dstOffset + copied, chunk};
+    _current.transferCommands->copyBuffer(_staging.getBuffer(), dst, region);
+    copied += chunk;
+  }
+
+  // NOTE: Without a transfer queue of its own, the acquire is a plain
+  // barrier on the same queue
+  bool separate = _transferFamily != _graphicsFamily;
+  if (separate) {
+    _releaseBuffers.push_back(vk::BufferMemoryBarrier{
+        vk::AccessFlagBits::eTransferWrite, {}, _transferFamily,
+        _graphicsFamily, dst, dstOffset, size});
+  }
+  _acquireBuffers.push_back(vk::BufferMemoryBarrier{
+      separate ? vk::AccessFlags{} : vk::AccessFlagBits::eTransferWrite,
+      vk::AccessFlagBits::eMemoryRead,
+      separate ? _transferFamily : VK_QUEUE_FAMILY_IGNORED,
+      separate ? _graphicsFamily : VK_QUEUE_FAMILY_IGNORED, dst, dstOffset,
+      size});
+  _acquireStages |= vk::PipelineStageFlagBits::eAllCommands;
+}
+
+void UploadManager::uploadImage(vk::Image dst, uint32_t mipLevels,
+                                const std::vector<ImageLevel> &levels,
+                                rg::Access after, uint32_t blockSize) {
+  // A run of whole block rows from one level
+  struct Slice {
+    const ImageLevel *level;
+    uint32_t row;
+    uint32_t rows;
+    vk::DeviceSize size;
+  };
+
+  auto align = [](vk::DeviceSize offset) {
+    return (offset + STAGING_ALIGNMENT - 1) & ~(STAGING_ALIGNMENT - 1);
+  };
+
+  begin();
+
+  rg::transition(_current.transferCommands.get(), dst,
+                 vk::ImageAspectFlagBits::eColor, mipLevels, rg::Access::None,
+                 rg::Access::TransferDst);
+
+  std::vector<Slice> slices{};
+  for (const ImageLevel &level : levels) {
+    uint32_t blockRows = (level.height + blockSize - 1) / blockSize;
+    vk::DeviceSize rowSize = level.size / blockRows;
+    uint32_t rowsPerChunk = static_cast<uint32_t>(
+        std::max<vk::DeviceSize>(STAGING_CHUNK_SIZE / rowSize, 1));
+
+    for (uint32_t row = 0; row < blockRows; row += rowsPerChunk) {
+      uint32_t rows = std::min(blockRows - row, rowsPerChunk);
+      slices.push_back(Slice{&level, row, rows, rows * rowSize});
+    }
+  }
+
+  // Slices go through the ring together for as long as they fit in a
+  // chunk, each group with a single copy. That's usually the whole mip
+  // chain at once.
+  //
+  // NOTE: If the ring fills up in the middle of an image, the batch is
+  // submitted without the release. The rest of the copies follow on the
+  // same queue, and the release goes with the last of them.
+  size_t first = 0;
+  while (first < slices.size()) {
+    size_t last = first;
+    vk::DeviceSize groupSize = 0;
+    while (last < slices.size()) {
+      vk::DeviceSize end = align(groupSize) + slices[last].size;
+      if (last > first && end > STAGING_CHUNK_SIZE) break;
+      groupSize = end;
+      last++;
+    }
+
+    vk::DeviceSize stagingOffset;
+    char *staging =
+        static_cast<char *>(allocateStaging(groupSize, stagingOffset));
+
+    std::vector<vk::BufferImageCopy> regions{};
+    vk::DeviceSize groupOffset = 0;
+    for (size_t i = first; i < last; i++) {
+      const Slice &slice = slices[i];
+      const ImageLevel &level = *slice.level;
+      vk::DeviceSize rowSize = slice.size / slice.rows;
+
+      groupOffset = align(groupOffset);
+      memcpy(staging + groupOffset,
+             static_cast<const char *>(level.data) + slice.row * rowSize,
+             slice.size);
+
+      // NOTE: The last row of blocks can hang over the edge of the level
+      uint32_t y = slice.row * blockSize;
+      uint32_t height = std::min(slice.rows * blockSize, level.height - y);
+      regions.push_back(vk::BufferImageCopy{
+          stagingOffset + groupOffset, 0, 0,
+          vk::ImageSubresourceLayers{vk::ImageAspectFlagBits::eColor,
+                                     level.mipLevel, 0, 1},
+          vk::Offset3D{0, static_cast<int32_t>(y), 0},
+          vk::Extent3D{level.width, height, 1}});
+      groupOffset += slice.size;
+    }
+
+    _current.transferCommands->copyBufferToImage(
+        _staging.getBuffer(), dst, vk::ImageLayout::eTransferDstOptimal,
+        regions);
+    first = last;
+  }
+
+  rg::State next = rg::getState(after);
+  vk::ImageSubresourceRange range{vk::ImageAspectFlagBits::eColor, 0,
+                                  mipLevels, 0, 1};
+
+  // NOTE: The layout change happens once, as part of the release and
+  // acquire pair, so both of them name the same layouts
+  bool separate = _transferFamily != _graphicsFamily;
+  if (separate) {
+    _releaseImages.push_back(vk::ImageMemoryBarrier{
+        vk::AccessFlagBits::eTransferWrite, {},
+        vk::ImageLayout::eTransferDstOptimal, next.layout, _transferFamily,
+        _graphicsFamily, dst, range});
+  }
+  _acquireImages.push_back(vk::ImageMemoryBarrier{
+      separate ? vk::AccessFlags{} : vk::AccessFlagBits::eTransferWrite,
+      next.access, vk::ImageLayout::eTransferDstOptimal, next.layout,
+      separate ? _transferFamily : VK_QUEUE_FAMILY_IGNORED,
+      separate ? _graphicsFamily : VK_QUEUE_FAMILY_IGNORED, dst, range});
+  _acquireStages |= next.stages;
+}
+
+void UploadManager::record(std::function<void(vk::CommandBuffer)> &&function) {
+  begin();
+  _records.push_back(std::move(function));
+}
+
+/******  SUBMIT  ******/
+
+uint64_t UploadManager::submit() {
+  if (!_recording) return _lastValue;
+
+  bool separate = _transferFamily != _graphicsFamily;
+  vk::CommandBuffer transferCmd = _current.transferCommands.get();
+  vk::CommandBuffer graphicsCmd = _current.graphicsCommands.get();
+
+  if (separate && (!_releaseBuffers.empty() || !_releaseImages.empty())) {
+    transferCmd.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                vk::PipelineStageFlagBits::eBottomOfPipe, {},
+                                {}, _releaseBuffers, _releaseImages);
+  }
+  transferCmd.end();
+
+  graphicsCmd.begin(vk::CommandBufferBeginInfo{
+      vk::CommandBufferUsageFlagBits::eOneTimeSubmit});
+  if (!_acquireBuffers.empty() || !_acquireImages.empty()) {
+    graphicsCmd.pipelineBarrier(separate
+                                    ? vk::PipelineStageFlagBits::eTopOfPipe
+                                    : vk::PipelineStageFlagBits::eTransfer,
+                                _acquireStages, {}, {}, _acquireBuffers,
+                                _acquireImages);
+  }
+  for (auto &record : _records) {
+    record(graphicsCmd);
+  }
+  graphicsCmd.end();
+
+  uint64_t value = _lastValue + 1;
+  _current.value = value;
+
+  if (separate) {
+    vk::TimelineSemaphoreSubmitInfo transferTimelineInfo{};
+    transferTimelineInfo.signalSemaphoreValueCount = 1;
+    transferTimelineInfo.pSignalSemaphoreValues = &value;
+
+    vk::SubmitInfo transferSubmit{};
+    transferSubmit.pNext = &transferTimelineInfo;
+    transferSubmit.commandBufferCount = 1;
+    transferSubmit.pCommandBuffers = &transferCmd;
+    transferSubmit.signalSemaphoreCount = 1;
+    transferSubmit.pSignalSemaphores = &_transferTimeline.get();
+    _transferQueue.submit(transferSubmit);
+
+    vk::TimelineSemaphoreSubmitInfo graphicsTimelineInfo{};
+    graphicsTimelineInfo.waitSemaphoreValueCount = 1;
+    graphicsTimelineInfo.pWaitSemaphoreValues = &value;
+    graphicsTimelineInfo.signalSemaphoreValueCount = 1;
+    graphicsTimelineInfo.pSignalSemaphoreValues = &value;
+
+    vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eAllCommands;
+    vk::SubmitInfo graphicsSubmit{};
+    graphicsSubmit.pNext = &graphicsTimelineInfo;
+    graphicsSubmit.waitSemaphoreCount = 1;
+    graphicsSubmit.pWaitSemaphores = &_transferTimeline.get();
+    graphicsSubmit.pWaitDstStageMask = &waitStage;
+    graphicsSubmit.commandBufferCount = 1;
+    graphicsSubmit.pCommandBuffers = &graphicsCmd;
+    graphicsSubmit.signalSemaphoreCount = 1;
+    graphicsSubmit.pSignalSemaphores = &_timeline.get();
+    _graphicsQueue.submit(graphicsSubmit);
+  } else {
+    vk::TimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.signalSemaphoreValueCount = 1;
+    timelineInfo.pSignalSemaphoreValues = &value;
+
+    vk::CommandBuffer commandBuffers[] = {transferCmd, graphicsCmd};
+    vk::SubmitInfo submitInfo{};
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 2;
+    submitInfo.pCommandBuffers = commandBuffers;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &_timeline.get();
+    _graphicsQueue.submit(submitInfo);
+  }
+
+  _staging.close(value);
+  _pending.push_back(std::move(_current));
+  _recording = false;
+  _lastValue = value;
+
+  _releaseBuffers.clear();
+  _releaseImages.clear();
+  _acquireBuffers.clear();
+  _acquireImages.clear();
+  _acquireStages = {};
+  _records.clear();
+
+  return value;
+}
+
+bool UploadManager::isDone(uint64_t value) const {
+  return _device.getSemaphoreCounterValue(_timeline.get()) >= value;
+}
+
+void UploadManager::wait(uint64_t value) const {
+  vk::SemaphoreWaitInfo waitInfo{{}, 1, &_timeline.get(), &value};
+  auto result = _device.waitSemaphores(waitInfo, UINT64_MAX);
+  assert(result == vk::Result::eSuccess);
+}
+
+void UploadManager::collect() {
+  if (_pending.empty()) return;
+
+  uint64_t done = _device.getSemaphoreCounterValue(_timeline.get());
+  while (!_pending.empty() && _pending.front().value <= done) {
+    _pending.pop_front();
+  }
+  _staging.release(done);
+}
@@ -4,9 +4,12 @@
 #define NOMINMAX
 
 #include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <iostream>
 #include <set>
 
+#include "file_utils.hpp"
 #include "vk_utils.hpp"
 
 namespace vkutils {
@@ -50,6 +53,28 @@ QueueFamilyIndices findQueueFamilies(const vk::PhysicalDevice &device,
   abort();
 }
 
+std::optional<uint32_t> findTransferQueueFamily(
+    const vk::PhysicalDevice &device) {
+  std::vector<vk::QueueFamilyProperties> queueFamilyProperties =
+      device.getQueueFamilyProperties();
+
+  // Only transfer, usually the copy engine. It has to be able to copy any
+  // image region, down to the smallest mip.
+  uint32_t i = 0;
+  for (const auto &qfp : queueFamilyProperties) {
+    if (qfp.queueFlags & vk::QueueFlagBits::eTransfer &&
+        !(qfp.queueFlags & vk::QueueFlagBits::eGraphics) &&
+        !(qfp.queueFlags & vk::QueueFlagBits::eCompute) &&
+        qfp.minImageTransferGranularity == vk::Extent3D{1, 1, 1}) {
+      return i;
+    }
+
+    i++;
+  }
+
+  return std::nullopt;
+}
+
 SwapchainSupportDetails querySwapchainSupport(const vk::PhysicalDevice &device,
                                               const vk::SurfaceKHR &surface) {
   SwapchainSupportDetails details{device.getSurfaceCapabilitiesKHR(surface),
@@ -191,90 +216,95 @@ std::vector<char> readFile(const std::string &filename) {
   return buffer;
 }
 
-vk::UniqueShaderModule createUniqueShaderModule(const vk::Device &device,
-                                                const std::vector<char> &code) {
-  vk::ShaderModuleCreateInfo createInfo{
-      vk::ShaderModuleCreateFlags{}, code.size(),
-      reinterpret_cast<const uint32_t *>(code.data())};
-
-  return device.createShaderModuleUnique(createInfo);
-}
-
-uint32_t getMipLevels(int texWidth, int texHeight) {
-  return static_cast<uint32_t>(
-             std::floor(std::log2(std::max(texWidth, texHeight)))) +
-         1;
+// Goes in front of what the driver gives us. Its own header has no driver
+// version, and a cache from an older driver is something we'd rather not
+// hand back to it.
+struct PipelineCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  uint32_t unused;  // Pad to 8, so there's nothing uninitialized to compare
+  uint64_t dataSize;
+};
+
+constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43505342;  // "BSPC"
+constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+
+static PipelineCacheHeader makePipelineCacheHeader(
+    const vk::PhysicalDeviceProperties &properties, uint64_t dataSize) {
+  PipelineCacheHeader header{};
+  header.magic = PIPELINE_CACHE_MAGIC;
+  header.version = PIPELINE_CACHE_VERSION;
+  header.vendorID = properties.vendorID;
+  header.deviceID = properties.deviceID;
+  header.driverVersion = properties.driverVersion;
+  memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID.data(),
+         VK_UUID_SIZE);
+  header.dataSize = dataSize;
+  return header;
 }
 
-// Jack Ritter. An Efficient Bounding Sphere. 1990
-void computeBoundingSphere(glm::vec4 &result, const glm::vec3 points[],
-                           size_t count) {
-  assert(count > 0);
-
-  // find extremum points along all 3 axes; for each axis we get a pair of
-  // points with min/max coordinates
-  size_t pmin[3] = {0, 0, 0};
-  size_t pmax[3] = {0, 0, 0};
-
-  for (size_t i = 0; i < count; ++i) {
-    glm::vec3 p = points[i];
+std::vector<uint8_t> readPipelineCache(
+    const std::string &filename,
+    const vk::PhysicalDeviceProperties &properties) {
+  std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
-    for (int axis = 0; axis < 3; ++axis) {
-      pmin[axis] = (p[axis] < points[pmin[axis]][axis]) ? i : pmin[axis];
-      pmax[axis] = (p[axis] > points[pmax[axis]][axis]) ? i : pmax[axis];
-    }
+  // NOTE: Not being there is fine, it's the first run
+  if (!file.is_open()) {
+    return {};
   }
 
-  // find the pair of points with largest distance
-  float paxisd2 = 0;
-  int paxis = 0;
-
-  for (int axis = 0; axis < 3; ++axis) {
-    glm::vec3 p1 = points[pmin[axis]];
-    glm::vec3 p2 = points[pmax[axis]];
-
-    float d2 = (p2[0] - p1[0]) * (p2[0] - p1[0]) +
-               (p2[1] - p1[1]) * (p2[1] - p1[1]) +
-               (p2[2] - p1[2]) * (p2[2] - p1[2]);
-
-    if (d2 > paxisd2) {
-      paxisd2 = d2;
-      paxis = axis;
-    }
+  size_t fileSize = (size_t)file.tellg();
+  if (fileSize < sizeof(PipelineCacheHeader)) {
+    std::cerr << "Pipeline cache " << filename << " is truncated" << std::endl;
+    return {};
   }
 
-  // use the longest segment as the initial sphere diameter
-  glm::vec3 p1 = points[pmin[paxis]];
-  glm::vec3 p2 = points[pmax[paxis]];
+  PipelineCacheHeader header{};
+  file.seekg(0);
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+
+  PipelineCacheHeader expected =
+      makePipelineCacheHeader(properties, fileSize - sizeof(header));
+  if (memcmp(&header, &expected, sizeof(header)) != 0) {
+    std::cerr << "Pipeline cache " << filename
+              << " is from another device or driver, starting over"
+              << std::endl;
+    return {};
+  }
 
-  float center[3] = {(p1[0] + p2[0]) / 2, (p1[1] + p2[1]) / 2,
-                     (p1[2] + p2[2]) / 2};
-  float radius = sqrtf(paxisd2) / 2;
+  std::vector<uint8_t> data(header.dataSize);
+  file.read(reinterpret_cast<char *>(data.data()), data.size());
+  if (!file) {
+    return {};
+  }
 
-  // iteratively adjust the sphere up until all points fit
-  for (size_t i = 0; i < count; ++i) {
-    glm::vec3 p = points[i];
-    float d2 = (p[0] - center[0]) * (p[0] - center[0]) +
-               (p[1] - center[1]) * (p[1] - center[1]) +
-               (p[2] - center[2]) * (p[2] - center[2]);
+  return data;
+}
 
-    if (d2 > radius * radius) {
-      float d = sqrtf(d2);
-      assert(d > 0);
+void writePipelineCache(const std::string &filename,
+                        const vk::PhysicalDeviceProperties &properties,
+                        const std::vector<uint8_t> &data) {
+  PipelineCacheHeader header = makePipelineCacheHeader(properties, data.size());
+  writeFileAtomic(filename, &header, sizeof(header), data.data(), data.size());
+}
 
-      float k = 0.5f + (radius / d) / 2;
+vk::UniqueShaderModule createUniqueShaderModule(const vk::Device &device,
+                                                const std::vector<char> &code) {
+  vk::ShaderModuleCreateInfo createInfo{
+      vk::ShaderModuleCreateFlags{}, code.size(),
+      reinterpret_cast<const uint32_t *>(code.data())};
 
-      center[0] = center[0] * k + p[0] * (1 - k);
-      center[1] = center[1] * k + p[1] * (1 - k);
-      center[2] = center[2] * k + p[2] * (1 - k);
-      radius = (radius + d) / 2;
-    }
-  }
+  return device.createShaderModuleUnique(createInfo);
+}
 
-  result[0] = center[0];
-  result[1] = center[1];
-  result[2] = center[2];
-  result[3] = radius;
+uint32_t getMipLevels(int texWidth, int texHeight) {
+  return static_cast<uint32_t>(
+             std::floor(std::log2(std::max(texWidth, texHeight)))) +
+         1;
 }
 
 }  // namespace vkutils
@@ -0,0 +1,205 @@
+#include "chart.hpp"
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+TEST_CASE("ChartTimeline") {
+  DStack stack{1024};
+
+  RhythmEvent bar0[] = {{.beat = 0, .gamepadButton = GAMEPAD_A},
+                        {.beat = 4, .gamepadButton = GAMEPAD_A},
+                        {.beat = 8, .gamepadButton = GAMEPAD_B}};
+  RhythmEvent bar1[] = {{.beat = 2, .gamepadButton = GAMEPAD_B},
+                        {.beat = 10, .gamepadButton = GAMEPAD_A}};
+  RhythmBar bars[] = {{.nEvents = 3, .rhythmEvents = bar0},
+                      {.nEvents = 2, .rhythmEvents = bar1}};
+
+  ChartTimeline timeline{};
+  timeline.build(bars, 2, stack);
+
+  SECTION("event offsets") {
+    REQUIRE(timeline.eventOffset(0) == 0);
+    REQUIRE(timeline.eventOffset(1) == 1);
+    REQUIRE(timeline.eventOffset(8) == 2);
+    REQUIRE(timeline.eventOffset(9) == 3);
+    REQUIRE(timeline.eventOffset(RHYTHM_BAR_BEATS + 2) == 3);
+    REQUIRE(timeline.eventOffset(RHYTHM_BAR_BEATS + 3) == 4);
+    REQUIRE(timeline.eventOffset(1000) == 5);
+  }
+
+  SECTION("seek into a talking bar") {
+    ChartCursor cursor = timeline.seek(5);
+    REQUIRE(cursor.barIndex == 0);
+    REQUIRE(cursor.eventIndex == 2);
+    REQUIRE(cursor.talking);
+  }
+
+  SECTION("seek into a listening bar") {
+    ChartCursor cursor = timeline.seek(RHYTHM_BAR_BEATS + BAR_BEATS + 3);
+    REQUIRE(cursor.barIndex == 1);
+    REQUIRE(cursor.eventIndex == 1);
+    REQUIRE(!cursor.talking);
+  }
+
+  SECTION("seek onto a bar line") {
+    // Stops just short so that the rhythmic update does the flip
+    ChartCursor cursor = timeline.seek(RHYTHM_BAR_BEATS);
+    REQUIRE(cursor.barIndex == 0);
+    REQUIRE(!cursor.talking);
+
+    cursor = timeline.seek(BAR_BEATS);
+    REQUIRE(cursor.barIndex == 0);
+    REQUIRE(cursor.talking);
+
+    cursor = timeline.seek(0);
+    REQUIRE(cursor.barIndex == -1);
+  }
+
+  SECTION("seek past the end") {
+    ChartCursor cursor = timeline.seek(RHYTHM_BAR_BEATS * 10 + 5);
+    REQUIRE(cursor.barIndex == 1);
+    REQUIRE(cursor.eventIndex == 2);
+    REQUIRE(!cursor.talking);
+  }
+}
+
+// Somewhere to write charts to, gone again at the end of the test
+struct TempDir {
+  std::filesystem::path path;
+
+  TempDir()
+      : path{std::filesystem::temp_directory_path() / "bolster_chart_test"} {
+    std::filesystem::create_directories(path);
+  }
+  ~TempDir() {
+    std::error_code ec;
+    std::filesystem::remove_all(path, ec);
+  }
+
+  std::string file(const char *name) const { return (path / name).string(); }
+};
+
+TEST_CASE("ChartStream") {
+  DStack stack{4096};
+  TempDir dir{};
+  const std::string json = dir.file("chart_test.json");
+  const std::string binary = dir.file("chart_test.bsc");
+
+  // Longer than the window, so the stream has to slide
+  const size_t nBars = ChartStream::WINDOW_BARS * 3;
+  {
+    std::ofstream o(json);
+    o << "{\"events\": [";
+    for (size_t i{}; i < nBars; i++) {
+      o << (i ? "," : "") << "[{\"beat\": " << i % BAR_BEATS
+        << ", \"gamepadButton\": " << GAMEPAD_A << "}]";
+    }
+    o << "]}";
+  }
+
+  REQUIRE(convertChart(json.c_str(), binary.c_str()));
+
+  ChartStream stream{};
+  REQUIRE(stream.open(binary.c_str(), stack));
+  REQUIRE(stream.getBarCount() == nBars);
+
+  SECTION("reads bars in order") {
+    for (size_t i{}; i < nBars; i++) {
+      stream.advance(i);
+      const RhythmBar &bar = stream.getBar(i);
+      REQUIRE(bar.nEvents == 1);
+      REQUIRE(bar.rhythmEvents[0].beat == i % BAR_BEATS);
+    }
+  }
+
+  SECTION("jumps outside the window") {
+    const RhythmBar &bar = stream.getBar(nBars - 1);
+    REQUIRE(bar.rhythmEvents[0].beat == (nBars - 1) % BAR_BEATS);
+
+    ChartCursor cursor = stream.seek(RHYTHM_BAR_BEATS * 2 + 3);
+    REQUIRE(cursor.barIndex == 2);
+    REQUIRE(cursor.eventIndex == 1);
+    REQUIRE(cursor.talking);
+  }
+
+  SECTION("keeps the last bar it handed out") {
+    // Moving the window past a bar doesn't free its slot while it's held
+    const RhythmBar &bar = stream.getBar(0);
+    for (size_t i = 1; i < ChartStream::WINDOW_BARS; i++) {
+      stream.advance(i);
+    }
+    REQUIRE(bar.nEvents == 1);
+    REQUIRE(bar.rhythmEvents[0].beat == 0);
+
+    // Bar 8 shares its slot, and gets it once bar 0 is let go
+    const RhythmBar &next = stream.getBar(ChartStream::WINDOW_BARS);
+    REQUIRE(next.rhythmEvents[0].beat == ChartStream::WINDOW_BARS % BAR_BEATS);
+  }
+
+  SECTION("won't open a chart that was cut short") {
+    const std::string cut = dir.file("chart_test_cut.bsc");
+    std::filesystem::copy_file(binary, cut);
+    std::filesystem::resize_file(cut, std::filesystem::file_size(cut) - 1);
+
+    ChartStream other{};
+    REQUIRE(!other.open(cut.c_str(), stack));
+  }
+
+  SECTION("leaves the old binary chart alone when it can't convert") {
+    const std::string bad = dir.file("chart_test_bad.json");
+    {
+      std::ofstream o(bad);
+      o << "{\"events\": [[";
+      for (size_t i{}; i <= MAX_BAR_EVENTS; i++) {
+        o << (i ? "," : "") << "{\"beat\": 0, \"gamepadButton\": 0}";
+      }
+      o << "]]}";
+    }
+    auto size = std::filesystem::file_size(binary);
+    REQUIRE(!convertChart(bad.c_str(), binary.c_str()));
+    REQUIRE(std::filesystem::file_size(binary) == size);
+    REQUIRE(!std::filesystem::exists(binary + ".tmp"));
+  }
+
+  stream.close();
+}
+
+TEST_CASE("Bad charts") {
+  DStack stack{4096};
+  TempDir dir{};
+  const std::string json = dir.file("chart_test.json");
+  const std::string binary = dir.file("chart_test.bsc");
+
+  // Half edited charts are read all the time while hot reloading, none
+  // of them may throw
+  const char *charts[] = {
+      "{\"events\": [[{\"beat\": 0}]]}",
+      "{\"events\": [[{\"gamepadButton\": 0}]]}",
+      "{\"events\": [[{\"beat\": \"0\", \"gamepadButton\": 0}]]}",
+      "{\"events\": [[{\"beat\": -1, \"gamepadButton\": 0}]]}",
+      "{\"events\": [[{\"beat\": 16, \"gamepadButton\": 0}]]}",
+      "{\"events\": [[{\"beat\": 0, \"gamepadButton\": 8}]]}",
+      "{\"events\": [3]}",
+      "{\"events\": [[4]]}",
+      "[1, 2]",
+  };
+
+  for (const char *chart : charts) {
+    INFO(chart);
+    {
+      std::ofstream o(json);
+      o << chart;
+    }
+
+    Chart loaded{};
+    REQUIRE(!loadChart(json.c_str(), stack, loaded));
+    REQUIRE(!convertChart(json.c_str(), binary.c_str()));
+    REQUIRE(!std::filesystem::exists(binary));
+  }
+}
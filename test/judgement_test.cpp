@@ -0,0 +1,106 @@
+#include "judgement.hpp"
+
+#include <stdint.h>
+
+#include "chart.hpp"
+#include "tempo_map.hpp"
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+// Music bar the player repeats rhythm bar index in. Its cues start on
+// chart beat index * RHYTHM_BAR_BEATS, and the repeat is a bar after that.
+static int32_t listeningBar(int32_t index) {
+  int32_t chartBeat = index * RHYTHM_BAR_BEATS + BAR_BEATS;
+  return (chartBeat - static_cast<int32_t>(CHART_BEAT_OFFSET)) / BAR_BEATS;
+}
+
+// Where the music is when the given beat of a bar is heard, plus late
+// seconds
+static MusicPos musicPosAt(const TempoMap &tempoMap, int32_t bar,
+                           uint32_t beat, double late = 0.) {
+  double time = tempoMap.timeAt(tempoMap.beatAtBar(bar) + beat);
+  return tempoMap.musicPosAt(time + late);
+}
+
+// Hit error for an event on the given beat of bar, heard at mp
+static double hitErrorMs(const MusicPos &mp, int32_t bar, uint32_t beat) {
+  double barStart;
+  REQUIRE(getBarStartBeat(mp, bar, barStart));
+  return getHitErrorMs(mp, barStart + beat);
+}
+
+TEST_CASE("Hit error") {
+  TempoMap tempoMap{};
+  // 120 bpm is 8 sixteenths a second
+  tempoMap.setConstant(120., 2.);
+
+  SECTION("on the event") {
+    for (int32_t index : {0, 1, 3}) {
+      for (uint32_t beat : {0u, 4u, 13u}) {
+        int32_t bar = listeningBar(index);
+        MusicPos mp = musicPosAt(tempoMap, bar, beat);
+        REQUIRE(mp.bar == bar);
+        REQUIRE(hitErrorMs(mp, bar, beat) == Approx(0.).margin(1e-6));
+      }
+    }
+  }
+
+  SECTION("first rhythm bar") {
+    // Its cues play over the lead in, so it's repeated in music bar 0
+    REQUIRE(listeningBar(0) == 0);
+    MusicPos mp = musicPosAt(tempoMap, 0, 4);
+    REQUIRE(mp.time == Approx(0.5));
+    REQUIRE(judge(hitErrorMs(mp, 0, 4), JudgementWindows{}) ==
+            Judgement::PERFECT);
+  }
+
+  SECTION("late and early") {
+    MusicPos late = musicPosAt(tempoMap, listeningBar(2), 8, 0.02);
+    REQUIRE(hitErrorMs(late, listeningBar(2), 8) == Approx(20.));
+
+    MusicPos early = musicPosAt(tempoMap, listeningBar(2), 8, -0.03);
+    REQUIRE(hitErrorMs(early, listeningBar(2), 8) == Approx(-30.));
+  }
+
+  SECTION("meter changes") {
+    // Bars of 12 sixteenths from bar 2 on
+    REQUIRE(tempoMap.addMeter(2, 3, 4));
+    int32_t bar = listeningBar(3);
+    MusicPos mp = musicPosAt(tempoMap, bar, 10);
+    REQUIRE(mp.bar == bar);
+    REQUIRE(mp.barBeats == 12);
+    REQUIRE(hitErrorMs(mp, bar, 10) == Approx(0.).margin(1e-6));
+  }
+
+  SECTION("early, before the bar line") {
+    // Still in the talking bar, but near enough to hit beat 0
+    int32_t bar = listeningBar(2);
+    MusicPos mp = musicPosAt(tempoMap, bar, 0, -0.03);
+    REQUIRE(mp.bar == bar - 1);
+    REQUIRE(hitErrorMs(mp, bar, 0) == Approx(-30.));
+
+    // Even when the bar before is shorter
+    REQUIRE(tempoMap.addMeter(bar - 1, 3, 4));
+    REQUIRE(tempoMap.addMeter(bar, 4, 4));
+    mp = musicPosAt(tempoMap, bar, 0, -0.03);
+    REQUIRE(mp.barBeats == 12);
+    REQUIRE(hitErrorMs(mp, bar, 0) == Approx(-30.));
+  }
+
+  SECTION("late, after the bar line") {
+    // The bar's start is only known from inside it or the bar before, so
+    // it's kept from earlier on
+    int32_t bar = listeningBar(1);
+    double barStart;
+    REQUIRE(getBarStartBeat(musicPosAt(tempoMap, bar, 8), bar, barStart));
+
+    MusicPos mp = musicPosAt(tempoMap, bar, 15, 0.15);
+    REQUIRE(mp.bar == bar + 1);
+    double unknown;
+    REQUIRE(!getBarStartBeat(mp, bar, unknown));
+    double errorMs = getHitErrorMs(mp, barStart + 15);
+    REQUIRE(errorMs == Approx(150.));
+    REQUIRE(judge(errorMs, JudgementWindows{}) == Judgement::BAD);
+  }
+}
@@ -0,0 +1,168 @@
+#include "mesh_optimize.hpp"
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <vector>
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+// A flat grid of size x size quads, two triangles each
+static void makeGrid(size_t size, std::vector<glm::vec3> &positions,
+                     std::vector<uint32_t> &indices) {
+  for (size_t y{}; y <= size; y++) {
+    for (size_t x{}; x <= size; x++) {
+      positions.push_back(glm::vec3{static_cast<float>(x),
+                                    static_cast<float>(y), 0.f});
+    }
+  }
+
+  uint32_t row = static_cast<uint32_t>(size + 1);
+  for (uint32_t y{}; y < size; y++) {
+    for (uint32_t x{}; x < size; x++) {
+      uint32_t i = y * row + x;
+      indices.insert(indices.end(), {i, i + 1, i + row});
+      indices.insert(indices.end(), {i + 1, i + row + 1, i + row});
+    }
+  }
+}
+
+// The triangles, each rotated to start at its smallest index, so the same
+// triangles in any order compare equal
+static std::vector<std::array<uint32_t, 3>> getTriangles(
+    const std::vector<uint32_t> &indices) {
+  std::vector<std::array<uint32_t, 3>> triangles;
+  for (size_t i{}; i < indices.size(); i += 3) {
+    std::array<uint32_t, 3> t{indices[i], indices[i + 1], indices[i + 2]};
+    std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+    triangles.push_back(t);
+  }
+  std::sort(triangles.begin(), triangles.end());
+  return triangles;
+}
+
+static void shuffleTriangles(std::vector<uint32_t> &indices) {
+  std::vector<std::array<uint32_t, 3>> triangles;
+  for (size_t i{}; i < indices.size(); i += 3) {
+    triangles.push_back({indices[i], indices[i + 1], indices[i + 2]});
+  }
+  std::shuffle(triangles.begin(), triangles.end(), std::mt19937{1234});
+
+  indices.clear();
+  for (const auto &t : triangles) {
+    indices.insert(indices.end(), t.begin(), t.end());
+  }
+}
+
+TEST_CASE("Vertex cache misses") {
+  SECTION("one triangle") {
+    std::vector<uint32_t> indices{0, 1, 2};
+    REQUIRE(getVertexCacheMisses(indices.data(), indices.size(), 3) == 3);
+  }
+
+  SECTION("shared vertices hit") {
+    std::vector<uint32_t> indices{0, 1, 2, 2, 1, 3};
+    REQUIRE(getVertexCacheMisses(indices.data(), indices.size(), 4) == 4);
+  }
+
+  SECTION("fifo evicts") {
+    // 0 is pushed out by the three after it
+    std::vector<uint32_t> indices{0, 1, 2, 3, 4, 5, 0, 1, 2};
+    REQUIRE(getVertexCacheMisses(indices.data(), indices.size(), 6, 3) == 9);
+    REQUIRE(getVertexCacheMisses(indices.data(), indices.size(), 6, 6) == 6);
+  }
+}
+
+TEST_CASE("Mesh optimization") {
+  std::vector<glm::vec3> positions;
+  std::vector<uint32_t> indices;
+  makeGrid(32, positions, indices);
+  shuffleTriangles(indices);
+
+  const auto triangles = getTriangles(indices);
+  size_t nTriangles = indices.size() / 3;
+  size_t missesBefore =
+      getVertexCacheMisses(indices.data(), indices.size(), positions.size());
+
+  std::vector<uint32_t> clusters;
+  optimizeVertexCache(indices.data(), indices.size(), positions.size(),
+                      clusters);
+
+  SECTION("cache order") {
+    REQUIRE(getTriangles(indices) == triangles);
+    REQUIRE(!clusters.empty());
+    REQUIRE(clusters[0] == 0);
+    REQUIRE(std::is_sorted(clusters.begin(), clusters.end()));
+
+    size_t misses =
+        getVertexCacheMisses(indices.data(), indices.size(), positions.size());
+    REQUIRE(misses < missesBefore / 2);
+    // Every vertex has to miss once, and a grid can't do much better
+    REQUIRE(static_cast<float>(misses) / nTriangles < 0.8f);
+  }
+
+  SECTION("overdraw order") {
+    size_t missesCache =
+        getVertexCacheMisses(indices.data(), indices.size(), positions.size());
+    optimizeOverdraw(indices.data(), indices.size(), positions.data(),
+                     positions.size(), clusters);
+
+    REQUIRE(getTriangles(indices) == triangles);
+    size_t misses =
+        getVertexCacheMisses(indices.data(), indices.size(), positions.size());
+    REQUIRE(misses < missesBefore / 2);
+    REQUIRE(misses <= missesCache * 1.5f);
+  }
+
+  SECTION("fetch order") {
+    std::vector<uint32_t> original = indices;
+    std::vector<uint32_t> remap;
+    size_t nUsed = optimizeVertexFetch(indices.data(), indices.size(),
+                                       positions.size(), remap);
+    REQUIRE(nUsed == positions.size());
+
+    // First uses count up from 0
+    uint32_t next{};
+    for (size_t i{}; i < indices.size(); i++) {
+      REQUIRE(indices[i] <= next);
+      if (indices[i] == next) next++;
+      REQUIRE(remap[original[i]] == indices[i]);
+    }
+  }
+
+  SECTION("unused vertices") {
+    std::vector<uint32_t> small{4, 2, 3};
+    std::vector<uint32_t> remap;
+    REQUIRE(optimizeVertexFetch(small.data(), small.size(), 5, remap) == 3);
+    REQUIRE(small == std::vector<uint32_t>{0, 1, 2});
+    REQUIRE(remap[0] == ~0u);
+    REQUIRE(remap[1] == ~0u);
+    REQUIRE(remap[4] == 0);
+  }
+}
+
+TEST_CASE("Overdraw order") {
+  // Two quads facing away from each other. The one facing out from the
+  // middle goes first, whatever order they came in.
+  std::vector<glm::vec3> positions{
+      {0.f, 0.f, 1.f}, {1.f, 0.f, 1.f}, {1.f, 1.f, 1.f}, {0.f, 1.f, 1.f},
+      {0.f, 0.f, 0.f}, {1.f, 0.f, 0.f}, {1.f, 1.f, 0.f}, {0.f, 1.f, 0.f}};
+  // The top one faces +z, the bottom one -z. Both outwards.
+  std::vector<uint32_t> indices{4, 6, 5, 4, 7, 6, 0, 1, 2, 0, 2, 3};
+  std::vector<uint32_t> clusters{0, 2};
+
+  optimizeOverdraw(indices.data(), indices.size(), positions.data(),
+                   positions.size(), clusters);
+  // Both face out just as much, so they keep their order
+  REQUIRE(indices[0] == 4);
+
+  // Flipped, the bottom one faces in
+  std::vector<uint32_t> flipped{4, 5, 6, 4, 6, 7, 0, 1, 2, 0, 2, 3};
+  optimizeOverdraw(flipped.data(), flipped.size(), positions.data(),
+                   positions.size(), clusters);
+  REQUIRE(flipped[0] == 0);
+  REQUIRE(flipped[6] == 4);
+}
@@ -0,0 +1,199 @@
+#include "rhythmic_state.hpp"
+
+#include <stdint.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "dstack.hpp"
+#include "game_state_manager.hpp"
+#include "latency.hpp"
+#include "tempo_map.hpp"
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+// A level1.json to load, gone again at the end of the test
+struct TempLevel {
+  std::filesystem::path path;
+  std::string dataDir;
+
+  // Every bar has an A on each of the given beats
+  explicit TempLevel(size_t nBars, std::vector<uint32_t> beats = {0, 4, 8, 12})
+      : path{std::filesystem::temp_directory_path() /
+             "bolster_rhythmic_state_test"},
+        dataDir{path.string() + "/"} {
+    std::filesystem::create_directories(path);
+
+    std::ofstream o(path / "level1.json");
+    o << "{\"events\": [";
+    for (size_t i{}; i < nBars; i++) {
+      o << (i ? "," : "") << "[";
+      for (size_t e{}; e < beats.size(); e++) {
+        o << (e ? "," : "") << "{\"beat\": " << beats[e]
+          << ", \"gamepadButton\": " << GAMEPAD_A << "}";
+      }
+      o << "]";
+    }
+    o << "]}";
+  }
+  ~TempLevel() {
+    std::error_code ec;
+    std::filesystem::remove_all(path, ec);
+  }
+};
+
+// What came out of a rhythmic update at the given beat of a bar
+struct Frame {
+  std::vector<FrameEvent> storage;
+  FrameEvents frameEvents;
+
+  Frame() : storage(MAX_FRAME_EVENTS), frameEvents{} {
+    frameEvents.events = storage.data();
+  }
+
+  const FrameEvent *find(EventType type) const {
+    for (uint32_t i{}; i < frameEvents.nEvents; i++) {
+      if (frameEvents.events[i].type == type) {
+        return &frameEvents.events[i];
+      }
+    }
+    return nullptr;
+  }
+};
+
+// Plus late seconds
+static MusicPos musicPosAt(const TempoMap &tempoMap, int32_t bar,
+                           uint32_t beat, double late = 0.) {
+  double time = tempoMap.timeAt(tempoMap.beatAtBar(bar) + beat);
+  return tempoMap.musicPosAt(time + late);
+}
+
+TEST_CASE("Seeking and practice loops") {
+  TempLevel level{8};
+  DStack allocator{1000000 * 10};
+  LatencyOffsets latencyOffsets{};
+  GameStateManager gameStateManager{allocator, latencyOffsets,
+                                    level.dataDir.c_str(), false};
+
+  RhythmicState state{1, gameStateManager, allocator, level.dataDir.c_str(),
+                      false};
+  state.onEnter();
+
+  TempoMap tempoMap{};
+  tempoMap.setConstant(120., 2.);
+  GamepadState gamepadState{};
+
+  SECTION("seek to a sixteenth") {
+    // Rhythm bar 1 is talking in music bar 1. Landing on its second cue
+    // plays that cue, not the one on the bar line.
+    Frame seek{};
+    state.seek(1, 4, seek.frameEvents);
+    const FrameEvent *event = seek.find(EventType::MUSIC_SEEK);
+    REQUIRE(event);
+    REQUIRE(event->bar == 1);
+    REQUIRE(event->beatRel == 4);
+
+    Frame frame{};
+    state.rUpdate(musicPosAt(tempoMap, 1, 4), gamepadState, frame.frameEvents);
+    REQUIRE(frame.find(EventType::RHYTHM_DOWN));
+  }
+
+  SECTION("loop") {
+    state.setLoop(2, 0, 4, 8);
+
+    // Not there yet, so the music is taken to the start of the loop
+    Frame before{};
+    state.rUpdate(musicPosAt(tempoMap, 0, 3), gamepadState,
+                  before.frameEvents);
+    const FrameEvent *event = before.find(EventType::MUSIC_SEEK);
+    REQUIRE(event);
+    REQUIRE(event->bar == 2);
+    REQUIRE(event->beatRel == 0);
+
+    Frame inside{};
+    state.rUpdate(musicPosAt(tempoMap, 4, 7), gamepadState,
+                  inside.frameEvents);
+    REQUIRE(!inside.find(EventType::MUSIC_SEEK));
+
+    Frame end{};
+    state.rUpdate(musicPosAt(tempoMap, 4, 8), gamepadState, end.frameEvents);
+    event = end.find(EventType::MUSIC_SEEK);
+    REQUIRE(event);
+    REQUIRE(event->bar == 2);
+
+    state.clearLoop();
+    Frame cleared{};
+    state.rUpdate(musicPosAt(tempoMap, 5, 0), gamepadState,
+                  cleared.frameEvents);
+    REQUIRE(!cleared.find(EventType::MUSIC_SEEK));
+  }
+
+  SECTION("practice loop from the game state manager") {
+    gameStateManager.setState(RHYTHMIC_STATE);
+    gameStateManager.setPracticeLoop(1, 3);
+
+    Frame frame{};
+    gameStateManager.rUpdate(musicPosAt(tempoMap, 3, 0), gamepadState,
+                             frame.frameEvents);
+    const FrameEvent *event = frame.find(EventType::MUSIC_SEEK);
+    REQUIRE(event);
+    REQUIRE(event->bar == 1);
+  }
+}
+
+TEST_CASE("Judging across bar lines") {
+  // Close enough to both bar lines to be hit from the talking bars
+  TempLevel level{4, {0, 15}};
+  DStack allocator{1000000 * 10};
+  LatencyOffsets latencyOffsets{};
+  GameStateManager gameStateManager{allocator, latencyOffsets,
+                                    level.dataDir.c_str(), false};
+
+  RhythmicState state{1, gameStateManager, allocator, level.dataDir.c_str(),
+                      false};
+  state.onEnter();
+
+  TempoMap tempoMap{};
+  tempoMap.setConstant(120., 2.);
+  GamepadState idle{};
+  GamepadState pressed{};
+  pressed[GAMEPAD_A] = true;
+
+  // Rhythm bar 1 talks in music bar 1 and is repeated in music bar 2
+  Frame seek{};
+  state.seek(1, 0, seek.frameEvents);
+
+  // Early on beat 0, before the bar line
+  Frame early{};
+  state.update(0.f, musicPosAt(tempoMap, 2, 0, -0.03), pressed,
+               early.frameEvents);
+  REQUIRE(early.find(EventType::PLAYER_PERFECT));
+
+  SECTION("late on the last event, after the bar line") {
+    Frame late{};
+    state.update(0.f, musicPosAt(tempoMap, 2, 15, 0.15), pressed,
+                 late.frameEvents);
+    REQUIRE(late.find(EventType::PLAYER_BAD));
+    REQUIRE(state.getHitStats().getCount(Judgement::MISS) == 0);
+  }
+
+  SECTION("the last event is missed once it's too late") {
+    Frame stillOk{};
+    state.update(0.f, musicPosAt(tempoMap, 3, 0), idle, stillOk.frameEvents);
+    REQUIRE(!stillOk.find(EventType::PLAYER_FAIL));
+
+    Frame missed{};
+    state.update(0.f, musicPosAt(tempoMap, 3, 4), idle, missed.frameEvents);
+    REQUIRE(missed.find(EventType::PLAYER_FAIL));
+    REQUIRE(state.getHitStats().getCount(Judgement::MISS) == 1);
+
+    // Then on to rhythm bar 2, its beat 0 is in music bar 4
+    Frame next{};
+    state.update(0.f, musicPosAt(tempoMap, 4, 0, 0.01), pressed,
+                 next.frameEvents);
+    REQUIRE(next.find(EventType::PLAYER_PERFECT));
+  }
+}
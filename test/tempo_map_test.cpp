@@ -0,0 +1,126 @@
+#include "tempo_map.hpp"
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <fstream>
+
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+TEST_CASE("TempoMap tempo") {
+  TempoMap tempoMap{};
+
+  SECTION("constant tempo") {
+    // 120 bpm is 8 sixteenths a second
+    tempoMap.setConstant(120., 2.);
+    REQUIRE(tempoMap.getSegmentCount() == 1);
+    REQUIRE(tempoMap.beatAt(2.) == Approx(0.));
+    REQUIRE(tempoMap.beatAt(3.) == Approx(8.));
+    REQUIRE(tempoMap.timeAt(16.) == Approx(4.));
+    REQUIRE(tempoMap.spbAt(10.) == Approx(0.125));
+  }
+
+  SECTION("lead in is negative") {
+    tempoMap.setConstant(120., 2.);
+    REQUIRE(tempoMap.beatAt(0.) == Approx(-16.));
+    REQUIRE(tempoMap.timeAt(-8.) == Approx(1.));
+  }
+
+  SECTION("tempo changes") {
+    REQUIRE(tempoMap.addSegment(0., 120.));
+    REQUIRE(tempoMap.addSegment(2., 60.));
+    REQUIRE(tempoMap.addSegment(6., 240.));
+
+    // Out of order and nonsense segments are refused
+    REQUIRE_FALSE(tempoMap.addSegment(5., 100.));
+    REQUIRE_FALSE(tempoMap.addSegment(7., 0.));
+
+    REQUIRE(tempoMap.beatAt(2.) == Approx(16.));
+    REQUIRE(tempoMap.beatAt(4.) == Approx(24.));
+    REQUIRE(tempoMap.beatAt(6.) == Approx(32.));
+    REQUIRE(tempoMap.beatAt(7.) == Approx(48.));
+    REQUIRE(tempoMap.spbAt(3.) == Approx(0.25));
+
+    for (double t = 0.; t < 10.; t += 0.37) {
+      REQUIRE(tempoMap.timeAt(tempoMap.beatAt(t)) == Approx(t));
+    }
+  }
+}
+
+TEST_CASE("TempoMap meter") {
+  TempoMap tempoMap{};
+  tempoMap.setConstant(120., 0.);
+
+  SECTION("4/4 by default") {
+    BarPos barPos = tempoMap.barAt(37.5);
+    REQUIRE(barPos.bar == 2);
+    REQUIRE(barPos.beatRel == 5);
+    REQUIRE(barPos.barBeats == 16);
+    REQUIRE(barPos.barStartBeat == Approx(32.));
+  }
+
+  SECTION("lead in counts down") {
+    BarPos barPos = tempoMap.barAt(-1.);
+    REQUIRE(barPos.bar == -1);
+    REQUIRE(barPos.beatRel == 15);
+    REQUIRE(tempoMap.beatAtBar(-1) == Approx(-16.));
+  }
+
+  SECTION("changes of meter") {
+    REQUIRE(tempoMap.addMeter(2, 3, 4));
+    REQUIRE(tempoMap.addMeter(4, 7, 8));
+    REQUIRE_FALSE(tempoMap.addMeter(3, 4, 4));
+    REQUIRE_FALSE(tempoMap.addMeter(5, 5, 32));
+
+    // Bars 0 and 1 in 4/4, 2 and 3 in 3/4, then 7/8
+    REQUIRE(tempoMap.beatAtBar(2) == Approx(32.));
+    REQUIRE(tempoMap.beatAtBar(3) == Approx(44.));
+    REQUIRE(tempoMap.beatAtBar(4) == Approx(56.));
+    REQUIRE(tempoMap.beatAtBar(5) == Approx(70.));
+
+    BarPos barPos = tempoMap.barAt(47.);
+    REQUIRE(barPos.bar == 3);
+    REQUIRE(barPos.beatRel == 3);
+    REQUIRE(barPos.barBeats == 12);
+
+    barPos = tempoMap.barAt(71.);
+    REQUIRE(barPos.bar == 5);
+    REQUIRE(barPos.beatRel == 1);
+    REQUIRE(barPos.barBeats == 14);
+  }
+
+  SECTION("meter on bar 0 replaces 4/4") {
+    REQUIRE(tempoMap.addMeter(0, 3, 4));
+    REQUIRE(tempoMap.barAt(12.).bar == 1);
+    REQUIRE(tempoMap.barAt(-1.).beatRel == 11);
+  }
+}
+
+TEST_CASE("TempoMap files") {
+  const char *filename = "tempo_map_test.json";
+
+  TempoMap tempoMap{};
+  REQUIRE(tempoMap.addSegment(1.5, 100.));
+  REQUIRE(tempoMap.addSegment(30., 140.));
+  REQUIRE(tempoMap.addMeter(8, 3, 4));
+  REQUIRE(tempoMap.save(filename));
+
+  TempoMap loaded{};
+  REQUIRE(loaded.load(filename));
+  REQUIRE(loaded.getSegmentCount() == 2);
+  REQUIRE(loaded.getStartTime() == Approx(1.5));
+  REQUIRE(loaded.spbAt(40.) == Approx(tempoMap.spbAt(40.)));
+  REQUIRE(loaded.beatAtBar(10) == Approx(tempoMap.beatAtBar(10)));
+
+  SECTION("broken files are refused") {
+    std::ofstream o(filename);
+    o << "{\"segments\": [{\"time\": 2, \"bpm\": 100}, "
+         "{\"time\": 1, \"bpm\": 100}]}";
+    o.close();
+
+    REQUIRE_FALSE(loaded.load(filename));
+  }
+
+  std::remove(filename);
+}
@@ -0,0 +1,469 @@
+// Offline beat tracker. Finds the tempo of a track and where its beats
+// are, and writes it out as a tempo map next to the track:
+//
+//   beatmap [-j threads] track.mp3 [more tracks...]
+//
+// -> track.mp3.tempo.json, which the audio engine picks up on load.
+//
+// Onsets come from the spectral flux of a short time fft. The tempo is the
+// strongest autocorrelation lag of the onsets, estimated in overlapping
+// windows so that tracks which drift or change tempo get several segments.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "soloud.h"
+#include "soloud_wav.h"
+#include "tempo_map.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define BEATMAP_SSE
+  #include <xmmintrin.h>
+#endif
+
+constexpr size_t FRAME_SIZE = 1024;
+constexpr size_t HOP_SIZE = 256;
+
+constexpr double MIN_BPM = 60.;
+constexpr double MAX_BPM = 180.;
+// Tempo estimates lean towards this, to settle octave errors
+constexpr double PREFERRED_BPM = 120.;
+
+constexpr double WINDOW_SECONDS = 12.;
+constexpr double WINDOW_HOP_SECONDS = 6.;
+// Windows closer than this to the current tempo stay in the same segment
+constexpr double TEMPO_TOLERANCE = 0.02;
+
+constexpr float PI = 3.14159265358979f;
+
+/******  FFT  ******/
+
+// Radix 2 fft over split real and imaginary arrays. Keeping them apart
+// lets the butterflies do four at a time.
+class Fft {
+ public:
+  explicit Fft(size_t n) : _n{n}, _bitReverse(n), _twRe(n), _twIm(n) {
+    size_t bits{};
+    while ((size_t{1} << bits) < n) bits++;
+
+    for (size_t i{}; i < n; i++) {
+      size_t r{};
+      for (size_t b{}; b < bits; b++) {
+        r |= ((i >> b) & 1) << (bits - 1 - b);
+      }
+      _bitReverse[i] = r;
+    }
+
+    // Twiddles for each stage one after the other, the stage with
+    // half size h starts at h - 1
+    for (size_t half = 1; half < n; half *= 2) {
+      for (size_t j{}; j < half; j++) {
+        float angle = -PI * j / half;
+        _twRe[half - 1 + j] = std::cos(angle);
+        _twIm[half - 1 + j] = std::sin(angle);
+      }
+    }
+  }
+
+  void forward(float *re, float *im) const {
+    for (size_t i{}; i < _n; i++) {
+      size_t r = _bitReverse[i];
+      if (r > i) {
+        std::swap(re[i], re[r]);
+        std::swap(im[i], im[r]);
+      }
+    }
+
+    for (size_t half = 1; half < _n; half *= 2) {
+      const float *wr = &_twRe[half - 1];
+      const float *wi = &_twIm[half - 1];
+
+      for (size_t block{}; block < _n; block += half * 2) {
+        float *ar = re + block;
+        float *ai = im + block;
+        float *br = ar + half;
+        float *bi = ai + half;
+
+        size_t j{};
+#ifdef BEATMAP_SSE
+        for (; j + 4 <= half; j += 4) {
+          __m128 xr = _mm_loadu_ps(br + j);
+          __m128 xi = _mm_loadu_ps(bi + j);
+          __m128 twr = _mm_loadu_ps(wr + j);
+          __m128 twi = _mm_loadu_ps(wi + j);
+
+          __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, twr), _mm_mul_ps(xi, twi));
+          __m128 ti = _mm_add_ps(_mm_mul_ps(xr, twi), _mm_mul_ps(xi, twr));
+
+          __m128 ur = _mm_loadu_ps(ar + j);
+          __m128 ui = _mm_loadu_ps(ai + j);
+
+          _mm_storeu_ps(ar + j, _mm_add_ps(ur, tr));
+          _mm_storeu_ps(ai + j, _mm_add_ps(ui, ti));
+          _mm_storeu_ps(br + j, _mm_sub_ps(ur, tr));
+          _mm_storeu_ps(bi + j, _mm_sub_ps(ui, ti));
+        }
+#endif
+        for (; j < half; j++) {
+          float tr = br[j] * wr[j] - bi[j] * wi[j];
+          float ti = br[j] * wi[j] + bi[j] * wr[j];
+          br[j] = ar[j] - tr;
+          bi[j] = ai[j] - ti;
+          ar[j] += tr;
+          ai[j] += ti;
+        }
+      }
+    }
+  }
+
+ private:
+  size_t _n;
+  std::vector<size_t> _bitReverse;
+  std::vector<float> _twRe;
+  std::vector<float> _twIm;
+};
+
+/******  ONSETS  ******/
+
+static void applyWindow(const float *in, const float *window, float *out,
+                        size_t n) {
+  size_t i{};
+#ifdef BEATMAP_SSE
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps(out + i, _mm_mul_ps(_mm_loadu_ps(in + i),
+                                      _mm_loadu_ps(window + i)));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = in[i] * window[i];
+  }
+}
+
+// Compressed magnitude of every bin, and how much it rose since the last
+// frame. Only increases count, that's where the onsets are.
+static float spectralFlux(const float *re, const float *im, float *magnitude,
+                          size_t nBins) {
+  size_t k{};
+  float flux{};
+#ifdef BEATMAP_SSE
+  __m128 sum = _mm_setzero_ps();
+  for (; k + 4 <= nBins; k += 4) {
+    __m128 r = _mm_loadu_ps(re + k);
+    __m128 i = _mm_loadu_ps(im + k);
+    __m128 power = _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(i, i));
+    // Fourth root of the power, a cheap stand in for log compression
+    __m128 m = _mm_sqrt_ps(_mm_sqrt_ps(power));
+
+    __m128 rise = _mm_sub_ps(m, _mm_loadu_ps(magnitude + k));
+    sum = _mm_add_ps(sum, _mm_max_ps(rise, _mm_setzero_ps()));
+    _mm_storeu_ps(magnitude + k, m);
+  }
+  float lanes[4];
+  _mm_storeu_ps(lanes, sum);
+  flux = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+  for (; k < nBins; k++) {
+    float m = std::sqrt(std::sqrt(re[k] * re[k] + im[k] * im[k]));
+    flux += std::max(m - magnitude[k], 0.f);
+    magnitude[k] = m;
+  }
+
+  return flux;
+}
+
+// Onset strength per hop, with the local average taken out
+static std::vector<float> onsetEnvelope(const Fft &fft,
+                                        const std::vector<float> &samples,
+                                        double frameRate) {
+  std::vector<float> window(FRAME_SIZE);
+  for (size_t i{}; i < FRAME_SIZE; i++) {
+    window[i] = 0.5f - 0.5f * std::cos(2.f * PI * i / (FRAME_SIZE - 1));
+  }
+
+  size_t nBins = FRAME_SIZE / 2;
+  std::vector<float> re(FRAME_SIZE), im(FRAME_SIZE), magnitude(nBins);
+
+  size_t nFrames = samples.size() < FRAME_SIZE
+                       ? 0
+                       : (samples.size() - FRAME_SIZE) / HOP_SIZE;
+  std::vector<float> flux(nFrames);
+
+  for (size_t f{}; f < nFrames; f++) {
+    applyWindow(&samples[f * HOP_SIZE], window.data(), re.data(), FRAME_SIZE);
+    std::fill(im.begin(), im.end(), 0.f);
+    fft.forward(re.data(), im.data());
+    flux[f] = spectralFlux(re.data(), im.data(), magnitude.data(), nBins);
+  }
+
+  // Everything rises from nothing in the first frame
+  if (nFrames > 1) {
+    flux[0] = flux[1];
+  }
+
+  // Subtract a half second moving average and keep what's above it
+  size_t radius = static_cast<size_t>(frameRate * 0.25);
+  std::vector<float> envelope(nFrames);
+  double sum{};
+  size_t lo{}, hi{};
+  for (size_t f{}; f < nFrames; f++) {
+    while (hi < nFrames && hi <= f + radius) sum += flux[hi++];
+    while (lo + radius < f) sum -= flux[lo++];
+    envelope[f] = std::max(flux[f] - static_cast<float>(sum / (hi - lo)), 0.f);
+  }
+
+  return envelope;
+}
+
+/******  TEMPO  ******/
+
+// Strongest beat period in the given frames, as a fractional lag in frames
+static double estimateLag(const std::vector<float> &envelope, size_t begin,
+                          size_t end, double frameRate) {
+  size_t minLag = static_cast<size_t>(60. * frameRate / MAX_BPM);
+  size_t maxLag = static_cast<size_t>(60. * frameRate / MIN_BPM) + 1;
+
+  std::vector<double> scores(maxLag + 2, 0.);
+  for (size_t lag = minLag; lag <= maxLag + 1; lag++) {
+    double r{};
+    for (size_t f = begin; f + lag < end; f++) {
+      r += envelope[f] * envelope[f + lag];
+    }
+
+    // Log gaussian weighting, an octave away from the preferred tempo
+    // counts for about half
+    double bpm = 60. * frameRate / lag;
+    double octaves = std::log2(bpm / PREFERRED_BPM);
+    scores[lag] = r * std::exp(-0.5 * octaves * octaves / (0.9 * 0.9));
+  }
+
+  size_t best = minLag;
+  for (size_t lag = minLag; lag <= maxLag; lag++) {
+    if (scores[lag] > scores[best]) best = lag;
+  }
+
+  // Parabolic interpolation around the peak for a sub frame lag
+  double offset{};
+  if (best > minLag) {
+    double a = scores[best - 1], b = scores[best], c = scores[best + 1];
+    double denominator = a - 2. * b + c;
+    if (denominator != 0.) {
+      offset = 0.5 * (a - c) / denominator;
+    }
+  }
+
+  return best + std::clamp(offset, -0.5, 0.5);
+}
+
+// Offset of the beat grid in frames, the one that lands on the most onsets
+static double estimatePhase(const std::vector<float> &envelope, size_t begin,
+                            size_t end, double lag,
+                            double *score = nullptr) {
+  double bestPhase{}, bestScore{-1.};
+  for (double phase{}; phase < lag; phase += 1.) {
+    double phaseScore{};
+    for (double f = begin + phase; f < end; f += lag) {
+      // NOTE: The last one can round up past the end
+      phaseScore += envelope[std::min(static_cast<size_t>(f + 0.5), end - 1)];
+    }
+    if (phaseScore > bestScore) {
+      bestScore = phaseScore;
+      bestPhase = phase;
+    }
+  }
+
+  if (score) {
+    *score = bestScore;
+  }
+  return begin + bestPhase;
+}
+
+// The windowed estimate is only good to about a percent, which drifts a
+// whole beat in a couple of minutes. Fine tune it over the whole segment.
+static double refineLag(const std::vector<float> &envelope, size_t begin,
+                        size_t end, double lag) {
+  double bestLag = lag, bestScore{-1.};
+  for (double l = lag * (1. - TEMPO_TOLERANCE);
+       l <= lag * (1. + TEMPO_TOLERANCE); l += 0.01) {
+    double score;
+    estimatePhase(envelope, begin, end, l, &score);
+    if (score > bestScore) {
+      bestScore = score;
+      bestLag = l;
+    }
+  }
+  return bestLag;
+}
+
+static bool analyze(const Fft &fft, const std::string &filename) {
+  SoLoud::Wav wav;
+  if (wav.load(filename.c_str()) != SoLoud::SO_NO_ERROR) {
+    std::cerr << "Couldn't load " << filename << std::endl;
+    return false;
+  }
+
+  // Mix down to mono, the channels are one after the other
+  size_t nSamples = wav.mSampleCount;
+  std::vector<float> samples(nSamples, 0.f);
+  for (unsigned int c{}; c < wav.mChannels; c++) {
+    for (size_t i{}; i < nSamples; i++) {
+      samples[i] += wav.mData[c * nSamples + i] / wav.mChannels;
+    }
+  }
+
+  double frameRate = wav.mBaseSamplerate / HOP_SIZE;
+  std::vector<float> envelope = onsetEnvelope(fft, samples, frameRate);
+  if (envelope.size() < frameRate * WINDOW_SECONDS) {
+    std::cerr << filename << " is too short to find a tempo" << std::endl;
+    return false;
+  }
+
+  size_t windowFrames = static_cast<size_t>(frameRate * WINDOW_SECONDS);
+  size_t hopFrames = static_cast<size_t>(frameRate * WINDOW_HOP_SECONDS);
+
+  TempoMap tempoMap{};
+
+  // Tempo of each window. Windows that agree are averaged into one
+  // segment, a window that doesn't starts a new one at its centre.
+  double segmentLagSum{};
+  size_t segmentWindows{};
+  size_t segmentBegin{};
+  std::vector<std::pair<size_t, double>> segments;  // start frame, lag
+
+  for (size_t begin{}; begin + windowFrames <= envelope.size();
+       begin += hopFrames) {
+    double lag = estimateLag(envelope, begin, begin + windowFrames, frameRate);
+
+    if (segmentWindows > 0) {
+      double segmentLag = segmentLagSum / segmentWindows;
+      if (std::abs(lag - segmentLag) / segmentLag > TEMPO_TOLERANCE) {
+        segments.emplace_back(segmentBegin, segmentLag);
+        segmentBegin = begin + windowFrames / 2;
+        segmentLagSum = 0.;
+        segmentWindows = 0;
+      }
+    }
+
+    segmentLagSum += lag;
+    segmentWindows++;
+  }
+  segments.emplace_back(segmentBegin, segmentLagSum / segmentWindows);
+
+  for (size_t s{}; s < segments.size(); s++) {
+    size_t end = s + 1 < segments.size() ? segments[s + 1].first
+                                         : envelope.size();
+    segments[s].second =
+        refineLag(envelope, segments[s].first, end, segments[s].second);
+  }
+
+  // Line the grid up with the onsets of the first segment. Beat 0 is the
+  // first grid beat where the music has started, which is two onsets in a
+  // row on the grid so a stray click in the intro doesn't count.
+  double firstLag = segments[0].second;
+  size_t firstEnd =
+      segments.size() > 1 ? segments[1].first : envelope.size();
+  double phase = estimatePhase(envelope, 0, firstEnd, firstLag);
+  while (phase >= firstLag) phase -= firstLag;
+
+  float peak = *std::max_element(envelope.begin(), envelope.end());
+  auto onsetNear = [&](double frame) {
+    size_t lo = static_cast<size_t>(std::max(frame - 2., 0.));
+    size_t hi = std::min(static_cast<size_t>(frame + 3.), envelope.size());
+    for (size_t f = lo; f < hi; f++) {
+      if (envelope[f] > peak * 0.3f) return true;
+    }
+    return false;
+  };
+  while (phase + firstLag < firstEnd &&
+         !(onsetNear(phase) && onsetNear(phase + firstLag))) {
+    phase += firstLag;
+  }
+
+  // NOTE: Frame f covers the samples from f * HOP_SIZE, centre it
+  double frameOffset = (FRAME_SIZE / 2.) / HOP_SIZE;
+  if (!tempoMap.addSegment((phase + frameOffset) / frameRate,
+                           60. * frameRate / firstLag)) {
+    std::cerr << "Couldn't find a tempo in " << filename << std::endl;
+    return false;
+  }
+
+  // Later segments start on the closest quarter of the one before, so the
+  // grid carries on without a jump
+  for (size_t s = 1; s < segments.size(); s++) {
+    const TempoSegment &last =
+        tempoMap.getSegment(tempoMap.getSegmentCount() - 1);
+    double quarter = last.spb * 4.;
+    double time = (segments[s].first + frameOffset) / frameRate;
+    double snapped =
+        last.time + std::round((time - last.time) / quarter) * quarter;
+
+    // Snapped onto the one before, which just carries on instead
+    if (snapped <= last.time) {
+      continue;
+    }
+    if (!tempoMap.addSegment(snapped, 60. * frameRate / segments[s].second)) {
+      std::cerr << "Too many tempo changes in " << filename << std::endl;
+      return false;
+    }
+  }
+
+  std::string out = filename + ".tempo.json";
+  if (!tempoMap.save(out.c_str())) {
+    return false;
+  }
+
+  std::cout << filename << ": " << tempoMap.getSegmentCount()
+            << " tempo segment(s), "
+            << 60. / (tempoMap.getSegment(0).spb * 4.) << " bpm, first beat at "
+            << tempoMap.getStartTime() << "s" << std::endl;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  size_t nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      nThreads = std::max(atoi(argv[++i]), 1);
+    } else {
+      files.emplace_back(argv[i]);
+    }
+  }
+
+  if (files.empty()) {
+    std::cerr << "usage: beatmap [-j threads] track [tracks...]" << std::endl;
+    return 1;
+  }
+
+  // One track per thread at a time. The fft tables are read only, so
+  // they're shared.
+  Fft fft{FRAME_SIZE};
+  std::atomic<size_t> nextFile{0};
+  std::atomic<int> nFailed{0};
+
+  std::vector<std::thread> workers;
+  for (size_t t{}; t < std::min(nThreads, files.size()); t++) {
+    workers.emplace_back([&] {
+      for (size_t f = nextFile++; f < files.size(); f = nextFile++) {
+        if (!analyze(fft, files[f])) {
+          nFailed++;
+        }
+      }
+    });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  return nFailed > 0 ? 1 : 0;
+}
@@ -0,0 +1,103 @@
+// Offline mesh cooker. Lays out the geometry of a glTF model the way the
+// engine uploads it, into the cooked directory next to the model:
+//
+//   meshcook scene.gltf [more models...]
+//
+// -> cooked/<key>.model, which the engine maps and copies into staging
+// instead of building the meshes from the glTF buffers. The engine cooks
+// a model itself the first time it's loaded, this just does it up front.
+//
+// Vertices are welded and reordered for the vertex cache, overdraw and
+// fetching on the way, see mesh_optimize.hpp. The ACMR before and after is
+// printed for each model.
+
+#include <stdint.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "mesh_cook.hpp"
+
+// Define these only in *one *.cc file.
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define TINYGLTF_NOEXCEPTION
+#include "tiny_gltf.h"
+
+// Textures are texconv's job
+static bool skipImage(tinygltf::Image *, const int, std::string *,
+                      std::string *, int, int, const unsigned char *, int,
+                      void *) {
+  return true;
+}
+
+static bool cook(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary);
+  if (!file.is_open()) {
+    std::cerr << "Couldn't open " << filename << std::endl;
+    return false;
+  }
+  std::string gltf{std::istreambuf_iterator<char>(file),
+                   std::istreambuf_iterator<char>()};
+  std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+  tinygltf::TinyGLTF loader;
+  tinygltf::Model model;
+  std::string err, warn;
+  loader.SetImageLoader(skipImage, nullptr);
+  if (!loader.LoadASCIIFromString(&model, &err, &warn, gltf.data(),
+                                  static_cast<unsigned int>(gltf.size()),
+                                  directory)) {
+    std::cerr << "Couldn't load " << filename << ": " << err << std::endl;
+    return false;
+  }
+
+  uint64_t key = getModelKey(gltf, directory);
+  std::string path = getCookedModelPath(directory, key);
+
+  CookedModel cooked{};
+  CookStats stats{};
+  cookModel(model, cooked, &stats);
+  std::vector<uint8_t> data = serializeCookedModel(key, cooked);
+  if (!writeCookedModel(path, data)) {
+    std::cerr << "Couldn't write " << path << std::endl;
+    return false;
+  }
+
+  std::cout << filename << " -> " << path << ": " << cooked.nodes.size()
+            << " nodes, " << cooked.meshes.size() << " meshes, "
+            << cooked.vertices.size() << " vertices, "
+            << cooked.indices.size() / 3 << " triangles, "
+            << data.size() / 1024 << " KB" << std::endl;
+
+  // NOTE: ACMR is vertex shader runs per triangle. 0.5 is as good as it
+  // gets for a closed mesh, 3 is every vertex of every triangle
+  if (stats.nTriangles > 0) {
+    double triangles = static_cast<double>(stats.nTriangles);
+    printf("  welded %zu -> %zu vertices, ACMR %.3f -> %.3f\n",
+           stats.nSourceVertices, stats.nVertices,
+           stats.missesBefore / triangles, stats.missesAfter / triangles);
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "usage: meshcook model.gltf [models...]" << std::endl;
+    return 1;
+  }
+
+  int nFailed{};
+  for (int i = 1; i < argc; i++) {
+    if (!cook(argv[i])) {
+      nFailed++;
+    }
+  }
+
+  return nFailed > 0 ? 1 : 0;
+}
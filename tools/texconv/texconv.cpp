@@ -0,0 +1,408 @@
+// Offline texture compressor. Compresses every image a glTF model uses,
+// with a full mip chain, into the cooked directory next to the model:
+//
+//   texconv [-j threads] scene.gltf [more models...]
+//
+// -> cooked/<key>.bc.dds, which the engine loads instead of the source.
+//
+// Normal maps become BC5, everything else BC7, sRGB if it holds color.
+// BC7 only uses mode 6, a single pair of endpoints per block with 16 steps
+// between them. It's not the best BC7 can do, but it's simple and close.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "texture_cook.hpp"
+
+// Define these only in *one *.cc file.
+#define TINYGLTF_IMPLEMENTATION
+#define STB_IMAGE_IMPLEMENTATION
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#define TINYGLTF_NOEXCEPTION
+#include "tiny_gltf.h"
+
+// Both BC5 and BC7 blocks are 4x4 texels in 16 bytes
+constexpr size_t BLOCK_BYTES = 16;
+
+struct Job {
+  std::string name;
+  const std::vector<uint8_t> *source;
+  TextureUsage usage;
+  std::string path;
+};
+
+/******  BC4  ******/
+
+// One channel, the two endpoints and 3 bit indices. With the first
+// endpoint above the second, there are 6 steps between them.
+static void encodeBc4(const uint8_t values[16], uint8_t *out) {
+  uint8_t lo = *std::min_element(values, values + 16);
+  uint8_t hi = *std::max_element(values, values + 16);
+
+  uint64_t bits{};
+  if (hi != lo) {
+    for (int i{}; i < 16; i++) {
+      // How far towards hi, in sevenths. Index 0 is hi, 1 is lo and the
+      // ones after step from hi to lo.
+      int t = ((values[i] - lo) * 14 + (hi - lo)) / (2 * (hi - lo));
+      int index = t == 7 ? 0 : t == 0 ? 1 : 8 - t;
+      bits |= static_cast<uint64_t>(index) << (3 * i);
+    }
+  }
+
+  out[0] = hi;
+  out[1] = lo;
+  for (int i{}; i < 6; i++) {
+    out[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+}
+
+/******  BC7  ******/
+
+static const int BC7_WEIGHTS[16] = {0,  4,  9,  13, 17, 21, 26, 30,
+                                    34, 38, 43, 47, 51, 55, 60, 64};
+
+struct Bc7Endpoint {
+  int q[4];  // 7 bits a channel
+  int p;     // Shared lowest bit
+};
+
+static int bc7Value(const Bc7Endpoint &e, int c) { return (e.q[c] << 1) | e.p; }
+
+static Bc7Endpoint quantizeBc7(const float e[4]) {
+  Bc7Endpoint best{};
+  float bestError = INFINITY;
+
+  for (int p{}; p < 2; p++) {
+    Bc7Endpoint q{{}, p};
+    float error{};
+    for (int c{}; c < 4; c++) {
+      q.q[c] = std::clamp(static_cast<int>(std::lround((e[c] - p) / 2.f)), 0,
+                          127);
+      float d = bc7Value(q, c) - e[c];
+      error += d * d;
+    }
+    if (error < bestError) {
+      bestError = error;
+      best = q;
+    }
+  }
+
+  return best;
+}
+
+// Picks the closest step for each pixel, returns the squared error
+static uint32_t findBc7Indices(const uint8_t pixels[16][4],
+                               const Bc7Endpoint &e0, const Bc7Endpoint &e1,
+                               int indices[16]) {
+  int palette[16][4];
+  for (int i{}; i < 16; i++) {
+    for (int c{}; c < 4; c++) {
+      int w = BC7_WEIGHTS[i];
+      palette[i][c] =
+          ((64 - w) * bc7Value(e0, c) + w * bc7Value(e1, c) + 32) >> 6;
+    }
+  }
+
+  uint32_t total{};
+  for (int i{}; i < 16; i++) {
+    uint32_t best = UINT32_MAX;
+    for (int j{}; j < 16; j++) {
+      uint32_t error{};
+      for (int c{}; c < 4; c++) {
+        int d = palette[j][c] - pixels[i][c];
+        error += d * d;
+      }
+      if (error < best) {
+        best = error;
+        indices[i] = j;
+      }
+    }
+    total += best;
+  }
+
+  return total;
+}
+
+// Ends of the line through the pixels that follows their spread the most
+static void fitLine(const uint8_t pixels[16][4], float lo[4], float hi[4]) {
+  float mean[4]{};
+  for (int i{}; i < 16; i++) {
+    for (int c{}; c < 4; c++) mean[c] += pixels[i][c] / 16.f;
+  }
+
+  float cov[4][4]{};
+  for (int i{}; i < 16; i++) {
+    for (int a{}; a < 4; a++) {
+      for (int b{}; b < 4; b++) {
+        cov[a][b] += (pixels[i][a] - mean[a]) * (pixels[i][b] - mean[b]);
+      }
+    }
+  }
+
+  // Power iteration, starting from the channel that varies the most
+  int widest{};
+  for (int c = 1; c < 4; c++) {
+    if (cov[c][c] > cov[widest][widest]) widest = c;
+  }
+  float axis[4] = {cov[widest][0], cov[widest][1], cov[widest][2],
+                   cov[widest][3]};
+  for (int n{}; n < 8; n++) {
+    float next[4]{};
+    float length{};
+    for (int a{}; a < 4; a++) {
+      for (int b{}; b < 4; b++) next[a] += cov[a][b] * axis[b];
+      length += next[a] * next[a];
+    }
+    length = std::sqrt(length);
+    if (length < 1e-6f) break;
+    for (int c{}; c < 4; c++) axis[c] = next[c] / length;
+  }
+
+  float length = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] +
+                           axis[2] * axis[2] + axis[3] * axis[3]);
+  if (length < 1e-6f) {
+    // All the same color
+    std::copy(mean, mean + 4, lo);
+    std::copy(mean, mean + 4, hi);
+    return;
+  }
+  for (int c{}; c < 4; c++) axis[c] /= length;
+
+  float tMin = INFINITY;
+  float tMax = -INFINITY;
+  for (int i{}; i < 16; i++) {
+    float t{};
+    for (int c{}; c < 4; c++) t += (pixels[i][c] - mean[c]) * axis[c];
+    tMin = std::min(tMin, t);
+    tMax = std::max(tMax, t);
+  }
+
+  for (int c{}; c < 4; c++) {
+    lo[c] = std::clamp(mean[c] + axis[c] * tMin, 0.f, 255.f);
+    hi[c] = std::clamp(mean[c] + axis[c] * tMax, 0.f, 255.f);
+  }
+}
+
+// Moves the endpoints to where they fit the chosen steps best, least
+// squares over all channels at once
+static bool refitBc7(const uint8_t pixels[16][4], const int indices[16],
+                     float lo[4], float hi[4]) {
+  float a{}, b{}, c{};
+  float d0[4]{}, d1[4]{};
+  for (int i{}; i < 16; i++) {
+    float w = BC7_WEIGHTS[indices[i]] / 64.f;
+    a += (1.f - w) * (1.f - w);
+    b += (1.f - w) * w;
+    c += w * w;
+    for (int ch{}; ch < 4; ch++) {
+      d0[ch] += (1.f - w) * pixels[i][ch];
+      d1[ch] += w * pixels[i][ch];
+    }
+  }
+
+  float det = a * c - b * b;
+  if (std::abs(det) < 1e-6f) return false;
+
+  for (int ch{}; ch < 4; ch++) {
+    lo[ch] = std::clamp((c * d0[ch] - b * d1[ch]) / det, 0.f, 255.f);
+    hi[ch] = std::clamp((a * d1[ch] - b * d0[ch]) / det, 0.f, 255.f);
+  }
+  return true;
+}
+
+static void putBits(uint8_t *out, int &pos, uint32_t value, int count) {
+  for (int i{}; i < count; i++, pos++) {
+    out[pos / 8] |= ((value >> i) & 1) << (pos % 8);
+  }
+}
+
+static void encodeBc7(const uint8_t pixels[16][4], uint8_t *out) {
+  float lo[4], hi[4];
+  fitLine(pixels, lo, hi);
+
+  Bc7Endpoint e0 = quantizeBc7(lo);
+  Bc7Endpoint e1 = quantizeBc7(hi);
+  int indices[16];
+  uint32_t error = findBc7Indices(pixels, e0, e1, indices);
+
+  if (error > 0 && refitBc7(pixels, indices, lo, hi)) {
+    Bc7Endpoint r0 = quantizeBc7(lo);
+    Bc7Endpoint r1 = quantizeBc7(hi);
+    int refit[16];
+    if (findBc7Indices(pixels, r0, r1, refit) < error) {
+      e0 = r0;
+      e1 = r1;
+      std::copy(refit, refit + 16, indices);
+    }
+  }
+
+  // The top bit of the first index isn't stored, so it has to be 0
+  if (indices[0] >= 8) {
+    std::swap(e0, e1);
+    for (int &index : indices) index = 15 - index;
+  }
+
+  memset(out, 0, BLOCK_BYTES);
+  int pos{};
+  putBits(out, pos, 1 << 6, 7);  // Mode 6
+  for (int c{}; c < 4; c++) {
+    putBits(out, pos, e0.q[c], 7);
+    putBits(out, pos, e1.q[c], 7);
+  }
+  putBits(out, pos, e0.p, 1);
+  putBits(out, pos, e1.p, 1);
+  putBits(out, pos, indices[0], 3);
+  for (int i = 1; i < 16; i++) {
+    putBits(out, pos, indices[i], 4);
+  }
+}
+
+/******  DDS  ******/
+
+static std::vector<uint8_t> compress(const TextureImage &image,
+                                     TextureUsage usage) {
+  uint32_t blocksX = (image.width + 3) / 4;
+  uint32_t blocksY = (image.height + 3) / 4;
+  std::vector<uint8_t> out(blocksX * blocksY * BLOCK_BYTES);
+
+  for (uint32_t by{}; by < blocksY; by++) {
+    for (uint32_t bx{}; bx < blocksX; bx++) {
+      // Blocks that hang over the edge repeat the last row or column
+      uint8_t pixels[16][4];
+      for (uint32_t i{}; i < 16; i++) {
+        uint32_t x = std::min(bx * 4 + i % 4, image.width - 1);
+        uint32_t y = std::min(by * 4 + i / 4, image.height - 1);
+        memcpy(pixels[i], &image.pixels[(y * image.width + x) * 4], 4);
+      }
+
+      uint8_t *block = &out[(by * blocksX + bx) * BLOCK_BYTES];
+      if (usage == TextureUsage::Normal) {
+        uint8_t x[16], y[16];
+        for (int i{}; i < 16; i++) {
+          x[i] = pixels[i][0];
+          y[i] = pixels[i][1];
+        }
+        encodeBc4(x, block);
+        encodeBc4(y, block + 8);
+      } else {
+        encodeBc7(pixels, block);
+      }
+    }
+  }
+
+  return out;
+}
+
+static bool cook(const Job &job) {
+  TextureImage image{};
+  if (!decodeImage(*job.source, image)) {
+    std::cerr << "Couldn't decode " << job.name << std::endl;
+    return false;
+  }
+
+  uint32_t width = image.width;
+  uint32_t height = image.height;
+
+  std::vector<std::vector<uint8_t>> levels;
+  size_t totalSize{};
+  for (const TextureImage &mip : generateMips(std::move(image), job.usage)) {
+    levels.push_back(compress(mip, job.usage));
+    totalSize += levels.back().size();
+  }
+
+  uint32_t format = job.usage == TextureUsage::Normal ? DXGI_FORMAT_BC5_UNORM
+                    : job.usage == TextureUsage::Color
+                        ? DXGI_FORMAT_BC7_UNORM_SRGB
+                        : DXGI_FORMAT_BC7_UNORM;
+  if (!writeDds(job.path, format, width, height, levels)) {
+    return false;
+  }
+
+  const char *formatName = job.usage == TextureUsage::Normal  ? "BC5"
+                           : job.usage == TextureUsage::Color ? "BC7 sRGB"
+                                                              : "BC7";
+  std::cout << job.name << " -> " << job.path << ": " << width << "x"
+            << height << ", " << levels.size() << " mips, " << formatName
+            << ", " << totalSize / 1024 << " KB" << std::endl;
+  return true;
+}
+
+int main(int argc, char **argv) {
+  size_t nThreads = std::max(std::thread::hardware_concurrency(), 1u);
+  std::vector<std::string> files;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      nThreads = std::max(atoi(argv[++i]), 1);
+    } else {
+      files.emplace_back(argv[i]);
+    }
+  }
+
+  if (files.empty()) {
+    std::cerr << "usage: texconv [-j threads] model.gltf [models...]"
+              << std::endl;
+    return 1;
+  }
+
+  // NOTE: The images are only decoded by the job that cooks them
+  std::vector<std::vector<std::vector<uint8_t>>> sources(files.size());
+  std::vector<Job> jobs;
+  int nFailed{};
+
+  for (size_t f{}; f < files.size(); f++) {
+    tinygltf::TinyGLTF loader;
+    tinygltf::Model model;
+    std::string err, warn;
+    loader.SetImageLoader(keepImageSource, &sources[f]);
+    if (!loader.LoadASCIIFromFile(&model, &err, &warn, files[f])) {
+      std::cerr << "Couldn't load " << files[f] << ": " << err << std::endl;
+      nFailed++;
+      continue;
+    }
+    sources[f].resize(model.images.size());
+
+    std::string directory =
+        files[f].substr(0, files[f].find_last_of("/\\") + 1);
+    std::vector<TextureUsage> usages = getImageUsages(model);
+    for (size_t i{}; i < model.images.size(); i++) {
+      std::string name = model.images[i].uri.empty()
+                             ? files[f] + " image " + std::to_string(i)
+                             : directory + model.images[i].uri;
+      uint64_t key = getTextureKey(sources[f][i], usages[i]);
+      jobs.push_back(Job{name, &sources[f][i], usages[i],
+                         getCookedTexturePath(directory, key, true)});
+    }
+  }
+
+  // One image per thread at a time
+  std::atomic<size_t> nextJob{0};
+  std::atomic<int> nFailedJobs{0};
+
+  std::vector<std::thread> workers;
+  for (size_t t{}; t < std::min(nThreads, jobs.size()); t++) {
+    workers.emplace_back([&] {
+      for (size_t j = nextJob++; j < jobs.size(); j = nextJob++) {
+        if (!cook(jobs[j])) {
+          nFailedJobs++;
+        }
+      }
+    });
+  }
+
+  for (auto &worker : workers) {
+    worker.join();
+  }
+
+  return nFailed + nFailedJobs > 0 ? 1 : 0;
+}